@@ -260,7 +260,7 @@ _pacmd() {
     local comps
     local flags='-h --help --version'
     local commands=(exit help list-modules list-cards list-sinks list-sources list-clients
-                    list-samples list-sink-inputs list-source-outputs stat info
+                    list-samples list-sink-inputs list-source-outputs stat info metrics
                     load-module unload-module describe-module set-sink-volume
                     set-source-volume set-sink-input-volume set-source-output-volume
                     set-sink-mute set-source-mut set-sink-input-mute
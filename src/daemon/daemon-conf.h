@@ -76,17 +76,21 @@ typedef struct pa_daemon_conf {
         log_time,
         flat_volumes,
         lock_memory,
-        deferred_volume;
+        deferred_volume,
+        lazy_rewind,
+        huge_pages;
     pa_server_type_t local_server_type;
     int exit_idle_time,
         scache_idle_time,
         realtime_priority,
         nice_level,
-        resample_method;
+        resample_method,
+        numa_node;
     char *script_commands, *dl_search_path, *default_script_file;
     pa_log_target *log_target;
     pa_log_level_t log_level;
     unsigned log_backtrace;
+    unsigned resample_cpu_budget;
     char *config_file;
 
 #ifdef HAVE_SYS_RESOURCE_H
@@ -133,6 +137,7 @@ typedef struct pa_daemon_conf {
     uint32_t alternate_sample_rate;
     pa_channel_map default_channel_map;
     size_t shm_size;
+    size_t scache_converted_size;
 } pa_daemon_conf;
 
 /* Allocate a new structure and fill it with sane defaults */
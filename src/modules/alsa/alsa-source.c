@@ -409,8 +409,10 @@ static int try_recover(struct userdata *u, const char *call, int err) {
 
     pa_assert(err != -EAGAIN);
 
-    if (err == -EPIPE)
+    if (err == -EPIPE) {
         pa_log_debug("%s: Buffer overrun!", call);
+        pa_atomic_inc(&u->source->metrics.n_xruns);
+    }
 
     if (err == -ESTRPIPE)
         pa_log_debug("%s: System suspended!", call);
@@ -446,6 +448,8 @@ static size_t check_left_to_record(struct userdata *u, size_t n_bytes, bool on_t
         PA_DEBUG_TRAP;
 #endif
 
+        pa_atomic_inc(&u->source->metrics.n_xruns);
+
         if (pa_log_ratelimit(PA_LOG_INFO))
             pa_log_info("Overrun!");
     }
@@ -0,0 +1,87 @@
+#ifndef fooa2dpcodecapihfoo
+#define fooa2dpcodecapihfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+#include <pulsecore/core.h>
+
+/* An A2DP codec implementation. The negotiation callbacks are used by
+ * bluez5-util to register media endpoints and to pick/validate the
+ * configuration of a transport, everything else is used by the device
+ * module while streaming. Encoders and decoders produce and consume
+ * complete RTP packets, so the device module never has to know about
+ * codec specific payload headers. */
+typedef struct pa_a2dp_codec {
+    /* Unique short name, used in endpoint paths and log messages */
+    const char *name;
+    /* Human readable name */
+    const char *description;
+    /* Codec id as registered with BlueZ, see a2dp-codecs.h */
+    uint8_t id;
+
+    /* Fills the capabilities we support into the buffer, returns the
+     * size of the capabilities or 0 on failure. */
+    size_t (*fill_capabilities)(uint8_t *capabilities, size_t capabilities_size);
+    /* Returns true if the configuration the remote side picked is one
+     * we can handle. */
+    bool (*is_configuration_valid)(const uint8_t *config, size_t config_size);
+    /* Picks the preferred configuration out of the remote capabilities,
+     * based on the default sample spec. Returns the size of the
+     * configuration or 0 on failure. */
+    size_t (*fill_preferred_configuration)(const pa_sample_spec *default_sample_spec,
+                                           const uint8_t *capabilities, size_t capabilities_size,
+                                           uint8_t *config, size_t config_size);
+
+    /* Creates a codec instance for the given configuration and sets the
+     * sample spec the stream has to use. Returns NULL on failure. */
+    void *(*init)(bool for_encoding, const uint8_t *config, size_t config_size, pa_sample_spec *sample_spec);
+    void (*deinit)(void *codec_info);
+    /* Resets the codec state when a stream is (re)started. Encoders go
+     * back to their highest bitrate. Returns negative on failure. */
+    int (*reset)(void *codec_info);
+
+    /* Returns how much PCM has to be read/written to fill one packet of
+     * the given link MTU */
+    size_t (*get_read_block_size)(void *codec_info, size_t read_link_mtu);
+    size_t (*get_write_block_size)(void *codec_info, size_t write_link_mtu);
+
+    /* Steps the encoder bitrate down/up by one notch. Returns the new
+     * write block size, or 0 if the bitrate has not changed. */
+    size_t (*reduce_encoder_bitrate)(void *codec_info, size_t write_link_mtu);
+    size_t (*increase_encoder_bitrate)(void *codec_info, size_t write_link_mtu);
+
+    /* Encodes PCM into a single RTP packet. Returns the size of the
+     * packet, or 0 on failure. *processed is set to the number of
+     * consumed input bytes. */
+    size_t (*encode_buffer)(void *codec_info, uint32_t timestamp,
+                            const uint8_t *input_buffer, size_t input_size,
+                            uint8_t *output_buffer, size_t output_size,
+                            size_t *processed);
+    /* Decodes a single RTP packet into PCM. Returns the number of
+     * decoded bytes. *processed is set to the number of consumed input
+     * bytes, which is smaller than input_size on failure. */
+    size_t (*decode_buffer)(void *codec_info,
+                            const uint8_t *input_buffer, size_t input_size,
+                            uint8_t *output_buffer, size_t output_size,
+                            size_t *processed);
+} pa_a2dp_codec;
+
+#endif
@@ -0,0 +1,335 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/asyncq.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/flist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/poll.h>
+#include <pulsecore/thread.h>
+
+#include "a2dp-encoder-thread.h"
+
+/* Large enough for PA_A2DP_ENCODER_THREAD_MAX_DEPTH chunks in flight,
+ * even if every one of them has to be split into two packets after the
+ * bitrate went up */
+#define QUEUE_SIZE 64
+
+PA_STATIC_FLIST_DECLARE(chunks, 0, pa_xfree);
+
+struct pa_a2dp_encoder_thread {
+    const pa_a2dp_codec *codec;
+    void *codec_info;
+    pa_sample_spec sample_spec;
+    size_t write_link_mtu;
+    int realtime_priority;
+
+    pa_thread *thread;
+    pa_asyncq *inq;                 /* PCM chunks, IO thread -> encoder */
+    pa_asyncq *outq;                /* Packets, encoder -> IO thread */
+    pa_flist *free_packets;
+    pa_memchunk shutdown;           /* Pushed to inq to stop the encoder */
+
+    pa_rtpoll_item *rtpoll_item;
+    bool polling;
+
+    /* Bitrate change requested by the IO thread, -1, 0 or 1 */
+    pa_atomic_t bitrate_request;
+
+    /* Encoder thread only */
+    uint64_t encode_index;
+    size_t write_block_size;
+
+    /* IO thread only */
+    pa_a2dp_packet *pending;
+};
+
+static pa_a2dp_packet *packet_new(pa_a2dp_encoder_thread *t) {
+    pa_a2dp_packet *p;
+
+    if (!(p = pa_flist_pop(t->free_packets))) {
+        p = pa_xmalloc(PA_ALIGN(sizeof(pa_a2dp_packet)) + t->write_link_mtu);
+        p->data = (uint8_t *) p + PA_ALIGN(sizeof(pa_a2dp_packet));
+    }
+
+    return p;
+}
+
+static void packet_free(pa_a2dp_encoder_thread *t, pa_a2dp_packet *p) {
+    if (pa_flist_push(t->free_packets, p) < 0)
+        pa_xfree(p);
+}
+
+static void chunk_free(pa_memchunk *c) {
+    pa_memblock_unref(c->memblock);
+
+    if (pa_flist_push(PA_STATIC_FLIST_GET(chunks), c) < 0)
+        pa_xfree(c);
+}
+
+/* Run from encoder thread */
+static void apply_bitrate_request(pa_a2dp_encoder_thread *t) {
+    size_t write_block_size = 0;
+    int request;
+
+    do {
+        request = pa_atomic_load(&t->bitrate_request);
+    } while (!pa_atomic_cmpxchg(&t->bitrate_request, request, 0));
+
+    if (request < 0)
+        write_block_size = t->codec->reduce_encoder_bitrate(t->codec_info, t->write_link_mtu);
+    else if (request > 0)
+        write_block_size = t->codec->increase_encoder_bitrate(t->codec_info, t->write_link_mtu);
+
+    if (write_block_size > 0)
+        t->write_block_size = write_block_size;
+}
+
+/* Run from encoder thread */
+static void encode_chunk(pa_a2dp_encoder_thread *t, const pa_memchunk *c) {
+    const uint8_t *d;
+    size_t length = c->length;
+
+    d = (const uint8_t *) pa_memblock_acquire_chunk(c);
+
+    /* A chunk rendered before the bitrate went up may not fit into a
+     * single packet anymore */
+    while (length > 0) {
+        pa_a2dp_packet *p;
+        size_t processed = 0;
+
+        p = packet_new(t);
+        p->size = t->codec->encode_buffer(t->codec_info, t->encode_index / pa_frame_size(&t->sample_spec),
+                                          d, length, p->data, t->write_link_mtu, &processed);
+        p->write_block_size = t->write_block_size;
+
+        if (PA_UNLIKELY(p->size == 0 || processed == 0)) {
+            /* Hand the rest over anyway, so that the IO thread notices
+             * and its accounting stays right */
+            p->size = 0;
+            processed = length;
+        }
+
+        p->pcm_bytes = processed;
+        t->encode_index += processed;
+        d += processed;
+        length -= processed;
+
+        pa_assert_se(pa_asyncq_push(t->outq, p, true) == 0);
+    }
+
+    pa_memblock_release(c->memblock);
+}
+
+static void thread_func(void *userdata) {
+    pa_a2dp_encoder_thread *t = userdata;
+
+    pa_assert(t);
+
+    pa_log_debug("Encoder thread starting up");
+
+    if (t->realtime_priority > 0)
+        pa_make_realtime(t->realtime_priority);
+
+    for (;;) {
+        pa_memchunk *c;
+
+        pa_assert_se(c = pa_asyncq_pop(t->inq, true));
+
+        if (c == &t->shutdown)
+            break;
+
+        apply_bitrate_request(t);
+        encode_chunk(t, c);
+        chunk_free(c);
+    }
+
+    pa_log_debug("Encoder thread shutting down");
+}
+
+/* Run from IO thread */
+static int outq_before(pa_rtpoll_item *i) {
+    pa_a2dp_encoder_thread *t;
+    struct pollfd *pollfd;
+
+    pa_assert_se(t = pa_rtpoll_item_get_userdata(i));
+    pollfd = pa_rtpoll_item_get_pollfd(i, NULL);
+
+    /* Move the next packet out of the queue right away, otherwise we'd
+     * keep waking up for it while the IO thread waits for the socket */
+    if (!t->pending && (t->pending = pa_asyncq_pop(t->outq, false)))
+        return 1;
+
+    if (t->pending) {
+        pollfd->events = 0;
+        return 0;
+    }
+
+    pollfd->events = POLLIN;
+
+    if (pa_asyncq_read_before_poll(t->outq) < 0)
+        return 1; /* 1 means immediate restart of the loop */
+
+    t->polling = true;
+    return 0;
+}
+
+/* Run from IO thread */
+static void outq_after(pa_rtpoll_item *i) {
+    pa_a2dp_encoder_thread *t;
+
+    pa_assert_se(t = pa_rtpoll_item_get_userdata(i));
+
+    if (!t->polling)
+        return;
+
+    pa_asyncq_read_after_poll(t->outq);
+    t->polling = false;
+}
+
+pa_a2dp_encoder_thread *pa_a2dp_encoder_thread_new(const pa_a2dp_codec *codec, void *codec_info,
+                                                   const pa_sample_spec *ss, size_t write_link_mtu,
+                                                   size_t write_block_size, pa_rtpoll *rtpoll,
+                                                   int realtime_priority) {
+    pa_a2dp_encoder_thread *t;
+    struct pollfd *pollfd;
+
+    pa_assert(codec);
+    pa_assert(codec_info);
+    pa_assert(ss);
+    pa_assert(write_link_mtu > 0);
+    pa_assert(write_block_size > 0);
+    pa_assert(rtpoll);
+
+    t = pa_xnew0(pa_a2dp_encoder_thread, 1);
+    t->codec = codec;
+    t->codec_info = codec_info;
+    t->sample_spec = *ss;
+    t->write_link_mtu = write_link_mtu;
+    t->write_block_size = write_block_size;
+    t->realtime_priority = realtime_priority;
+    pa_atomic_store(&t->bitrate_request, 0);
+
+    t->inq = pa_asyncq_new(QUEUE_SIZE);
+    t->outq = pa_asyncq_new(QUEUE_SIZE);
+    t->free_packets = pa_flist_new(QUEUE_SIZE);
+
+    t->rtpoll_item = pa_rtpoll_item_new(rtpoll, PA_RTPOLL_NORMAL, 1);
+    pollfd = pa_rtpoll_item_get_pollfd(t->rtpoll_item, NULL);
+    pollfd->fd = pa_asyncq_read_fd(t->outq);
+    pollfd->events = POLLIN;
+    pa_rtpoll_item_set_before_callback(t->rtpoll_item, outq_before);
+    pa_rtpoll_item_set_after_callback(t->rtpoll_item, outq_after);
+    pa_rtpoll_item_set_userdata(t->rtpoll_item, t);
+
+    if (!(t->thread = pa_thread_new("bluetooth-enc", thread_func, t))) {
+        pa_log_error("Failed to create encoder thread");
+        pa_a2dp_encoder_thread_free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void pa_a2dp_encoder_thread_free(pa_a2dp_encoder_thread *t) {
+    pa_a2dp_packet *p;
+
+    pa_assert(t);
+
+    if (t->thread) {
+        pa_assert_se(pa_asyncq_push(t->inq, &t->shutdown, true) == 0);
+        pa_thread_free(t->thread);
+    }
+
+    if (t->rtpoll_item)
+        pa_rtpoll_item_free(t->rtpoll_item);
+
+    if (t->pending)
+        pa_xfree(t->pending);
+
+    while ((p = pa_asyncq_pop(t->outq, false)))
+        pa_xfree(p);
+
+    pa_asyncq_free(t->inq, (pa_free_cb_t) chunk_free);
+    pa_asyncq_free(t->outq, NULL);
+    pa_flist_free(t->free_packets, pa_xfree);
+
+    pa_xfree(t);
+}
+
+int pa_a2dp_encoder_thread_push(pa_a2dp_encoder_thread *t, const pa_memchunk *chunk) {
+    pa_memchunk *c;
+
+    pa_assert(t);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+
+    if (!(c = pa_flist_pop(PA_STATIC_FLIST_GET(chunks))))
+        c = pa_xnew(pa_memchunk, 1);
+
+    *c = *chunk;
+    pa_memblock_ref(c->memblock);
+
+    if (pa_asyncq_push(t->inq, c, false) < 0) {
+        chunk_free(c);
+        return -1;
+    }
+
+    return 0;
+}
+
+const pa_a2dp_packet *pa_a2dp_encoder_thread_peek(pa_a2dp_encoder_thread *t) {
+    pa_assert(t);
+
+    if (!t->pending)
+        t->pending = pa_asyncq_pop(t->outq, false);
+
+    return t->pending;
+}
+
+void pa_a2dp_encoder_thread_drop(pa_a2dp_encoder_thread *t) {
+    pa_assert(t);
+    pa_assert(t->pending);
+
+    packet_free(t, t->pending);
+    t->pending = NULL;
+}
+
+void pa_a2dp_encoder_thread_reduce_bitrate(pa_a2dp_encoder_thread *t) {
+    pa_assert(t);
+
+    if (t->codec->reduce_encoder_bitrate)
+        pa_atomic_store(&t->bitrate_request, -1);
+}
+
+void pa_a2dp_encoder_thread_increase_bitrate(pa_a2dp_encoder_thread *t) {
+    pa_assert(t);
+
+    if (t->codec->increase_encoder_bitrate)
+        pa_atomic_store(&t->bitrate_request, 1);
+}
@@ -0,0 +1,77 @@
+#ifndef fooa2dpencoderthreadhfoo
+#define fooa2dpencoderthreadhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+
+#include <pulsecore/memchunk.h>
+#include <pulsecore/rtpoll.h>
+
+#include "a2dp-codec-api.h"
+
+/* Runs an A2DP encoder in a thread of its own, so that the IO thread
+ * only has to render PCM and write packets that are already encoded.
+ * PCM goes to the encoder and packets come back through lock-free
+ * queues. The IO thread is woken up through an rtpoll item when a
+ * packet becomes ready. While the encoder thread runs it owns the codec
+ * state, so bitrate changes are only requested here and applied by the
+ * encoder before it encodes the next chunk. All functions except _new()
+ * and _free() are run from the IO thread only. */
+
+#define PA_A2DP_ENCODER_THREAD_MAX_DEPTH 16
+
+typedef struct pa_a2dp_encoder_thread pa_a2dp_encoder_thread;
+
+typedef struct pa_a2dp_packet {
+    uint8_t *data;
+    /* Size of the encoded packet, 0 if encoding failed */
+    size_t size;
+    /* PCM bytes that went into the packet */
+    size_t pcm_bytes;
+    /* Write block size that was in effect when the packet was encoded */
+    size_t write_block_size;
+} pa_a2dp_packet;
+
+/* codec_info has to be reset already and must not be touched by anyone
+ * else until the encoder thread is freed. realtime_priority is the
+ * priority the encoder thread runs with, 0 for no realtime scheduling. */
+pa_a2dp_encoder_thread *pa_a2dp_encoder_thread_new(const pa_a2dp_codec *codec, void *codec_info,
+                                                   const pa_sample_spec *ss, size_t write_link_mtu,
+                                                   size_t write_block_size, pa_rtpoll *rtpoll,
+                                                   int realtime_priority);
+void pa_a2dp_encoder_thread_free(pa_a2dp_encoder_thread *t);
+
+/* Queues a chunk of PCM for encoding. Chunks must be a multiple of the
+ * codec frame size. Returns negative if the queue is full. */
+int pa_a2dp_encoder_thread_push(pa_a2dp_encoder_thread *t, const pa_memchunk *chunk);
+
+/* Returns the oldest packet that has not been written yet, or NULL if
+ * the encoder has not caught up. */
+const pa_a2dp_packet *pa_a2dp_encoder_thread_peek(pa_a2dp_encoder_thread *t);
+/* Drops the packet returned by _peek() once it has been written */
+void pa_a2dp_encoder_thread_drop(pa_a2dp_encoder_thread *t);
+
+/* Asks the encoder to step its bitrate down/up by one notch. Packets
+ * carry the resulting write block size. */
+void pa_a2dp_encoder_thread_reduce_bitrate(pa_a2dp_encoder_thread *t);
+void pa_a2dp_encoder_thread_increase_bitrate(pa_a2dp_encoder_thread *t);
+
+#endif
@@ -0,0 +1,198 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "a2dp-rate-control.h"
+
+/* Backlog, in packets, above which we consider the link congested if
+ * the queue didn't shrink since the last change */
+#define HIGH_WATERMARK_PERCENT 200
+/* Backlog, in packets, below which we consider the link idle */
+#define LOW_WATERMARK_PERCENT 50
+/* Give the link some time to react to a decrease before the next one */
+#define DECREASE_HOLDOFF_USEC (200 * PA_USEC_PER_MSEC)
+/* How long the link has to stay idle before we try a higher bitrate.
+ * This doubles every time such a probe fails quickly. */
+#define RECOVERY_MIN_USEC (2 * PA_USEC_PER_SEC)
+#define RECOVERY_MAX_USEC (30 * PA_USEC_PER_SEC)
+
+struct pa_a2dp_rate_control {
+    int fd;
+    int sndbuf;
+    bool outq_is_free_space;
+    bool disabled;
+
+    size_t queued;                  /* Send queue right before the current write */
+    size_t packet_cost;             /* Queue space one packet takes, learned on the fly */
+
+    pa_usec_t last_write;
+    pa_usec_t last_change;
+    size_t queued_at_last_change;
+    pa_usec_t last_increase;
+    pa_usec_t idle_since;
+    pa_usec_t recovery_usec;
+};
+
+pa_a2dp_rate_control *pa_a2dp_rate_control_new(int fd, bool outq_is_free_space) {
+    pa_a2dp_rate_control *rc;
+    socklen_t l;
+
+    pa_assert(fd >= 0);
+
+    rc = pa_xnew0(pa_a2dp_rate_control, 1);
+    rc->fd = fd;
+    rc->outq_is_free_space = outq_is_free_space;
+    rc->recovery_usec = RECOVERY_MIN_USEC;
+
+    l = sizeof(rc->sndbuf);
+    if (outq_is_free_space && getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &rc->sndbuf, &l) < 0) {
+        pa_log_warn("Failed to query send buffer size, disabling bitrate adaptation: %s", pa_cstrerror(errno));
+        rc->disabled = true;
+    }
+
+    return rc;
+}
+
+void pa_a2dp_rate_control_free(pa_a2dp_rate_control *rc) {
+    pa_assert(rc);
+
+    pa_xfree(rc);
+}
+
+static int get_queued(pa_a2dp_rate_control *rc, size_t *queued) {
+    int v;
+
+    if (ioctl(rc->fd, TIOCOUTQ, &v) < 0) {
+        pa_log_warn("TIOCOUTQ failed, disabling bitrate adaptation: %s", pa_cstrerror(errno));
+        rc->disabled = true;
+        return -1;
+    }
+
+    if (rc->outq_is_free_space)
+        v = rc->sndbuf - v;
+
+    *queued = v > 0 ? (size_t) v : 0;
+
+    return 0;
+}
+
+void pa_a2dp_rate_control_before_write(pa_a2dp_rate_control *rc) {
+    pa_assert(rc);
+
+    if (rc->disabled)
+        return;
+
+    get_queued(rc, &rc->queued);
+}
+
+static pa_a2dp_rate_action_t decrease(pa_a2dp_rate_control *rc, pa_usec_t now) {
+    rc->idle_since = 0;
+
+    if (rc->last_change > 0 && now - rc->last_change < DECREASE_HOLDOFF_USEC)
+        return PA_A2DP_RATE_KEEP;
+
+    /* The link couldn't cope with the last increase, wait longer next time */
+    if (rc->last_increase > 0 && rc->last_change == rc->last_increase && now - rc->last_increase < rc->recovery_usec)
+        rc->recovery_usec = PA_MIN(rc->recovery_usec * 2, RECOVERY_MAX_USEC);
+
+    rc->last_change = now;
+    rc->queued_at_last_change = rc->queued;
+
+    pa_log_debug("Send queue congested (%lu bytes queued), lowering bitrate", (unsigned long) rc->queued);
+
+    return PA_A2DP_RATE_DECREASE;
+}
+
+static pa_a2dp_rate_action_t increase(pa_a2dp_rate_control *rc, pa_usec_t now) {
+    /* The last increase held up, so probe a bit faster again */
+    if (rc->last_increase > 0 && rc->last_change == rc->last_increase)
+        rc->recovery_usec = PA_MAX(rc->recovery_usec / 2, RECOVERY_MIN_USEC);
+
+    rc->idle_since = now;
+    rc->last_change = rc->last_increase = now;
+    rc->queued_at_last_change = rc->queued;
+
+    return PA_A2DP_RATE_INCREASE;
+}
+
+pa_a2dp_rate_action_t pa_a2dp_rate_control_after_write(pa_a2dp_rate_control *rc, pa_usec_t now,
+                                                       pa_usec_t packet_duration, bool written) {
+    size_t backlog;
+    bool late;
+
+    pa_assert(rc);
+
+    if (rc->disabled)
+        return PA_A2DP_RATE_KEEP;
+
+    late = rc->last_write > 0 && now - rc->last_write > 2 * packet_duration;
+
+    if (written) {
+        size_t queued;
+
+        /* Learn how much queue space a packet takes, including whatever
+         * overhead the kernel accounts for it */
+        if (get_queued(rc, &queued) < 0)
+            return PA_A2DP_RATE_KEEP;
+
+        if (queued > rc->queued) {
+            size_t cost = queued - rc->queued;
+
+            rc->packet_cost = rc->packet_cost > 0 ? (3 * rc->packet_cost + cost) / 4 : cost;
+        }
+
+        rc->last_write = now;
+    }
+
+    if (!written || late)
+        return decrease(rc, now);
+
+    if (rc->packet_cost == 0)
+        return PA_A2DP_RATE_KEEP;
+
+    backlog = rc->queued * 100 / rc->packet_cost;
+
+    /* The queue is building up and didn't shrink since the last change */
+    if (backlog >= HIGH_WATERMARK_PERCENT && rc->queued >= rc->queued_at_last_change)
+        return decrease(rc, now);
+
+    if (backlog < LOW_WATERMARK_PERCENT) {
+        if (rc->idle_since == 0)
+            rc->idle_since = now;
+        else if (now - rc->idle_since >= rc->recovery_usec)
+            return increase(rc, now);
+    } else
+        rc->idle_since = 0;
+
+    return PA_A2DP_RATE_KEEP;
+}
@@ -0,0 +1,53 @@
+#ifndef fooa2dpratecontrolhfoo
+#define fooa2dpratecontrolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+
+/* Decides when an A2DP encoder should change its bitrate, based on how
+ * much data is still waiting in the socket's send queue when the next
+ * packet is about to be written and on whether writes happen in time.
+ * The bitrate is lowered as soon as the queue keeps growing, before the
+ * socket overflows, and raised again one step at a time once the queue
+ * stayed empty for a while. Run from the IO thread only. */
+
+typedef struct pa_a2dp_rate_control pa_a2dp_rate_control;
+
+typedef enum pa_a2dp_rate_action {
+    PA_A2DP_RATE_KEEP,
+    PA_A2DP_RATE_DECREASE,
+    PA_A2DP_RATE_INCREASE
+} pa_a2dp_rate_action_t;
+
+/* Bluetooth sockets report the free space in the send buffer for
+ * TIOCOUTQ, everything else reports the queued bytes. */
+pa_a2dp_rate_control *pa_a2dp_rate_control_new(int fd, bool outq_is_free_space);
+void pa_a2dp_rate_control_free(pa_a2dp_rate_control *rc);
+
+/* Samples the send queue, call right before writing a packet */
+void pa_a2dp_rate_control_before_write(pa_a2dp_rate_control *rc);
+
+/* Call after the write attempt. written is false if the packet could
+ * not be written because the socket was full. */
+pa_a2dp_rate_action_t pa_a2dp_rate_control_after_write(pa_a2dp_rate_control *rc, pa_usec_t now,
+                                                       pa_usec_t packet_duration, bool written);
+
+#endif
@@ -24,6 +24,8 @@
 
 #include <pulsecore/core.h>
 
+#include "a2dp-codec-api.h"
+
 #define PA_BLUETOOTH_UUID_A2DP_SOURCE "0000110a-0000-1000-8000-00805f9b34fb"
 #define PA_BLUETOOTH_UUID_A2DP_SINK   "0000110b-0000-1000-8000-00805f9b34fb"
 
@@ -62,6 +64,7 @@ struct pa_bluetooth_transport {
     pa_bluetooth_profile_t profile;
 
     uint8_t codec;
+    const pa_a2dp_codec *a2dp_codec;
     uint8_t *config;
     size_t config_size;
 
@@ -96,7 +99,8 @@ struct pa_bluetooth_adapter {
 };
 
 pa_bluetooth_transport *pa_bluetooth_transport_new(pa_bluetooth_device *d, const char *owner, const char *path,
-                                                   pa_bluetooth_profile_t p, const uint8_t *config, size_t size);
+                                                   pa_bluetooth_profile_t p, const pa_a2dp_codec *codec,
+                                                   const uint8_t *config, size_t size);
 
 void pa_bluetooth_transport_put(pa_bluetooth_transport *t);
 void pa_bluetooth_transport_free(pa_bluetooth_transport *t);
@@ -26,9 +26,6 @@
 
 #include <errno.h>
 
-#include <arpa/inet.h>
-#include <sbc/sbc.h>
-
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 
@@ -45,9 +42,10 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/time-smoother.h>
 
-#include "a2dp-codecs.h"
+#include "a2dp-codec-api.h"
+#include "a2dp-encoder-thread.h"
+#include "a2dp-rate-control.h"
 #include "bluez5-util.h"
-#include "rtp.h"
 
 #include "module-bluez5-device-symdef.h"
 
@@ -55,17 +53,16 @@ PA_MODULE_AUTHOR("João Paulo Rechi Vita");
 PA_MODULE_DESCRIPTION("BlueZ 5 Bluetooth audio sink and source");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(false);
-PA_MODULE_USAGE("path=<device object path>");
+PA_MODULE_USAGE("path=<device object path> "
+                "encode_ahead=<number of packets to encode ahead in a separate thread, 0 to encode in the IO thread>");
 
 #define MAX_PLAYBACK_CATCH_UP_USEC (100 * PA_USEC_PER_MSEC)
 #define FIXED_LATENCY_PLAYBACK_A2DP (25 * PA_USEC_PER_MSEC)
 #define FIXED_LATENCY_RECORD_A2DP   (25 * PA_USEC_PER_MSEC)
 
-#define BITPOOL_DEC_LIMIT 32
-#define BITPOOL_DEC_STEP 5
-
 static const char* const valid_modargs[] = {
     "path",
+    "encode_ahead",
     NULL
 };
 
@@ -81,18 +78,6 @@ typedef struct bluetooth_msg {
 PA_DEFINE_PRIVATE_CLASS(bluetooth_msg, pa_msgobject);
 #define BLUETOOTH_MSG(o) (bluetooth_msg_cast(o))
 
-typedef struct sbc_info {
-    sbc_t sbc;                           /* Codec data */
-    bool sbc_initialized;                /* Keep track if the encoder is initialized */
-    size_t codesize, frame_length;       /* SBC Codesize, frame_length. We simply cache those values here */
-    uint16_t seq_num;                    /* Cumulative packet sequence */
-    uint8_t min_bitpool;
-    uint8_t max_bitpool;
-
-    void* buffer;                        /* Codec transfer buffer */
-    size_t buffer_size;                  /* Size of the buffer */
-} sbc_info_t;
-
 struct userdata {
     pa_module *module;
     pa_core *core;
@@ -126,11 +111,19 @@ struct userdata {
     size_t write_block_size;
     uint64_t read_index;
     uint64_t write_index;
+    uint64_t render_index;               /* PCM handed to the encoder thread */
     pa_usec_t started_at;
     pa_smoother *read_smoother;
     pa_memchunk write_memchunk;
     pa_sample_spec sample_spec;
-    struct sbc_info sbc_info;
+
+    const pa_a2dp_codec *a2dp_codec;
+    void *codec_info;                    /* Codec state, owned by a2dp_codec */
+    pa_a2dp_rate_control *rate_control;  /* Only for playback with codecs that can change their bitrate */
+    uint32_t encode_ahead;               /* Packets to encode ahead, 0 to encode in the IO thread */
+    pa_a2dp_encoder_thread *encoder;     /* Owns codec_info while the stream is set up, if encode_ahead > 0 */
+    void *buffer;                        /* Codec transfer buffer */
+    size_t buffer_size;                  /* Size of the buffer */
 };
 
 typedef enum pa_bluetooth_form_factor {
@@ -240,105 +233,38 @@ static void a2dp_prepare_buffer(struct userdata *u) {
 
     pa_assert(u);
 
-    if (u->sbc_info.buffer_size >= min_buffer_size)
+    if (u->buffer_size >= min_buffer_size)
         return;
 
-    u->sbc_info.buffer_size = 2 * min_buffer_size;
-    pa_xfree(u->sbc_info.buffer);
-    u->sbc_info.buffer = pa_xmalloc(u->sbc_info.buffer_size);
+    u->buffer_size = 2 * min_buffer_size;
+    pa_xfree(u->buffer);
+    u->buffer = pa_xmalloc(u->buffer_size);
 }
 
-/* Run from IO thread */
-static int a2dp_process_render(struct userdata *u) {
-    struct sbc_info *sbc_info;
-    struct rtp_header *header;
-    struct rtp_payload *payload;
-    size_t nbytes;
-    void *d;
-    const void *p;
-    size_t to_write, to_encode;
-    unsigned frame_count;
-    int ret = 0;
-
+/* Run from I/O thread */
+static void update_write_block_size(struct userdata *u, size_t write_block_size) {
     pa_assert(u);
-    pa_assert(u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK);
     pa_assert(u->sink);
 
-    /* First, render some data */
-    if (!u->write_memchunk.memblock)
-        pa_sink_render_full(u->sink, u->write_block_size, &u->write_memchunk);
-
-    pa_assert(u->write_memchunk.length == u->write_block_size);
-
-    a2dp_prepare_buffer(u);
-
-    sbc_info = &u->sbc_info;
-    header = sbc_info->buffer;
-    payload = (struct rtp_payload*) ((uint8_t*) sbc_info->buffer + sizeof(*header));
-
-    frame_count = 0;
-
-    /* Try to create a packet of the full MTU */
-
-    p = (const uint8_t *) pa_memblock_acquire_chunk(&u->write_memchunk);
-    to_encode = u->write_memchunk.length;
+    u->write_block_size = write_block_size;
 
-    d = (uint8_t*) sbc_info->buffer + sizeof(*header) + sizeof(*payload);
-    to_write = sbc_info->buffer_size - sizeof(*header) - sizeof(*payload);
-
-    while (PA_LIKELY(to_encode > 0 && to_write > 0)) {
-        ssize_t written;
-        ssize_t encoded;
-
-        encoded = sbc_encode(&sbc_info->sbc,
-                             p, to_encode,
-                             d, to_write,
-                             &written);
-
-        if (PA_UNLIKELY(encoded <= 0)) {
-            pa_log_error("SBC encoding error (%li)", (long) encoded);
-            pa_memblock_release(u->write_memchunk.memblock);
-            return -1;
-        }
-
-        pa_assert_fp((size_t) encoded <= to_encode);
-        pa_assert_fp((size_t) encoded == sbc_info->codesize);
-
-        pa_assert_fp((size_t) written <= to_write);
-        pa_assert_fp((size_t) written == sbc_info->frame_length);
-
-        p = (const uint8_t*) p + encoded;
-        to_encode -= encoded;
-
-        d = (uint8_t*) d + written;
-        to_write -= written;
-
-        frame_count++;
-    }
-
-    pa_memblock_release(u->write_memchunk.memblock);
+    pa_sink_set_max_request_within_thread(u->sink, u->write_block_size);
 
-    pa_assert(to_encode == 0);
+    /* Blocks waiting in the encoder thread add to the latency */
+    pa_sink_set_fixed_latency_within_thread(u->sink,
+            FIXED_LATENCY_PLAYBACK_A2DP +
+            pa_bytes_to_usec((1 + (u->encoder ? u->encode_ahead : 0)) * u->write_block_size, &u->sample_spec));
+}
 
-    PA_ONCE_BEGIN {
-        pa_log_debug("Using SBC encoder implementation: %s", pa_strnull(sbc_get_implementation_info(&sbc_info->sbc)));
-    } PA_ONCE_END;
+/* Run from IO thread */
+static int a2dp_write_packet(struct userdata *u, const void *p, size_t nbytes) {
+    int ret = 0;
 
     /* write it to the fifo */
-    memset(sbc_info->buffer, 0, sizeof(*header) + sizeof(*payload));
-    header->v = 2;
-    header->pt = 1;
-    header->sequence_number = htons(sbc_info->seq_num++);
-    header->timestamp = htonl(u->write_index / pa_frame_size(&u->sample_spec));
-    header->ssrc = htonl(1);
-    payload->frame_count = frame_count;
-
-    nbytes = (uint8_t*) d - (uint8_t*) sbc_info->buffer;
-
     for (;;) {
         ssize_t l;
 
-        l = pa_write(u->stream_fd, sbc_info->buffer, nbytes, &u->stream_write_type);
+        l = pa_write(u->stream_fd, p, nbytes, &u->stream_write_type);
 
         pa_assert(l != 0);
 
@@ -367,13 +293,108 @@ static int a2dp_process_render(struct userdata *u) {
             break;
         }
 
+        ret = 1;
+
+        break;
+    }
+
+    return ret;
+}
+
+/* Run from IO thread */
+static int a2dp_process_render(struct userdata *u) {
+    const uint8_t *p;
+    size_t processed;
+    size_t nbytes;
+    int ret;
+
+    pa_assert(u);
+    pa_assert(u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK);
+    pa_assert(u->sink);
+
+    /* First, render some data */
+    if (!u->write_memchunk.memblock)
+        pa_sink_render_full(u->sink, u->write_block_size, &u->write_memchunk);
+
+    /* A chunk that could not be written before the bitrate was lowered is
+     * smaller than a block now, but still fits into a packet */
+    pa_assert(u->write_memchunk.length <= u->write_block_size);
+
+    a2dp_prepare_buffer(u);
+
+    /* Try to create a packet of the full MTU */
+
+    p = (const uint8_t *) pa_memblock_acquire_chunk(&u->write_memchunk);
+
+    nbytes = u->a2dp_codec->encode_buffer(u->codec_info, u->write_index / pa_frame_size(&u->sample_spec),
+                                          p, u->write_memchunk.length,
+                                          u->buffer, u->buffer_size,
+                                          &processed);
+
+    pa_memblock_release(u->write_memchunk.memblock);
+
+    if (PA_UNLIKELY(nbytes == 0))
+        return -1;
+
+    pa_assert(processed == u->write_memchunk.length);
+
+    if ((ret = a2dp_write_packet(u, u->buffer, nbytes)) > 0) {
         u->write_index += (uint64_t) u->write_memchunk.length;
         pa_memblock_unref(u->write_memchunk.memblock);
         pa_memchunk_reset(&u->write_memchunk);
+    }
 
-        ret = 1;
+    return ret;
+}
 
-        break;
+/* Run from IO thread */
+static void a2dp_encode_ahead(struct userdata *u) {
+    pa_assert(u);
+    pa_assert(u->encoder);
+
+    /* Keep the encoder thread busy with up to encode_ahead blocks */
+    while (u->render_index - u->write_index < u->encode_ahead * u->write_block_size) {
+        pa_memchunk chunk;
+
+        pa_sink_render_full(u->sink, u->write_block_size, &chunk);
+
+        if (pa_a2dp_encoder_thread_push(u->encoder, &chunk) < 0) {
+            pa_memblock_unref(chunk.memblock);
+            break;
+        }
+
+        u->render_index += (uint64_t) chunk.length;
+        pa_memblock_unref(chunk.memblock);
+    }
+}
+
+/* Run from IO thread */
+static bool a2dp_packet_ready(struct userdata *u) {
+    pa_assert(u);
+
+    return !u->encoder || pa_a2dp_encoder_thread_peek(u->encoder);
+}
+
+/* Run from IO thread */
+static int a2dp_process_encoded(struct userdata *u) {
+    const pa_a2dp_packet *packet;
+    int ret;
+
+    pa_assert(u);
+    pa_assert(u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK);
+    pa_assert(u->sink);
+    pa_assert_se(packet = pa_a2dp_encoder_thread_peek(u->encoder));
+
+    if (PA_UNLIKELY(packet->size == 0))
+        return -1;
+
+    if ((ret = a2dp_write_packet(u, packet->data, packet->size)) > 0) {
+        u->write_index += (uint64_t) packet->pcm_bytes;
+
+        if (packet->write_block_size != u->write_block_size)
+            update_write_block_size(u, packet->write_block_size);
+
+        pa_a2dp_encoder_thread_drop(u->encoder);
     }
 
     return ret;
@@ -395,22 +416,13 @@ static int a2dp_process_push(struct userdata *u) {
     for (;;) {
         bool found_tstamp = false;
         pa_usec_t tstamp;
-        struct sbc_info *sbc_info;
-        struct rtp_header *header;
-        struct rtp_payload *payload;
-        const void *p;
-        void *d;
+        uint8_t *d;
         ssize_t l;
-        size_t to_write, to_decode;
-        size_t total_written = 0;
+        size_t processed;
 
         a2dp_prepare_buffer(u);
 
-        sbc_info = &u->sbc_info;
-        header = sbc_info->buffer;
-        payload = (struct rtp_payload*) ((uint8_t*) sbc_info->buffer + sizeof(*header));
-
-        l = pa_read(u->stream_fd, sbc_info->buffer, sbc_info->buffer_size, &u->stream_write_type);
+        l = pa_read(u->stream_fd, u->buffer, u->buffer_size, &u->stream_write_type);
 
         if (l <= 0) {
 
@@ -427,7 +439,7 @@ static int a2dp_process_push(struct userdata *u) {
             break;
         }
 
-        pa_assert((size_t) l <= sbc_info->buffer_size);
+        pa_assert((size_t) l <= u->buffer_size);
 
         /* TODO: get timestamp from rtp */
         if (!found_tstamp) {
@@ -435,53 +447,23 @@ static int a2dp_process_push(struct userdata *u) {
             tstamp = pa_rtclock_now();
         }
 
-        p = (uint8_t*) sbc_info->buffer + sizeof(*header) + sizeof(*payload);
-        to_decode = l - sizeof(*header) - sizeof(*payload);
-
         d = pa_memblock_acquire(memchunk.memblock);
-        to_write = memchunk.length = pa_memblock_get_length(memchunk.memblock);
-
-        while (PA_LIKELY(to_decode > 0)) {
-            size_t written;
-            ssize_t decoded;
-
-            decoded = sbc_decode(&sbc_info->sbc,
-                                 p, to_decode,
-                                 d, to_write,
-                                 &written);
-
-            if (PA_UNLIKELY(decoded <= 0)) {
-                pa_log_error("SBC decoding error (%li)", (long) decoded);
-                pa_memblock_release(memchunk.memblock);
-                pa_memblock_unref(memchunk.memblock);
-                return 0;
-            }
-
-            total_written += written;
-
-            /* Reset frame length, it can be changed due to bitpool change */
-            sbc_info->frame_length = sbc_get_frame_length(&sbc_info->sbc);
-
-            pa_assert_fp((size_t) decoded <= to_decode);
-            pa_assert_fp((size_t) decoded == sbc_info->frame_length);
-
-            pa_assert_fp((size_t) written == sbc_info->codesize);
-
-            p = (const uint8_t*) p + decoded;
-            to_decode -= decoded;
+        memchunk.length = u->a2dp_codec->decode_buffer(u->codec_info,
+                                                       u->buffer, (size_t) l,
+                                                       d, pa_memblock_get_length(memchunk.memblock),
+                                                       &processed);
+        pa_memblock_release(memchunk.memblock);
 
-            d = (uint8_t*) d + written;
-            to_write -= written;
+        if (PA_UNLIKELY(processed != (size_t) l)) {
+            /* The codec already complained, just drop the packet */
+            pa_memblock_unref(memchunk.memblock);
+            return 0;
         }
 
-        u->read_index += (uint64_t) total_written;
+        u->read_index += (uint64_t) memchunk.length;
         pa_smoother_put(u->read_smoother, tstamp, pa_bytes_to_usec(u->read_index, &u->sample_spec));
         pa_smoother_resume(u->read_smoother, tstamp, true);
 
-        memchunk.length -= to_write;
-
-        pa_memblock_release(memchunk.memblock);
-
         pa_source_post(u->source, &memchunk);
 
         ret = l;
@@ -494,63 +476,79 @@ static int a2dp_process_push(struct userdata *u) {
 }
 
 /* Run from I/O thread */
-static void a2dp_set_bitpool(struct userdata *u, uint8_t bitpool) {
-    struct sbc_info *sbc_info;
+static void a2dp_reduce_encoder_bitrate(struct userdata *u) {
+    size_t write_block_size;
 
     pa_assert(u);
 
-    sbc_info = &u->sbc_info;
+    if (!u->a2dp_codec->reduce_encoder_bitrate)
+        return;
 
-    if (sbc_info->sbc.bitpool == bitpool)
+    if (u->encoder) {
+        pa_a2dp_encoder_thread_reduce_bitrate(u->encoder);
         return;
+    }
 
-    if (bitpool > sbc_info->max_bitpool)
-        bitpool = sbc_info->max_bitpool;
-    else if (bitpool < sbc_info->min_bitpool)
-        bitpool = sbc_info->min_bitpool;
+    if ((write_block_size = u->a2dp_codec->reduce_encoder_bitrate(u->codec_info, u->write_link_mtu)) > 0)
+        update_write_block_size(u, write_block_size);
+}
 
-    sbc_info->sbc.bitpool = bitpool;
+/* Run from I/O thread */
+static void a2dp_increase_encoder_bitrate(struct userdata *u) {
+    size_t write_block_size;
 
-    sbc_info->codesize = sbc_get_codesize(&sbc_info->sbc);
-    sbc_info->frame_length = sbc_get_frame_length(&sbc_info->sbc);
+    pa_assert(u);
 
-    pa_log_debug("Bitpool has changed to %u", sbc_info->sbc.bitpool);
+    if (!u->a2dp_codec->increase_encoder_bitrate)
+        return;
 
-    u->read_block_size =
-        (u->read_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / sbc_info->frame_length * sbc_info->codesize;
+    if (u->encoder) {
+        pa_a2dp_encoder_thread_increase_bitrate(u->encoder);
+        return;
+    }
 
-    u->write_block_size =
-        (u->write_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / sbc_info->frame_length * sbc_info->codesize;
+    /* A pending chunk must still fit into a packet */
+    if (u->write_memchunk.memblock)
+        return;
 
-    pa_sink_set_max_request_within_thread(u->sink, u->write_block_size);
-    pa_sink_set_fixed_latency_within_thread(u->sink,
-            FIXED_LATENCY_PLAYBACK_A2DP + pa_bytes_to_usec(u->write_block_size, &u->sample_spec));
+    if ((write_block_size = u->a2dp_codec->increase_encoder_bitrate(u->codec_info, u->write_link_mtu)) > 0)
+        update_write_block_size(u, write_block_size);
 }
 
 /* Run from I/O thread */
-static void a2dp_reduce_bitpool(struct userdata *u) {
-    struct sbc_info *sbc_info;
-    uint8_t bitpool;
+static void a2dp_adapt_encoder_bitrate(struct userdata *u, bool written) {
+    pa_usec_t packet_duration;
 
     pa_assert(u);
 
-    sbc_info = &u->sbc_info;
-
-    /* Check if bitpool is already at its limit */
-    if (sbc_info->sbc.bitpool <= BITPOOL_DEC_LIMIT)
+    if (!u->rate_control)
         return;
 
-    bitpool = sbc_info->sbc.bitpool - BITPOOL_DEC_STEP;
-
-    if (bitpool < BITPOOL_DEC_LIMIT)
-        bitpool = BITPOOL_DEC_LIMIT;
+    packet_duration = pa_bytes_to_usec(u->write_block_size, &u->sample_spec);
 
-    a2dp_set_bitpool(u, bitpool);
+    switch (pa_a2dp_rate_control_after_write(u->rate_control, pa_rtclock_now(), packet_duration, written)) {
+        case PA_A2DP_RATE_DECREASE:
+            a2dp_reduce_encoder_bitrate(u);
+            break;
+        case PA_A2DP_RATE_INCREASE:
+            a2dp_increase_encoder_bitrate(u);
+            break;
+        case PA_A2DP_RATE_KEEP:
+            break;
+    }
 }
 
 static void teardown_stream(struct userdata *u) {
+    if (u->encoder) {
+        pa_a2dp_encoder_thread_free(u->encoder);
+        u->encoder = NULL;
+    }
+
+    if (u->rate_control) {
+        pa_a2dp_rate_control_free(u->rate_control);
+        u->rate_control = NULL;
+    }
+
     if (u->rtpoll_item) {
         pa_rtpoll_item_free(u->rtpoll_item);
         u->rtpoll_item = NULL;
@@ -610,20 +608,11 @@ static void transport_release(struct userdata *u) {
 
 /* Run from I/O thread */
 static void transport_config_mtu(struct userdata *u) {
-    u->read_block_size =
-        (u->read_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / u->sbc_info.frame_length * u->sbc_info.codesize;
-
-    u->write_block_size =
-        (u->write_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / u->sbc_info.frame_length * u->sbc_info.codesize;
+    u->read_block_size = u->a2dp_codec->get_read_block_size(u->codec_info, u->read_link_mtu);
+    u->write_block_size = u->a2dp_codec->get_write_block_size(u->codec_info, u->write_link_mtu);
 
-    if (u->sink) {
-        pa_sink_set_max_request_within_thread(u->sink, u->write_block_size);
-        pa_sink_set_fixed_latency_within_thread(u->sink,
-                                                FIXED_LATENCY_PLAYBACK_A2DP +
-                                                pa_bytes_to_usec(u->write_block_size, &u->sample_spec));
-    }
+    if (u->sink)
+        update_write_block_size(u, u->write_block_size);
 
     if (u->source)
         pa_source_set_fixed_latency_within_thread(u->source,
@@ -632,12 +621,15 @@ static void transport_config_mtu(struct userdata *u) {
 }
 
 /* Run from I/O thread */
-static void setup_stream(struct userdata *u) {
+static int setup_stream(struct userdata *u) {
     struct pollfd *pollfd;
     int one;
 
     pa_log_info("Transport %s resuming", u->transport->path);
 
+    if (u->a2dp_codec->reset(u->codec_info) < 0)
+        return -1;
+
     transport_config_mtu(u);
 
     pa_make_fd_nonblock(u->stream_fd);
@@ -649,19 +641,33 @@ static void setup_stream(struct userdata *u) {
 
     pa_log_debug("Stream properly set up, we're ready to roll!");
 
-    if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK)
-        a2dp_set_bitpool(u, u->sbc_info.max_bitpool);
+    if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK &&
+        u->a2dp_codec->reduce_encoder_bitrate && u->a2dp_codec->increase_encoder_bitrate)
+        u->rate_control = pa_a2dp_rate_control_new(u->stream_fd, true);
 
     u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
     pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
     pollfd->fd = u->stream_fd;
     pollfd->events = pollfd->revents = 0;
 
-    u->read_index = u->write_index = 0;
+    u->read_index = u->write_index = u->render_index = 0;
     u->started_at = 0;
 
+    if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK && u->encode_ahead > 0) {
+        int priority = u->core->realtime_scheduling ? u->core->realtime_priority : 0;
+
+        if ((u->encoder = pa_a2dp_encoder_thread_new(u->a2dp_codec, u->codec_info, &u->sample_spec,
+                                                     u->write_link_mtu, u->write_block_size,
+                                                     u->rtpoll, priority)))
+            update_write_block_size(u, u->write_block_size);
+        else
+            pa_log_warn("Failed to start encoder thread, encoding in the IO thread");
+    }
+
     if (u->source)
         u->read_smoother = pa_smoother_new(PA_USEC_PER_SEC, 2*PA_USEC_PER_SEC, true, true, 10, pa_rtclock_now(), true);
+
+    return 0;
 }
 
 /* Run from IO thread */
@@ -700,10 +706,8 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
 
                     /* Resume the device if the sink was suspended as well */
                     if (!u->sink || !PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-                        if (transport_acquire(u, false) < 0)
+                        if (transport_acquire(u, false) < 0 || setup_stream(u) < 0)
                             failed = true;
-                        else
-                            setup_stream(u);
                     }
 
                     /* We don't resume the smoother here. Instead we
@@ -753,6 +757,7 @@ static int add_source(struct userdata *u) {
     data.name = pa_sprintf_malloc("bluez_source.%s", u->device->address);
     data.namereg_fail = false;
     pa_proplist_sets(data.proplist, "bluetooth.protocol", pa_bluetooth_profile_to_string(u->profile));
+    pa_proplist_sets(data.proplist, "bluetooth.codec", u->a2dp_codec->name);
     pa_source_new_data_set_sample_spec(&data, &u->sample_spec);
 
     connect_ports(u, &data, PA_DIRECTION_INPUT);
@@ -817,10 +822,8 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
                     /* Resume the device if the source was suspended as well */
                     if (!u->source || !PA_SOURCE_IS_OPENED(u->source->thread_info.state)) {
-                        if (transport_acquire(u, false) < 0)
+                        if (transport_acquire(u, false) < 0 || setup_stream(u) < 0)
                             failed = true;
-                        else
-                            setup_stream(u);
                     }
 
                     break;
@@ -841,7 +844,8 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
                 wi = pa_bytes_to_usec(u->write_index + u->write_block_size, &u->sample_spec);
             } else {
                 ri = pa_rtclock_now() - u->started_at;
-                wi = pa_bytes_to_usec(u->write_index, &u->sample_spec);
+                /* Include what is still queued up for the encoder thread */
+                wi = pa_bytes_to_usec(u->encoder ? u->render_index : u->write_index, &u->sample_spec);
             }
 
             *((pa_usec_t*) data) = FIXED_LATENCY_PLAYBACK_A2DP + wi > ri ? FIXED_LATENCY_PLAYBACK_A2DP + wi - ri : 0;
@@ -868,6 +872,7 @@ static int add_sink(struct userdata *u) {
     data.name = pa_sprintf_malloc("bluez_sink.%s", u->device->address);
     data.namereg_fail = false;
     pa_proplist_sets(data.proplist, "bluetooth.protocol", pa_bluetooth_profile_to_string(u->profile));
+    pa_proplist_sets(data.proplist, "bluetooth.codec", u->a2dp_codec->name);
     pa_sink_new_data_set_sample_spec(&data, &u->sample_spec);
 
     connect_ports(u, &data, PA_DIRECTION_OUTPUT);
@@ -896,112 +901,28 @@ static int add_sink(struct userdata *u) {
 }
 
 /* Run from main thread */
-static void transport_config(struct userdata *u) {
-    sbc_info_t *sbc_info = &u->sbc_info;
-    a2dp_sbc_t *config;
-
+static int transport_config(struct userdata *u) {
     pa_assert(u->transport);
+    pa_assert(u->transport->a2dp_codec);
 
-    u->sample_spec.format = PA_SAMPLE_S16LE;
-    config = (a2dp_sbc_t *) u->transport->config;
-
-    if (sbc_info->sbc_initialized)
-        sbc_reinit(&sbc_info->sbc, 0);
-    else
-        sbc_init(&sbc_info->sbc, 0);
-    sbc_info->sbc_initialized = true;
-
-    switch (config->frequency) {
-        case SBC_SAMPLING_FREQ_16000:
-            sbc_info->sbc.frequency = SBC_FREQ_16000;
-            u->sample_spec.rate = 16000U;
-            break;
-        case SBC_SAMPLING_FREQ_32000:
-            sbc_info->sbc.frequency = SBC_FREQ_32000;
-            u->sample_spec.rate = 32000U;
-            break;
-        case SBC_SAMPLING_FREQ_44100:
-            sbc_info->sbc.frequency = SBC_FREQ_44100;
-            u->sample_spec.rate = 44100U;
-            break;
-        case SBC_SAMPLING_FREQ_48000:
-            sbc_info->sbc.frequency = SBC_FREQ_48000;
-            u->sample_spec.rate = 48000U;
-            break;
-        default:
-            pa_assert_not_reached();
-    }
-
-    switch (config->channel_mode) {
-        case SBC_CHANNEL_MODE_MONO:
-            sbc_info->sbc.mode = SBC_MODE_MONO;
-            u->sample_spec.channels = 1;
-            break;
-        case SBC_CHANNEL_MODE_DUAL_CHANNEL:
-            sbc_info->sbc.mode = SBC_MODE_DUAL_CHANNEL;
-            u->sample_spec.channels = 2;
-            break;
-        case SBC_CHANNEL_MODE_STEREO:
-            sbc_info->sbc.mode = SBC_MODE_STEREO;
-            u->sample_spec.channels = 2;
-            break;
-        case SBC_CHANNEL_MODE_JOINT_STEREO:
-            sbc_info->sbc.mode = SBC_MODE_JOINT_STEREO;
-            u->sample_spec.channels = 2;
-            break;
-        default:
-            pa_assert_not_reached();
-    }
-
-    switch (config->allocation_method) {
-        case SBC_ALLOCATION_SNR:
-            sbc_info->sbc.allocation = SBC_AM_SNR;
-            break;
-        case SBC_ALLOCATION_LOUDNESS:
-            sbc_info->sbc.allocation = SBC_AM_LOUDNESS;
-            break;
-        default:
-            pa_assert_not_reached();
+    if (u->codec_info) {
+        u->a2dp_codec->deinit(u->codec_info);
+        u->codec_info = NULL;
     }
 
-    switch (config->subbands) {
-        case SBC_SUBBANDS_4:
-            sbc_info->sbc.subbands = SBC_SB_4;
-            break;
-        case SBC_SUBBANDS_8:
-            sbc_info->sbc.subbands = SBC_SB_8;
-            break;
-        default:
-            pa_assert_not_reached();
-    }
+    u->a2dp_codec = u->transport->a2dp_codec;
 
-    switch (config->block_length) {
-        case SBC_BLOCK_LENGTH_4:
-            sbc_info->sbc.blocks = SBC_BLK_4;
-            break;
-        case SBC_BLOCK_LENGTH_8:
-            sbc_info->sbc.blocks = SBC_BLK_8;
-            break;
-        case SBC_BLOCK_LENGTH_12:
-            sbc_info->sbc.blocks = SBC_BLK_12;
-            break;
-        case SBC_BLOCK_LENGTH_16:
-            sbc_info->sbc.blocks = SBC_BLK_16;
-            break;
-        default:
-            pa_assert_not_reached();
+    u->codec_info = u->a2dp_codec->init(u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK,
+                                        u->transport->config, u->transport->config_size,
+                                        &u->sample_spec);
+    if (!u->codec_info) {
+        pa_log_error("Failed to initialize %s codec", u->a2dp_codec->description);
+        return -1;
     }
 
-    sbc_info->min_bitpool = config->min_bitpool;
-    sbc_info->max_bitpool = config->max_bitpool;
+    pa_log_info("Using %s codec", u->a2dp_codec->description);
 
-    /* Set minimum bitpool for source to get the maximum possible block_size */
-    sbc_info->sbc.bitpool = u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK ? sbc_info->max_bitpool : sbc_info->min_bitpool;
-    sbc_info->codesize = sbc_get_codesize(&sbc_info->sbc);
-    sbc_info->frame_length = sbc_get_frame_length(&sbc_info->sbc);
-
-    pa_log_info("SBC parameters: allocation=%u, subbands=%u, blocks=%u, bitpool=%u",
-                sbc_info->sbc.allocation, sbc_info->sbc.subbands, sbc_info->sbc.blocks, sbc_info->sbc.bitpool);
+    return 0;
 }
 
 /* Run from main thread */
@@ -1026,9 +947,7 @@ static int setup_transport(struct userdata *u) {
     else if (transport_acquire(u, false) < 0)
         return -1; /* We need to fail here until the interactions with module-suspend-on-idle and alike get improved */
 
-    transport_config(u);
-
-    return 0;
+    return transport_config(u);
 }
 
 /* Run from main thread */
@@ -1071,8 +990,8 @@ static void thread_func(void *userdata) {
     pa_thread_mq_install(&u->thread_mq);
 
     /* Setup the stream only if the transport was already acquired */
-    if (u->transport_acquired)
-        setup_stream(u);
+    if (u->transport_acquired && setup_stream(u) < 0)
+        goto fail;
 
     for (;;) {
         struct pollfd *pollfd;
@@ -1146,9 +1065,10 @@ static void thread_func(void *userdata) {
                                 pa_sink_render_full(u->sink, skip_bytes, &tmp);
                                 pa_memblock_unref(tmp.memblock);
                                 u->write_index += skip_bytes;
+                                u->render_index += skip_bytes;
 
                                 if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SINK)
-                                    a2dp_reduce_bitpool(u);
+                                    a2dp_reduce_encoder_bitrate(u);
                             }
                         }
 
@@ -1157,20 +1077,33 @@ static void thread_func(void *userdata) {
                     }
                 }
 
-                if (writable && do_write > 0) {
+                if (u->encoder)
+                    a2dp_encode_ahead(u);
+
+                /* With an encoder thread we may have to wait for it */
+                if (writable && do_write > 0 && a2dp_packet_ready(u)) {
                     int n_written;
 
                     if (u->write_index <= 0)
                         u->started_at = pa_rtclock_now();
 
-                    if ((n_written = a2dp_process_render(u)) < 0)
+                    if (u->rate_control)
+                        pa_a2dp_rate_control_before_write(u->rate_control);
+
+                    if ((n_written = (u->encoder ? a2dp_process_encoded(u) : a2dp_process_render(u))) < 0)
                         goto io_fail;
 
+                    a2dp_adapt_encoder_bitrate(u, n_written > 0);
+
                     if (n_written == 0)
                         pa_log("Broken kernel: we got EAGAIN on write() after POLLOUT!");
 
                     do_write -= n_written;
                     writable = false;
+
+                    /* Replace the block we just wrote */
+                    if (u->encoder)
+                        a2dp_encode_ahead(u);
                 }
 
                 if ((!u->source || !PA_SOURCE_IS_LINKED(u->source->thread_info.state)) && do_write <= 0) {
@@ -1299,6 +1232,11 @@ static void stop_thread(struct userdata *u) {
         u->thread = NULL;
     }
 
+    if (u->encoder) {
+        pa_a2dp_encoder_thread_free(u->encoder);
+        u->encoder = NULL;
+    }
+
     if (u->rtpoll_item) {
         pa_rtpoll_item_free(u->rtpoll_item);
         u->rtpoll_item = NULL;
@@ -1807,6 +1745,13 @@ int pa__init(pa_module* m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "encode_ahead", &u->encode_ahead) < 0 ||
+        u->encode_ahead > PA_A2DP_ENCODER_THREAD_MAX_DEPTH) {
+        pa_log_error("Failed to parse encode_ahead argument, expected a number between 0 and %u",
+                     PA_A2DP_ENCODER_THREAD_MAX_DEPTH);
+        goto fail;
+    }
+
     if ((u->discovery = pa_shared_get(u->core, "bluetooth-discovery")))
         pa_bluetooth_discovery_ref(u->discovery);
     else {
@@ -1881,11 +1826,11 @@ void pa__done(pa_module *m) {
     if (u->transport_state_changed_slot)
         pa_hook_slot_free(u->transport_state_changed_slot);
 
-    if (u->sbc_info.buffer)
-        pa_xfree(u->sbc_info.buffer);
+    if (u->buffer)
+        pa_xfree(u->buffer);
 
-    if (u->sbc_info.sbc_initialized)
-        sbc_finish(&u->sbc_info.sbc);
+    if (u->codec_info)
+        u->a2dp_codec->deinit(u->codec_info);
 
     if (u->msg)
         pa_xfree(u->msg);
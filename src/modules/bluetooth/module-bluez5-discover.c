@@ -26,6 +26,7 @@
 #include <pulsecore/core.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/modargs.h>
 #include <pulsecore/module.h>
 #include <pulsecore/shared.h>
 
@@ -37,6 +38,12 @@ PA_MODULE_AUTHOR("João Paulo Rechi Vita");
 PA_MODULE_DESCRIPTION("Detect available BlueZ 5 Bluetooth audio devices and load BlueZ 5 Bluetooth audio drivers");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(true);
+PA_MODULE_USAGE("encode_ahead=<number of packets to encode ahead in a separate thread, passed on to module-bluez5-device>");
+
+static const char* const valid_modargs[] = {
+    "encode_ahead",
+    NULL
+};
 
 struct userdata {
     pa_module *module;
@@ -44,6 +51,7 @@ struct userdata {
     pa_hashmap *loaded_device_paths;
     pa_hook_slot *device_connection_changed_slot;
     pa_bluetooth_discovery *discovery;
+    uint32_t encode_ahead;
 };
 
 static pa_hook_result_t device_connection_changed_cb(pa_bluetooth_discovery *y, const pa_bluetooth_device *d, struct userdata *u) {
@@ -64,7 +72,7 @@ static pa_hook_result_t device_connection_changed_cb(pa_bluetooth_discovery *y,
     if (!module_loaded && pa_bluetooth_device_any_transport_connected(d)) {
         /* a new device has been connected */
         pa_module *m;
-        char *args = pa_sprintf_malloc("path=%s", d->path);
+        char *args = pa_sprintf_malloc("path=%s encode_ahead=%u", d->path, u->encode_ahead);
 
         pa_log_debug("Loading module-bluez5-device %s", args);
         m = pa_module_load(u->module->core, "module-bluez5-device", args);
@@ -85,14 +93,28 @@ static pa_hook_result_t device_connection_changed_cb(pa_bluetooth_discovery *y,
 
 int pa__init(pa_module *m) {
     struct userdata *u;
+    pa_modargs *ma;
 
     pa_assert(m);
 
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log_error("Failed to parse module arguments");
+        return -1;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->module = m;
     u->core = m->core;
     u->loaded_device_paths = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
 
+    if (pa_modargs_get_value_u32(ma, "encode_ahead", &u->encode_ahead) < 0) {
+        pa_log_error("Failed to parse encode_ahead argument");
+        pa_modargs_free(ma);
+        goto fail;
+    }
+
+    pa_modargs_free(ma);
+
     if (!(u->discovery = pa_bluetooth_discovery_get(u->core)))
         goto fail;
 
@@ -38,6 +38,8 @@
 
 #include "adrian.h"
 
+typedef struct pa_fdaf_ec pa_fdaf_ec;
+
 /* Common data structures */
 
 typedef struct pa_echo_canceller_msg pa_echo_canceller_msg;
@@ -61,6 +63,9 @@ struct pa_echo_canceller_params {
             AEC *aec;
         } adrian;
 #endif
+        struct {
+            pa_fdaf_ec *ec;
+        } fdaf;
 #ifdef HAVE_WEBRTC
         struct {
             /* This is a void* so that we don't have to convert this whole file
@@ -168,6 +173,15 @@ void pa_adrian_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *
 void pa_adrian_ec_done(pa_echo_canceller *ec);
 #endif
 
+/* Partitioned frequency-domain adaptive filter */
+bool pa_fdaf_ec_init(pa_core *c, pa_echo_canceller *ec,
+                     pa_sample_spec *rec_ss, pa_channel_map *rec_map,
+                     pa_sample_spec *play_ss, pa_channel_map *play_map,
+                     pa_sample_spec *out_ss, pa_channel_map *out_map,
+                     uint32_t *nframes, const char *args);
+void pa_fdaf_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out);
+void pa_fdaf_ec_done(pa_echo_canceller *ec);
+
 #ifdef HAVE_WEBRTC
 /* WebRTC canceller functions */
 PA_C_DECL_BEGIN
@@ -0,0 +1,342 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+
+#include "fdaf-aec.h"
+
+/* Smoothing of the per-bin far end power used to normalize the step size */
+#define POWER_SMOOTHING 0.7f
+
+/* Regularization of the normalization, about the power of a signal at
+ * -60 dBFS in one bin */
+#define NOISE_FLOOR 1e-6f
+
+struct pa_fdaf_fft {
+    unsigned n, m;      /* Real and complex transform size, m = n/2 */
+    unsigned *rev;      /* Bit reversal permutation for m */
+    float *tw;          /* exp(-2 pi i k / m), k < m/2 */
+    float *rtw;         /* exp(-2 pi i k / n), k <= m */
+    float *work;
+};
+
+struct pa_fdaf {
+    unsigned block_size, n_partitions, n_bins;
+    float mu;
+
+    pa_fdaf_fft *fft;
+
+    float *far_prev;    /* Previous block of far end samples */
+    float *buf;         /* Time domain scratch buffer, 2 blocks */
+    float *X;           /* Far end spectra of the last n_partitions blocks */
+    float *W;           /* Filter partitions */
+    float *Y, *E, *G;
+    float *power;       /* Smoothed far end power per bin, over all partitions */
+    unsigned cur;       /* Partition slot of the newest far end spectrum */
+};
+
+pa_fdaf_fft *pa_fdaf_fft_new(unsigned n) {
+    pa_fdaf_fft *t;
+    unsigned i, bits = 0;
+
+    pa_assert(n >= 4);
+    pa_assert((n & (n - 1)) == 0);
+
+    t = pa_xnew0(pa_fdaf_fft, 1);
+    t->n = n;
+    t->m = n / 2;
+
+    while ((1U << bits) < t->m)
+        bits++;
+
+    t->rev = pa_xnew(unsigned, t->m);
+    for (i = 0; i < t->m; i++) {
+        unsigned j, r = 0;
+
+        for (j = 0; j < bits; j++)
+            if (i & (1U << j))
+                r |= 1U << (bits - 1 - j);
+
+        t->rev[i] = r;
+    }
+
+    t->tw = pa_xnew(float, t->m);
+    for (i = 0; i < t->m / 2; i++) {
+        t->tw[2*i] = (float) cos(2 * M_PI * i / t->m);
+        t->tw[2*i+1] = (float) -sin(2 * M_PI * i / t->m);
+    }
+
+    t->rtw = pa_xnew(float, 2 * (t->m + 1));
+    for (i = 0; i <= t->m; i++) {
+        t->rtw[2*i] = (float) cos(2 * M_PI * i / t->n);
+        t->rtw[2*i+1] = (float) -sin(2 * M_PI * i / t->n);
+    }
+
+    t->work = pa_xnew(float, 2 * t->m);
+
+    return t;
+}
+
+void pa_fdaf_fft_free(pa_fdaf_fft *t) {
+    pa_assert(t);
+
+    pa_xfree(t->rev);
+    pa_xfree(t->tw);
+    pa_xfree(t->rtw);
+    pa_xfree(t->work);
+    pa_xfree(t);
+}
+
+/* In place forward complex FFT of t->m points, iterative radix 2 */
+static void complex_fft(pa_fdaf_fft *t, float *z) {
+    unsigned i, j, len;
+
+    for (i = 0; i < t->m; i++) {
+        unsigned r = t->rev[i];
+
+        if (r > i) {
+            float re = z[2*i], im = z[2*i+1];
+
+            z[2*i] = z[2*r];
+            z[2*i+1] = z[2*r+1];
+            z[2*r] = re;
+            z[2*r+1] = im;
+        }
+    }
+
+    for (len = 2; len <= t->m; len <<= 1) {
+        unsigned half = len / 2, step = t->m / len;
+
+        for (i = 0; i < t->m; i += len) {
+            for (j = 0; j < half; j++) {
+                float *a = z + 2 * (i + j), *b = z + 2 * (i + j + half);
+                float wr = t->tw[2*j*step], wi = t->tw[2*j*step+1];
+                float br = b[0] * wr - b[1] * wi;
+                float bi = b[0] * wi + b[1] * wr;
+
+                b[0] = a[0] - br;
+                b[1] = a[1] - bi;
+                a[0] += br;
+                a[1] += bi;
+            }
+        }
+    }
+}
+
+/* The n real samples are transformed as n/2 complex ones, even samples in
+ * the real and odd samples in the imaginary part, and the two interleaved
+ * spectra are separated afterwards */
+void pa_fdaf_fft_forward(pa_fdaf_fft *t, const float *in, float *out) {
+    float *z = t->work;
+    unsigned k, m = t->m;
+
+    memcpy(z, in, t->n * sizeof(float));
+    complex_fft(t, z);
+
+    for (k = 0; k <= m; k++) {
+        unsigned a = k % m, b = (m - k) % m;
+        float zr = z[2*a], zi = z[2*a+1];
+        float cr = z[2*b], ci = -z[2*b+1];
+
+        /* Spectra of the even and odd samples */
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float or_ = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+
+        float wr = t->rtw[2*k], wi = t->rtw[2*k+1];
+
+        out[2*k] = er + or_ * wr - oi * wi;
+        out[2*k+1] = ei + or_ * wi + oi * wr;
+    }
+}
+
+void pa_fdaf_fft_inverse(pa_fdaf_fft *t, const float *in, float *out) {
+    float *z = t->work;
+    unsigned k, m = t->m;
+    float scale = 1.0f / m;
+
+    for (k = 0; k < m; k++) {
+        float xr = in[2*k], xi = in[2*k+1];
+        float cr = in[2*(m-k)], ci = -in[2*(m-k)+1];
+
+        float er = 0.5f * (xr + cr), ei = 0.5f * (xi + ci);
+        float dr = 0.5f * (xr - cr), di = 0.5f * (xi - ci);
+
+        /* Undo the twiddle: multiply with the conjugate */
+        float wr = t->rtw[2*k], wi = -t->rtw[2*k+1];
+        float or_ = dr * wr - di * wi, oi = dr * wi + di * wr;
+
+        /* z = even + i * odd, conjugated for the inverse transform */
+        z[2*k] = er - oi;
+        z[2*k+1] = -(ei + or_);
+    }
+
+    complex_fft(t, z);
+
+    for (k = 0; k < m; k++) {
+        out[2*k] = z[2*k] * scale;
+        out[2*k+1] = -z[2*k+1] * scale;
+    }
+}
+
+pa_fdaf *pa_fdaf_new(unsigned block_size, unsigned n_partitions, float mu) {
+    pa_fdaf *f;
+
+    pa_assert(block_size >= 2);
+    pa_assert((block_size & (block_size - 1)) == 0);
+    pa_assert(n_partitions >= 1);
+    pa_assert(mu > 0 && mu < 1);
+
+    f = pa_xnew0(pa_fdaf, 1);
+    f->block_size = block_size;
+    f->n_partitions = n_partitions;
+    f->n_bins = block_size + 1;
+    f->mu = mu;
+
+    f->fft = pa_fdaf_fft_new(2 * block_size);
+
+    f->far_prev = pa_xnew0(float, block_size);
+    f->buf = pa_xnew0(float, 2 * block_size);
+    f->X = pa_xnew0(float, 2 * f->n_bins * n_partitions);
+    f->W = pa_xnew0(float, 2 * f->n_bins * n_partitions);
+    f->Y = pa_xnew0(float, 2 * f->n_bins);
+    f->E = pa_xnew0(float, 2 * f->n_bins);
+    f->G = pa_xnew0(float, 2 * f->n_bins);
+    f->power = pa_xnew0(float, f->n_bins);
+
+    return f;
+}
+
+void pa_fdaf_free(pa_fdaf *f) {
+    pa_assert(f);
+
+    pa_fdaf_fft_free(f->fft);
+
+    pa_xfree(f->far_prev);
+    pa_xfree(f->buf);
+    pa_xfree(f->X);
+    pa_xfree(f->W);
+    pa_xfree(f->Y);
+    pa_xfree(f->E);
+    pa_xfree(f->G);
+    pa_xfree(f->power);
+    pa_xfree(f);
+}
+
+void pa_fdaf_reset(pa_fdaf *f) {
+    pa_assert(f);
+
+    memset(f->far_prev, 0, f->block_size * sizeof(float));
+    memset(f->X, 0, 2 * f->n_bins * f->n_partitions * sizeof(float));
+    memset(f->W, 0, 2 * f->n_bins * f->n_partitions * sizeof(float));
+    memset(f->power, 0, f->n_bins * sizeof(float));
+}
+
+/* Spectrum of the far end block that is p blocks old */
+static float *far_spectrum(pa_fdaf *f, unsigned p) {
+    return f->X + 2 * f->n_bins * ((f->cur + f->n_partitions - p) % f->n_partitions);
+}
+
+void pa_fdaf_process(pa_fdaf *f, const float *mic, const float *far, float *out, float step) {
+    unsigned B, k, n, p;
+
+    pa_assert(f);
+    pa_assert(mic);
+    pa_assert(far);
+    pa_assert(out);
+
+    B = f->block_size;
+
+    /* Overlap-save: transform the previous and the current far end block */
+    memcpy(f->buf, f->far_prev, B * sizeof(float));
+    memcpy(f->buf + B, far, B * sizeof(float));
+    memcpy(f->far_prev, far, B * sizeof(float));
+
+    f->cur = (f->cur + 1) % f->n_partitions;
+    pa_fdaf_fft_forward(f->fft, f->buf, far_spectrum(f, 0));
+
+    /* Echo estimate: sum of all partitions applied to their far end block.
+     * The far end power over all partitions is collected on the way, the
+     * gradients of all partitions add up and it bounds their sum. */
+    memset(f->Y, 0, 2 * f->n_bins * sizeof(float));
+    memset(f->G, 0, f->n_bins * sizeof(float));
+
+    for (p = 0; p < f->n_partitions; p++) {
+        const float *X = far_spectrum(f, p), *W = f->W + 2 * f->n_bins * p;
+
+        for (k = 0; k < f->n_bins; k++) {
+            f->Y[2*k] += W[2*k] * X[2*k] - W[2*k+1] * X[2*k+1];
+            f->Y[2*k+1] += W[2*k] * X[2*k+1] + W[2*k+1] * X[2*k];
+            f->G[k] += X[2*k] * X[2*k] + X[2*k+1] * X[2*k+1];
+        }
+    }
+
+    for (k = 0; k < f->n_bins; k++)
+        f->power[k] = POWER_SMOOTHING * f->power[k] + (1.0f - POWER_SMOOTHING) * f->G[k];
+
+    pa_fdaf_fft_inverse(f->fft, f->Y, f->buf);
+
+    /* Only the second half is free of circular wrap-around */
+    for (n = 0; n < B; n++) {
+        f->buf[B + n] = mic[n] - f->buf[B + n];
+        out[n] = f->buf[B + n];
+    }
+
+    if (step <= 0.0f)
+        return;
+
+    /* Error spectrum, zero padded in front for the correlation */
+    memset(f->buf, 0, B * sizeof(float));
+    pa_fdaf_fft_forward(f->fft, f->buf, f->E);
+
+    for (k = 0; k < f->n_bins; k++) {
+        float s = f->mu * step / (f->power[k] + NOISE_FLOOR * 2 * B * f->n_partitions);
+
+        f->E[2*k] *= s;
+        f->E[2*k+1] *= s;
+    }
+
+    for (p = 0; p < f->n_partitions; p++) {
+        const float *X = far_spectrum(f, p);
+        float *W = f->W + 2 * f->n_bins * p;
+
+        /* Gradient: far end spectrum conjugated times error spectrum */
+        for (k = 0; k < f->n_bins; k++) {
+            f->G[2*k] = X[2*k] * f->E[2*k] + X[2*k+1] * f->E[2*k+1];
+            f->G[2*k+1] = X[2*k] * f->E[2*k+1] - X[2*k+1] * f->E[2*k];
+        }
+
+        /* Keep the partition a linear filter of B taps, otherwise it
+         * picks up the circular wrap-around */
+        pa_fdaf_fft_inverse(f->fft, f->G, f->buf);
+        memset(f->buf + B, 0, B * sizeof(float));
+        pa_fdaf_fft_forward(f->fft, f->buf, f->G);
+
+        for (k = 0; k < 2 * f->n_bins; k++)
+            W[k] += f->G[k];
+    }
+}
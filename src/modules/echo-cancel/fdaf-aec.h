@@ -0,0 +1,58 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#ifndef foofdafaechfoo
+#define foofdafaechfoo
+
+/* Partitioned block frequency-domain adaptive filter (PBFDAF).
+ *
+ * The echo path is modelled by an FIR filter of n_partitions * block_size
+ * taps. The filter is split into partitions of block_size taps, each of
+ * which is applied and adapted as a spectrum of 2 * block_size bins, using
+ * overlap-save. Per block this costs a handful of FFTs plus one complex
+ * multiply-add per bin and partition, instead of two passes over all taps
+ * for every single sample as time-domain NLMS needs. */
+
+typedef struct pa_fdaf pa_fdaf;
+
+/* block_size has to be a power of two. mu is the step size, normalized to
+ * the far end power in each bin, 0 < mu < 1. */
+pa_fdaf *pa_fdaf_new(unsigned block_size, unsigned n_partitions, float mu);
+void pa_fdaf_free(pa_fdaf *f);
+
+/* Processes one block of block_size samples. out may be the same as mic.
+ * step scales the adaptation for this block: 1 adapts at full speed, 0
+ * freezes the filter, e.g. during double talk. */
+void pa_fdaf_process(pa_fdaf *f, const float *mic, const float *far, float *out, float step);
+
+/* Forgets the echo path */
+void pa_fdaf_reset(pa_fdaf *f);
+
+/* Real FFT helpers, exposed for testing. n is the number of real samples
+ * and has to be a power of two, at least 4. Spectra have n/2+1 complex
+ * bins, stored as interleaved real and imaginary parts. The forward
+ * transform isn't scaled, the inverse one scales by 1/n. */
+typedef struct pa_fdaf_fft pa_fdaf_fft;
+
+pa_fdaf_fft *pa_fdaf_fft_new(unsigned n);
+void pa_fdaf_fft_free(pa_fdaf_fft *t);
+void pa_fdaf_fft_forward(pa_fdaf_fft *t, const float *in, float *out);
+void pa_fdaf_fft_inverse(pa_fdaf_fft *t, const float *in, float *out);
+
+#endif
@@ -0,0 +1,225 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/modargs.h>
+
+#include "echo-cancel.h"
+#include "fdaf-aec.h"
+
+/* Rounded down to a power of two, so 16 ms gives 512 frames at 32 kHz */
+#define DEFAULT_FRAME_SIZE_MS 16
+/* Length of the echo tail that is modelled */
+#define DEFAULT_FILTER_SIZE_MS 128
+#define DEFAULT_MU 0.5
+
+/* Double talk detection (Geigel): the near end is considered active if the
+ * microphone peak gets above this fraction of the far end peak over the
+ * filter length. Adaptation stays frozen for HANGOVER blocks after that. */
+#define DTD_THRESHOLD 0.5f
+#define DTD_HANGOVER 2
+
+/* Below -70 dBFS there is nothing to learn the echo path from */
+#define SILENCE_LEVEL 3e-4f
+
+static const char* const valid_modargs[] = {
+    "frame_size_ms",
+    "filter_size_ms",
+    "mu",
+    NULL
+};
+
+struct pa_fdaf_ec {
+    pa_fdaf *fdaf;
+    unsigned blocksize;
+
+    float *rec, *play;
+
+    /* DC removal on both inputs */
+    float rec_x1, rec_y1, play_x1, play_y1;
+
+    /* Far end block peaks over the filter length */
+    float *far_peaks;
+    unsigned n_far_peaks, far_peak_idx;
+    unsigned hangover;
+};
+
+static void pa_fdaf_ec_fixate_spec(pa_sample_spec *rec_ss, pa_channel_map *rec_map,
+                                   pa_sample_spec *play_ss, pa_channel_map *play_map,
+                                   pa_sample_spec *out_ss, pa_channel_map *out_map) {
+    out_ss->format = PA_SAMPLE_S16NE;
+    out_ss->channels = 1;
+    pa_channel_map_init_mono(out_map);
+
+    *play_ss = *out_ss;
+    *play_map = *out_map;
+    *rec_ss = *out_ss;
+    *rec_map = *out_map;
+}
+
+bool pa_fdaf_ec_init(pa_core *c, pa_echo_canceller *ec,
+                     pa_sample_spec *rec_ss, pa_channel_map *rec_map,
+                     pa_sample_spec *play_ss, pa_channel_map *play_map,
+                     pa_sample_spec *out_ss, pa_channel_map *out_map,
+                     uint32_t *nframes, const char *args) {
+    uint32_t frame_size_ms, filter_size_ms;
+    unsigned n_partitions;
+    double mu;
+    pa_fdaf_ec *e;
+    pa_modargs *ma;
+
+    if (!(ma = pa_modargs_new(args, valid_modargs))) {
+        pa_log("Failed to parse submodule arguments.");
+        goto fail;
+    }
+
+    frame_size_ms = DEFAULT_FRAME_SIZE_MS;
+    if (pa_modargs_get_value_u32(ma, "frame_size_ms", &frame_size_ms) < 0 || frame_size_ms < 1 || frame_size_ms > 200) {
+        pa_log("Invalid frame_size_ms specification");
+        goto fail;
+    }
+
+    filter_size_ms = DEFAULT_FILTER_SIZE_MS;
+    if (pa_modargs_get_value_u32(ma, "filter_size_ms", &filter_size_ms) < 0 || filter_size_ms < 1 || filter_size_ms > 2000) {
+        pa_log("Invalid filter_size_ms specification");
+        goto fail;
+    }
+
+    mu = DEFAULT_MU;
+    if (pa_modargs_get_value_double(ma, "mu", &mu) < 0 || mu <= 0 || mu >= 1) {
+        pa_log("Invalid mu specification, should be between 0 and 1");
+        goto fail;
+    }
+
+    pa_fdaf_ec_fixate_spec(rec_ss, rec_map, play_ss, play_map, out_ss, out_map);
+
+    *nframes = pa_echo_canceller_blocksize_power2(out_ss->rate, frame_size_ms);
+    if (*nframes < 2) {
+        pa_log("frame_size_ms is too small for rate %u", out_ss->rate);
+        goto fail;
+    }
+
+    n_partitions = (unsigned) (((uint64_t) out_ss->rate * filter_size_ms / 1000 + *nframes - 1) / *nframes);
+    n_partitions = PA_MAX(n_partitions, 1U);
+
+    e = pa_xnew0(pa_fdaf_ec, 1);
+    e->blocksize = *nframes;
+    e->fdaf = pa_fdaf_new(*nframes, n_partitions, (float) mu);
+    e->rec = pa_xnew(float, *nframes);
+    e->play = pa_xnew(float, *nframes);
+    e->n_far_peaks = n_partitions + 1;
+    e->far_peaks = pa_xnew0(float, e->n_far_peaks);
+
+    ec->params.priv.fdaf.ec = e;
+
+    pa_log_debug("Using nframes %u, %u partitions, mu %0.2f, rate %u", *nframes, n_partitions, mu, out_ss->rate);
+
+    pa_modargs_free(ma);
+    return true;
+
+fail:
+    if (ma)
+        pa_modargs_free(ma);
+    return false;
+}
+
+static void to_float(const int16_t *in, float *out, unsigned n, float *x1, float *y1) {
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        float x = in[i] / 32768.0f;
+
+        /* y[n] = x[n] - x[n-1] + 0.995 y[n-1] */
+        *y1 = x - *x1 + 0.995f * *y1;
+        *x1 = x;
+        out[i] = *y1;
+    }
+}
+
+static float peak(const float *buf, unsigned n) {
+    unsigned i;
+    float p = 0;
+
+    for (i = 0; i < n; i++)
+        p = PA_MAX(p, fabsf(buf[i]));
+
+    return p;
+}
+
+/* Step size for the current block: full speed while only the far end is
+ * talking, frozen during double talk and far end silence */
+static float adaptation_step(pa_fdaf_ec *e) {
+    float far_peak = 0, mic_peak;
+    unsigned i;
+
+    e->far_peaks[e->far_peak_idx] = peak(e->play, e->blocksize);
+    e->far_peak_idx = (e->far_peak_idx + 1) % e->n_far_peaks;
+
+    for (i = 0; i < e->n_far_peaks; i++)
+        far_peak = PA_MAX(far_peak, e->far_peaks[i]);
+
+    mic_peak = peak(e->rec, e->blocksize);
+
+    if (mic_peak > DTD_THRESHOLD * far_peak)
+        e->hangover = DTD_HANGOVER;
+    else if (e->hangover > 0)
+        e->hangover--;
+
+    if (e->hangover > 0 || far_peak < SILENCE_LEVEL)
+        return 0.0f;
+
+    return 1.0f;
+}
+
+void pa_fdaf_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out) {
+    pa_fdaf_ec *e = ec->params.priv.fdaf.ec;
+    unsigned i;
+
+    /* We know it's S16NE mono data */
+    to_float((const int16_t *) rec, e->rec, e->blocksize, &e->rec_x1, &e->rec_y1);
+    to_float((const int16_t *) play, e->play, e->blocksize, &e->play_x1, &e->play_y1);
+
+    pa_fdaf_process(e->fdaf, e->rec, e->play, e->rec, adaptation_step(e));
+
+    for (i = 0; i < e->blocksize; i++)
+        ((int16_t *) out)[i] = (int16_t) PA_CLAMP_UNLIKELY(lrintf(e->rec[i] * 32768.0f), -0x8000, 0x7FFF);
+}
+
+void pa_fdaf_ec_done(pa_echo_canceller *ec) {
+    pa_fdaf_ec *e = ec->params.priv.fdaf.ec;
+
+    if (!e)
+        return;
+
+    pa_fdaf_free(e->fdaf);
+    pa_xfree(e->rec);
+    pa_xfree(e->play);
+    pa_xfree(e->far_peaks);
+    pa_xfree(e);
+
+    ec->params.priv.fdaf.ec = NULL;
+}
@@ -32,6 +32,7 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <time.h>
 
 #include "echo-cancel.h"
 
@@ -50,7 +51,10 @@
 #include <pulsecore/modargs.h>
 #include <pulsecore/log.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/sconv.h>
 #include <pulsecore/ltdl-helper.h>
 
 #include "module-echo-cancel-symdef.h"
@@ -77,6 +81,7 @@ PA_MODULE_USAGE(
           "save_aec=<save AEC data in /tmp> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "dsp_thread=<run the canceller in its own thread> "
         ));
 
 /* NOTE: Make sure the enum and ec_table are maintained in the correct order */
@@ -89,6 +94,7 @@ typedef enum {
 #ifdef HAVE_ADRIAN_EC
     PA_ECHO_CANCELLER_ADRIAN,
 #endif
+    PA_ECHO_CANCELLER_FDAF,
 #ifdef HAVE_WEBRTC
     PA_ECHO_CANCELLER_WEBRTC,
 #endif
@@ -123,6 +129,12 @@ static const pa_echo_canceller ec_table[] = {
         .done                   = pa_adrian_ec_done,
     },
 #endif
+    {
+        /* Partitioned block frequency-domain adaptive filter */
+        .init                   = pa_fdaf_ec_init,
+        .run                    = pa_fdaf_ec_run,
+        .done                   = pa_fdaf_ec_done,
+    },
 #ifdef HAVE_WEBRTC
     {
         /* WebRTC's audio processing engine */
@@ -142,6 +154,10 @@ static const pa_echo_canceller ec_table[] = {
 #define DEFAULT_ADJUST_TOLERANCE (5*PA_USEC_PER_MSEC)
 #define DEFAULT_SAVE_AEC false
 #define DEFAULT_AUTOLOADED false
+#define DEFAULT_DSP_THREAD false
+
+/* Number of blocks that can be queued up for the DSP thread */
+#define DSP_QUEUE_LENGTH 32
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
@@ -162,6 +178,13 @@ static const pa_echo_canceller ec_table[] = {
  * To do this we send all played samples to the source IO thread where they
  * are then pushed into the memblockq.
  *
+ * With dsp_thread=true, the source IO thread only does the alignment. The
+ * aligned blocks are queued up for a separate thread that runs the canceller
+ * (and writes the save_aec files), which then sends the canceled blocks back
+ * to the source IO thread to be posted. This keeps a slow canceller from
+ * holding up the other streams of the source master, at the cost of some
+ * latency.
+ *
  * Alignment is performed in two steps:
  *
  * 1) when something happens that requires quick adjustment of the alignment of
@@ -202,6 +225,15 @@ struct snapshot {
     size_t plen;
 };
 
+/* A block of work for the DSP thread. The memblocks are owned by the job
+ * until the DSP thread is done with it. */
+struct dsp_job {
+    pa_memchunk rec, play;
+    float drift;
+    /* The capture volume at the time the job was queued, for the AGC */
+    pa_cvolume volume;
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -252,8 +284,32 @@ struct userdata {
 
     bool use_volume_sharing;
 
+    /* The DSP thread, reading jobs from dsp_inq and sending canceled blocks
+     * back through dsp_outq */
+    bool use_dsp_thread;
+    pa_thread *dsp_thread;
+    pa_thread_mq dsp_thread_mq;
+    pa_rtpoll *dsp_rtpoll;
+    pa_echo_canceller_msg *dsp_msg;
+    pa_asyncmsgq *dsp_inq, *dsp_outq;
+    pa_rtpoll_item *rtpoll_item_dsp;
+
+    /* Ring of jobs, written in the source IO thread in the order the DSP
+     * thread handles them */
+    struct dsp_job dsp_jobs[DSP_QUEUE_LENGTH];
+    unsigned dsp_job_next;
+    pa_atomic_t dsp_jobs_pending;
+
+    /* DSP thread only: the volume of the job being run */
+    pa_cvolume dsp_volume;
+
     struct {
         pa_cvolume current_volume;
+
+        /* Captured blocks that went to the DSP thread and didn't come back
+         * yet */
+        unsigned dsp_blocks_in_flight;
+        bool dsp_overloaded;
     } thread_info;
 };
 
@@ -277,6 +333,7 @@ static const char* const valid_modargs[] = {
     "save_aec",
     "autoloaded",
     "use_volume_sharing",
+    "dsp_thread",
     NULL
 };
 
@@ -284,7 +341,8 @@ enum {
     SOURCE_OUTPUT_MESSAGE_POST = PA_SOURCE_OUTPUT_MESSAGE_MAX,
     SOURCE_OUTPUT_MESSAGE_REWIND,
     SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT,
-    SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME
+    SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME,
+    SOURCE_OUTPUT_MESSAGE_DSP_POST
 };
 
 enum {
@@ -295,6 +353,13 @@ enum {
     ECHO_CANCELLER_MESSAGE_SET_VOLUME,
 };
 
+enum {
+    DSP_MESSAGE_RUN,
+    DSP_MESSAGE_PLAY,
+    DSP_MESSAGE_RECORD,
+    DSP_MESSAGE_SET_DRIFT
+};
+
 static int64_t calc_diff(struct userdata *u, struct snapshot *snapshot) {
     int64_t diff_time, buffer_latency;
     pa_usec_t plen, rlen, source_delay, sink_delay, recv_counter, send_counter;
@@ -419,7 +484,10 @@ static int source_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t
                 /* Add the latency internal to our source output on top */
                 pa_bytes_to_usec(pa_memblockq_get_length(u->source_output->thread_info.delay_memblockq), &u->source_output->source->sample_spec) +
                 /* and the buffering we do on the source */
-                pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec);
+                pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec) +
+                /* and the blocks that are with the DSP thread */
+                pa_bytes_to_usec((uint64_t) u->thread_info.dsp_blocks_in_flight * u->source_output_blocksize,
+                                 &u->source_output->source->sample_spec);
 
             return 0;
 
@@ -707,6 +775,70 @@ static void do_resync(struct userdata *u) {
     apply_diff_time(u, diff_time);
 }
 
+/* Hands a job to the DSP thread, which takes over the references of rchunk
+ * and pchunk. Either of them may be NULL. Returns false, and drops the
+ * chunks, if the DSP thread is too far behind to take another job.
+ *
+ * Called from source I/O thread context. */
+static bool dsp_submit(struct userdata *u, int code, pa_memchunk *rchunk, pa_memchunk *pchunk, float drift) {
+    struct dsp_job *job;
+
+    if (pa_atomic_load(&u->dsp_jobs_pending) >= DSP_QUEUE_LENGTH) {
+        if (!u->thread_info.dsp_overloaded)
+            pa_log_warn("DSP thread is falling behind, dropping blocks");
+
+        u->thread_info.dsp_overloaded = true;
+
+        if (rchunk)
+            pa_memblock_unref(rchunk->memblock);
+        if (pchunk)
+            pa_memblock_unref(pchunk->memblock);
+
+        return false;
+    }
+
+    u->thread_info.dsp_overloaded = false;
+
+    job = &u->dsp_jobs[u->dsp_job_next];
+    u->dsp_job_next = (u->dsp_job_next + 1) % DSP_QUEUE_LENGTH;
+
+    if (rchunk)
+        job->rec = *rchunk;
+    else
+        pa_memchunk_reset(&job->rec);
+
+    if (pchunk)
+        job->play = *pchunk;
+    else
+        pa_memchunk_reset(&job->play);
+
+    job->drift = drift;
+    job->volume = u->thread_info.current_volume;
+
+    if (rchunk)
+        u->thread_info.dsp_blocks_in_flight++;
+
+    pa_atomic_inc(&u->dsp_jobs_pending);
+    pa_asyncmsgq_post(u->dsp_inq, PA_MSGOBJECT(u->dsp_msg), code, job, 0, NULL, NULL);
+
+    return true;
+}
+
+/* Stands in for a captured block the DSP thread could not take.
+ *
+ * Called from source I/O thread context. */
+static void post_silence(struct userdata *u) {
+    pa_memchunk silence;
+
+    silence.index = 0;
+    silence.length = u->source_blocksize;
+    silence.memblock = pa_memblock_new(u->source->core->mempool, silence.length);
+    pa_silence_memblock(silence.memblock, &u->source->sample_spec);
+
+    pa_source_post(u->source, &silence);
+    pa_memblock_unref(silence.memblock);
+}
+
 /* 1. Calculate drift at this point, pass to canceller
  * 2. Push out playback samples in blocksize chunks
  * 3. Push out capture samples in blocksize chunks
@@ -739,6 +871,27 @@ static void do_push_drift_comp(struct userdata *u) {
     u->sink_rem = plen % u->sink_blocksize;
     u->source_rem = rlen % u->source_output_blocksize;
 
+    if (u->use_dsp_thread) {
+        dsp_submit(u, DSP_MESSAGE_SET_DRIFT, NULL, NULL, drift);
+
+        while (plen >= u->sink_blocksize) {
+            pa_memblockq_peek_fixed_size(u->sink_memblockq, u->sink_blocksize, &pchunk);
+            pa_memblockq_drop(u->sink_memblockq, u->sink_blocksize);
+            dsp_submit(u, DSP_MESSAGE_PLAY, NULL, &pchunk, 0);
+            plen -= u->sink_blocksize;
+        }
+
+        while (rlen >= u->source_output_blocksize) {
+            pa_memblockq_peek_fixed_size(u->source_memblockq, u->source_output_blocksize, &rchunk);
+            pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
+            if (!dsp_submit(u, DSP_MESSAGE_RECORD, &rchunk, NULL, 0))
+                post_silence(u);
+            rlen -= u->source_output_blocksize;
+        }
+
+        return;
+    }
+
     /* Now let the canceller work its drift compensation magic */
     u->ec->set_drift(u->ec, drift);
 
@@ -829,53 +982,186 @@ static void do_push(struct userdata *u) {
         if (plen < u->sink_blocksize)
             pa_memblockq_seek(u->sink_memblockq, u->sink_blocksize - plen, PA_SEEK_RELATIVE, true);
 
-        rdata = pa_memblock_acquire(rchunk.memblock);
-        rdata += rchunk.index;
-        pdata = pa_memblock_acquire(pchunk.memblock);
-        pdata += pchunk.index;
+        if (u->use_dsp_thread) {
+            if (!dsp_submit(u, DSP_MESSAGE_RUN, &rchunk, &pchunk, 0))
+                post_silence(u);
+        } else {
+            rdata = pa_memblock_acquire(rchunk.memblock);
+            rdata += rchunk.index;
+            pdata = pa_memblock_acquire(pchunk.memblock);
+            pdata += pchunk.index;
+
+            cchunk.index = 0;
+            cchunk.length = u->source_blocksize;
+            cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
+            cdata = pa_memblock_acquire(cchunk.memblock);
+
+            if (u->save_aec) {
+                if (u->captured_file)
+                    unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
+                if (u->played_file)
+                    unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
+            }
 
-        cchunk.index = 0;
-        cchunk.length = u->source_blocksize;
-        cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
-        cdata = pa_memblock_acquire(cchunk.memblock);
+            /* perform echo cancellation */
+            u->ec->run(u->ec, rdata, pdata, cdata);
 
-        if (u->save_aec) {
-            if (u->captured_file)
-                unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
-            if (u->played_file)
-                unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
-        }
+            if (u->save_aec) {
+                if (u->canceled_file)
+                    unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
+            }
 
-        /* perform echo cancellation */
-        u->ec->run(u->ec, rdata, pdata, cdata);
+            pa_memblock_release(cchunk.memblock);
+            pa_memblock_release(pchunk.memblock);
+            pa_memblock_release(rchunk.memblock);
 
-        if (u->save_aec) {
-            if (u->canceled_file)
-                unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
-        }
+            pa_memblock_unref(rchunk.memblock);
+            pa_memblock_unref(pchunk.memblock);
 
-        pa_memblock_release(cchunk.memblock);
-        pa_memblock_release(pchunk.memblock);
-        pa_memblock_release(rchunk.memblock);
+            /* forward the (echo-canceled) data to the virtual source */
+            pa_source_post(u->source, &cchunk);
+            pa_memblock_unref(cchunk.memblock);
+        }
 
         /* drop consumed source samples */
         pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
-        pa_memblock_unref(rchunk.memblock);
         rlen -= u->source_output_blocksize;
 
         /* drop consumed sink samples */
         pa_memblockq_drop(u->sink_memblockq, u->sink_blocksize);
-        pa_memblock_unref(pchunk.memblock);
 
         if (plen >= u->sink_blocksize)
             plen -= u->sink_blocksize;
         else
             plen = 0;
+    }
+}
 
-        /* forward the (echo-canceled) data to the virtual source */
-        pa_source_post(u->source, &cchunk);
+/* Runs one job, posts the canceled block back to the source I/O thread and
+ * writes the save_aec files.
+ *
+ * Called from DSP thread context. */
+static int dsp_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    struct userdata *u = PA_ECHO_CANCELLER_MSG(o)->userdata;
+    struct dsp_job *job = data;
+    pa_memchunk cchunk;
+    uint8_t *rdata = NULL, *pdata = NULL, *cdata = NULL;
+    int unused PA_GCC_UNUSED;
+
+    pa_memchunk_reset(&cchunk);
+
+    u->dsp_volume = job->volume;
+
+    if (job->rec.memblock) {
+        rdata = (uint8_t *) pa_memblock_acquire(job->rec.memblock) + job->rec.index;
+
+        cchunk.index = 0;
+        cchunk.length = code == DSP_MESSAGE_RUN ? u->source_blocksize : u->source_output_blocksize;
+        cchunk.memblock = pa_memblock_new(u->core->mempool, cchunk.length);
+        cdata = pa_memblock_acquire(cchunk.memblock);
+    }
+
+    if (job->play.memblock)
+        pdata = (uint8_t *) pa_memblock_acquire(job->play.memblock) + job->play.index;
+
+    switch (code) {
+        case DSP_MESSAGE_RUN:
+            u->ec->run(u->ec, rdata, pdata, cdata);
+            break;
+
+        case DSP_MESSAGE_PLAY:
+            u->ec->play(u->ec, pdata);
+            break;
+
+        case DSP_MESSAGE_RECORD:
+            u->ec->record(u->ec, rdata, cdata);
+            break;
+
+        case DSP_MESSAGE_SET_DRIFT:
+            u->ec->set_drift(u->ec, job->drift);
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+
+    if (cchunk.memblock) {
+        pa_memblock_release(cchunk.memblock);
+        pa_asyncmsgq_post(u->dsp_outq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_DSP_POST, NULL, 0, &cchunk, NULL);
+    }
+
+    /* The block is on its way, now there's time for the files */
+    if (u->save_aec) {
+        if (u->drift_file) {
+            if (code == DSP_MESSAGE_SET_DRIFT)
+                fprintf(u->drift_file, "d %a\n", job->drift);
+            else if (code == DSP_MESSAGE_PLAY)
+                fprintf(u->drift_file, "p %d\n", u->sink_blocksize);
+            else if (code == DSP_MESSAGE_RECORD)
+                fprintf(u->drift_file, "c %d\n", u->source_output_blocksize);
+        }
+
+        if (rdata && u->captured_file)
+            unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
+        if (pdata && u->played_file)
+            unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
+        if (cdata && u->canceled_file) {
+            cdata = pa_memblock_acquire(cchunk.memblock);
+            unused = fwrite(cdata, 1, cchunk.length, u->canceled_file);
+            pa_memblock_release(cchunk.memblock);
+        }
+    }
+
+    if (cchunk.memblock)
         pa_memblock_unref(cchunk.memblock);
+
+    if (job->rec.memblock) {
+        pa_memblock_release(job->rec.memblock);
+        pa_memblock_unref(job->rec.memblock);
+        pa_memchunk_reset(&job->rec);
+    }
+
+    if (job->play.memblock) {
+        pa_memblock_release(job->play.memblock);
+        pa_memblock_unref(job->play.memblock);
+        pa_memchunk_reset(&job->play);
+    }
+
+    pa_atomic_dec(&u->dsp_jobs_pending);
+
+    return 0;
+}
+
+static void dsp_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+
+    pa_log_debug("DSP thread starting up");
+
+    if (u->core->realtime_scheduling)
+        pa_make_realtime(u->core->realtime_priority);
+
+    pa_thread_mq_install(&u->dsp_thread_mq);
+
+    for (;;) {
+        int ret;
+
+        if ((ret = pa_rtpoll_run(u->dsp_rtpoll, true)) < 0)
+            goto fail;
+
+        if (ret == 0)
+            goto finish;
     }
+
+fail:
+    /* If this was no regular exit from the loop we have to continue
+     * processing messages until we received PA_MESSAGE_SHUTDOWN */
+    pa_asyncmsgq_post(u->dsp_thread_mq.outq, PA_MSGOBJECT(u->core), PA_CORE_MESSAGE_UNLOAD_MODULE, u->module, 0, NULL, NULL);
+    pa_asyncmsgq_wait_for(u->dsp_thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+
+finish:
+    pa_log_debug("DSP thread shutting down");
 }
 
 /* Called from source I/O thread context. */
@@ -1090,6 +1376,17 @@ static int source_output_process_msg_cb(pa_msgobject *obj, int code, void *data,
             apply_diff_time(u, offset);
             return 0;
 
+        case SOURCE_OUTPUT_MESSAGE_DSP_POST:
+            pa_source_output_assert_io_context(u->source_output);
+
+            pa_assert(u->thread_info.dsp_blocks_in_flight > 0);
+            u->thread_info.dsp_blocks_in_flight--;
+
+            if (PA_SOURCE_IS_OPENED(u->source->thread_info.state))
+                pa_source_post(u->source, chunk);
+
+            return 0;
+
     }
 
     return pa_source_output_process_msg(obj, code, data, offset, chunk);
@@ -1265,6 +1562,12 @@ static void source_output_attach_cb(pa_source_output *o) {
             o->source->thread_info.rtpoll,
             PA_RTPOLL_LATE,
             u->asyncmsgq);
+
+    if (u->use_dsp_thread)
+        u->rtpoll_item_dsp = pa_rtpoll_item_new_asyncmsgq_read(
+                o->source->thread_info.rtpoll,
+                PA_RTPOLL_LATE,
+                u->dsp_outq);
 }
 
 /* Called from sink I/O thread context. */
@@ -1317,6 +1620,11 @@ static void source_output_detach_cb(pa_source_output *o) {
         pa_rtpoll_item_free(u->rtpoll_item_read);
         u->rtpoll_item_read = NULL;
     }
+
+    if (u->rtpoll_item_dsp) {
+        pa_rtpoll_item_free(u->rtpoll_item_dsp);
+        u->rtpoll_item_dsp = NULL;
+    }
 }
 
 /* Called from sink I/O thread context. */
@@ -1554,14 +1862,22 @@ static int canceller_process_msg_cb(pa_msgobject *o, int code, void *userdata, i
     return 0;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* The capture volume as seen by the thread running the canceller */
+static const pa_cvolume *capture_volume(struct userdata *u) {
+    return u->use_dsp_thread ? &u->dsp_volume : &u->thread_info.current_volume;
+}
+
+/* Called by the canceller, so source I/O thread context, or DSP thread
+ * context with dsp_thread=true. */
 void pa_echo_canceller_get_capture_volume(pa_echo_canceller *ec, pa_cvolume *v) {
-    *v = ec->msg->userdata->thread_info.current_volume;
+    *v = *capture_volume(ec->msg->userdata);
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread context, or DSP thread
+ * context with dsp_thread=true. The new volume goes to the main thread
+ * through the outq of the calling thread. */
 void pa_echo_canceller_set_capture_volume(pa_echo_canceller *ec, pa_cvolume *v) {
-    if (!pa_cvolume_equal(&ec->msg->userdata->thread_info.current_volume, v)) {
+    if (!pa_cvolume_equal(capture_volume(ec->msg->userdata), v)) {
         pa_cvolume *vol = pa_xnewdup(pa_cvolume, v, 1);
 
         pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, vol, 0, NULL,
@@ -1595,6 +1911,8 @@ static pa_echo_canceller_method_t get_ec_method_from_string(const char *method)
     if (pa_streq(method, "adrian"))
         return PA_ECHO_CANCELLER_ADRIAN;
 #endif
+    if (pa_streq(method, "fdaf"))
+        return PA_ECHO_CANCELLER_FDAF;
 #ifdef HAVE_WEBRTC
     if (pa_streq(method, "webrtc"))
         return PA_ECHO_CANCELLER_WEBRTC;
@@ -1740,6 +2058,12 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    u->use_dsp_thread = DEFAULT_DSP_THREAD;
+    if (pa_modargs_get_value_boolean(ma, "dsp_thread", &u->use_dsp_thread) < 0) {
+        pa_log("Failed to parse dsp_thread value");
+        goto fail;
+    }
+
     if (init_common(ma, u, &source_ss, &source_map) < 0)
         goto fail;
 
@@ -1991,6 +2315,26 @@ int pa__init(pa_module*m) {
     u->ec->msg->userdata = u;
 
     u->thread_info.current_volume = u->source->reference_volume;
+    u->dsp_volume = u->source->reference_volume;
+
+    if (u->use_dsp_thread) {
+        u->dsp_msg = pa_msgobject_new(pa_echo_canceller_msg);
+        u->dsp_msg->parent.process_msg = dsp_process_msg_cb;
+        u->dsp_msg->userdata = u;
+
+        u->dsp_inq = pa_asyncmsgq_new(0);
+        u->dsp_outq = pa_asyncmsgq_new(0);
+
+        u->dsp_rtpoll = pa_rtpoll_new();
+        pa_thread_mq_init(&u->dsp_thread_mq, m->core->mainloop, u->dsp_rtpoll);
+        pa_rtpoll_item_new_asyncmsgq_read(u->dsp_rtpoll, PA_RTPOLL_EARLY, u->dsp_inq);
+        pa_rtpoll_item_new_asyncmsgq_write(u->dsp_rtpoll, PA_RTPOLL_LATE, u->dsp_outq);
+
+        if (!(u->dsp_thread = pa_thread_new("echo-cancel-dsp", dsp_thread_func, u))) {
+            pa_log("Failed to create DSP thread.");
+            goto fail;
+        }
+    }
 
     pa_sink_put(u->sink);
     pa_source_put(u->source);
@@ -2047,6 +2391,23 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unlink(u->sink);
 
+    /* Nothing feeds the DSP thread anymore, and it must be gone before the
+     * source output it posts to */
+    if (u->dsp_thread) {
+        unsigned i;
+
+        pa_asyncmsgq_send(u->dsp_thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+        pa_thread_free(u->dsp_thread);
+
+        /* Jobs the thread didn't get to anymore */
+        for (i = 0; i < DSP_QUEUE_LENGTH; i++) {
+            if (u->dsp_jobs[i].rec.memblock)
+                pa_memblock_unref(u->dsp_jobs[i].rec.memblock);
+            if (u->dsp_jobs[i].play.memblock)
+                pa_memblock_unref(u->dsp_jobs[i].play.memblock);
+        }
+    }
+
     if (u->source_output)
         pa_source_output_unref(u->source_output);
     if (u->sink_input)
@@ -2062,6 +2423,18 @@ void pa__done(pa_module*m) {
     if (u->sink_memblockq)
         pa_memblockq_free(u->sink_memblockq);
 
+    if (u->dsp_rtpoll) {
+        pa_thread_mq_done(&u->dsp_thread_mq);
+        pa_rtpoll_free(u->dsp_rtpoll);
+    }
+
+    if (u->dsp_inq)
+        pa_asyncmsgq_unref(u->dsp_inq);
+    if (u->dsp_outq)
+        pa_asyncmsgq_unref(u->dsp_outq);
+    if (u->dsp_msg)
+        pa_echo_canceller_msg_unref(u->dsp_msg);
+
     if (u->ec) {
         if (u->ec->done)
             u->ec->done(u->ec);
@@ -2087,8 +2460,135 @@ void pa__done(pa_module*m) {
 }
 
 #ifdef ECHO_CANCEL_TEST
+/* Far end blocks above this mean square (-50 dBFS) count as active */
+#define FAR_ACTIVE_POWER 1e-5
+
+/* Statistics to compare cancellers on the same files.
+ *
+ * Speed is given as real-time factor, the time spent in the canceller
+ * divided by the duration of the audio, and as the distribution of the time
+ * each capture block took. A block that takes longer than the audio it
+ * contains would have caused an overrun on a live system.
+ *
+ * Quality is given as echo return loss enhancement, i.e. how much weaker the
+ * output is than the captured signal. ERLE is only meaningful over stretches
+ * where the captured signal is mostly echo, so it's also reported separately
+ * for blocks in which the far end is active. */
+struct test_stats {
+    clock_t cpu;
+    pa_usec_t wall;
+    uint64_t frames;
+    double rec_energy, out_energy;
+    double rec_energy_far, out_energy_far;
+    float *buf;
+
+    pa_usec_t *block_usec;
+    unsigned n_blocks, max_blocks, n_overruns;
+};
+
+static double block_energy(struct test_stats *s, const pa_sample_spec *ss, const uint8_t *data, size_t length) {
+    unsigned i, n = length / pa_sample_size(ss);
+    double e = 0;
+
+    s->buf = pa_xrealloc(s->buf, n * sizeof(float));
+    pa_get_convert_to_float32ne_function(ss->format)(n, data, s->buf);
+
+    for (i = 0; i < n; i++)
+        e += s->buf[i] * s->buf[i];
+
+    return e;
+}
+
+/* Adds the time since start_cpu and start_wall. Time spent in play() is only
+ * accounted to the totals, the per block figures are about the capture
+ * path. */
+static pa_usec_t account_time(struct test_stats *s, clock_t start_cpu, pa_usec_t start_wall) {
+    pa_usec_t elapsed = pa_rtclock_now() - start_wall;
+
+    s->cpu += clock() - start_cpu;
+    s->wall += elapsed;
+
+    return elapsed;
+}
+
+static void account_block(struct test_stats *s, pa_usec_t elapsed,
+                          const pa_sample_spec *rec_ss, const uint8_t *rec, size_t rec_length,
+                          const pa_sample_spec *play_ss, const uint8_t *play, size_t play_length,
+                          const pa_sample_spec *out_ss, const uint8_t *out, size_t out_length) {
+    double r, o;
+
+    if (s->n_blocks >= s->max_blocks) {
+        s->max_blocks = PA_MAX(s->max_blocks * 2, 1024U);
+        s->block_usec = pa_xrenew(pa_usec_t, s->block_usec, s->max_blocks);
+    }
+
+    s->block_usec[s->n_blocks++] = elapsed;
+
+    if (elapsed > pa_bytes_to_usec(out_length, out_ss))
+        s->n_overruns++;
+
+    r = block_energy(s, rec_ss, rec, rec_length);
+    o = block_energy(s, out_ss, out, out_length);
+
+    s->frames += out_length / pa_frame_size(out_ss);
+    s->rec_energy += r;
+    s->out_energy += o;
+
+    if (play && block_energy(s, play_ss, play, play_length) / (play_length / pa_sample_size(play_ss)) > FAR_ACTIVE_POWER) {
+        s->rec_energy_far += r;
+        s->out_energy_far += o;
+    }
+}
+
+static double erle_db(double rec, double out) {
+    return 10 * log10((rec + 1e-12) / (out + 1e-12));
+}
+
+static int usec_compare(const void *a, const void *b) {
+    pa_usec_t x = *(const pa_usec_t *) a, y = *(const pa_usec_t *) b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static pa_usec_t percentile(struct test_stats *s, unsigned p) {
+    return s->block_usec[(uint64_t) (s->n_blocks - 1) * p / 100];
+}
+
+static void print_stats(struct test_stats *s, const pa_sample_spec *ss) {
+    double duration = (double) s->frames / ss->rate;
+
+    if (s->n_blocks == 0) {
+        pa_log_info("No blocks were processed");
+        return;
+    }
+
+    pa_log_info("Processed %0.2f s of audio in %u blocks, %0.3f s of CPU time",
+                duration, s->n_blocks, (double) s->cpu / CLOCKS_PER_SEC);
+    pa_log_info("Real-time factor: %0.4f", (double) s->wall / PA_USEC_PER_SEC / duration);
+
+    qsort(s->block_usec, s->n_blocks, sizeof(pa_usec_t), usec_compare);
+
+    pa_log_info("Block time (usec): min %llu, median %llu, 95%% %llu, 99%% %llu, max %llu, %u overruns",
+                (unsigned long long) s->block_usec[0],
+                (unsigned long long) percentile(s, 50),
+                (unsigned long long) percentile(s, 95),
+                (unsigned long long) percentile(s, 99),
+                (unsigned long long) s->block_usec[s->n_blocks - 1],
+                s->n_overruns);
+
+    pa_log_info("ERLE: %0.1f dB overall, %0.1f dB while the far end is active",
+                erle_db(s->rec_energy, s->out_energy), erle_db(s->rec_energy_far, s->out_energy_far));
+}
+
 /*
- * Stand-alone test program for running in the canceller on pre-recorded files.
+ * Stand-alone test program for running in the canceller on pre-recorded files,
+ * e.g. the ones written with save_aec=true.
+ *
+ * Cancellers that do their own drift compensation are fed with play() and
+ * record() calls, either as logged in the drift file or, with -d, in a
+ * schedule that simulates a constant drift between the two clocks. The block
+ * size is whatever the canceller picks, and can usually be configured with
+ * frame_size_ms in aec_args.
  */
 int main(int argc, char* argv[]) {
     struct userdata u;
@@ -2097,15 +2597,40 @@ int main(int argc, char* argv[]) {
     pa_modargs *ma = NULL;
     uint8_t *rdata = NULL, *pdata = NULL, *cdata = NULL;
     int unused PA_GCC_UNUSED;
-    int ret = 0, i;
+    int ret = 0, i, opt;
     char c;
     float drift;
     uint32_t nframes;
+    struct test_stats stats;
+    clock_t start_cpu;
+    pa_usec_t start_wall, elapsed;
+    bool simulate_drift = false;
+    double sim_drift = 0, play_credit = 0;
+    const char *program = argv[0];
 
     if (!getenv("MAKE_CHECK"))
         pa_log_set_level(PA_LOG_DEBUG);
 
     pa_memzero(&u, sizeof(u));
+    pa_memzero(&stats, sizeof(stats));
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+            case 'd':
+                if (pa_atod(optarg, &sim_drift) < 0 || sim_drift <= -1 || sim_drift >= 1) {
+                    pa_log("Invalid drift '%s', expected a ratio like 0.0001", optarg);
+                    goto fail;
+                }
+                simulate_drift = true;
+                break;
+
+            default:
+                goto usage;
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
 
     if (argc < 4 || argc > 7) {
         goto usage;
@@ -2161,7 +2686,14 @@ int main(int argc, char* argv[]) {
     u.source_blocksize = nframes * pa_frame_size(&source_ss);
     u.sink_blocksize = nframes * pa_frame_size(&sink_ss);
 
-    if (u.ec->params.drift_compensation) {
+    pa_log_info("Canceller block size: %u frames (%0.1f ms)", nframes, (double) nframes * 1000 / source_ss.rate);
+
+    if (simulate_drift && !u.ec->params.drift_compensation) {
+        pa_log("Canceller does not compensate drift, can't simulate it");
+        goto fail;
+    }
+
+    if (u.ec->params.drift_compensation && !simulate_drift) {
         if (argc < 6) {
             pa_log("Drift compensation enabled but drift file not specified");
             goto fail;
@@ -2186,7 +2718,40 @@ int main(int argc, char* argv[]) {
                 goto fail;
             }
 
+            start_cpu = clock();
+            start_wall = pa_rtclock_now();
             u.ec->run(u.ec, rdata, pdata, cdata);
+            elapsed = account_time(&stats, start_cpu, start_wall);
+
+            account_block(&stats, elapsed, &source_output_ss, rdata, u.source_output_blocksize,
+                          &sink_ss, pdata, u.sink_blocksize, &source_ss, cdata, u.source_blocksize);
+
+            unused = fwrite(cdata, u.source_blocksize, 1, u.canceled_file);
+        }
+    } else if (simulate_drift) {
+        /* The playback clock runs (1 + drift) times as fast as the capture
+         * clock, so that many play blocks go in per captured block */
+        while (fread(rdata, u.source_output_blocksize, 1, u.captured_file) > 0) {
+            for (play_credit += 1 + sim_drift; play_credit >= 1; play_credit -= 1) {
+                if (fread(pdata, u.sink_blocksize, 1, u.played_file) == 0) {
+                    perror("Played file ended before captured file");
+                    goto fail;
+                }
+
+                start_cpu = clock();
+                start_wall = pa_rtclock_now();
+                u.ec->play(u.ec, pdata);
+                account_time(&stats, start_cpu, start_wall);
+            }
+
+            start_cpu = clock();
+            start_wall = pa_rtclock_now();
+            u.ec->set_drift(u.ec, (float) sim_drift);
+            u.ec->record(u.ec, rdata, cdata);
+            elapsed = account_time(&stats, start_cpu, start_wall);
+
+            account_block(&stats, elapsed, &source_output_ss, rdata, u.source_output_blocksize,
+                          &sink_ss, pdata, u.sink_blocksize, &source_ss, cdata, u.source_blocksize);
 
             unused = fwrite(cdata, u.source_blocksize, 1, u.canceled_file);
         }
@@ -2214,7 +2779,13 @@ int main(int argc, char* argv[]) {
                         goto fail;
                     }
 
+                    start_cpu = clock();
+                    start_wall = pa_rtclock_now();
                     u.ec->record(u.ec, rdata, cdata);
+                    elapsed = account_time(&stats, start_cpu, start_wall);
+
+                    account_block(&stats, elapsed, &source_output_ss, rdata, i,
+                                  &sink_ss, NULL, 0, &source_ss, cdata, i);
 
                     unused = fwrite(cdata, i, 1, u.canceled_file);
 
@@ -2231,7 +2802,10 @@ int main(int argc, char* argv[]) {
                         goto fail;
                     }
 
+                    start_cpu = clock();
+                    start_wall = pa_rtclock_now();
                     u.ec->play(u.ec, pdata);
+                    account_time(&stats, start_cpu, start_wall);
 
                     break;
             }
@@ -2245,6 +2819,8 @@ int main(int argc, char* argv[]) {
 
     u.ec->done(u.ec);
 
+    print_stats(&stats, &source_ss);
+
 out:
     if (u.captured_file)
         fclose(u.captured_file);
@@ -2258,6 +2834,8 @@ out:
     pa_xfree(rdata);
     pa_xfree(pdata);
     pa_xfree(cdata);
+    pa_xfree(stats.buf);
+    pa_xfree(stats.block_usec);
 
     pa_xfree(u.ec);
     pa_xfree(u.core);
@@ -2268,7 +2846,7 @@ out:
     return ret;
 
 usage:
-    pa_log("Usage: %s play_file rec_file out_file [module args] [drift_file]", argv[0]);
+    pa_log("Usage: %s [-d drift] play_file rec_file out_file [module args] [drift_file]", program);
 
 fail:
     ret = -1;
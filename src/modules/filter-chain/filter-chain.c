@@ -0,0 +1,537 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "filter-chain.h"
+
+#define MAX_STAGES 32
+
+struct stage {
+    const pa_filter_stage_type *type;
+    void *state;
+};
+
+struct pa_filter_chain {
+    pa_sample_spec sample_spec;
+    struct stage stages[MAX_STAGES];
+    unsigned n_stages;
+};
+
+/* gain: multiplies all channels with a constant factor */
+
+struct gain {
+    unsigned channels;
+    float factor;
+};
+
+static const char* const gain_args[] = {
+    "db",
+    NULL
+};
+
+static void *gain_init(pa_modargs *ma, const pa_sample_spec *ss) {
+    struct gain *g;
+    double db = 0;
+
+    if (pa_modargs_get_value_double(ma, "db", &db) < 0) {
+        pa_log("gain: db= expects a number");
+        return NULL;
+    }
+
+    g = pa_xnew0(struct gain, 1);
+    g->channels = ss->channels;
+    g->factor = (float) pow(10.0, db / 20.0);
+
+    return g;
+}
+
+static void gain_process(void *state, float *buf, unsigned n) {
+    struct gain *g = state;
+    unsigned i;
+
+    for (i = 0; i < n * g->channels; i++)
+        buf[i] *= g->factor;
+}
+
+/* biquad: a second order IIR filter, coefficients as in the Audio EQ
+ * Cookbook by Robert Bristow-Johnson */
+
+struct biquad {
+    unsigned channels;
+    float b0, b1, b2, a1, a2;
+    float *z; /* Two state variables per channel */
+};
+
+static const char* const biquad_args[] = {
+    "type",
+    "freq",
+    "q",
+    "gain",
+    NULL
+};
+
+static void *biquad_init(pa_modargs *ma, const pa_sample_spec *ss) {
+    struct biquad *b;
+    const char *type;
+    double freq = 1000, q = M_SQRT1_2, gain = 0;
+    double w0, cw, alpha, A, sA, b0, b1, b2, a0, a1, a2;
+
+    type = pa_modargs_get_value(ma, "type", "peaking");
+
+    if (pa_modargs_get_value_double(ma, "freq", &freq) < 0 || freq <= 0 || freq >= ss->rate / 2.0) {
+        pa_log("biquad: freq= expects a frequency between 0 and %u Hz", ss->rate / 2);
+        return NULL;
+    }
+
+    if (pa_modargs_get_value_double(ma, "q", &q) < 0 || q <= 0) {
+        pa_log("biquad: q= expects a positive number");
+        return NULL;
+    }
+
+    if (pa_modargs_get_value_double(ma, "gain", &gain) < 0) {
+        pa_log("biquad: gain= expects a number");
+        return NULL;
+    }
+
+    w0 = 2 * M_PI * freq / ss->rate;
+    cw = cos(w0);
+    alpha = sin(w0) / (2 * q);
+    A = pow(10.0, gain / 40.0);
+    sA = 2 * sqrt(A) * alpha;
+
+    if (pa_streq(type, "lowpass")) {
+        b0 = b2 = (1 - cw) / 2;
+        b1 = 1 - cw;
+        a0 = 1 + alpha;
+        a1 = -2 * cw;
+        a2 = 1 - alpha;
+    } else if (pa_streq(type, "highpass")) {
+        b0 = b2 = (1 + cw) / 2;
+        b1 = -(1 + cw);
+        a0 = 1 + alpha;
+        a1 = -2 * cw;
+        a2 = 1 - alpha;
+    } else if (pa_streq(type, "bandpass")) {
+        b0 = alpha;
+        b1 = 0;
+        b2 = -alpha;
+        a0 = 1 + alpha;
+        a1 = -2 * cw;
+        a2 = 1 - alpha;
+    } else if (pa_streq(type, "notch")) {
+        b0 = b2 = 1;
+        b1 = -2 * cw;
+        a0 = 1 + alpha;
+        a1 = -2 * cw;
+        a2 = 1 - alpha;
+    } else if (pa_streq(type, "peaking")) {
+        b0 = 1 + alpha * A;
+        b1 = -2 * cw;
+        b2 = 1 - alpha * A;
+        a0 = 1 + alpha / A;
+        a1 = -2 * cw;
+        a2 = 1 - alpha / A;
+    } else if (pa_streq(type, "lowshelf")) {
+        b0 = A * ((A + 1) - (A - 1) * cw + sA);
+        b1 = 2 * A * ((A - 1) - (A + 1) * cw);
+        b2 = A * ((A + 1) - (A - 1) * cw - sA);
+        a0 = (A + 1) + (A - 1) * cw + sA;
+        a1 = -2 * ((A - 1) + (A + 1) * cw);
+        a2 = (A + 1) + (A - 1) * cw - sA;
+    } else if (pa_streq(type, "highshelf")) {
+        b0 = A * ((A + 1) + (A - 1) * cw + sA);
+        b1 = -2 * A * ((A - 1) + (A + 1) * cw);
+        b2 = A * ((A + 1) + (A - 1) * cw - sA);
+        a0 = (A + 1) - (A - 1) * cw + sA;
+        a1 = 2 * ((A - 1) - (A + 1) * cw);
+        a2 = (A + 1) - (A - 1) * cw - sA;
+    } else {
+        pa_log("biquad: unknown filter type '%s'", type);
+        return NULL;
+    }
+
+    b = pa_xnew0(struct biquad, 1);
+    b->channels = ss->channels;
+    b->b0 = (float) (b0 / a0);
+    b->b1 = (float) (b1 / a0);
+    b->b2 = (float) (b2 / a0);
+    b->a1 = (float) (a1 / a0);
+    b->a2 = (float) (a2 / a0);
+    b->z = pa_xnew0(float, 2 * ss->channels);
+
+    return b;
+}
+
+static void biquad_done(void *state) {
+    struct biquad *b = state;
+
+    pa_xfree(b->z);
+    pa_xfree(b);
+}
+
+static void biquad_process(void *state, float *buf, unsigned n) {
+    struct biquad *b = state;
+    unsigned c, i;
+
+    /* Transposed direct form II */
+    for (c = 0; c < b->channels; c++) {
+        float z1 = b->z[2*c], z2 = b->z[2*c+1];
+        float *d = buf + c;
+
+        for (i = 0; i < n; i++, d += b->channels) {
+            float x = *d, y;
+
+            y = b->b0 * x + z1;
+            z1 = b->b1 * x - b->a1 * y + z2;
+            z2 = b->b2 * x - b->a2 * y;
+            *d = y;
+        }
+
+        b->z[2*c] = z1;
+        b->z[2*c+1] = z2;
+    }
+}
+
+static void biquad_reset(void *state) {
+    struct biquad *b = state;
+
+    memset(b->z, 0, 2 * b->channels * sizeof(float));
+}
+
+/* delay: delays all channels by a fixed time */
+
+struct delay {
+    unsigned channels;
+    unsigned length; /* In frames */
+    unsigned pos;
+    float *line;
+};
+
+static const char* const delay_args[] = {
+    "ms",
+    NULL
+};
+
+static void *delay_init(pa_modargs *ma, const pa_sample_spec *ss) {
+    struct delay *d;
+    uint32_t ms = 0;
+
+    if (pa_modargs_get_value_u32(ma, "ms", &ms) < 0 || ms > 1000) {
+        pa_log("delay: ms= expects a number of milliseconds up to 1000");
+        return NULL;
+    }
+
+    d = pa_xnew0(struct delay, 1);
+    d->channels = ss->channels;
+    d->length = (unsigned) (pa_usec_to_bytes(ms * PA_USEC_PER_MSEC, ss) / pa_frame_size(ss));
+    d->line = pa_xnew0(float, PA_MAX(d->length, 1U) * ss->channels);
+
+    return d;
+}
+
+static void delay_done(void *state) {
+    struct delay *d = state;
+
+    pa_xfree(d->line);
+    pa_xfree(d);
+}
+
+static void delay_process(void *state, float *buf, unsigned n) {
+    struct delay *d = state;
+    unsigned i, c;
+
+    if (d->length == 0)
+        return;
+
+    for (i = 0; i < n; i++, buf += d->channels) {
+        float *l = d->line + d->pos * d->channels;
+
+        for (c = 0; c < d->channels; c++) {
+            float t = l[c];
+
+            l[c] = buf[c];
+            buf[c] = t;
+        }
+
+        if (++d->pos >= d->length)
+            d->pos = 0;
+    }
+}
+
+static void delay_reset(void *state) {
+    struct delay *d = state;
+
+    memset(d->line, 0, PA_MAX(d->length, 1U) * d->channels * sizeof(float));
+    d->pos = 0;
+}
+
+static size_t delay_get_latency(void *state) {
+    struct delay *d = state;
+
+    return d->length;
+}
+
+/* limiter: keeps the peaks below a ceiling, with instant attack and an
+ * exponential release. All channels share one gain, so the stereo image
+ * doesn't move. */
+
+struct limiter {
+    unsigned channels;
+    float ceiling;
+    float release;
+    float gain;
+};
+
+static const char* const limiter_args[] = {
+    "ceiling",
+    "release",
+    NULL
+};
+
+static void *limiter_init(pa_modargs *ma, const pa_sample_spec *ss) {
+    struct limiter *l;
+    double ceiling = -1;
+    uint32_t release = 50;
+
+    if (pa_modargs_get_value_double(ma, "ceiling", &ceiling) < 0 || ceiling > 0) {
+        pa_log("limiter: ceiling= expects a level in dB up to 0");
+        return NULL;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "release", &release) < 0 || release <= 0) {
+        pa_log("limiter: release= expects a positive number of milliseconds");
+        return NULL;
+    }
+
+    l = pa_xnew0(struct limiter, 1);
+    l->channels = ss->channels;
+    l->ceiling = (float) pow(10.0, ceiling / 20.0);
+    l->release = (float) (1.0 - exp(-1000.0 / (release * (double) ss->rate)));
+    l->gain = 1.0f;
+
+    return l;
+}
+
+static void limiter_process(void *state, float *buf, unsigned n) {
+    struct limiter *l = state;
+    unsigned i, c;
+
+    for (i = 0; i < n; i++, buf += l->channels) {
+        float peak = 0, target;
+
+        for (c = 0; c < l->channels; c++)
+            peak = PA_MAX(peak, fabsf(buf[c]));
+
+        target = peak > l->ceiling ? l->ceiling / peak : 1.0f;
+
+        if (target < l->gain)
+            l->gain = target;
+        else
+            l->gain += (target - l->gain) * l->release;
+
+        for (c = 0; c < l->channels; c++)
+            buf[c] *= l->gain;
+    }
+}
+
+static void limiter_reset(void *state) {
+    struct limiter *l = state;
+
+    l->gain = 1.0f;
+}
+
+static const pa_filter_stage_type stage_types[] = {
+    { "gain", gain_args, gain_init, pa_xfree, gain_process, NULL, NULL },
+    { "biquad", biquad_args, biquad_init, biquad_done, biquad_process, biquad_reset, NULL },
+    { "delay", delay_args, delay_init, delay_done, delay_process, delay_reset, delay_get_latency },
+    { "limiter", limiter_args, limiter_init, pa_xfree, limiter_process, limiter_reset, NULL },
+};
+
+static const pa_filter_stage_type *find_stage_type(const char *name) {
+    unsigned i;
+
+    for (i = 0; i < PA_ELEMENTSOF(stage_types); i++)
+        if (pa_streq(stage_types[i].name, name))
+            return &stage_types[i];
+
+    return NULL;
+}
+
+static int add_stage(pa_filter_chain *c, const char *name, const char *args) {
+    const pa_filter_stage_type *type;
+    pa_modargs *ma;
+    void *state;
+
+    if (c->n_stages >= MAX_STAGES) {
+        pa_log("Too many stages, at most %u are supported", MAX_STAGES);
+        return -1;
+    }
+
+    if (!(type = find_stage_type(name))) {
+        pa_log("Unknown stage '%s'", name);
+        return -1;
+    }
+
+    if (!(ma = pa_modargs_new(args, type->valid_args))) {
+        pa_log("Failed to parse arguments of stage '%s'", name);
+        return -1;
+    }
+
+    state = type->init(ma, &c->sample_spec);
+    pa_modargs_free(ma);
+
+    if (!state)
+        return -1;
+
+    c->stages[c->n_stages].type = type;
+    c->stages[c->n_stages].state = state;
+    c->n_stages++;
+
+    return 0;
+}
+
+pa_filter_chain *pa_filter_chain_new(const char *description, const pa_sample_spec *ss) {
+    pa_filter_chain *c;
+    const char *p;
+
+    pa_assert(description);
+    pa_assert(ss);
+    pa_assert(ss->format == PA_SAMPLE_FLOAT32NE);
+
+    c = pa_xnew0(pa_filter_chain, 1);
+    c->sample_spec = *ss;
+
+    p = description;
+
+    for (;;) {
+        char *name, *args;
+        const char *e;
+        size_t l;
+        int r;
+
+        p += strspn(p, " \t\n,");
+
+        if (!*p)
+            break;
+
+        if ((l = strcspn(p, " \t\n,(")) == 0) {
+            pa_log("Expected a stage name at '%s'", p);
+            goto fail;
+        }
+
+        name = pa_xstrndup(p, l);
+        p += l;
+        p += strspn(p, " \t\n");
+
+        if (*p == '(') {
+            if (!(e = strchr(p, ')'))) {
+                pa_log("Missing ')' after the arguments of stage '%s'", name);
+                pa_xfree(name);
+                goto fail;
+            }
+
+            args = pa_xstrndup(p + 1, (size_t) (e - p - 1));
+            p = e + 1;
+        } else
+            args = NULL;
+
+        r = add_stage(c, name, args);
+
+        pa_xfree(name);
+        pa_xfree(args);
+
+        if (r < 0)
+            goto fail;
+    }
+
+    if (c->n_stages == 0) {
+        pa_log("The filter chain has no stages");
+        goto fail;
+    }
+
+    return c;
+
+fail:
+    pa_filter_chain_free(c);
+    return NULL;
+}
+
+void pa_filter_chain_free(pa_filter_chain *c) {
+    unsigned i;
+
+    pa_assert(c);
+
+    for (i = 0; i < c->n_stages; i++)
+        c->stages[i].type->done(c->stages[i].state);
+
+    pa_xfree(c);
+}
+
+unsigned pa_filter_chain_get_n_stages(pa_filter_chain *c) {
+    pa_assert(c);
+
+    return c->n_stages;
+}
+
+void pa_filter_chain_process(pa_filter_chain *c, float *buf, unsigned n) {
+    unsigned i;
+
+    pa_assert(c);
+    pa_assert(buf);
+
+    for (i = 0; i < c->n_stages; i++)
+        c->stages[i].type->process(c->stages[i].state, buf, n);
+}
+
+void pa_filter_chain_reset(pa_filter_chain *c) {
+    unsigned i;
+
+    pa_assert(c);
+
+    for (i = 0; i < c->n_stages; i++)
+        if (c->stages[i].type->reset)
+            c->stages[i].type->reset(c->stages[i].state);
+}
+
+size_t pa_filter_chain_get_latency(pa_filter_chain *c) {
+    size_t latency = 0;
+    unsigned i;
+
+    pa_assert(c);
+
+    for (i = 0; i < c->n_stages; i++)
+        if (c->stages[i].type->get_latency)
+            latency += c->stages[i].type->get_latency(c->stages[i].state);
+
+    return latency;
+}
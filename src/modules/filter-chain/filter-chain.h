@@ -0,0 +1,69 @@
+#ifndef foofilterchainhfoo
+#define foofilterchainhfoo
+
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+#include <pulse/sample.h>
+
+#include <pulsecore/modargs.h>
+
+/* An ordered list of processing stages that all work in place on the
+ * same buffer of interleaved float samples. A chain is described by a
+ * string like
+ *
+ *     biquad(type=peaking freq=1000 q=0.7 gain=3) gain(db=-3) limiter
+ *
+ * where the arguments of every stage use the usual module argument
+ * syntax. */
+
+typedef struct pa_filter_stage_type {
+    const char *name;
+    const char* const *valid_args;
+
+    /* Sets the stage up for the given sample spec, which is always
+     * FLOAT32NE. Returns NULL on failure. */
+    void *(*init)(pa_modargs *ma, const pa_sample_spec *ss);
+    void (*done)(void *state);
+
+    /* Processes n frames of interleaved samples in place */
+    void (*process)(void *state, float *buf, unsigned n);
+
+    /* Forgets all history, e.g. after a rewind. Optional. */
+    void (*reset)(void *state);
+
+    /* Returns how many frames the stage delays the signal. Optional. */
+    size_t (*get_latency)(void *state);
+} pa_filter_stage_type;
+
+typedef struct pa_filter_chain pa_filter_chain;
+
+pa_filter_chain *pa_filter_chain_new(const char *description, const pa_sample_spec *ss);
+void pa_filter_chain_free(pa_filter_chain *c);
+
+unsigned pa_filter_chain_get_n_stages(pa_filter_chain *c);
+
+/* Runs all stages, one after the other, over the buffer */
+void pa_filter_chain_process(pa_filter_chain *c, float *buf, unsigned n);
+void pa_filter_chain_reset(pa_filter_chain *c);
+
+/* Sum of the latencies of all stages, in frames */
+size_t pa_filter_chain_get_latency(pa_filter_chain *c);
+
+#endif
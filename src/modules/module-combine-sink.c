@@ -72,6 +72,10 @@ PA_MODULE_USAGE(
 
 #define BLOCK_USEC (PA_USEC_PER_MSEC * 200)
 
+/* Number of rendered chunks the outputs can be apart from each other.
+ * Must be a power of two. */
+#define RING_SLOTS 256
+
 static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
@@ -92,13 +96,18 @@ struct output {
     pa_sink_input *sink_input;
     bool ignore_state_change;
 
-    pa_asyncmsgq *inq,    /* Message queue from the sink thread to this sink input */
-                 *outq;   /* Message queue from this sink input to the sink thread */
-    pa_rtpoll_item *inq_rtpoll_item_read, *inq_rtpoll_item_write;
+    pa_asyncmsgq *outq;   /* Message queue from this sink input to the sink thread */
     pa_rtpoll_item *outq_rtpoll_item_read, *outq_rtpoll_item_write;
 
     pa_memblockq *memblockq;
 
+    /* Our cursor into the broadcast ring. Advanced by the output
+     * thread when it takes a chunk, and by the sink thread when it has
+     * to skip us forward because we fell too far behind. Whoever moves
+     * the cursor past a slot owns the reference to it we held. */
+    pa_atomic_t ring_read_seq;
+    pa_atomic_t ring_read_bytes;
+
     /* For communication of the stream latencies to the main thread */
     pa_usec_t total_latency;
 
@@ -134,6 +143,18 @@ struct userdata {
 
     pa_idxset* outputs; /* managed in main context */
 
+    /* Single producer, multiple consumer ring of rendered chunks. The
+     * sink thread renders ahead into it and every output reads at its
+     * own cursor, so no thread ever has to wait for another one. Each
+     * slot holds one memblock reference per output that was active
+     * when the chunk was published. */
+    struct {
+        pa_memchunk slots[RING_SLOTS]; /* written by the IO thread only */
+        pa_atomic_t write_seq;
+        pa_atomic_t write_bytes;
+        pa_atomic_t need;              /* set while a SINK_MESSAGE_NEED is pending */
+    } ring;
+
     struct {
         PA_LLIST_HEAD(struct output, active_outputs); /* managed in IO thread context */
         pa_atomic_t running;  /* we cache that value here, so that every thread can query it cheaply */
@@ -153,10 +174,6 @@ enum {
     SINK_MESSAGE_UPDATE_REQUESTED_LATENCY
 };
 
-enum {
-    SINK_INPUT_MESSAGE_POST = PA_SINK_INPUT_MESSAGE_MAX,
-};
-
 static void output_disable(struct output *o);
 static void output_enable(struct output *o);
 static void output_free(struct output *o);
@@ -351,66 +368,164 @@ finish:
 }
 
 /* Called from I/O thread context */
-static void render_memblock(struct userdata *u, struct output *o, size_t length) {
+static void ring_release(struct userdata *u, unsigned from, unsigned to) {
+    pa_assert(u);
+
+    for (; from != to; from++)
+        pa_memblock_unref(u->ring.slots[from % RING_SLOTS].memblock);
+}
+
+/* Called from I/O thread context */
+static void ring_make_room(struct userdata *u, struct output *o, unsigned write_seq) {
     pa_assert(u);
     pa_assert(o);
 
-    /* We are run by the sink thread, on behalf of an output (o). The
-     * output is waiting for us, hence it is safe to access its
-     * mainblockq and asyncmsgq directly. */
+    /* An output that is a whole ring behind would block everybody
+     * else. Skip it forward to the newer half of the ring instead. */
+    for (;;) {
+        unsigned read_seq, new_seq, seq;
+        size_t skipped = 0;
+
+        read_seq = (unsigned) pa_atomic_load(&o->ring_read_seq);
+
+        if (write_seq - read_seq < RING_SLOTS)
+            return;
+
+        new_seq = write_seq - RING_SLOTS / 2;
+
+        /* Collect the sizes before we give up our claim */
+        for (seq = read_seq; seq != new_seq; seq++)
+            skipped += u->ring.slots[seq % RING_SLOTS].length;
+
+        if (!pa_atomic_cmpxchg(&o->ring_read_seq, (int) read_seq, (int) new_seq))
+            continue;
+
+        ring_release(u, read_seq, new_seq);
+        pa_atomic_add(&o->ring_read_bytes, (int) skipped);
+        pa_atomic_add(&o->sink_input->metrics.upstream_skipped, (int) skipped);
+
+        pa_log_warn("[%s] Output fell behind, skipping %0.2f ms.", o->sink->name,
+                    (double) pa_bytes_to_usec(skipped, &u->sink->sample_spec) / PA_USEC_PER_MSEC);
+        return;
+    }
+}
+
+/* Called from I/O thread context */
+static void ring_publish(struct userdata *u, const pa_memchunk *chunk) {
+    struct output *o;
+    unsigned write_seq;
+
+    pa_assert(u);
+    pa_assert(chunk);
+
+    write_seq = (unsigned) pa_atomic_load(&u->ring.write_seq);
+
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        ring_make_room(u, o, write_seq);
+        pa_memblock_ref(chunk->memblock);
+    }
+
+    u->ring.slots[write_seq % RING_SLOTS] = *chunk;
+
+    /* Make the chunk visible only after the slot has been filled */
+    pa_atomic_add(&u->ring.write_bytes, (int) chunk->length);
+    pa_atomic_inc(&u->ring.write_seq);
+}
+
+/* Called from I/O thread context */
+static void render_ahead(struct userdata *u) {
+    struct output *o;
+    size_t lead = (size_t) -1, target;
+
+    pa_assert(u);
 
     /* If we are not running, we cannot produce any data */
-    if (!pa_atomic_load(&u->thread_info.running))
+    if (!pa_atomic_load(&u->thread_info.running) || !u->thread_info.active_outputs)
         return;
 
-    /* Maybe there's some data in the requesting output's queue
-     * now? */
-    while (pa_asyncmsgq_process_one(o->inq) > 0)
-        ;
+    /* Stay one request ahead of the output that is furthest ahead */
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        size_t lag = (unsigned) pa_atomic_load(&u->ring.write_bytes) - (unsigned) pa_atomic_load(&o->ring_read_bytes);
+
+        if (lag < lead)
+            lead = lag;
+    }
+
+    target = u->sink->thread_info.max_request;
 
-    /* Ok, now let's prepare some data if we really have to */
-    while (!pa_memblockq_is_readable(o->memblockq)) {
-        struct output *j;
+    while (lead < target) {
         pa_memchunk chunk;
 
         /* Render data! */
-        pa_sink_render(u->sink, length, &chunk);
+        pa_sink_render(u->sink, target - lead, &chunk);
 
         u->thread_info.counter += chunk.length;
+        lead += chunk.length;
 
-        /* OK, let's send this data to the other threads */
-        PA_LLIST_FOREACH(j, u->thread_info.active_outputs) {
-            if (j == o)
-                continue;
+        ring_publish(u, &chunk);
+        pa_memblock_unref(chunk.memblock);
+    }
+}
 
-            pa_asyncmsgq_post(j->inq, PA_MSGOBJECT(j->sink_input), SINK_INPUT_MESSAGE_POST, NULL, 0, &chunk, NULL);
-        }
+/* Called from I/O thread context of the output */
+static bool ring_read(struct output *o, pa_memchunk *chunk) {
+    struct userdata *u;
 
-        /* And place it directly into the requesting output's queue */
-        pa_memblockq_push_align(o->memblockq, &chunk);
-        pa_memblock_unref(chunk.memblock);
+    pa_assert(o);
+    pa_assert_se(u = o->userdata);
+
+    for (;;) {
+        unsigned read_seq;
+
+        read_seq = (unsigned) pa_atomic_load(&o->ring_read_seq);
+
+        if (read_seq == (unsigned) pa_atomic_load(&u->ring.write_seq))
+            return false;
+
+        /* The slot can only be reused after we moved past it, so if
+         * the cursor didn't move under our feet the copy is valid and
+         * the reference it carries is ours */
+        *chunk = u->ring.slots[read_seq % RING_SLOTS];
+
+        if (pa_atomic_cmpxchg(&o->ring_read_seq, (int) read_seq, (int) (read_seq + 1))) {
+            pa_atomic_add(&o->ring_read_bytes, (int) chunk->length);
+            return true;
+        }
     }
 }
 
+/* Called from I/O thread context of the output */
+static size_t ring_lag(struct output *o) {
+    pa_assert(o);
+
+    return (unsigned) pa_atomic_load(&o->userdata->ring.write_bytes) - (unsigned) pa_atomic_load(&o->ring_read_bytes);
+}
+
 /* Called from I/O thread context */
 static void request_memblock(struct output *o, size_t length) {
+    struct userdata *u;
+    pa_memchunk chunk;
+
     pa_assert(o);
     pa_sink_input_assert_ref(o->sink_input);
-    pa_sink_assert_ref(o->userdata->sink);
+    pa_assert_se(u = o->userdata);
+    pa_sink_assert_ref(u->sink);
 
-    /* If another thread already prepared some data we received
-     * the data over the asyncmsgq, hence let's first process
-     * it. */
-    while (pa_asyncmsgq_process_one(o->inq) > 0)
-        ;
+    /* Take what the sink thread rendered for us so far */
+    while (!pa_memblockq_is_readable(o->memblockq) && ring_read(o, &chunk)) {
+        pa_memblockq_push_align(o->memblockq, &chunk);
+        pa_memblock_unref(chunk.memblock);
+    }
 
-    /* Check whether we're now readable */
-    if (pa_memblockq_is_readable(o->memblockq))
-        return;
+    pa_atomic_store(&o->sink_input->metrics.upstream_lag, (int) ring_lag(o));
 
-    /* OK, we need to prepare new data, but only if the sink is actually running */
-    if (pa_atomic_load(&o->userdata->thread_info.running))
-        pa_asyncmsgq_send(o->outq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_NEED, o, (int64_t) length, NULL);
+    /* If the next request couldn't be served anymore, ask the sink
+     * thread to render some more. Never wait for it though, it will be
+     * done long before that request comes. */
+    if (ring_lag(o) < length &&
+        pa_atomic_load(&u->thread_info.running) &&
+        pa_atomic_cmpxchg(&u->ring.need, 0, 1))
+        pa_asyncmsgq_post(o->outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_NEED, NULL, 0, NULL, NULL);
 }
 
 /* Called from I/O thread context */
@@ -502,13 +617,8 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(o = i->userdata);
 
-    /* Set up the queue from the sink thread to us */
-    pa_assert(!o->inq_rtpoll_item_read && !o->outq_rtpoll_item_write);
-
-    o->inq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
-            i->sink->thread_info.rtpoll,
-            PA_RTPOLL_LATE,  /* This one is not that important, since we check for data in _peek() anyway. */
-            o->inq);
+    /* Set up the queue from us to the sink thread */
+    pa_assert(!o->outq_rtpoll_item_write);
 
     o->outq_rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(
             i->sink->thread_info.rtpoll,
@@ -533,11 +643,6 @@ static void sink_input_detach_cb(pa_sink_input *i) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(o = i->userdata);
 
-    if (o->inq_rtpoll_item_read) {
-        pa_rtpoll_item_free(o->inq_rtpoll_item_read);
-        o->inq_rtpoll_item_read = NULL;
-    }
-
     if (o->outq_rtpoll_item_write) {
         pa_rtpoll_item_free(o->outq_rtpoll_item_write);
         o->outq_rtpoll_item_write = NULL;
@@ -565,21 +670,12 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
         case PA_SINK_INPUT_MESSAGE_GET_LATENCY: {
             pa_usec_t *r = data;
 
-            *r = pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq), &o->sink_input->sample_spec);
+            *r = pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq) + ring_lag(o), &o->sink_input->sample_spec);
 
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
             break;
         }
-
-        case SINK_INPUT_MESSAGE_POST:
-
-            if (PA_SINK_IS_OPENED(o->sink_input->sink->thread_info.state))
-                pa_memblockq_push_align(o->memblockq, chunk);
-            else
-                pa_memblockq_flush_write(o->memblockq, true);
-
-            return 0;
     }
 
     return pa_sink_input_process_msg(obj, code, data, offset, chunk);
@@ -705,16 +801,16 @@ static void output_add_within_thread(struct output *o) {
 
     PA_LLIST_PREPEND(struct output, o->userdata->thread_info.active_outputs, o);
 
-    pa_assert(!o->outq_rtpoll_item_read && !o->inq_rtpoll_item_write);
+    /* New outputs start with the next chunk that is rendered */
+    pa_atomic_store(&o->ring_read_seq, pa_atomic_load(&o->userdata->ring.write_seq));
+    pa_atomic_store(&o->ring_read_bytes, pa_atomic_load(&o->userdata->ring.write_bytes));
+
+    pa_assert(!o->outq_rtpoll_item_read);
 
     o->outq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
             o->userdata->rtpoll,
             PA_RTPOLL_EARLY-1,  /* This item is very important */
             o->outq);
-    o->inq_rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(
-            o->userdata->rtpoll,
-            PA_RTPOLL_EARLY,
-            o->inq);
 }
 
 /* Called from thread context of the io thread */
@@ -724,15 +820,20 @@ static void output_remove_within_thread(struct output *o) {
 
     PA_LLIST_REMOVE(struct output, o->userdata->thread_info.active_outputs, o);
 
+    /* The sink input is unlinked already, so nobody reads at this
+     * cursor anymore. Drop the references we still hold. */
+    ring_release(o->userdata,
+                 (unsigned) pa_atomic_load(&o->ring_read_seq),
+                 (unsigned) pa_atomic_load(&o->userdata->ring.write_seq));
+    pa_atomic_store(&o->ring_read_seq, pa_atomic_load(&o->userdata->ring.write_seq));
+
+    /* A render request still sitting in our queue gets flushed */
+    pa_atomic_store(&o->userdata->ring.need, 0);
+
     if (o->outq_rtpoll_item_read) {
         pa_rtpoll_item_free(o->outq_rtpoll_item_read);
         o->outq_rtpoll_item_read = NULL;
     }
-
-    if (o->inq_rtpoll_item_write) {
-        pa_rtpoll_item_free(o->inq_rtpoll_item_write);
-        o->inq_rtpoll_item_write = NULL;
-    }
 }
 
 /* Called from thread context of the io thread */
@@ -743,6 +844,7 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
         case PA_SINK_MESSAGE_SET_STATE: {
             bool running = (PA_PTR_TO_UINT(data) == PA_SINK_RUNNING);
+            int r;
 
             pa_atomic_store(&u->thread_info.running, running);
 
@@ -751,7 +853,15 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             else
                 pa_smoother_pause(u->thread_info.smoother, pa_rtclock_now());
 
-            break;
+            /* Fill the ring before the outputs ask for data, but only
+             * after the state change went through, rendering needs an
+             * opened sink */
+            r = pa_sink_process_msg(o, code, data, offset, chunk);
+
+            if (running)
+                render_ahead(u);
+
+            return r;
         }
 
         case PA_SINK_MESSAGE_GET_LATENCY: {
@@ -774,6 +884,7 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             output_add_within_thread(data);
             update_max_request(u);
             update_fixed_latency(u);
+            render_ahead(u);
             return 0;
 
         case SINK_MESSAGE_REMOVE_OUTPUT:
@@ -783,7 +894,8 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             return 0;
 
         case SINK_MESSAGE_NEED:
-            render_memblock(u, (struct output*) data, (size_t) offset);
+            pa_atomic_store(&u->ring.need, 0);
+            render_ahead(u);
             return 0;
 
         case SINK_MESSAGE_UPDATE_LATENCY: {
@@ -900,7 +1012,6 @@ static struct output *output_new(struct userdata *u, pa_sink *sink) {
 
     o = pa_xnew0(struct output, 1);
     o->userdata = u;
-    o->inq = pa_asyncmsgq_new(0);
     o->outq = pa_asyncmsgq_new(0);
     o->sink = sink;
     o->memblockq = pa_memblockq_new(
@@ -927,19 +1038,11 @@ static void output_free(struct output *o) {
     output_disable(o);
     update_description(o->userdata);
 
-    if (o->inq_rtpoll_item_read)
-        pa_rtpoll_item_free(o->inq_rtpoll_item_read);
-    if (o->inq_rtpoll_item_write)
-        pa_rtpoll_item_free(o->inq_rtpoll_item_write);
-
     if (o->outq_rtpoll_item_read)
         pa_rtpoll_item_free(o->outq_rtpoll_item_read);
     if (o->outq_rtpoll_item_write)
         pa_rtpoll_item_free(o->outq_rtpoll_item_write);
 
-    if (o->inq)
-        pa_asyncmsgq_unref(o->inq);
-
     if (o->outq)
         pa_asyncmsgq_unref(o->outq);
 
@@ -1003,7 +1106,6 @@ static void output_disable(struct output *o) {
 
     /* Finally, drop all queued data */
     pa_memblockq_flush_write(o->memblockq, true);
-    pa_asyncmsgq_flush(o->inq, false);
     pa_asyncmsgq_flush(o->outq, false);
 }
 
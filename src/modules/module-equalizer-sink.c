@@ -571,6 +571,30 @@ static void process_samples(struct userdata *u) {
     flatten_to_memblockq(u);
 }
 
+/* Like process_samples(), but for input that has been silent long enough
+ * for the windows and the overlaps to hold nothing but zeros. The output
+ * is silent then, so the transforms are skipped. */
+static void skip_samples(struct userdata *u) {
+    size_t fs = pa_frame_size(&(u->sink->sample_spec));
+    size_t iterations, length;
+    pa_assert(u->samples_gathered >= u->window_size);
+    iterations = (u->samples_gathered - u->overlap_size) / u->R;
+
+    //the input buffers are all zeros, so there is nothing to move
+    u->samples_gathered -= iterations * u->R;
+    u->first_iteration = false;
+
+    length = iterations * u->R * fs;
+    while (length > 0) {
+        pa_memchunk silence;
+
+        pa_silence_memchunk_get(&u->sink->core->silence_cache, u->sink->core->mempool, &silence, &u->sink->sample_spec, length);
+        pa_memblockq_push(u->output_q, &silence);
+        length -= silence.length;
+        pa_memblock_unref(silence.memblock);
+    }
+}
+
 static void input_buffer(struct userdata *u, pa_memchunk *in) {
     size_t fs = pa_frame_size(&(u->sink->sample_spec));
     size_t samples = in->length/fs;
@@ -595,6 +619,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     size_t mbs;
     //struct timeval start, end;
     pa_memchunk tchunk;
+    bool decayed = true;
 
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
@@ -648,6 +673,10 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
         tchunk.length = PA_MIN(input_remaining * fs, tchunk.length);
 
+        //a round can only be skipped if all of its input is silent
+        if (!pa_sink_input_silence_decayed(i, &tchunk, 2 * u->window_size * fs))
+            decayed = false;
+
         pa_memblockq_drop(u->input_q, tchunk.length);
         //pa_log_debug("asked for %ld input samples, got %ld samples",input_remaining,buffer->length/fs);
         /* copy new input */
@@ -666,7 +695,11 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_assert(u->R < u->window_size);
     //pa_rtclock_get(&start);
     /* process a block */
-    process_samples(u);
+    if (decayed) {
+        skip_samples(u);
+        pa_atomic_inc(&i->metrics.dsp_skipped);
+    } else
+        process_samples(u);
     //pa_rtclock_get(&end);
     //pa_log_debug("Took %0.6f seconds to process", (double) pa_timeval_diff(&end, &start) / PA_USEC_PER_SEC);
 END:
@@ -40,6 +40,9 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/strbuf.h>
+#include <pulsecore/thread.h>
 
 #ifdef HAVE_DBUS
 #include <pulsecore/protocol-dbus.h>
@@ -61,34 +64,78 @@ PA_MODULE_USAGE(
       "rate=<sample rate> "
       "channels=<number of channels> "
       "channel_map=<input channel map> "
-      "plugin=<ladspa plugin name> "
-      "label=<ladspa plugin label> "
-      "control=<comma separated list of input control values> "
-      "input_ladspaport_map=<comma separated list of input LADSPA port names> "
-      "output_ladspaport_map=<comma separated list of output LADSPA port names> "));
+      "plugin=<ladspa plugin name, several separated by '|' to chain them> "
+      "label=<ladspa plugin label, one for each plugin> "
+      "control=<comma separated list of input control values, one list for each plugin separated by '|'> "
+      "input_ladspaport_map=<comma separated list of input LADSPA port names, one list for each plugin separated by '|'> "
+      "output_ladspaport_map=<comma separated list of output LADSPA port names, one list for each plugin separated by '|'> "
+      "threads=<number of additional threads to run independent plugin instances in> "));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
+#define MAX_PLUGINS 16
+
+/* LADSPA doesn't tell how long the plugins keep ringing after their
+ * input went silent, so wait this long before skipping them */
+#define SILENCE_TAIL_USEC (2*PA_USEC_PER_SEC)
 
 /* PLEASE NOTICE: The PortAudio ports and the LADSPA ports are two different concepts.
 They are not related and where possible the names of the LADSPA port variables contains "ladspa" to avoid confusion */
 
+struct plugin {
+    lt_dlhandle dl;
+    const LADSPA_Descriptor *descriptor;
+    LADSPA_Handle handle[PA_CHANNELS_MAX];
+    unsigned long max_ladspaport_count, input_count, output_count, n_instances;
+    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
+
+    /* Only for plugins that can't work in place: one output buffer per
+    output port and instance, copied back to the channel buffers after run() */
+    LADSPA_Data **scratch;
+
+    /* The control values of this plugin start at this index of u->control */
+    unsigned long control_offset, n_control;
+};
+
+struct worker {
+    struct userdata *u;
+    pa_thread *thread;
+    pa_semaphore *start;
+    unsigned index;
+};
+
 struct userdata {
     pa_module *module;
 
     pa_sink *sink;
     pa_sink_input *sink_input;
 
-    const LADSPA_Descriptor *descriptor;
-    LADSPA_Handle handle[PA_CHANNELS_MAX];
-    unsigned long max_ladspaport_count, input_count, output_count, channels;
-    LADSPA_Data **input, **output;
+    /* The plugins are run one after the other on the same buffers: the
+    input is deinterleaved once into one buffer per channel, every plugin
+    instance reads and writes the channels of its group in place, and the
+    result is interleaved once at the end. */
+    struct plugin *plugins;
+    unsigned n_plugins;
+    unsigned long channels;
+    LADSPA_Data *buffer[PA_CHANNELS_MAX];
     size_t block_size;
     LADSPA_Data *control;
     long unsigned n_control;
 
     /* This is a dummy buffer. Every port must be connected, but we don't care
-    about control out ports. We connect them all to this single buffer. */
-    LADSPA_Data control_out;
+    about control out ports. We connect all of them of an instance to a
+    single value, one per instance as instances may run in parallel. */
+    LADSPA_Data control_out[PA_CHANNELS_MAX];
+
+    /* If every plugin groups the channels the same way, the groups are
+    independent of each other and can be run in parallel. The IO thread
+    takes its share of the groups and waits for the workers to finish
+    theirs. */
+    struct worker *workers;
+    unsigned n_workers;
+    unsigned long n_groups;
+    pa_semaphore *done;
+    unsigned work_frames;
+    bool quit;
 
     pa_memblockq *memblockq;
 
@@ -116,6 +163,7 @@ static const char* const valid_modargs[] = {
     "control",
     "input_ladspaport_map",
     "output_ladspaport_map",
+    "threads",
     NULL
 };
 
@@ -437,12 +485,77 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+/* Called from I/O thread or worker thread context */
+static void run_instance(struct userdata *u, struct plugin *pl, unsigned long h, unsigned n) {
+    unsigned long c;
+
+    pl->descriptor->run(pl->handle[h], n);
+
+    if (pl->scratch)
+        for (c = 0; c < pl->output_count; c++)
+            memcpy(u->buffer[h*pl->max_ladspaport_count + c], pl->scratch[h*pl->output_count + c], n * sizeof(LADSPA_Data));
+}
+
+/* Called from I/O thread or worker thread context */
+static void run_groups(struct userdata *u, unsigned index, unsigned n) {
+    unsigned long h;
+    unsigned i;
+
+    /* All plugins have the same instance layout here, so instance h of
+     * every plugin only touches the channels of group h */
+    for (h = index; h < u->n_groups; h += u->n_workers + 1)
+        for (i = 0; i < u->n_plugins; i++)
+            run_instance(u, &u->plugins[i], h, n);
+}
+
+static void worker_func(void *userdata) {
+    struct worker *w = userdata;
+    struct userdata *u = w->u;
+
+    if (u->module->core->realtime_scheduling)
+        pa_make_realtime(u->module->core->realtime_priority);
+
+    for (;;) {
+        pa_semaphore_wait(w->start);
+
+        if (u->quit)
+            break;
+
+        run_groups(u, w->index, u->work_frames);
+        pa_semaphore_post(u->done);
+    }
+}
+
+/* Called from I/O thread context */
+static void run_chain(struct userdata *u, unsigned n) {
+    unsigned i;
+    unsigned long h;
+
+    if (u->n_workers > 0) {
+        u->work_frames = n;
+
+        for (i = 0; i < u->n_workers; i++)
+            pa_semaphore_post(u->workers[i].start);
+
+        run_groups(u, 0, n);
+
+        for (i = 0; i < u->n_workers; i++)
+            pa_semaphore_wait(u->done);
+
+        return;
+    }
+
+    for (i = 0; i < u->n_plugins; i++)
+        for (h = 0; h < u->plugins[i].n_instances; h++)
+            run_instance(u, &u->plugins[i], h, n);
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
     float *src, *dst;
     size_t fs;
-    unsigned n, h, c;
+    unsigned n, c;
     pa_memchunk tchunk;
 
     pa_sink_input_assert_ref(i);
@@ -468,6 +581,17 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_assert(n > 0);
 
+    tchunk.length = n*fs;
+
+    if (pa_sink_input_silence_decayed(i, &tchunk, pa_usec_to_bytes(SILENCE_TAIL_USEC, &i->sample_spec))) {
+        pa_silence_memchunk_get(&i->sink->core->silence_cache, i->sink->core->mempool, chunk, &i->sample_spec, tchunk.length);
+        pa_memblockq_drop(u->memblockq, chunk->length);
+        pa_memblock_unref(tchunk.memblock);
+
+        pa_atomic_inc(&i->metrics.dsp_skipped);
+        return 0;
+    }
+
     chunk->index = 0;
     chunk->length = n*fs;
     chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
@@ -477,13 +601,13 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        for (c = 0; c < u->input_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src+ h*u->max_ladspaport_count + c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[h], n);
-        for (c = 0; c < u->output_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[c], sizeof(float), n);
-    }
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->buffer[c], sizeof(float), src + c, u->channels*sizeof(float), n);
+
+    run_chain(u, n);
+
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + c, u->channels*sizeof(float), u->buffer[c], sizeof(float), n);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -509,19 +633,24 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
 
         if (amount > 0) {
-            unsigned c;
+            unsigned p;
+            unsigned long c;
 
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, true);
 
-            pa_log_debug("Resetting plugin");
+            pa_log_debug("Resetting plugins");
 
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->activate(u->handle[c]);
+            /* Reset the plugins */
+            for (p = 0; p < u->n_plugins; p++) {
+                struct plugin *pl = &u->plugins[p];
+
+                if (pl->descriptor->deactivate)
+                    for (c = 0; c < pl->n_instances; c++)
+                        pl->descriptor->deactivate(pl->handle[c]);
+                if (pl->descriptor->activate)
+                    for (c = 0; c < pl->n_instances; c++)
+                        pl->descriptor->activate(pl->handle[c]);
+            }
         }
     }
 
@@ -678,23 +807,22 @@ static void sink_input_mute_changed_cb(pa_sink_input *i) {
     pa_sink_mute_changed(u->sink, i->muted);
 }
 
-static int parse_control_parameters(struct userdata *u, const char *cdata, double *read_values, bool *use_default) {
+static int parse_control_parameters(unsigned long n_control, const char *cdata, double *read_values, bool *use_default) {
     unsigned long p = 0;
     const char *state = NULL;
     char *k;
 
     pa_assert(read_values);
     pa_assert(use_default);
-    pa_assert(u);
 
-    pa_log_debug("Trying to read %lu control values", u->n_control);
+    pa_log_debug("Trying to read %lu control values", n_control);
 
-    if (!cdata && u->n_control > 0)
+    if (!cdata && n_control > 0)
         return -1;
 
     pa_log_debug("cdata: '%s'", cdata);
 
-    while ((k = pa_split(cdata, ",", &state)) && p < u->n_control) {
+    while ((k = pa_split(cdata, ",", &state)) && p < n_control) {
         double f;
 
         if (*k == 0) {
@@ -721,19 +849,19 @@ static int parse_control_parameters(struct userdata *u, const char *cdata, doubl
     /* The previous loop doesn't take the last control value into account
        if it is left empty, so we do it here. */
     if (*cdata == 0 || cdata[strlen(cdata) - 1] == ',') {
-        if (p < u->n_control)
+        if (p < n_control)
             use_default[p] = true;
         p++;
     }
 
-    if (p > u->n_control || k) {
-        pa_log("Too many control values passed, %lu expected.", u->n_control);
+    if (p > n_control || k) {
+        pa_log("Too many control values passed, %lu expected.", n_control);
         pa_xfree(k);
         goto fail;
     }
 
-    if (p < u->n_control) {
-        pa_log("Not enough control values passed, %lu expected, %lu passed.", u->n_control, p);
+    if (p < n_control) {
+        pa_log("Not enough control values passed, %lu expected, %lu passed.", n_control, p);
         goto fail;
     }
 
@@ -745,90 +873,101 @@ fail:
 
 static void connect_control_ports(struct userdata *u) {
     unsigned long p = 0, h = 0, c;
-    const LADSPA_Descriptor *d;
+    unsigned i;
 
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
 
-    for (p = 0; p < d->PortCount; p++) {
-        if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
-            continue;
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+        const LADSPA_Descriptor *d;
 
-        if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
-            continue;
-        }
+        pa_assert_se(d = pl->descriptor);
+
+        for (p = 0; p < d->PortCount; p++) {
+            if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
+                continue;
+
+            if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
+                for (c = 0; c < pl->n_instances; c++)
+                    d->connect_port(pl->handle[c], p, &u->control_out[c]);
+                continue;
+            }
 
-        /* input control port */
+            /* input control port */
 
-        pa_log_debug("Binding %f to port %s", u->control[h], d->PortNames[p]);
+            pa_log_debug("Binding %f to port %s of %s", u->control[h], d->PortNames[p], d->Label);
 
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->connect_port(u->handle[c], p, &u->control[h]);
+            for (c = 0; c < pl->n_instances; c++)
+                d->connect_port(pl->handle[c], p, &u->control[h]);
 
-        h++;
+            h++;
+        }
     }
 }
 
 static int validate_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
     unsigned long p = 0, h = 0;
-    const LADSPA_Descriptor *d;
+    unsigned i;
     pa_sample_spec ss;
 
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
 
     ss = u->ss;
 
-    /* Iterate over all ports. Check for every control port that 1) it
-     * supports default values if a default value is provided and 2) the
-     * provided value is within the limits specified in the plugin. */
+    /* Iterate over all ports of all plugins. Check for every control port
+     * that 1) it supports default values if a default value is provided and
+     * 2) the provided value is within the limits specified in the plugin. */
 
-    for (p = 0; p < d->PortCount; p++) {
-        LADSPA_PortRangeHintDescriptor hint = d->PortRangeHints[p].HintDescriptor;
+    for (i = 0; i < u->n_plugins; i++) {
+        const LADSPA_Descriptor *d;
 
-        if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
-            continue;
+        pa_assert_se(d = u->plugins[i].descriptor);
 
-        if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p]))
-            continue;
+        for (p = 0; p < d->PortCount; p++) {
+            LADSPA_PortRangeHintDescriptor hint = d->PortRangeHints[p].HintDescriptor;
 
-        if (use_default[h]) {
-            /* User wants to use default value. Check if the plugin
-             * provides it. */
-            if (!LADSPA_IS_HINT_HAS_DEFAULT(hint)) {
-                pa_log_warn("Control port value left empty but plugin defines no default.");
-                return -1;
-            }
-        }
-        else {
-            /* Check if the user-provided value is within the bounds. */
-            LADSPA_Data lower = d->PortRangeHints[p].LowerBound;
-            LADSPA_Data upper = d->PortRangeHints[p].UpperBound;
-
-            if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
-                upper *= (LADSPA_Data) ss.rate;
-                lower *= (LADSPA_Data) ss.rate;
-            }
+            if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
+                continue;
 
-            if (LADSPA_IS_HINT_BOUNDED_ABOVE(hint)) {
-                if (control_values[h] > upper) {
-                    pa_log_warn("Control value %lu over upper bound: %f (upper bound: %f)", h, control_values[h], upper);
+            if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p]))
+                continue;
+
+            if (use_default[h]) {
+                /* User wants to use default value. Check if the plugin
+                 * provides it. */
+                if (!LADSPA_IS_HINT_HAS_DEFAULT(hint)) {
+                    pa_log_warn("Control port value left empty but plugin defines no default.");
                     return -1;
                 }
             }
-            if (LADSPA_IS_HINT_BOUNDED_BELOW(hint)) {
-                if (control_values[h] < lower) {
-                    pa_log_warn("Control value %lu below lower bound: %f (lower bound: %f)", h, control_values[h], lower);
-                    return -1;
+            else {
+                /* Check if the user-provided value is within the bounds. */
+                LADSPA_Data lower = d->PortRangeHints[p].LowerBound;
+                LADSPA_Data upper = d->PortRangeHints[p].UpperBound;
+
+                if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
+                    upper *= (LADSPA_Data) ss.rate;
+                    lower *= (LADSPA_Data) ss.rate;
+                }
+
+                if (LADSPA_IS_HINT_BOUNDED_ABOVE(hint)) {
+                    if (control_values[h] > upper) {
+                        pa_log_warn("Control value %lu over upper bound: %f (upper bound: %f)", h, control_values[h], upper);
+                        return -1;
+                    }
+                }
+                if (LADSPA_IS_HINT_BOUNDED_BELOW(hint)) {
+                    if (control_values[h] < lower) {
+                        pa_log_warn("Control value %lu below lower bound: %f (lower bound: %f)", h, control_values[h], lower);
+                        return -1;
+                    }
                 }
             }
-        }
 
-        h++;
+            h++;
+        }
     }
 
     return 0;
@@ -836,106 +975,113 @@ static int validate_control_parameters(struct userdata *u, double *control_value
 
 static int write_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
     unsigned long p = 0, h = 0, c;
-    const LADSPA_Descriptor *d;
+    unsigned i;
     pa_sample_spec ss;
 
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
 
     ss = u->ss;
 
     if (validate_control_parameters(u, control_values, use_default) < 0)
         return -1;
 
-    /* p iterates over all ports, h is the control port iterator */
-
-    for (p = 0; p < d->PortCount; p++) {
-        LADSPA_PortRangeHintDescriptor hint = d->PortRangeHints[p].HintDescriptor;
-
-        if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
-            continue;
+    /* i iterates over the plugins, p over all ports of a plugin, h is the
+     * control port iterator across all plugins */
 
-        if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
-            continue;
-        }
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+        const LADSPA_Descriptor *d;
 
-        if (use_default[h]) {
+        pa_assert_se(d = pl->descriptor);
 
-            LADSPA_Data lower, upper;
+        for (p = 0; p < d->PortCount; p++) {
+            LADSPA_PortRangeHintDescriptor hint = d->PortRangeHints[p].HintDescriptor;
 
-            lower = d->PortRangeHints[p].LowerBound;
-            upper = d->PortRangeHints[p].UpperBound;
+            if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
+                continue;
 
-            if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
-                lower *= (LADSPA_Data) ss.rate;
-                upper *= (LADSPA_Data) ss.rate;
+            if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
+                for (c = 0; c < pl->n_instances; c++)
+                    d->connect_port(pl->handle[c], p, &u->control_out[c]);
+                continue;
             }
 
-            switch (hint & LADSPA_HINT_DEFAULT_MASK) {
+            if (use_default[h]) {
 
-            case LADSPA_HINT_DEFAULT_MINIMUM:
-                u->control[h] = lower;
-                break;
-
-            case LADSPA_HINT_DEFAULT_MAXIMUM:
-                u->control[h] = upper;
-                break;
+                LADSPA_Data lower, upper;
 
-            case LADSPA_HINT_DEFAULT_LOW:
-                if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
-                else
-                    u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
-                break;
-
-            case LADSPA_HINT_DEFAULT_MIDDLE:
-                if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
-                else
-                    u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
-                break;
-
-            case LADSPA_HINT_DEFAULT_HIGH:
-                if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
-                else
-                    u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
-                break;
+                lower = d->PortRangeHints[p].LowerBound;
+                upper = d->PortRangeHints[p].UpperBound;
 
-            case LADSPA_HINT_DEFAULT_0:
-                u->control[h] = 0;
-                break;
-
-            case LADSPA_HINT_DEFAULT_1:
-                u->control[h] = 1;
-                break;
-
-            case LADSPA_HINT_DEFAULT_100:
-                u->control[h] = 100;
-                break;
-
-            case LADSPA_HINT_DEFAULT_440:
-                u->control[h] = 440;
-                break;
+                if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
+                    lower *= (LADSPA_Data) ss.rate;
+                    upper *= (LADSPA_Data) ss.rate;
+                }
 
-            default:
-                pa_assert_not_reached();
-            }
-        }
-        else {
-            if (LADSPA_IS_HINT_INTEGER(hint)) {
-                u->control[h] = roundf(control_values[h]);
+                switch (hint & LADSPA_HINT_DEFAULT_MASK) {
+
+                case LADSPA_HINT_DEFAULT_MINIMUM:
+                    u->control[h] = lower;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_MAXIMUM:
+                    u->control[h] = upper;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_LOW:
+                    if (LADSPA_IS_HINT_LOGARITHMIC(hint))
+                        u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
+                    else
+                        u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
+                    break;
+
+                case LADSPA_HINT_DEFAULT_MIDDLE:
+                    if (LADSPA_IS_HINT_LOGARITHMIC(hint))
+                        u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
+                    else
+                        u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
+                    break;
+
+                case LADSPA_HINT_DEFAULT_HIGH:
+                    if (LADSPA_IS_HINT_LOGARITHMIC(hint))
+                        u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
+                    else
+                        u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
+                    break;
+
+                case LADSPA_HINT_DEFAULT_0:
+                    u->control[h] = 0;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_1:
+                    u->control[h] = 1;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_100:
+                    u->control[h] = 100;
+                    break;
+
+                case LADSPA_HINT_DEFAULT_440:
+                    u->control[h] = 440;
+                    break;
+
+                default:
+                    pa_assert_not_reached();
+                }
             }
             else {
-                u->control[h] = control_values[h];
+                if (LADSPA_IS_HINT_INTEGER(hint)) {
+                    u->control[h] = roundf(control_values[h]);
+                }
+                else {
+                    u->control[h] = control_values[h];
+                }
             }
-        }
 
-        h++;
+            h++;
+        }
     }
 
     /* set the use_default array to the user data */
@@ -944,71 +1090,51 @@ static int write_control_parameters(struct userdata *u, double *control_values,
     return 0;
 }
 
-int pa__init(pa_module*m) {
-    struct userdata *u;
-    pa_sample_spec ss;
-    pa_channel_map map;
-    pa_modargs *ma;
-    char *t;
-    pa_sink *master;
-    pa_sink_input_new_data sink_input_data;
-    pa_sink_new_data sink_data;
-    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
-    LADSPA_Descriptor_Function descriptor_func;
-    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
-    const char *e, *cdata;
-    const LADSPA_Descriptor *d;
-    unsigned long p, h, j, n_control, c;
-    pa_memchunk silence;
-
-    pa_assert(m);
-
-    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
+/* Splits a '|' separated list of per-plugin values into exactly n items.
+ * If the list isn't given, all items are NULL. */
+static int split_plugin_list(const char *list, unsigned n, char **items) {
+    unsigned i;
 
-    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
-        pa_log("Failed to parse module arguments.");
-        goto fail;
-    }
+    for (i = 0; i < n; i++)
+        items[i] = NULL;
 
-    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
-        pa_log("Master sink not found");
-        goto fail;
-    }
+    if (!list)
+        return 0;
 
-    ss = master->sample_spec;
-    ss.format = PA_SAMPLE_FLOAT32;
-    map = master->channel_map;
-    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
-        pa_log("Invalid sample format specification or channel map");
-        goto fail;
-    }
+    for (i = 0; i < n; i++) {
+        const char *e = strchr(list, '|');
 
-    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
-        pa_log("Missing LADSPA plugin name");
-        goto fail;
-    }
+        if (!e != (i == n - 1)) {
+            for (; i > 0; i--) {
+                pa_xfree(items[i - 1]);
+                items[i - 1] = NULL;
+            }
+            return -1;
+        }
 
-    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
-        pa_log("Missing LADSPA plugin label");
-        goto fail;
+        if (e) {
+            items[i] = pa_xstrndup(list, (size_t) (e - list));
+            list = e + 1;
+        } else
+            items[i] = pa_xstrdup(list);
     }
 
-    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
-        pa_log_debug("Using default input ladspa port mapping");
+    return 0;
+}
 
-    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
-        pa_log_debug("Using default output ladspa port mapping");
+static void free_plugin_list(char **items, unsigned n) {
+    unsigned i;
 
-    cdata = pa_modargs_get_value(ma, "control", NULL);
+    for (i = 0; i < n; i++)
+        pa_xfree(items[i]);
+}
 
-    u = pa_xnew0(struct userdata, 1);
-    u->module = m;
-    m->userdata = u;
-    u->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
-    u->channels = 0;
-    u->input = NULL;
-    u->output = NULL;
-    u->ss = ss;
+static int load_plugin(struct plugin *pl, const char *plugin, const char *label) {
+    LADSPA_Descriptor_Function descriptor_func;
+    const LADSPA_Descriptor *d;
+    const char *e;
+    char *t;
+    unsigned long p, j;
 
     if (!(e = getenv("LADSPA_PATH")))
         e = LADSPA_PATH;
@@ -1016,32 +1142,32 @@ int pa__init(pa_module*m) {
     /* FIXME: This is not exactly thread safe */
     t = pa_xstrdup(lt_dlgetsearchpath());
     lt_dlsetsearchpath(e);
-    m->dl = lt_dlopenext(plugin);
+    pl->dl = lt_dlopenext(plugin);
     lt_dlsetsearchpath(t);
     pa_xfree(t);
 
-    if (!m->dl) {
+    if (!pl->dl) {
         pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
-        goto fail;
+        return -1;
     }
 
-    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(m->dl, NULL, "ladspa_descriptor"))) {
+    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(pl->dl, NULL, "ladspa_descriptor"))) {
         pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
-        goto fail;
+        return -1;
     }
 
     for (j = 0;; j++) {
 
         if (!(d = descriptor_func(j))) {
             pa_log("Failed to find plugin label '%s' in plugin '%s'.", label, plugin);
-            goto fail;
+            return -1;
         }
 
         if (pa_streq(d->Label, label))
             break;
     }
 
-    u->descriptor = d;
+    pl->descriptor = d;
 
     pa_log_debug("Module: %s", plugin);
     pa_log_debug("Label: %s", d->Label);
@@ -1050,8 +1176,7 @@ int pa__init(pa_module*m) {
     pa_log_debug("Maker: %s", d->Maker);
     pa_log_debug("Copyright: %s", d->Copyright);
 
-    n_control = 0;
-    u->channels = ss.channels;
+    pl->max_ladspaport_count = 1;
 
     /*
     * Enumerate ladspa ports
@@ -1061,33 +1186,33 @@ int pa__init(pa_module*m) {
         if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p])) {
             if (LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is input: %s", p, d->PortNames[p]);
-                input_ladspaport[u->input_count] = p;
-                u->input_count++;
+                pl->input_ladspaport[pl->input_count] = p;
+                pl->input_count++;
             } else if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is output: %s", p, d->PortNames[p]);
-                output_ladspaport[u->output_count] = p;
-                u->output_count++;
+                pl->output_ladspaport[pl->output_count] = p;
+                pl->output_count++;
             }
         } else if (LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
             pa_log_debug("Port %lu is control: %s", p, d->PortNames[p]);
-            n_control++;
+            pl->n_control++;
         } else
             pa_log_debug("Ignored port %s", d->PortNames[p]);
         /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
         /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
         /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
-        if (u->input_count > u->max_ladspaport_count)
-            u->max_ladspaport_count = u->input_count;
+        if (pl->input_count > pl->max_ladspaport_count)
+            pl->max_ladspaport_count = pl->input_count;
         else
-            u->max_ladspaport_count = u->output_count;
+            pl->max_ladspaport_count = pl->output_count;
     }
 
-    if (u->channels % u->max_ladspaport_count) {
-        pa_log("Cannot handle non-integral number of plugins required for given number of channels");
-        goto fail;
-    }
+    return 0;
+}
 
-    pa_log_debug("Will run %lu plugin instances", u->channels / u->max_ladspaport_count);
+static int parse_ladspaport_maps(struct plugin *pl, const char *input_ladspaport_map, const char *output_ladspaport_map) {
+    const LADSPA_Descriptor *d = pl->descriptor;
+    unsigned long p, c;
 
     /* Parse data for input ladspa port map */
     if (input_ladspaport_map) {
@@ -1095,20 +1220,20 @@ int pa__init(pa_module*m) {
         char *pname;
         c = 0;
         while ((pname = pa_split(input_ladspaport_map, ",", &state))) {
-            if (c == u->input_count) {
+            if (c == pl->input_count) {
                 pa_log("Too many ports in input ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
 
             for (p = 0; p < d->PortCount; p++) {
                 if (pa_streq(d->PortNames[p], pname)) {
                     if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
-                        input_ladspaport[c] = p;
+                        pl->input_ladspaport[c] = p;
                     } else {
                         pa_log("Port %s is not an audio input ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1123,19 +1248,19 @@ int pa__init(pa_module*m) {
         char *pname;
         c = 0;
         while ((pname = pa_split(output_ladspaport_map, ",", &state))) {
-            if (c == u->output_count) {
+            if (c == pl->output_count) {
                 pa_log("Too many ports in output ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
             for (p = 0; p < d->PortCount; p++) {
                 if (pa_streq(d->PortNames[p], pname)) {
                     if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p]) && LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-                        output_ladspaport[c] = p;
+                        pl->output_ladspaport[c] = p;
                     } else {
                         pa_log("Port %s is not an output ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1144,36 +1269,255 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
+    return 0;
+}
 
-    /* Create buffers */
+static int instantiate_plugin(struct userdata *u, struct plugin *pl) {
+    const LADSPA_Descriptor *d = pl->descriptor;
+    unsigned long h, c;
+
+    if (u->channels % pl->max_ladspaport_count) {
+        pa_log("Cannot handle non-integral number of plugins required for given number of channels");
+        return -1;
+    }
+
+    pl->n_instances = u->channels / pl->max_ladspaport_count;
+
+    pa_log_debug("Will run %lu instances of %s", pl->n_instances, d->Label);
+
+    /* Instances read their input from the channel buffers of their group
+     * and, unless that doesn't work for them, write back in place */
     if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
-        for (c = 0; c < u->input_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
-        for (c = 0; c < u->output_count; c++)
-            u->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    } else {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
-        for (c = 0; c < u->max_ladspaport_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = u->input;
+        pl->scratch = pa_xnew(LADSPA_Data*, (unsigned) (pl->n_instances * pl->output_count));
+        for (c = 0; c < pl->n_instances * pl->output_count; c++)
+            pl->scratch[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
     }
-    /* Initialize plugin instances */
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        if (!(u->handle[h] = d->instantiate(d, ss.rate))) {
-            pa_log("Failed to instantiate plugin %s with label %s", plugin, d->Label);
-            goto fail;
+
+    for (h = 0; h < pl->n_instances; h++) {
+        if (!(pl->handle[h] = d->instantiate(d, u->ss.rate))) {
+            pa_log("Failed to instantiate plugin with label %s", d->Label);
+            return -1;
+        }
+
+        for (c = 0; c < pl->input_count; c++)
+            d->connect_port(pl->handle[h], pl->input_ladspaport[c], u->buffer[h*pl->max_ladspaport_count + c]);
+        for (c = 0; c < pl->output_count; c++)
+            d->connect_port(pl->handle[h], pl->output_ladspaport[c],
+                            pl->scratch ? pl->scratch[h*pl->output_count + c] : u->buffer[h*pl->max_ladspaport_count + c]);
+    }
+
+    return 0;
+}
+
+static int start_workers(struct userdata *u, unsigned n_threads) {
+    unsigned i;
+
+    for (i = 1; i < u->n_plugins; i++)
+        if (u->plugins[i].n_instances != u->plugins[0].n_instances) {
+            pa_log_warn("The plugins group the channels differently, not running instances in parallel.");
+            return 0;
+        }
+
+    u->n_groups = u->plugins[0].n_instances;
+    n_threads = PA_MIN(n_threads, (unsigned) u->n_groups - 1);
+
+    if (n_threads == 0)
+        return 0;
+
+    pa_log_debug("Running %lu channel groups in %u threads", u->n_groups, n_threads + 1);
+
+    u->done = pa_semaphore_new(0);
+    u->workers = pa_xnew0(struct worker, n_threads);
+
+    for (i = 0; i < n_threads; i++) {
+        struct worker *w = &u->workers[i];
+
+        w->u = u;
+        w->index = i + 1;
+        w->start = pa_semaphore_new(0);
+
+        if (!(w->thread = pa_thread_new("ladspa-worker", worker_func, w))) {
+            pa_log("Failed to create worker thread.");
+            pa_semaphore_free(w->start);
+            return -1;
         }
 
-        for (c = 0; c < u->input_count; c++)
-            d->connect_port(u->handle[h], input_ladspaport[c], u->input[c]);
-        for (c = 0; c < u->output_count; c++)
-            d->connect_port(u->handle[h], output_ladspaport[c], u->output[c]);
+        u->n_workers++;
     }
 
-    u->n_control = n_control;
+    return 0;
+}
+
+static void stop_workers(struct userdata *u) {
+    unsigned i;
+
+    u->quit = true;
+
+    for (i = 0; i < u->n_workers; i++) {
+        pa_semaphore_post(u->workers[i].start);
+        pa_thread_free(u->workers[i].thread);
+        pa_semaphore_free(u->workers[i].start);
+    }
+
+    u->n_workers = 0;
+    pa_xfree(u->workers);
+    u->workers = NULL;
+
+    if (u->done) {
+        pa_semaphore_free(u->done);
+        u->done = NULL;
+    }
+}
+
+/* With a chain the properties list all plugins, separated by '|' just
+ * like the module arguments */
+static void set_plugin_properties(struct userdata *u, pa_proplist *p) {
+    pa_strbuf *name, *maker, *copyright, *unique_id;
+    char *t;
+    unsigned i;
+
+    name = pa_strbuf_new();
+    maker = pa_strbuf_new();
+    copyright = pa_strbuf_new();
+    unique_id = pa_strbuf_new();
+
+    for (i = 0; i < u->n_plugins; i++) {
+        const LADSPA_Descriptor *d = u->plugins[i].descriptor;
+        const char *sep = i > 0 ? "|" : "";
+
+        pa_strbuf_printf(name, "%s%s", sep, d->Name);
+        pa_strbuf_printf(maker, "%s%s", sep, d->Maker);
+        pa_strbuf_printf(copyright, "%s%s", sep, d->Copyright);
+        pa_strbuf_printf(unique_id, "%s%lu", sep, (unsigned long) d->UniqueID);
+    }
+
+    t = pa_strbuf_tostring_free(name);
+    pa_proplist_sets(p, "device.ladspa.name", t);
+    pa_xfree(t);
+
+    t = pa_strbuf_tostring_free(maker);
+    pa_proplist_sets(p, "device.ladspa.maker", t);
+    pa_xfree(t);
+
+    t = pa_strbuf_tostring_free(copyright);
+    pa_proplist_sets(p, "device.ladspa.copyright", t);
+    pa_xfree(t);
+
+    t = pa_strbuf_tostring_free(unique_id);
+    pa_proplist_sets(p, "device.ladspa.unique_id", t);
+    pa_xfree(t);
+}
+
+int pa__init(pa_module*m) {
+    struct userdata *u;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_modargs *ma;
+    pa_sink *master;
+    pa_sink_input_new_data sink_input_data;
+    pa_sink_new_data sink_data;
+    const char *plugin, *label;
+    char *plugins[MAX_PLUGINS] = { NULL }, *labels[MAX_PLUGINS] = { NULL }, *controls[MAX_PLUGINS] = { NULL };
+    char *input_ladspaport_maps[MAX_PLUGINS] = { NULL }, *output_ladspaport_maps[MAX_PLUGINS] = { NULL };
+    const char *e;
+    unsigned long c;
+    unsigned i, n_plugins;
+    uint32_t n_threads = 0;
+    pa_memchunk silence;
+
+    pa_assert(m);
+
+    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments.");
+        goto fail;
+    }
+
+    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
+        pa_log("Master sink not found");
+        goto fail;
+    }
+
+    ss = master->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32;
+    map = master->channel_map;
+    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
+        pa_log("Invalid sample format specification or channel map");
+        goto fail;
+    }
+
+    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
+        pa_log("Missing LADSPA plugin name");
+        goto fail;
+    }
+
+    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
+        pa_log("Missing LADSPA plugin label");
+        goto fail;
+    }
+
+    for (n_plugins = 1, e = plugin; (e = strchr(e, '|')); e++)
+        n_plugins++;
+
+    if (n_plugins > MAX_PLUGINS) {
+        pa_log("Too many plugins, at most %u can be chained", MAX_PLUGINS);
+        goto fail;
+    }
+
+    if (split_plugin_list(plugin, n_plugins, plugins) < 0 ||
+        split_plugin_list(label, n_plugins, labels) < 0) {
+        pa_log("Number of plugin names and labels doesn't match");
+        goto fail;
+    }
+
+    if (split_plugin_list(pa_modargs_get_value(ma, "control", NULL), n_plugins, controls) < 0) {
+        pa_log("Number of control value lists doesn't match the number of plugins");
+        goto fail;
+    }
+
+    if (split_plugin_list(pa_modargs_get_value(ma, "input_ladspaport_map", NULL), n_plugins, input_ladspaport_maps) < 0 ||
+        split_plugin_list(pa_modargs_get_value(ma, "output_ladspaport_map", NULL), n_plugins, output_ladspaport_maps) < 0) {
+        pa_log("Number of ladspa port maps doesn't match the number of plugins");
+        goto fail;
+    }
+
+    if (!pa_modargs_get_value(ma, "input_ladspaport_map", NULL))
+        pa_log_debug("Using default input ladspa port mapping");
+
+    if (!pa_modargs_get_value(ma, "output_ladspaport_map", NULL))
+        pa_log_debug("Using default output ladspa port mapping");
+
+    if (pa_modargs_get_value_u32(ma, "threads", &n_threads) < 0 || n_threads >= PA_CHANNELS_MAX) {
+        pa_log("threads= expects a number below %u", PA_CHANNELS_MAX);
+        goto fail;
+    }
+
+    u = pa_xnew0(struct userdata, 1);
+    u->module = m;
+    m->userdata = u;
+    u->plugins = pa_xnew0(struct plugin, n_plugins);
+    u->n_plugins = n_plugins;
+    u->channels = ss.channels;
+    u->ss = ss;
+
+    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
+
+    /* Create buffers */
+    for (c = 0; c < u->channels; c++)
+        u->buffer[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+
+    for (i = 0; i < n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+
+        if (load_plugin(pl, plugins[i], labels[i]) < 0 ||
+            parse_ladspaport_maps(pl, input_ladspaport_maps[i], output_ladspaport_maps[i]) < 0 ||
+            instantiate_plugin(u, pl) < 0)
+            goto fail;
+
+        pl->control_offset = u->n_control;
+        u->n_control += pl->n_control;
+    }
 
     if (u->n_control > 0) {
         double *control_values;
@@ -1187,8 +1531,16 @@ int pa__init(pa_module*m) {
         u->control = pa_xnew(LADSPA_Data, (unsigned) u->n_control);
         u->use_default = pa_xnew(bool, (unsigned) u->n_control);
 
-        if ((parse_control_parameters(u, cdata, control_values, use_default) < 0) ||
-            (write_control_parameters(u, control_values, use_default) < 0)) {
+        for (i = 0; i < n_plugins; i++) {
+            struct plugin *pl = &u->plugins[i];
+
+            if (pl->n_control > 0 &&
+                parse_control_parameters(pl->n_control, controls[i],
+                                         control_values + pl->control_offset, use_default + pl->control_offset) < 0)
+                break;
+        }
+
+        if (i < n_plugins || write_control_parameters(u, control_values, use_default) < 0) {
             pa_xfree(control_values);
             pa_xfree(use_default);
 
@@ -1201,9 +1553,16 @@ int pa__init(pa_module*m) {
         pa_xfree(use_default);
     }
 
-    if (d->activate)
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->activate(u->handle[c]);
+    for (i = 0; i < n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+
+        if (pl->descriptor->activate)
+            for (c = 0; c < pl->n_instances; c++)
+                pl->descriptor->activate(pl->handle[c]);
+    }
+
+    if (n_threads > 0 && start_workers(u, n_threads) < 0)
+        goto fail;
 
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
@@ -1216,11 +1575,8 @@ int pa__init(pa_module*m) {
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
     pa_proplist_sets(sink_data.proplist, "device.ladspa.module", plugin);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", d->Label);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", d->Name);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", d->Maker);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", d->Copyright);
-    pa_proplist_setf(sink_data.proplist, "device.ladspa.unique_id", "%lu", (unsigned long) d->UniqueID);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", label);
+    set_plugin_properties(u, sink_data.proplist);
 
     if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
         pa_log("Invalid properties");
@@ -1232,7 +1588,8 @@ int pa__init(pa_module*m) {
         const char *z;
 
         z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s", d->Name, z ? z : master->name);
+        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s",
+                         pa_proplist_gets(sink_data.proplist, "device.ladspa.name"), z ? z : master->name);
     }
 
     u->sink = pa_sink_new(m->core, &sink_data,
@@ -1299,12 +1656,24 @@ int pa__init(pa_module*m) {
 
     pa_modargs_free(ma);
 
+    free_plugin_list(plugins, MAX_PLUGINS);
+    free_plugin_list(labels, MAX_PLUGINS);
+    free_plugin_list(controls, MAX_PLUGINS);
+    free_plugin_list(input_ladspaport_maps, MAX_PLUGINS);
+    free_plugin_list(output_ladspaport_maps, MAX_PLUGINS);
+
     return 0;
 
 fail:
     if (ma)
         pa_modargs_free(ma);
 
+    free_plugin_list(plugins, MAX_PLUGINS);
+    free_plugin_list(labels, MAX_PLUGINS);
+    free_plugin_list(controls, MAX_PLUGINS);
+    free_plugin_list(input_ladspaport_maps, MAX_PLUGINS);
+    free_plugin_list(output_ladspaport_maps, MAX_PLUGINS);
+
     pa__done(m);
 
     return -1;
@@ -1321,7 +1690,8 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
-    unsigned c;
+    unsigned long c;
+    unsigned i;
 
     pa_assert(m);
 
@@ -1347,36 +1717,37 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    for (c = 0; c < (u->channels / u->max_ladspaport_count); c++) {
-        if (u->handle[c]) {
-            if (u->descriptor->deactivate)
-                u->descriptor->deactivate(u->handle[c]);
-            u->descriptor->cleanup(u->handle[c]);
-        }
-    }
+    /* The IO thread doesn't call us anymore, so the workers are idle */
+    stop_workers(u);
 
-    if (u->output == u->input) {
-        if (u->input != NULL) {
-            for (c = 0; c < u->max_ladspaport_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-    } else {
-        if (u->input != NULL) {
-            for (c = 0; c < u->input_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+
+        for (c = 0; c < pl->n_instances; c++) {
+            if (pl->handle[c]) {
+                if (pl->descriptor->deactivate)
+                    pl->descriptor->deactivate(pl->handle[c]);
+                pl->descriptor->cleanup(pl->handle[c]);
+            }
         }
-        if (u->output != NULL) {
-            for (c = 0; c < u->output_count; c++)
-                pa_xfree(u->output[c]);
-            pa_xfree(u->output);
+
+        if (pl->scratch) {
+            for (c = 0; c < pl->n_instances * pl->output_count; c++)
+                pa_xfree(pl->scratch[c]);
+            pa_xfree(pl->scratch);
         }
+
+        if (pl->dl)
+            lt_dlclose(pl->dl);
     }
 
+    for (c = 0; c < u->channels; c++)
+        pa_xfree(u->buffer[c]);
+
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
+    pa_xfree(u->plugins);
     pa_xfree(u->control);
     pa_xfree(u->use_default);
     pa_xfree(u);
@@ -55,7 +55,9 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "incremental_rewind=<keep a mix history to rewind only the streams that changed?> "
+        "numa_node=<NUMA node to bind the IO thread to, -1 for none>");
 
 #define DEFAULT_SINK_NAME "null"
 #define BLOCK_USEC (PA_USEC_PER_SEC * 2)
@@ -80,6 +82,8 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "incremental_rewind",
+    "numa_node",
     NULL
 };
 
@@ -250,6 +254,8 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     pa_sink_new_data data;
     size_t nbytes;
+    bool incremental_rewind = false;
+    int32_t numa_node;
 
     pa_assert(m);
 
@@ -265,6 +271,17 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "incremental_rewind", &incremental_rewind) < 0) {
+        pa_log("Failed to parse incremental_rewind argument.");
+        goto fail;
+    }
+
+    numa_node = m->core->numa_node;
+    if (pa_modargs_get_value_s32(ma, "numa_node", &numa_node) < 0) {
+        pa_log("Failed to parse numa_node argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
@@ -277,6 +294,7 @@ int pa__init(pa_module*m) {
     pa_sink_new_data_set_name(&data, pa_modargs_get_value(ma, "sink_name", DEFAULT_SINK_NAME));
     pa_sink_new_data_set_sample_spec(&data, &ss);
     pa_sink_new_data_set_channel_map(&data, &map);
+    pa_sink_new_data_set_numa_node(&data, numa_node);
     pa_proplist_sets(data.proplist, PA_PROP_DEVICE_DESCRIPTION, _("Null Output"));
     pa_proplist_sets(data.proplist, PA_PROP_DEVICE_CLASS, "abstract");
 
@@ -305,6 +323,7 @@ int pa__init(pa_module*m) {
     nbytes = pa_usec_to_bytes(u->block_usec, &u->sink->sample_spec);
     pa_sink_set_max_rewind(u->sink, nbytes);
     pa_sink_set_max_request(u->sink, nbytes);
+    pa_sink_set_incremental_rewind(u->sink, incremental_rewind);
 
     if (!(u->thread = pa_thread_new("null-sink", thread_func, u))) {
         pa_log("Failed to create thread.");
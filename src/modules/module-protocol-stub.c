@@ -96,7 +96,7 @@
 #  define TCPWRAP_SERVICE "pulseaudio-http"
 #  define IPV4_PORT 4714
 #  define UNIX_SOCKET "http"
-#  define MODULE_ARGUMENTS
+#  define MODULE_ARGUMENTS "max-connections", "listen-fanout",
 
 #  ifdef USE_TCP_SOCKETS
 #    include "module-http-protocol-tcp-symdef.h"
@@ -105,7 +105,9 @@
 #  endif
 
   PA_MODULE_DESCRIPTION("HTTP "SOCKET_DESCRIPTION);
-  PA_MODULE_USAGE(SOCKET_USAGE);
+  PA_MODULE_USAGE("max-connections=<maximum number of concurrent connections> "
+                  "listen-fanout=<share one stream between all listeners of a source?> "
+                  SOCKET_USAGE);
 #elif defined(USE_PROTOCOL_NATIVE)
 #  include <pulsecore/protocol-native.h>
 #  define TCPWRAP_SERVICE "pulseaudio-native"
@@ -194,6 +196,7 @@ struct userdata {
     pa_cli_protocol *cli_protocol;
 #elif defined(USE_PROTOCOL_HTTP)
     pa_http_protocol *http_protocol;
+    pa_http_options *http_options;
 #elif defined(USE_PROTOCOL_NATIVE)
     pa_native_protocol *native_protocol;
     pa_native_options *native_options;
@@ -225,7 +228,7 @@ static void socket_server_on_connection_cb(pa_socket_server*s, pa_iochannel *io,
 #elif defined(USE_PROTOCOL_CLI)
     pa_cli_protocol_connect(u->cli_protocol, io, u->module);
 #elif defined(USE_PROTOCOL_HTTP)
-    pa_http_protocol_connect(u->http_protocol, io, u->module);
+    pa_http_protocol_connect(u->http_protocol, io, u->http_options);
 #elif defined(USE_PROTOCOL_NATIVE)
     pa_native_protocol_connect(u->native_protocol, io, u->native_options);
 #else
@@ -270,6 +273,11 @@ int pa__init(pa_module*m) {
     u->cli_protocol = pa_cli_protocol_get(m->core);
 #elif defined(USE_PROTOCOL_HTTP)
     u->http_protocol = pa_http_protocol_get(m->core);
+
+    u->http_options = pa_http_options_new();
+    if (pa_http_options_parse(u->http_options, m->core, ma) < 0)
+        goto fail;
+    u->http_options->module = m;
 #elif defined(USE_PROTOCOL_NATIVE)
     u->native_protocol = pa_native_protocol_get(m->core);
 
@@ -456,6 +464,8 @@ void pa__done(pa_module*m) {
         pa_http_protocol_disconnect(u->http_protocol, u->module);
         pa_http_protocol_unref(u->http_protocol);
     }
+    if (u->http_options)
+        pa_http_options_unref(u->http_options);
 #elif defined(USE_PROTOCOL_NATIVE)
     if (u->native_protocol) {
 
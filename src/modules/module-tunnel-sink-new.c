@@ -30,8 +30,10 @@
 #include <pulse/mainloop.h>
 #include <pulse/introspect.h>
 #include <pulse/error.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/core.h>
+#include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/i18n.h>
 #include <pulsecore/sink.h>
@@ -41,6 +43,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/poll.h>
 #include <pulsecore/proplist-util.h>
+#include <pulsecore/sconv.h>
 
 #include "module-tunnel-sink-new-symdef.h"
 
@@ -57,11 +60,14 @@ PA_MODULE_USAGE(
         "channels=<number of channels> "
         "rate=<sample rate> "
         "channel_map=<channel map> "
-        "cookie=<cookie file path>"
+        "cookie=<cookie file path> "
+        "remote_format=<transmit in the sample format of the remote sink> "
         );
 
 #define TUNNEL_THREAD_FAILED_MAINLOOP 1
 
+#define STATS_INTERVAL (10 * PA_USEC_PER_SEC)
+
 static void stream_state_cb(pa_stream *stream, void *userdata);
 static void stream_changed_buffer_attr_cb(pa_stream *stream, void *userdata);
 static void stream_set_buffer_attr_cb(pa_stream *stream, int success, void *userdata);
@@ -86,6 +92,24 @@ struct userdata {
     char *cookie_file;
     char *remote_server;
     char *remote_sink_name;
+
+    /* With remote_format=yes, the stream is created with the sample format
+     * of the remote sink if that one is smaller, and the rendered data is
+     * converted on the fly. Since the remote sink would reduce the data to
+     * its format anyway this costs no quality, but can halve the bandwidth
+     * for float sinks. */
+    bool remote_format;
+    pa_sample_spec stream_ss;
+    pa_convert_func_t to_float, from_float;
+    float *convert_buf;
+    size_t convert_buf_samples;
+
+    struct {
+        uint64_t rendered, sent;
+        pa_usec_t convert_usec;
+        pa_usec_t start, last_report;
+        uint64_t last_sent;
+    } stats;
 };
 
 static const char* const valid_modargs[] = {
@@ -98,6 +122,7 @@ static const char* const valid_modargs[] = {
     "rate",
     "channel_map",
     "cookie",
+    "remote_format",
    /* "reconnect", reconnect if server comes back again - unimplemented */
     NULL,
 };
@@ -122,6 +147,128 @@ static pa_proplist* tunnel_new_proplist(struct userdata *u) {
     return proplist;
 }
 
+/* Converts a length in bytes of the stream to bytes of the sink */
+static size_t stream_to_sink_bytes(struct userdata *u, size_t nbytes) {
+    return nbytes / pa_frame_size(&u->stream_ss) * pa_frame_size(&u->sink->sample_spec);
+}
+
+static size_t sink_to_stream_bytes(struct userdata *u, size_t nbytes) {
+    return nbytes / pa_frame_size(&u->sink->sample_spec) * pa_frame_size(&u->stream_ss);
+}
+
+/* Renders straight into the buffer of the stream, which is shared memory
+ * when the remote server is local. */
+static int write_direct(struct userdata *u, size_t writable) {
+    while (writable > 0) {
+        pa_memchunk target;
+        void *data;
+        size_t nbytes = writable;
+
+        if (pa_stream_begin_write(u->stream, &data, &nbytes) < 0)
+            return -1;
+
+        nbytes = pa_frame_align(PA_MIN(nbytes, writable), &u->sink->sample_spec);
+        if (nbytes == 0) {
+            pa_stream_cancel_write(u->stream);
+            break;
+        }
+
+        target.memblock = pa_memblock_new_fixed(u->module->core->mempool, data, nbytes, false);
+        target.index = 0;
+        target.length = nbytes;
+
+        pa_sink_render_into_full(u->sink, &target);
+        pa_memblock_unref_fixed(target.memblock);
+
+        if (pa_stream_write(u->stream, data, nbytes, NULL, 0, PA_SEEK_RELATIVE) < 0)
+            return -1;
+
+        u->stats.rendered += nbytes;
+        u->stats.sent += nbytes;
+        writable -= nbytes;
+    }
+
+    return 0;
+}
+
+/* Renders in the format of the sink and converts into the buffer of the
+ * stream */
+static int write_converted(struct userdata *u, size_t writable) {
+    while (writable > 0) {
+        pa_memchunk chunk;
+        pa_usec_t start;
+        void *data;
+        const uint8_t *src;
+        size_t nbytes = writable;
+        unsigned n;
+
+        if (pa_stream_begin_write(u->stream, &data, &nbytes) < 0)
+            return -1;
+
+        nbytes = pa_frame_align(PA_MIN(nbytes, writable), &u->stream_ss);
+        if (nbytes == 0) {
+            pa_stream_cancel_write(u->stream);
+            break;
+        }
+
+        pa_sink_render_full(u->sink, stream_to_sink_bytes(u, nbytes), &chunk);
+
+        start = pa_rtclock_now();
+
+        n = (unsigned) (nbytes / pa_sample_size(&u->stream_ss));
+        src = (const uint8_t *) pa_memblock_acquire(chunk.memblock) + chunk.index;
+
+        if (u->to_float) {
+            if (u->convert_buf_samples < n) {
+                pa_xfree(u->convert_buf);
+                u->convert_buf = pa_xnew(float, n);
+                u->convert_buf_samples = n;
+            }
+
+            u->to_float(n, src, u->convert_buf);
+            u->from_float(n, u->convert_buf, data);
+        } else
+            u->from_float(n, src, data);
+
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        u->stats.convert_usec += pa_rtclock_now() - start;
+
+        if (pa_stream_write(u->stream, data, nbytes, NULL, 0, PA_SEEK_RELATIVE) < 0)
+            return -1;
+
+        u->stats.rendered += stream_to_sink_bytes(u, nbytes);
+        u->stats.sent += nbytes;
+        writable -= nbytes;
+    }
+
+    return 0;
+}
+
+static void report_stats(struct userdata *u, bool final) {
+    pa_usec_t now = pa_rtclock_now();
+
+    if (u->stats.start == 0) {
+        u->stats.start = u->stats.last_report = now;
+        return;
+    }
+
+    if (!final && now - u->stats.last_report < STATS_INTERVAL)
+        return;
+
+    if (u->stats.rendered > 0)
+        pa_log_debug("Sent %llu bytes for %llu bytes rendered (%0.0f%%), %0.1f kbit/s now, %0.2f%% of the time converting",
+                     (unsigned long long) u->stats.sent,
+                     (unsigned long long) u->stats.rendered,
+                     100.0 * u->stats.sent / u->stats.rendered,
+                     (double) (u->stats.sent - u->stats.last_sent) * 8 * PA_USEC_PER_MSEC / PA_MAX(now - u->stats.last_report, 1U),
+                     100.0 * u->stats.convert_usec / PA_MAX(now - u->stats.start, 1U));
+
+    u->stats.last_report = now;
+    u->stats.last_sent = u->stats.sent;
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
     pa_proplist *proplist;
@@ -182,29 +329,17 @@ static void thread_func(void *userdata) {
 
                 writable = pa_stream_writable_size(u->stream);
                 if (writable > 0) {
-                    pa_memchunk memchunk;
-                    const void *p;
-
-                    pa_sink_render_full(u->sink, writable, &memchunk);
-
-                    pa_assert(memchunk.length > 0);
-
-                    /* we have new data to write */
-                    p = pa_memblock_acquire(memchunk.memblock);
-                    /* TODO: Use pa_stream_begin_write() to reduce copying. */
-                    ret = pa_stream_write(u->stream,
-                                          (uint8_t*) p + memchunk.index,
-                                          memchunk.length,
-                                          NULL,     /**< A cleanup routine for the data or NULL to request an internal copy */
-                                          0,        /** offset */
-                                          PA_SEEK_RELATIVE);
-                    pa_memblock_release(memchunk.memblock);
-                    pa_memblock_unref(memchunk.memblock);
+                    if (u->to_float || u->from_float)
+                        ret = write_converted(u, writable);
+                    else
+                        ret = write_direct(u, writable);
 
                     if (ret != 0) {
                         pa_log_error("Could not write data into the stream ... ret = %i", ret);
                         u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
                     }
+
+                    report_stats(u, false);
                 }
             }
         }
@@ -214,6 +349,8 @@ fail:
     pa_asyncmsgq_wait_for(u->thread_mq->inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
+    report_stats(u, true);
+
     if (u->stream) {
         pa_stream_disconnect(u->stream);
         pa_stream_unref(u->stream);
@@ -265,7 +402,7 @@ static void stream_changed_buffer_attr_cb(pa_stream *stream, void *userdata) {
     pa_assert(u);
 
     bufferattr = pa_stream_get_buffer_attr(u->stream);
-    pa_sink_set_max_request_within_thread(u->sink, bufferattr->tlength);
+    pa_sink_set_max_request_within_thread(u->sink, stream_to_sink_bytes(u, bufferattr->tlength));
 }
 
 /* called after we requested a change of the stream buffer_attr */
@@ -273,6 +410,92 @@ static void stream_set_buffer_attr_cb(pa_stream *stream, int success, void *user
     stream_changed_buffer_attr_cb(stream, userdata);
 }
 
+/* Creates the stream in the format of the sink, or in remote_ss if that is
+ * given and has smaller samples */
+static void create_stream(struct userdata *u, const pa_sample_spec *remote_ss) {
+    pa_proplist *proplist;
+    pa_buffer_attr bufferattr;
+    pa_usec_t requested_latency;
+    char *username = pa_get_user_name_malloc();
+    char *hostname = pa_get_host_name_malloc();
+    /* TODO: old tunnel put here the remote sink_name into stream name e.g. 'Null Output for lynxis@lazus' */
+    char *stream_name = pa_sprintf_malloc(_("Tunnel for %s@%s"), username, hostname);
+    pa_xfree(hostname);
+    pa_xfree(username);
+
+    pa_log_debug("Creating stream.");
+    pa_assert(!u->stream);
+
+    u->stream_ss = u->sink->sample_spec;
+    u->to_float = u->from_float = NULL;
+
+    if (remote_ss && pa_sample_size(remote_ss) < pa_sample_size(&u->sink->sample_spec) &&
+        pa_get_convert_from_float32ne_function(remote_ss->format)) {
+        u->stream_ss.format = remote_ss->format;
+        u->from_float = pa_get_convert_from_float32ne_function(u->stream_ss.format);
+
+        if (u->sink->sample_spec.format != PA_SAMPLE_FLOAT32NE)
+            u->to_float = pa_get_convert_to_float32ne_function(u->sink->sample_spec.format);
+
+        pa_log_info("Transmitting as %s instead of %s, like the remote sink.",
+                    pa_sample_format_to_string(u->stream_ss.format),
+                    pa_sample_format_to_string(u->sink->sample_spec.format));
+    }
+
+    proplist = tunnel_new_proplist(u);
+    u->stream = pa_stream_new_with_proplist(u->context,
+                                            stream_name,
+                                            &u->stream_ss,
+                                            &u->sink->channel_map,
+                                            proplist);
+    pa_proplist_free(proplist);
+    pa_xfree(stream_name);
+
+    if (!u->stream) {
+        pa_log_error("Could not create a stream.");
+        u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
+        return;
+    }
+
+    requested_latency = pa_sink_get_requested_latency_within_thread(u->sink);
+    if (requested_latency == (uint32_t) -1)
+        requested_latency = u->sink->thread_info.max_latency;
+
+    reset_bufferattr(&bufferattr);
+    bufferattr.tlength = pa_usec_to_bytes(requested_latency, &u->stream_ss);
+
+    pa_stream_set_state_callback(u->stream, stream_state_cb, u);
+    pa_stream_set_buffer_attr_callback(u->stream, stream_changed_buffer_attr_cb, u);
+    if (pa_stream_connect_playback(u->stream,
+                                   u->remote_sink_name,
+                                   &bufferattr,
+                                   PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_DONT_MOVE | PA_STREAM_START_CORKED | PA_STREAM_AUTO_TIMING_UPDATE,
+                                   NULL,
+                                   NULL) < 0) {
+        pa_log_error("Could not connect stream.");
+        u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
+    }
+    u->connected = true;
+}
+
+static void remote_sink_info_cb(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+
+    if (u->stream)
+        return;
+
+    if (i)
+        create_stream(u, &i->sample_spec);
+    else {
+        if (eol < 0)
+            pa_log_warn("Could not get the remote sink format: %s", pa_strerror(pa_context_errno(c)));
+
+        create_stream(u, NULL);
+    }
+}
+
 static void context_state_cb(pa_context *c, void *userdata) {
     struct userdata *u = userdata;
     pa_assert(u);
@@ -284,53 +507,24 @@ static void context_state_cb(pa_context *c, void *userdata) {
         case PA_CONTEXT_SETTING_NAME:
             break;
         case PA_CONTEXT_READY: {
-            pa_proplist *proplist;
-            pa_buffer_attr bufferattr;
-            pa_usec_t requested_latency;
-            char *username = pa_get_user_name_malloc();
-            char *hostname = pa_get_host_name_malloc();
-            /* TODO: old tunnel put here the remote sink_name into stream name e.g. 'Null Output for lynxis@lazus' */
-            char *stream_name = pa_sprintf_malloc(_("Tunnel for %s@%s"), username, hostname);
-            pa_xfree(hostname);
-            pa_xfree(username);
-
-            pa_log_debug("Connection successful. Creating stream.");
-            pa_assert(!u->stream);
-
-            proplist = tunnel_new_proplist(u);
-            u->stream = pa_stream_new_with_proplist(u->context,
-                                                    stream_name,
-                                                    &u->sink->sample_spec,
-                                                    &u->sink->channel_map,
-                                                    proplist);
-            pa_proplist_free(proplist);
-            pa_xfree(stream_name);
+            pa_operation *operation;
 
-            if (!u->stream) {
-                pa_log_error("Could not create a stream.");
-                u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
-                return;
+            pa_log_debug("Connection successful.");
+
+            if (!u->remote_format) {
+                create_stream(u, NULL);
+                break;
             }
 
-            requested_latency = pa_sink_get_requested_latency_within_thread(u->sink);
-            if (requested_latency == (uint32_t) -1)
-                requested_latency = u->sink->thread_info.max_latency;
-
-            reset_bufferattr(&bufferattr);
-            bufferattr.tlength = pa_usec_to_bytes(requested_latency, &u->sink->sample_spec);
-
-            pa_stream_set_state_callback(u->stream, stream_state_cb, userdata);
-            pa_stream_set_buffer_attr_callback(u->stream, stream_changed_buffer_attr_cb, userdata);
-            if (pa_stream_connect_playback(u->stream,
-                                           u->remote_sink_name,
-                                           &bufferattr,
-                                           PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_DONT_MOVE | PA_STREAM_START_CORKED | PA_STREAM_AUTO_TIMING_UPDATE,
-                                           NULL,
-                                           NULL) < 0) {
-                pa_log_error("Could not connect stream.");
+            /* The stream is created once we know the remote sink */
+            if (!(operation = pa_context_get_sink_info_by_name(c, u->remote_sink_name ? u->remote_sink_name : "@DEFAULT_SINK@",
+                                                               remote_sink_info_cb, u))) {
+                pa_log_error("Could not query the remote sink.");
                 u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
+                return;
             }
-            u->connected = true;
+
+            pa_operation_unref(operation);
             break;
         }
         case PA_CONTEXT_FAILED:
@@ -366,11 +560,11 @@ static void sink_update_requested_latency_cb(pa_sink *s) {
     if (u->stream) {
         switch (pa_stream_get_state(u->stream)) {
             case PA_STREAM_READY:
-                if (pa_stream_get_buffer_attr(u->stream)->tlength == nbytes)
+                if (pa_stream_get_buffer_attr(u->stream)->tlength == sink_to_stream_bytes(u, nbytes))
                     break;
 
                 reset_bufferattr(&bufferattr);
-                bufferattr.tlength = nbytes;
+                bufferattr.tlength = sink_to_stream_bytes(u, nbytes);
                 if ((operation = pa_stream_set_buffer_attr(u->stream, &bufferattr, stream_set_buffer_attr_cb, u)))
                     pa_operation_unref(operation);
                 break;
@@ -462,6 +656,11 @@ int pa__init(pa_module *m) {
     u->cookie_file = pa_xstrdup(pa_modargs_get_value(ma, "cookie", NULL));
     u->remote_sink_name = pa_xstrdup(pa_modargs_get_value(ma, "sink", NULL));
 
+    if (pa_modargs_get_value_boolean(ma, "remote_format", &u->remote_format) < 0) {
+        pa_log("Failed to parse remote_format value.");
+        goto fail;
+    }
+
     u->thread_mq = pa_xnew0(pa_thread_mq, 1);
     pa_thread_mq_init_thread_mainloop(u->thread_mq, m->core->mainloop, u->thread_mainloop_api);
 
@@ -497,6 +696,9 @@ int pa__init(pa_module *m) {
 
     pa_sink_new_data_done(&sink_data);
     u->sink->userdata = u;
+
+    /* Until the remote sink is known */
+    u->stream_ss = u->sink->sample_spec;
     u->sink->parent.process_msg = sink_process_msg_cb;
     u->sink->update_requested_latency = sink_update_requested_latency_cb;
 
@@ -559,6 +761,8 @@ void pa__done(pa_module *m) {
     if (u->remote_server)
         pa_xfree(u->remote_server);
 
+    pa_xfree(u->convert_buf);
+
     if (u->sink)
         pa_sink_unref(u->sink);
 
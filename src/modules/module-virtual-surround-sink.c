@@ -246,6 +246,20 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_assert(n > 0);
 
+    tchunk.length = n * u->sink_fs;
+
+    /* Once the input buffer holds nothing but silence, the output is
+     * silent as well and folding it can be skipped. The buffer stays all
+     * zeros, so where its offset points doesn't matter. */
+    if (pa_sink_input_silence_decayed(i, &tchunk, u->hrir_samples * u->sink_fs)) {
+        pa_silence_memchunk_get(&i->sink->core->silence_cache, i->sink->core->mempool, chunk, &i->sample_spec, n * u->fs);
+        pa_memblockq_drop(u->memblockq, chunk->length / u->fs * u->sink_fs);
+        pa_memblock_unref(tchunk.memblock);
+
+        pa_atomic_inc(&i->metrics.dsp_skipped);
+        return 0;
+    }
+
     chunk->index = 0;
     chunk->length = n * u->fs;
     chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
@@ -61,6 +61,10 @@ static void context_stat_callback(pa_pdispatch *pd, uint32_t command, uint32_t t
                pa_tagstruct_getu32(t, &i.memblock_allocated) < 0 ||
                pa_tagstruct_getu32(t, &i.memblock_allocated_size) < 0 ||
                pa_tagstruct_getu32(t, &i.scache_size) < 0 ||
+               (o->context->version >= 30 &&
+                (pa_tagstruct_getu32(t, &i.scache_converted_size) < 0 ||
+                 pa_tagstruct_getu64(t, &i.scache_hits) < 0 ||
+                 pa_tagstruct_getu64(t, &i.scache_misses) < 0)) ||
                !pa_tagstruct_eof(t)) {
         pa_context_fail(o->context, PA_ERR_PROTOCOL);
         goto finish;
@@ -669,6 +669,9 @@ typedef struct pa_stat_info {
     uint32_t memblock_allocated;       /**< Allocated memory blocks during the whole lifetime of the daemon. */
     uint32_t memblock_allocated_size;  /**< Total size of all memory blocks allocated during the whole lifetime of the daemon. */
     uint32_t scache_size;              /**< Total size of all sample cache entries. */
+    uint32_t scache_converted_size;    /**< Total size of the copies of sample cache entries converted to the format of a sink. \since 6.0 */
+    uint64_t scache_hits;              /**< Number of samples played without converting them first. \since 6.0 */
+    uint64_t scache_misses;            /**< Number of samples that needed to be converted to be played. \since 6.0 */
 } pa_stat_info;
 
 /** Callback prototype for pa_context_stat() */
@@ -25,6 +25,9 @@
 
 #include <stdio.h>
 
+#include <pulse/fork-detect.h>
+#include <pulse/volume.h>
+
 #include <pulsecore/macro.h>
 #include <pulsecore/pstream-util.h>
 
@@ -58,6 +61,48 @@ finish:
     pa_context_unref(c);
 }
 
+void pa_command_meter_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_METER_EVENT);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    pa_context_ref(c);
+
+    while (!pa_tagstruct_eof(t)) {
+        pa_meter_info i;
+        pa_cvolume peak, rms;
+        uint32_t facility;
+        unsigned k;
+
+        if (pa_tagstruct_getu32(t, &facility) < 0 ||
+            pa_tagstruct_getu32(t, &i.index) < 0 ||
+            pa_tagstruct_get_cvolume(t, &peak) < 0 ||
+            pa_tagstruct_get_cvolume(t, &rms) < 0 ||
+            peak.channels != rms.channels) {
+            pa_context_fail(c, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        i.facility = facility;
+        i.channels = peak.channels;
+
+        for (k = 0; k < i.channels; k++) {
+            i.peak[k] = (float) pa_sw_volume_to_linear(peak.values[k]);
+            i.rms[k] = (float) pa_sw_volume_to_linear(rms.values[k]);
+        }
+
+        if (c->meter_callback)
+            c->meter_callback(c, &i, c->meter_userdata);
+    }
+
+finish:
+    pa_context_unref(c);
+}
+
 pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_context_success_cb_t cb, void *userdata) {
     pa_operation *o;
     pa_tagstruct *t;
@@ -88,3 +133,66 @@ void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t
     c->subscribe_callback = cb;
     c->subscribe_userdata = userdata;
 }
+
+pa_operation* pa_context_subscribe_meter(pa_context *c, pa_subscription_event_type_t facility, uint32_t idx, pa_usec_t interval, pa_context_success_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 30, PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c,
+                                  facility == PA_SUBSCRIPTION_EVENT_SINK ||
+                                  facility == PA_SUBSCRIPTION_EVENT_SOURCE ||
+                                  facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, idx != PA_INVALID_INDEX, PA_ERR_INVALID);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_SUBSCRIBE_METER, &tag);
+    pa_tagstruct_putu32(t, facility);
+    pa_tagstruct_putu32(t, idx);
+    pa_tagstruct_put_usec(t, interval);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+pa_operation* pa_context_unsubscribe_meter(pa_context *c, pa_subscription_event_type_t facility, uint32_t idx, pa_context_success_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 30, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_UNSUBSCRIBE_METER, &tag);
+    pa_tagstruct_putu32(t, facility);
+    pa_tagstruct_putu32(t, idx);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+void pa_context_set_meter_callback(pa_context *c, pa_context_meter_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (c->state == PA_CONTEXT_TERMINATED || c->state == PA_CONTEXT_FAILED)
+        return;
+
+    c->meter_callback = cb;
+    c->meter_userdata = userdata;
+}
@@ -26,6 +26,7 @@
 #include <inttypes.h>
 
 #include <pulse/def.h>
+#include <pulse/sample.h>
 #include <pulse/context.h>
 #include <pulse/cdecl.h>
 #include <pulse/version.h>
@@ -80,6 +81,34 @@ pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_c
 /** Set the context specific call back function that is called whenever the state of the daemon changes */
 void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t cb, void *userdata);
 
+/** Levels of a sink, source or sink input, as passed to a
+ * pa_context_meter_cb_t. Levels are linear, 1.0 is full scale. \since 6.0 */
+typedef struct pa_meter_info {
+    pa_subscription_event_type_t facility; /**< One of PA_SUBSCRIPTION_EVENT_SINK, PA_SUBSCRIPTION_EVENT_SOURCE and PA_SUBSCRIPTION_EVENT_SINK_INPUT */
+    uint32_t index;                        /**< Index of the sink, source or sink input */
+    uint8_t channels;                      /**< Number of channels, in the sink's spec for sink inputs */
+    float peak[PA_CHANNELS_MAX];           /**< Highest absolute sample value of each channel since the last update */
+    float rms[PA_CHANNELS_MAX];            /**< Highest RMS level of each channel since the last update, measured over the server's processing blocks */
+} pa_meter_info;
+
+/** Meter callback prototype. \since 6.0 */
+typedef void (*pa_context_meter_cb_t)(pa_context *c, const pa_meter_info *i, void *userdata);
+
+/** Start receiving the levels of a sink, source or sink input every
+ * interval usec through the meter callback. The server computes them
+ * once for all clients, without a record stream for every meter like
+ * PA_STREAM_PEAK_DETECT needs. The interval is clamped to what the
+ * server supports. Subscribing again changes the interval. Meters of
+ * objects that go away are dropped silently. \since 6.0 */
+pa_operation* pa_context_subscribe_meter(pa_context *c, pa_subscription_event_type_t facility, uint32_t idx, pa_usec_t interval, pa_context_success_cb_t cb, void *userdata);
+
+/** Stop receiving the levels of a sink, source or sink input. \since 6.0 */
+pa_operation* pa_context_unsubscribe_meter(pa_context *c, pa_subscription_event_type_t facility, uint32_t idx, pa_context_success_cb_t cb, void *userdata);
+
+/** Set the callback function that is called with the levels of the
+ * subscribed meters. \since 6.0 */
+void pa_context_set_meter_callback(pa_context *c, pa_context_meter_cb_t cb, void *userdata);
+
 PA_C_DECL_END
 
 #endif
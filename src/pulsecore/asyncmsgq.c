@@ -34,11 +34,25 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/mutex.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/thread.h>
 
 #include "asyncmsgq.h"
 
+/* Messages are handed to and taken from the pa_asyncq in batches of up
+ * to this many */
+#define ASYNCMSGQ_BATCH 32
+
 PA_STATIC_FLIST_DECLARE(asyncmsgq, 0, pa_xfree);
-PA_STATIC_FLIST_DECLARE(semaphores, 0, (void(*)(void*)) pa_semaphore_free);
+
+/* Every sending thread waits on a semaphore of its own, no matter how
+ * many messages it waits for */
+PA_STATIC_TLS_DECLARE(completion_semaphore, (void(*)(void*)) pa_semaphore_free);
+
+/* Lives on the stack of a sender, shared by all messages it waits for */
+struct asyncmsgq_completion {
+    pa_semaphore *semaphore;
+    pa_atomic_t pending;
+};
 
 struct asyncmsgq_item {
     int code;
@@ -47,8 +61,8 @@ struct asyncmsgq_item {
     pa_free_cb_t free_cb;
     int64_t offset;
     pa_memchunk memchunk;
-    pa_semaphore *semaphore;
-    int ret;
+    struct asyncmsgq_completion *completion;
+    int *ret;
 };
 
 struct pa_asyncmsgq {
@@ -57,6 +71,10 @@ struct pa_asyncmsgq {
     pa_mutex *mutex; /* only for the writer side */
 
     struct asyncmsgq_item *current;
+
+    /* Reader side only: taken off the asyncq, but not handed out yet */
+    struct asyncmsgq_item *pending[ASYNCMSGQ_BATCH];
+    unsigned n_pending, pending_idx;
 };
 
 pa_asyncmsgq *pa_asyncmsgq_new(unsigned size) {
@@ -68,30 +86,36 @@ pa_asyncmsgq *pa_asyncmsgq_new(unsigned size) {
     pa_assert_se(a->asyncq = pa_asyncq_new(size));
     pa_assert_se(a->mutex = pa_mutex_new(false, true));
     a->current = NULL;
+    a->n_pending = a->pending_idx = 0;
 
     return a;
 }
 
-static void asyncmsgq_free(pa_asyncmsgq *a) {
-    struct asyncmsgq_item *i;
-    pa_assert(a);
+static void item_free(struct asyncmsgq_item *i) {
+    pa_assert(!i->completion);
 
-    while ((i = pa_asyncq_pop(a->asyncq, false))) {
+    if (i->object)
+        pa_msgobject_unref(i->object);
 
-        pa_assert(!i->semaphore);
+    if (i->memchunk.memblock)
+        pa_memblock_unref(i->memchunk.memblock);
 
-        if (i->object)
-            pa_msgobject_unref(i->object);
+    if (i->free_cb)
+        i->free_cb(i->userdata);
 
-        if (i->memchunk.memblock)
-            pa_memblock_unref(i->memchunk.memblock);
+    if (pa_flist_push(PA_STATIC_FLIST_GET(asyncmsgq), i) < 0)
+        pa_xfree(i);
+}
 
-        if (i->free_cb)
-            i->free_cb(i->userdata);
+static void asyncmsgq_free(pa_asyncmsgq *a) {
+    struct asyncmsgq_item *i;
+    pa_assert(a);
 
-        if (pa_flist_push(PA_STATIC_FLIST_GET(asyncmsgq), i) < 0)
-            pa_xfree(i);
-    }
+    while (a->pending_idx < a->n_pending)
+        item_free(a->pending[a->pending_idx++]);
+
+    while ((i = pa_asyncq_pop(a->asyncq, false)))
+        item_free(i);
 
     pa_asyncq_free(a->asyncq, NULL);
     pa_mutex_free(a->mutex);
@@ -112,25 +136,38 @@ void pa_asyncmsgq_unref(pa_asyncmsgq* q) {
         asyncmsgq_free(q);
 }
 
-void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk, pa_free_cb_t free_cb) {
+/* Messages that are waited for are not referenced, the sender keeps
+ * its references until they are completed */
+static struct asyncmsgq_item *item_new(pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk,
+                                       pa_free_cb_t free_cb, struct asyncmsgq_completion *completion, int *ret) {
     struct asyncmsgq_item *i;
-    pa_assert(PA_REFCNT_VALUE(a) > 0);
 
     if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(asyncmsgq))))
         i = pa_xnew(struct asyncmsgq_item, 1);
 
     i->code = code;
-    i->object = object ? pa_msgobject_ref(object) : NULL;
+    i->object = object && !completion ? pa_msgobject_ref(object) : object;
     i->userdata = (void*) userdata;
     i->free_cb = free_cb;
     i->offset = offset;
     if (chunk) {
         pa_assert(chunk->memblock);
         i->memchunk = *chunk;
-        pa_memblock_ref(i->memchunk.memblock);
+        if (!completion)
+            pa_memblock_ref(i->memchunk.memblock);
     } else
         pa_memchunk_reset(&i->memchunk);
-    i->semaphore = NULL;
+    i->completion = completion;
+    i->ret = ret;
+
+    return i;
+}
+
+void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk, pa_free_cb_t free_cb) {
+    struct asyncmsgq_item *i;
+    pa_assert(PA_REFCNT_VALUE(a) > 0);
+
+    i = item_new(object, code, userdata, offset, chunk, free_cb, NULL, NULL);
 
     /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
     pa_mutex_lock(a->mutex);
@@ -138,45 +175,90 @@ void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const vo
     pa_mutex_unlock(a->mutex);
 }
 
-int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk) {
-    struct asyncmsgq_item i;
+void pa_asyncmsgq_post_many(pa_asyncmsgq *a, const pa_asyncmsgq_msg *msgs, unsigned n) {
+    struct asyncmsgq_item *items[ASYNCMSGQ_BATCH];
+    unsigned k;
     pa_assert(PA_REFCNT_VALUE(a) > 0);
+    pa_assert(msgs || n == 0);
 
-    i.code = code;
-    i.object = object;
-    i.userdata = (void*) userdata;
-    i.free_cb = NULL;
-    i.ret = -1;
-    i.offset = offset;
-    if (chunk) {
-        pa_assert(chunk->memblock);
-        i.memchunk = *chunk;
-    } else
-        pa_memchunk_reset(&i.memchunk);
+    while (n > 0) {
+        unsigned batch = PA_MIN(n, ASYNCMSGQ_BATCH);
 
-    if (!(i.semaphore = pa_flist_pop(PA_STATIC_FLIST_GET(semaphores))))
-        i.semaphore = pa_semaphore_new(0);
+        for (k = 0; k < batch; k++)
+            items[k] = item_new(msgs[k].object, msgs[k].code, msgs[k].userdata, msgs[k].offset, msgs[k].memchunk,
+                                msgs[k].free_cb, NULL, NULL);
 
-    pa_assert_se(i.semaphore);
+        pa_mutex_lock(a->mutex);
+        pa_asyncq_post_many(a->asyncq, (void**) items, batch);
+        pa_mutex_unlock(a->mutex);
 
-    /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
-    pa_mutex_lock(a->mutex);
-    pa_assert_se(pa_asyncq_push(a->asyncq, &i, true) == 0);
-    pa_mutex_unlock(a->mutex);
+        msgs += batch;
+        n -= batch;
+    }
+}
+
+int pa_asyncmsgq_send_many(pa_asyncmsgq *a, pa_asyncmsgq_msg *msgs, unsigned n) {
+    struct asyncmsgq_item *items[ASYNCMSGQ_BATCH];
+    struct asyncmsgq_completion completion;
+    unsigned i, k;
+    pa_assert(PA_REFCNT_VALUE(a) > 0);
+    pa_assert(msgs);
+    pa_assert(n > 0);
+
+    if (!(completion.semaphore = PA_STATIC_TLS_GET(completion_semaphore))) {
+        pa_assert_se(completion.semaphore = pa_semaphore_new(0));
+        PA_STATIC_TLS_SET(completion_semaphore, completion.semaphore);
+    }
+
+    pa_atomic_store(&completion.pending, (int) n);
+
+    for (i = 0; i < n; i += k) {
+        unsigned batch = PA_MIN(n - i, ASYNCMSGQ_BATCH);
+
+        for (k = 0; k < batch; k++) {
+            pa_asyncmsgq_msg *m = &msgs[i + k];
+
+            m->ret = -1;
+            items[k] = item_new(m->object, m->code, m->userdata, m->offset, m->memchunk, NULL, &completion, &m->ret);
+        }
+
+        /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
+        pa_mutex_lock(a->mutex);
+        pa_assert_se(pa_asyncq_push_many(a->asyncq, (void**) items, batch, true) == (int) batch);
+        pa_mutex_unlock(a->mutex);
+    }
 
-    pa_semaphore_wait(i.semaphore);
+    /* The last completed message posts the semaphore */
+    pa_semaphore_wait(completion.semaphore);
 
-    if (pa_flist_push(PA_STATIC_FLIST_GET(semaphores), i.semaphore) < 0)
-        pa_semaphore_free(i.semaphore);
+    return msgs[n - 1].ret;
+}
+
+int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk) {
+    pa_asyncmsgq_msg m;
+
+    m.object = object;
+    m.code = code;
+    m.userdata = userdata;
+    m.offset = offset;
+    m.memchunk = chunk;
+    m.free_cb = NULL;
 
-    return i.ret;
+    return pa_asyncmsgq_send_many(a, &m, 1);
 }
 
 int pa_asyncmsgq_get(pa_asyncmsgq *a, pa_msgobject **object, int *code, void **userdata, int64_t *offset, pa_memchunk *chunk, bool wait_op) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
     pa_assert(!a->current);
 
-    if (!(a->current = pa_asyncq_pop(a->asyncq, wait_op))) {
+    if (a->pending_idx >= a->n_pending) {
+        a->n_pending = pa_asyncq_pop_many(a->asyncq, (void**) a->pending, ASYNCMSGQ_BATCH);
+        a->pending_idx = 0;
+    }
+
+    if (a->pending_idx < a->n_pending)
+        a->current = a->pending[a->pending_idx++];
+    else if (!wait_op || !(a->current = pa_asyncq_pop(a->asyncq, true))) {
 /*         pa_log("failure"); */
         return -1;
     }
@@ -208,27 +290,24 @@ int pa_asyncmsgq_get(pa_asyncmsgq *a, pa_msgobject **object, int *code, void **u
 }
 
 void pa_asyncmsgq_done(pa_asyncmsgq *a, int ret) {
+    struct asyncmsgq_completion *c;
+
     pa_assert(PA_REFCNT_VALUE(a) > 0);
     pa_assert(a);
     pa_assert(a->current);
 
-    if (a->current->semaphore) {
-        a->current->ret = ret;
-        pa_semaphore_post(a->current->semaphore);
-    } else {
-
-        if (a->current->free_cb)
-            a->current->free_cb(a->current->userdata);
-
-        if (a->current->object)
-            pa_msgobject_unref(a->current->object);
-
-        if (a->current->memchunk.memblock)
-            pa_memblock_unref(a->current->memchunk.memblock);
+    if ((c = a->current->completion)) {
+        *a->current->ret = ret;
 
+        /* The sender may go away as soon as the semaphore is posted */
+        a->current->completion = NULL;
         if (pa_flist_push(PA_STATIC_FLIST_GET(asyncmsgq), a->current) < 0)
             pa_xfree(a->current);
-    }
+
+        if (pa_atomic_dec(&c->pending) == 1)
+            pa_semaphore_post(c->semaphore);
+    } else
+        item_free(a->current);
 
     a->current = NULL;
 }
@@ -289,6 +368,9 @@ int pa_asyncmsgq_read_fd(pa_asyncmsgq *a) {
 int pa_asyncmsgq_read_before_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
+    if (a->pending_idx < a->n_pending)
+        return -1;
+
     return pa_asyncq_read_before_poll(a->asyncq);
 }
 
@@ -44,7 +44,12 @@
  *
  * There are two functions for submitting messages: _post and
  * _send. The former just enqueues the message asynchronously, the
- * latter waits for completion, synchronously. */
+ * latter waits for completion, synchronously.
+ *
+ * _post_many and _send_many do the same for a whole batch of messages,
+ * which wakes up the reader only once and, for _send_many, waits for
+ * the completion of all of them at once. The reader also takes the
+ * messages off the underlying pa_asyncq in batches. */
 
 enum {
     PA_MESSAGE_SHUTDOWN = -1/* A generic message to inform the handler of this queue to quit */
@@ -52,6 +57,17 @@ enum {
 
 typedef struct pa_asyncmsgq pa_asyncmsgq;
 
+/* A message for the batch functions */
+typedef struct pa_asyncmsgq_msg {
+    pa_msgobject *object;
+    int code;
+    const void *userdata;
+    int64_t offset;
+    const pa_memchunk *memchunk;
+    pa_free_cb_t free_cb; /* only used by _post_many */
+    int ret;              /* filled in by _send_many */
+} pa_asyncmsgq_msg;
+
 pa_asyncmsgq* pa_asyncmsgq_new(unsigned size);
 pa_asyncmsgq* pa_asyncmsgq_ref(pa_asyncmsgq *q);
 
@@ -60,6 +76,12 @@ void pa_asyncmsgq_unref(pa_asyncmsgq* q);
 void pa_asyncmsgq_post(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk, pa_free_cb_t userdata_free_cb);
 int pa_asyncmsgq_send(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk);
 
+void pa_asyncmsgq_post_many(pa_asyncmsgq *q, const pa_asyncmsgq_msg *msgs, unsigned n);
+
+/* Returns the return value of the last message, the others are stored
+ * in msgs[].ret */
+int pa_asyncmsgq_send_many(pa_asyncmsgq *q, pa_asyncmsgq_msg *msgs, unsigned n);
+
 int pa_asyncmsgq_get(pa_asyncmsgq *q, pa_msgobject **object, int *code, void **userdata, int64_t *offset, pa_memchunk *memchunk, bool wait);
 int pa_asyncmsgq_dispatch(pa_msgobject *object, int code, void *userdata, int64_t offset, pa_memchunk *memchunk);
 void pa_asyncmsgq_done(pa_asyncmsgq *q, int ret);
@@ -132,7 +132,7 @@ void pa_asyncq_free(pa_asyncq *l, pa_free_cb_t free_cb) {
     pa_xfree(l);
 }
 
-static int push(pa_asyncq*l, void *p, bool wait_op) {
+static int push(pa_asyncq*l, void *p, bool wait_op, bool notify) {
     unsigned idx;
     pa_atomic_ptr_t *cells;
 
@@ -159,7 +159,8 @@ static int push(pa_asyncq*l, void *p, bool wait_op) {
     _Y;
     l->write_idx++;
 
-    pa_fdsem_post(l->write_fdsem);
+    if (notify)
+        pa_fdsem_post(l->write_fdsem);
 
     return 0;
 }
@@ -171,7 +172,7 @@ static bool flush_postq(pa_asyncq *l, bool wait_op) {
 
     while ((q = l->last_localq)) {
 
-        if (push(l, q->data, wait_op) < 0)
+        if (push(l, q->data, wait_op, true) < 0)
             return false;
 
         l->last_localq = q->prev;
@@ -191,21 +192,41 @@ int pa_asyncq_push(pa_asyncq*l, void *p, bool wait_op) {
     if (!flush_postq(l, wait_op))
         return -1;
 
-    return push(l, p, wait_op);
+    return push(l, p, wait_op, true);
 }
 
-void pa_asyncq_post(pa_asyncq*l, void *p) {
-    struct localq *q;
+int pa_asyncq_push_many(pa_asyncq *l, void **p, unsigned n, bool wait_op) {
+    unsigned k, notified = 0;
 
     pa_assert(l);
-    pa_assert(p);
+    pa_assert(p || n == 0);
 
-    if (flush_postq(l, false))
-        if (pa_asyncq_push(l, p, false) >= 0)
-            return;
+    if (!flush_postq(l, wait_op))
+        return -1;
 
-    /* OK, we couldn't push anything in the queue. So let's queue it
-     * locally and push it later */
+    for (k = 0; k < n; k++) {
+        if (push(l, p[k], false, false) >= 0)
+            continue;
+
+        /* The queue is full. Wake up the reader for what is in there
+         * before waiting for it to make room, or we'd wait forever */
+        if (k > notified) {
+            pa_fdsem_post(l->write_fdsem);
+            notified = k;
+        }
+
+        if (!wait_op || push(l, p[k], true, false) < 0)
+            break;
+    }
+
+    if (k > notified)
+        pa_fdsem_post(l->write_fdsem);
+
+    return (int) k;
+}
+
+static void post_locally(pa_asyncq *l, void *p) {
+    struct localq *q;
 
     if (pa_log_ratelimit(PA_LOG_WARN))
         pa_log_warn("q overrun, queuing locally");
@@ -218,8 +239,38 @@ void pa_asyncq_post(pa_asyncq*l, void *p) {
 
     if (!l->last_localq)
         l->last_localq = q;
+}
+
+void pa_asyncq_post(pa_asyncq*l, void *p) {
+    pa_assert(l);
+    pa_assert(p);
+
+    if (flush_postq(l, false))
+        if (pa_asyncq_push(l, p, false) >= 0)
+            return;
+
+    /* OK, we couldn't push anything in the queue. So let's queue it
+     * locally and push it later */
+    post_locally(l, p);
+}
+
+void pa_asyncq_post_many(pa_asyncq *l, void **p, unsigned n) {
+    unsigned k = 0;
 
-    return;
+    pa_assert(l);
+    pa_assert(p || n == 0);
+
+    if (flush_postq(l, false))
+        for (; k < n; k++)
+            if (push(l, p[k], false, false) < 0)
+                break;
+
+    if (k > 0)
+        pa_fdsem_post(l->write_fdsem);
+
+    /* Whatever didn't fit goes to the local queue, in order */
+    for (; k < n; k++)
+        post_locally(l, p[k]);
 }
 
 void* pa_asyncq_pop(pa_asyncq*l, bool wait_op) {
@@ -259,6 +310,35 @@ void* pa_asyncq_pop(pa_asyncq*l, bool wait_op) {
     return ret;
 }
 
+unsigned pa_asyncq_pop_many(pa_asyncq *l, void **p, unsigned n) {
+    unsigned idx, k;
+    pa_atomic_ptr_t *cells;
+
+    pa_assert(l);
+    pa_assert(p || n == 0);
+
+    cells = PA_ASYNCQ_CELLS(l);
+
+    for (k = 0; k < n; k++) {
+        _Y;
+        idx = reduce(l, l->read_idx);
+
+        if (!(p[k] = pa_atomic_ptr_load(&cells[idx])))
+            break;
+
+        /* Guaranteed to succeed if we only have a single reader */
+        pa_assert_se(pa_atomic_ptr_cmpxchg(&cells[idx], p[k], NULL));
+
+        _Y;
+        l->read_idx++;
+    }
+
+    if (k > 0)
+        pa_fdsem_post(l->read_fdsem);
+
+    return k;
+}
+
 int pa_asyncq_read_fd(pa_asyncq *q) {
     pa_assert(q);
 
@@ -48,11 +48,26 @@ void pa_asyncq_free(pa_asyncq* q, pa_free_cb_t free_cb);
 void* pa_asyncq_pop(pa_asyncq *q, bool wait);
 int pa_asyncq_push(pa_asyncq *q, void *p, bool wait);
 
+/* Like pa_asyncq_push() for n entries, but wakes up the reader only
+ * once for all of them, and before waiting for room if the queue is
+ * full. Returns the number of entries pushed, which is only less than
+ * n if wait is false, or -1 if earlier posted entries couldn't be
+ * pushed without waiting. */
+int pa_asyncq_push_many(pa_asyncq *l, void **p, unsigned n, bool wait);
+
 /* Similar to pa_asyncq_push(), but if the queue is full, postpone the
  * appending of the item locally and delay until
  * pa_asyncq_before_poll_post() is called. */
 void pa_asyncq_post(pa_asyncq*l, void *p);
 
+/* Like pa_asyncq_post() for n entries, but wakes up the reader only
+ * once for all of them */
+void pa_asyncq_post_many(pa_asyncq *l, void **p, unsigned n);
+
+/* Pops up to n entries without waiting and wakes up a waiting writer
+ * only once for all of them. Returns the number of entries popped. */
+unsigned pa_asyncq_pop_many(pa_asyncq *l, void **p, unsigned n);
+
 /* For the reading side */
 int pa_asyncq_read_fd(pa_asyncq *q);
 int pa_asyncq_read_before_poll(pa_asyncq *a);
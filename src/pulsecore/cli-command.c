@@ -54,10 +54,12 @@
 #include <pulsecore/play-memchunk.h>
 #include <pulsecore/sound-file-stream.h>
 #include <pulsecore/shared.h>
+#include <pulsecore/shm.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/modinfo.h>
 #include <pulsecore/dynarray.h>
+#include <pulsecore/metrics.h>
 
 #include "cli-command.h"
 
@@ -93,6 +95,7 @@ static int pa_cli_command_sink_inputs(pa_core *c, pa_tokenizer *t, pa_strbuf *bu
 static int pa_cli_command_source_outputs(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
 static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
 static int pa_cli_command_info(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
+static int pa_cli_command_metrics(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
 static int pa_cli_command_load(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
 static int pa_cli_command_unload(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
 static int pa_cli_command_describe(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail);
@@ -151,6 +154,7 @@ static const struct command commands[] = {
     { "list-source-outputs",     pa_cli_command_source_outputs,     "List source outputs",          1 },
     { "stat",                    pa_cli_command_stat,               "Show memory block statistics", 1 },
     { "info",                    pa_cli_command_info,               "Show comprehensive status",    1 },
+    { "metrics",                 pa_cli_command_metrics,            "Show audio path metrics in Prometheus text format", 1 },
     { "ls",                      pa_cli_command_info,               NULL,                           1 },
     { "list",                    pa_cli_command_info,               NULL,                           1 },
     { "load-module",             pa_cli_command_load,               "Load a module (args: name, arguments)", 3},
@@ -381,9 +385,28 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool
                      (unsigned) pa_atomic_load(&mstat->n_exported),
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_atomic_load(&mstat->exported_size)));
 
+    pa_strbuf_printf(buf, "Memory pool slots in use: %u of %u.\n",
+                     (unsigned) pa_atomic_load(&mstat->n_slots_used),
+                     (unsigned) pa_atomic_load(&mstat->n_slots));
+
+    pa_strbuf_printf(buf, "Large memory pool slots in use: %u of %u.\n",
+                     (unsigned) pa_atomic_load(&mstat->n_large_slots_used),
+                     (unsigned) pa_atomic_load(&mstat->n_large_slots));
+
+    pa_strbuf_printf(buf, "Memory pool pages: %u %s pages of %s, NUMA node %i.\n",
+                     (unsigned) pa_atomic_load(&mstat->n_pages),
+                     pa_shm_pages_to_string(pa_atomic_load(&mstat->pages)),
+                     pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_atomic_load(&mstat->page_size)),
+                     pa_atomic_load(&mstat->numa_node));
+
     pa_strbuf_printf(buf, "Total sample cache size: %s.\n",
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_scache_total_size(c)));
 
+    pa_strbuf_printf(buf, "Converted sample cache size: %s, hits: %llu, misses: %llu.\n",
+                     pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_scache_variants_total_size(c)),
+                     (unsigned long long) c->scache_hits,
+                     (unsigned long long) c->scache_misses);
+
     pa_strbuf_printf(buf, "Default sample spec: %s\n",
                      pa_sample_spec_snprint(ss, sizeof(ss), &c->default_sample_spec));
 
@@ -407,6 +430,21 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool
     return 0;
 }
 
+static int pa_cli_command_metrics(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail) {
+    char *s;
+
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    s = pa_metrics_to_string(c);
+    pa_strbuf_puts(buf, s);
+    pa_xfree(s);
+
+    return 0;
+}
+
 static int pa_cli_command_info(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail) {
     pa_core_assert_ref(c);
     pa_assert(t);
@@ -1282,7 +1320,7 @@ static int pa_cli_command_play_file(pa_core *c, pa_tokenizer *t, pa_strbuf *buf,
         return -1;
     }
 
-    return pa_play_file(sink, fname, NULL);
+    return pa_play_file(sink, fname, NULL, NULL, NULL, 0, NULL);
 }
 
 static int pa_cli_command_list_shared_props(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool *fail) {
@@ -54,6 +54,7 @@
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sound-file.h>
+#include <pulsecore/sound-file-stream.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
@@ -64,6 +65,9 @@
 
 #define UNLOAD_POLL_TIME (60 * PA_USEC_PER_SEC)
 
+/* Silence fed after the sample to flush the history of the resampler */
+#define VARIANT_FLUSH_USEC (10 * PA_USEC_PER_MSEC)
+
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_core *c = userdata;
 
@@ -76,9 +80,186 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
     pa_core_rttime_restart(c, e, pa_rtclock_now() + UNLOAD_POLL_TIME);
 }
 
+static void variant_free(pa_scache_variant *v) {
+    pa_core *c;
+
+    pa_assert(v);
+
+    c = v->entry->core;
+
+    PA_LLIST_REMOVE(pa_scache_variant, c->scache_variants, v);
+    c->scache_variants_size -= v->memchunk.length;
+
+    pa_memblock_unref(v->memchunk.memblock);
+    pa_xfree(v);
+}
+
+/* Drops the converted copies of the entry, they are stale once its data
+ * changes */
+static void drop_variants(pa_scache_entry *e) {
+    pa_scache_variant *v, *n;
+
+    pa_assert(e);
+
+    for (v = e->core->scache_variants; v; v = n) {
+        n = v->next;
+
+        if (v->entry == e)
+            variant_free(v);
+    }
+}
+
+static pa_scache_variant* variant_get(pa_scache_entry *e, const pa_sample_spec *ss, const pa_channel_map *map) {
+    pa_scache_variant *v;
+    pa_core *c = e->core;
+
+    for (v = c->scache_variants; v; v = v->next)
+        if (v->entry == e &&
+            pa_sample_spec_equal(&v->sample_spec, ss) &&
+            pa_channel_map_equal(&v->channel_map, map))
+            break;
+
+    if (v && v != c->scache_variants) {
+        /* Move to the front of the LRU list */
+        PA_LLIST_REMOVE(pa_scache_variant, c->scache_variants, v);
+        PA_LLIST_PREPEND(pa_scache_variant, c->scache_variants, v);
+    }
+
+    return v;
+}
+
+/* Converts the whole entry in one go. The result is a single block that
+ * may be bigger than the pool block size. */
+static int convert_entry(pa_scache_entry *e, const pa_sample_spec *ss, const pa_channel_map *map, pa_memchunk *ret) {
+    pa_core *c = e->core;
+    pa_resampler *r;
+    pa_memchunk in, pad;
+    size_t max_in, flush, out_length, out_alloc, done;
+    uint8_t *out;
+
+    if (!(r = pa_resampler_new(c->mempool,
+                               &e->sample_spec, &e->channel_map,
+                               ss, map,
+                               c->resample_method,
+                               (c->disable_remixing ? PA_RESAMPLER_NO_REMIX : 0) |
+                               (c->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0))))
+        return -1;
+
+    max_in = pa_frame_align(pa_resampler_max_block_size(r), &e->sample_spec);
+    flush = pa_usec_to_bytes(VARIANT_FLUSH_USEC, &e->sample_spec);
+
+    pa_silence_memchunk_get(&c->silence_cache, c->mempool, &pad, &e->sample_spec, PA_MIN(flush, max_in));
+
+    out_alloc = pa_resampler_result(r, e->memchunk.length + flush) + pa_frame_size(ss) * 64;
+    out = pa_xmalloc(out_alloc);
+    out_length = 0;
+
+    for (done = 0; done < e->memchunk.length + flush; done += in.length) {
+        pa_memchunk o;
+
+        if (done < e->memchunk.length) {
+            in = e->memchunk;
+            in.index += done;
+            in.length = PA_MIN(e->memchunk.length - done, max_in);
+        } else
+            in = pad;
+
+        pa_resampler_run(r, &in, &o);
+
+        if (!o.memblock)
+            continue;
+
+        if (out_length + o.length > out_alloc) {
+            out_alloc = (out_length + o.length) * 2;
+            out = pa_xrealloc(out, out_alloc);
+        }
+
+        memcpy(out + out_length, (uint8_t *) pa_memblock_acquire(o.memblock) + o.index, o.length);
+        pa_memblock_release(o.memblock);
+        pa_memblock_unref(o.memblock);
+
+        out_length += o.length;
+    }
+
+    pa_memblock_unref(pad.memblock);
+    pa_resampler_free(r);
+
+    if (out_length == 0) {
+        pa_xfree(out);
+        return -1;
+    }
+
+    ret->memblock = pa_memblock_new_malloced(c->mempool, out, out_length);
+    ret->index = 0;
+    ret->length = out_length;
+
+    return 0;
+}
+
+/* How big the entry gets when converted to ss, without the resampler
+ * tail that convert_entry() flushes out */
+static uint64_t variant_size(pa_scache_entry *e, const pa_sample_spec *ss) {
+    uint64_t frames;
+
+    frames = e->memchunk.length / pa_frame_size(&e->sample_spec);
+    frames = (frames * ss->rate + e->sample_spec.rate - 1) / e->sample_spec.rate;
+
+    return frames * pa_frame_size(ss);
+}
+
+static pa_scache_variant* variant_new(pa_scache_entry *e, const pa_sample_spec *ss, const pa_channel_map *map) {
+    pa_scache_variant *v;
+    pa_core *c = e->core;
+    pa_memchunk chunk;
+
+    if (c->scache_variants_size_max == 0)
+        return NULL;
+
+    /* Don't convert what we couldn't keep anyway */
+    if (variant_size(e, ss) > c->scache_variants_size_max)
+        return NULL;
+
+    if (convert_entry(e, ss, map, &chunk) < 0)
+        return NULL;
+
+    if (chunk.length > c->scache_variants_size_max) {
+        pa_memblock_unref(chunk.memblock);
+        return NULL;
+    }
+
+    /* Evict the least recently played variants until this one fits */
+    while (c->scache_variants_size + chunk.length > c->scache_variants_size_max) {
+        pa_scache_variant *last;
+
+        for (last = c->scache_variants; last->next; last = last->next)
+            ;
+
+        variant_free(last);
+    }
+
+    v = pa_xnew(pa_scache_variant, 1);
+    v->entry = e;
+    v->sample_spec = *ss;
+    v->channel_map = *map;
+    v->memchunk = chunk;
+
+    PA_LLIST_PREPEND(pa_scache_variant, c->scache_variants, v);
+    c->scache_variants_size += chunk.length;
+
+    return v;
+}
+
+static bool stream_from_disk(pa_scache_entry *e) {
+    struct stat st;
+
+    return e->lazy && stat(e->filename, &st) >= 0 && st.st_size >= PA_SCACHE_STREAM_SIZE_MIN;
+}
+
 static void free_entry(pa_scache_entry *e) {
     pa_assert(e);
 
+    drop_variants(e);
+
     pa_namereg_unregister(e->core, e->name);
     pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_REMOVE, e->index);
     pa_xfree(e->name);
@@ -97,6 +278,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
     pa_assert(name);
 
     if ((e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE))) {
+        drop_variants(e);
+
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
 
@@ -292,11 +475,41 @@ void pa_scache_free_all(pa_core *c) {
     }
 }
 
+/* The volume stored with the entry, in the channel map of the entry,
+ * scaled by the one the caller asked for. Returns false if there is
+ * neither. */
+static bool entry_volume(pa_scache_entry *e, pa_volume_t volume, pa_cvolume *r) {
+    if (e->volume_is_set && pa_cvolume_valid(&e->volume)) {
+        *r = e->volume;
+
+        if (PA_VOLUME_IS_VALID(volume)) {
+            pa_cvolume v;
+
+            pa_cvolume_set(&v, r->channels, volume);
+            pa_sw_cvolume_multiply(r, r, &v);
+        }
+
+        return true;
+    }
+
+    if (PA_VOLUME_IS_VALID(volume)) {
+        /* Entries that were never loaded don't know their channels yet */
+        pa_cvolume_set(r, PA_MAX(e->sample_spec.channels, 1U), volume);
+        return true;
+    }
+
+    return false;
+}
+
 int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
     pa_scache_entry *e;
+    pa_scache_variant *v = NULL;
+    const pa_sample_spec *ss;
+    const pa_channel_map *map;
+    const pa_memchunk *chunk;
     pa_cvolume r;
     pa_proplist *merged;
-    bool pass_volume;
+    bool pass_volume, direct;
 
     pa_assert(c);
     pa_assert(name);
@@ -309,11 +522,52 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     pa_proplist_sets(merged, PA_PROP_MEDIA_NAME, name);
     pa_proplist_sets(merged, PA_PROP_EVENT_ID, name);
 
-    if (e->lazy && !e->memchunk.memblock) {
+    direct = pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) &&
+        pa_channel_map_equal(&e->channel_map, &sink->channel_map);
+
+    /* A converted copy saves us from loading lazy entries again, too */
+    if (!direct)
+        v = variant_get(e, &sink->sample_spec, &sink->channel_map);
+
+    if (!e->memchunk.memblock && !v && stream_from_disk(e)) {
+        pa_log_debug("Streaming sample \"%s\" from disk on \"%s\"", name, sink->name);
+
+        pa_proplist_update(merged, PA_UPDATE_REPLACE, e->proplist);
+
+        if (p)
+            pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
+
+        pass_volume = entry_volume(e, volume, &r);
+
+        /* Not in memory, so it counts as a miss */
+        c->scache_misses++;
+
+        if (pa_play_file(sink, e->filename,
+                         pass_volume ? &r : NULL,
+                         pa_channel_map_valid(&e->channel_map) ? &e->channel_map : NULL,
+                         merged,
+                         PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
+            goto fail;
+
+        pa_proplist_free(merged);
+        time(&e->last_used_time);
+
+        return 0;
+    }
+
+    if (e->lazy && !e->memchunk.memblock && !v) {
         pa_channel_map old_channel_map = e->channel_map;
+        pa_proplist *file_proplist = pa_proplist_new();
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
+        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, file_proplist) < 0) {
+            pa_proplist_free(file_proplist);
             goto fail;
+        }
+
+        /* Keep what the file says about itself for when we play the
+         * converted copy without loading it */
+        pa_proplist_update(e->proplist, PA_UPDATE_MERGE, file_proplist);
+        pa_proplist_free(file_proplist);
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
 
@@ -323,24 +577,40 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
             else
                 pa_cvolume_reset(&e->volume, e->sample_spec.channels);
         }
+
+        /* The file may have changed on disk */
+        drop_variants(e);
+        direct = pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) &&
+            pa_channel_map_equal(&e->channel_map, &sink->channel_map);
     }
 
-    if (!e->memchunk.memblock)
+    if (!v && !e->memchunk.memblock)
         goto fail;
 
-    pa_log_debug("Playing sample \"%s\" on \"%s\"", name, sink->name);
+    /* Entries played as they are don't go through the converted cache */
+    if (v)
+        c->scache_hits++;
+    else if (!direct) {
+        c->scache_misses++;
+        v = variant_new(e, &sink->sample_spec, &sink->channel_map);
+    }
+
+    pa_log_debug("Playing sample \"%s\" on \"%s\"%s", name, sink->name, v ? " (converted)" : "");
 
-    pass_volume = true;
+    pass_volume = entry_volume(e, volume, &r);
 
-    if (e->volume_is_set && PA_VOLUME_IS_VALID(volume)) {
-        pa_cvolume_set(&r, e->sample_spec.channels, volume);
-        pa_sw_cvolume_multiply(&r, &r, &e->volume);
-    } else if (e->volume_is_set)
-        r = e->volume;
-    else if (PA_VOLUME_IS_VALID(volume))
-        pa_cvolume_set(&r, e->sample_spec.channels, volume);
-    else
-        pass_volume = false;
+    if (v) {
+        ss = &v->sample_spec;
+        map = &v->channel_map;
+        chunk = &v->memchunk;
+
+        if (pass_volume)
+            pa_cvolume_remap(&r, &e->channel_map, map);
+    } else {
+        ss = &e->sample_spec;
+        map = &e->channel_map;
+        chunk = &e->memchunk;
+    }
 
     pa_proplist_update(merged, PA_UPDATE_REPLACE, e->proplist);
 
@@ -348,8 +618,8 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
         pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
 
     if (pa_play_memchunk(sink,
-                         &e->sample_spec, &e->channel_map,
-                         &e->memchunk,
+                         ss, map,
+                         chunk,
                          pass_volume ? &r : NULL,
                          merged,
                          PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
@@ -420,6 +690,12 @@ size_t pa_scache_total_size(pa_core *c) {
     return sum;
 }
 
+size_t pa_scache_variants_total_size(pa_core *c) {
+    pa_assert(c);
+
+    return c->scache_variants_size;
+}
+
 void pa_scache_unload_unused(pa_core *c) {
     pa_scache_entry *e;
     time_t now;
@@ -440,6 +716,7 @@ void pa_scache_unload_unused(pa_core *c) {
         if (e->last_used_time + c->scache_idle_time > now)
             continue;
 
+        /* Converted copies stay around, they are bounded separately */
         pa_memblock_unref(e->memchunk.memblock);
         pa_memchunk_reset(&e->memchunk);
 
@@ -29,6 +29,13 @@
 
 #define PA_SCACHE_ENTRY_SIZE_MAX (1024*1024*16)
 
+/* Lazy entries with bigger files are streamed from disk on every play
+ * instead of being loaded */
+#define PA_SCACHE_STREAM_SIZE_MIN (1024*1024)
+
+/* Default memory limit for the converted copies of all entries */
+#define PA_SCACHE_VARIANTS_SIZE_MAX (1024*1024*4)
+
 typedef struct pa_scache_entry {
     uint32_t index;
     pa_core *core;
@@ -49,6 +56,18 @@ typedef struct pa_scache_entry {
     pa_proplist *proplist;
 } pa_scache_entry;
 
+/* An entry converted to the sample spec and channel map of a sink, so that
+ * it can be played there without a resampler */
+struct pa_scache_variant {
+    pa_scache_entry *entry;
+
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_memchunk memchunk;
+
+    PA_LLIST_FIELDS(pa_scache_variant);
+};
+
 int pa_scache_add_item(pa_core *c, const char *name, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p, uint32_t *idx);
 int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint32_t *idx);
 int pa_scache_add_file_lazy(pa_core *c, const char *name, const char *filename, uint32_t *idx);
@@ -64,6 +83,7 @@ const char *pa_scache_get_name_by_id(pa_core *c, uint32_t id);
 uint32_t pa_scache_get_id_by_name(pa_core *c, const char *name);
 
 size_t pa_scache_total_size(pa_core *c);
+size_t pa_scache_variants_total_size(pa_core *c);
 
 void pa_scache_unload_unused(pa_core *c);
 
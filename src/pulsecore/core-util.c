@@ -121,6 +121,10 @@
 #include <sys/personality.h>
 #endif
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 #include <pulse/utf8.h>
@@ -3059,6 +3063,91 @@ unsigned pa_ncpus(void) {
     return ncpus <= 0 ? 1 : (unsigned) ncpus;
 }
 
+/* Restricts the calling thread to the CPUs of the given NUMA node.
+ * Memory the thread touches first afterwards is then allocated on
+ * that node as well. */
+int pa_numa_bind_thread(int node) {
+#if defined(__linux__) && defined(HAVE_SCHED_H) && defined(CPU_SET)
+    char fn[64], *list, *range;
+    const char *state = NULL;
+    cpu_set_t set;
+    unsigned n = 0;
+
+    pa_assert(node >= 0);
+
+    pa_snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%i/cpulist", node);
+
+    if (!(list = pa_read_line_from_file(fn))) {
+        pa_log_warn("Failed to read the CPUs of NUMA node %i.", node);
+        return -1;
+    }
+
+    CPU_ZERO(&set);
+
+    /* Something like "0-7,16-23" */
+    while ((range = pa_split(list, ",", &state))) {
+        unsigned first, last, cpu;
+        int k;
+
+        if ((k = sscanf(range, "%u-%u", &first, &last)) == 1)
+            last = first;
+
+        if (k >= 1)
+            for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, &set);
+                n++;
+            }
+
+        pa_xfree(range);
+    }
+
+    pa_xfree(list);
+
+    if (n == 0) {
+        pa_log_warn("NUMA node %i has no CPUs.", node);
+        return -1;
+    }
+
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        pa_log_warn("sched_setaffinity() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    pa_log_info("Bound thread to the %u CPUs of NUMA node %i.", n, node);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* Makes the kernel prefer the given NUMA node for the pages of the
+ * range that haven't been touched yet */
+int pa_numa_bind_memory(void *p, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask;
+
+    pa_assert(p);
+    pa_assert(node >= 0);
+
+    if ((size_t) node >= sizeof(mask) * 8) {
+        pa_log_warn("NUMA node %i out of range.", node);
+        return -1;
+    }
+
+    mask = 1UL << node;
+
+    /* 1 is MPOL_PREFERRED, we don't want to depend on libnuma just for that */
+    if (syscall(SYS_mbind, p, size, 1, &mask, sizeof(mask) * 8, 0) < 0) {
+        pa_log_warn("mbind() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 char *pa_replace(const char*s, const char*a, const char *b) {
     pa_strbuf *sb;
     size_t an;
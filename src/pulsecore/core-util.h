@@ -243,6 +243,9 @@ void pa_reduce(unsigned *num, unsigned *den);
 
 unsigned pa_ncpus(void);
 
+int pa_numa_bind_thread(int node);
+int pa_numa_bind_memory(void *p, size_t size, int node);
+
 char *pa_replace(const char*s, const char*a, const char *b);
 
 /* Escapes p by inserting backslashes in front of backslashes. chars is a
@@ -37,6 +37,8 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-scache.h>
 #include <pulsecore/core-subscribe.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/resample-budget.h>
 #include <pulsecore/random.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -63,7 +65,7 @@ static int core_process_msg(pa_msgobject *o, int code, void *userdata, int64_t o
 
 static void core_free(pa_object *o);
 
-pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size) {
+pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool huge_pages, int numa_node, size_t shm_size) {
     pa_core* c;
     pa_mempool *pool;
     int j;
@@ -71,14 +73,14 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size) {
     pa_assert(m);
 
     if (shared) {
-        if (!(pool = pa_mempool_new(shared, shm_size))) {
+        if (!(pool = pa_mempool_new_full(shared, shm_size, huge_pages, numa_node))) {
             pa_log_warn("failed to allocate shared memory pool. Falling back to a normal memory pool.");
             shared = false;
         }
     }
 
     if (!shared) {
-        if (!(pool = pa_mempool_new(shared, shm_size))) {
+        if (!(pool = pa_mempool_new_full(shared, shm_size, huge_pages, numa_node))) {
             pa_log("pa_mempool_new() failed.");
             return NULL;
         }
@@ -112,6 +114,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size) {
     pa_channel_map_init_extend(&c->default_channel_map, c->default_sample_spec.channels, PA_CHANNEL_MAP_DEFAULT);
     c->default_n_fragments = 4;
     c->default_fragment_size_msec = 25;
+    c->numa_node = numa_node;
 
     c->deferred_volume_safety_margin_usec = 8000;
     c->deferred_volume_extra_delay_usec = 0;
@@ -128,10 +131,18 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size) {
     pa_silence_cache_init(&c->silence_cache);
 
     c->exit_event = NULL;
+    c->meter_event = NULL;
+    c->resample_budget_event = NULL;
+    c->resample_budget_last = 0;
 
     c->exit_idle_time = -1;
     c->scache_idle_time = 20;
 
+    PA_LLIST_HEAD_INIT(pa_scache_variant, c->scache_variants);
+    c->scache_variants_size = 0;
+    c->scache_variants_size_max = PA_SCACHE_VARIANTS_SIZE_MAX;
+    c->scache_hits = c->scache_misses = 0;
+
     c->flat_volumes = true;
     c->disallow_module_loading = false;
     c->disallow_exit = false;
@@ -140,8 +151,10 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size) {
     c->realtime_priority = 5;
     c->disable_remixing = false;
     c->disable_lfe_remixing = false;
+    c->lazy_rewind = false;
     c->deferred_volume = true;
     c->resample_method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
+    c->resample_cpu_budget = 0;
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
         pa_hook_init(&c->hooks[j], c);
@@ -171,6 +184,7 @@ static void core_free(pa_object *o) {
 
     pa_assert(pa_idxset_isempty(c->scache));
     pa_idxset_free(c->scache, NULL);
+    pa_assert(!c->scache_variants);
 
     pa_assert(pa_idxset_isempty(c->modules));
     pa_idxset_free(c->modules, NULL);
@@ -204,6 +218,9 @@ static void core_free(pa_object *o) {
     if (c->exit_event)
         c->mainloop->time_free(c->exit_event);
 
+    pa_meter_stop(c);
+    pa_resample_budget_stop(c);
+
     pa_assert(!c->default_source);
     pa_assert(!c->default_sink);
 
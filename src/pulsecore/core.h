@@ -120,9 +120,12 @@ typedef enum pa_core_hook {
     PA_CORE_HOOK_CARD_PROFILE_AVAILABLE_CHANGED,
     PA_CORE_HOOK_PORT_AVAILABLE_CHANGED,
     PA_CORE_HOOK_PORT_LATENCY_OFFSET_CHANGED,
+    PA_CORE_HOOK_METERS_UPDATED,
     PA_CORE_HOOK_MAX
 } pa_core_hook_t;
 
+typedef struct pa_scache_variant pa_scache_variant;
+
 /* The core structure of PulseAudio. Every PulseAudio daemon contains
  * exactly one of these. It is used for storing kind of global
  * variables for the daemon. */
@@ -151,6 +154,7 @@ struct pa_core {
     pa_channel_map default_channel_map;
     pa_sample_spec default_sample_spec;
     uint32_t alternate_sample_rate;
+    int numa_node; /* the default for sinks, -1 for none */
     unsigned default_n_fragments, default_fragment_size_msec;
     unsigned deferred_volume_safety_margin_usec;
     int deferred_volume_extra_delay_usec;
@@ -167,9 +171,18 @@ struct pa_core {
 
     pa_time_event *exit_event;
     pa_time_event *scache_auto_unload_event;
+    pa_time_event *meter_event;
+    pa_time_event *resample_budget_event;
+    pa_usec_t resample_budget_last;
 
     int exit_idle_time, scache_idle_time;
 
+    /* Sample cache entries converted to the spec of a sink, most
+     * recently played first */
+    PA_LLIST_HEAD(pa_scache_variant, scache_variants);
+    size_t scache_variants_size, scache_variants_size_max;
+    uint64_t scache_hits, scache_misses;
+
     bool flat_volumes:1;
     bool disallow_module_loading:1;
     bool disallow_exit:1;
@@ -178,8 +191,10 @@ struct pa_core {
     bool disable_remixing:1;
     bool disable_lfe_remixing:1;
     bool deferred_volume:1;
+    bool lazy_rewind:1;
 
     pa_resample_method_t resample_method;
+    unsigned resample_cpu_budget; /* percent of the time, 0 for none */
     int realtime_priority;
 
     pa_server_type_t server_type;
@@ -197,7 +212,7 @@ enum {
     PA_CORE_MESSAGE_MAX
 };
 
-pa_core* pa_core_new(pa_mainloop_api *m, bool shared, size_t shm_size);
+pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool huge_pages, int numa_node, size_t shm_size);
 
 /* Check whether no one is connected to this core */
 void pa_core_check_idle(pa_core *c);
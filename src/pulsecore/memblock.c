@@ -47,6 +47,7 @@
 #include <pulsecore/refcnt.h>
 #include <pulsecore/llist.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/memtrap.h>
 
@@ -59,6 +60,20 @@
 #define PA_MEMPOOL_SLOTS_MAX 1024
 #define PA_MEMPOOL_SLOT_SIZE (64*1024)
 
+/* Blocks that don't fit into a slot are taken from a second, smaller
+ * set of slots four times the size, following the normal ones in the
+ * same memory, before we fall back to malloc(). They are carved out of
+ * the pool size: one in every 32 slots is combined with three others
+ * into a large one. */
+#define PA_MEMPOOL_LARGE_SLOT_FACTOR 4
+#define PA_MEMPOOL_LARGE_SLOTS_DIVISOR 32
+
+/* Every thread keeps a few free slots of each pool it uses for
+ * itself. They are handed back and forth between the thread and the
+ * pool in magazines of this many slots, so that the shared free list
+ * is only touched once for every so many allocations. */
+#define PA_MEMPOOL_MAGAZINE_SIZE 16
+
 #define PA_MEMEXPORT_SLOTS_MAX 128
 
 #define PA_MEMIMPORT_SLOTS_MAX 160
@@ -83,6 +98,8 @@ struct pa_memblock {
         struct {
             /* If type == PA_MEMBLOCK_USER this points to a function for freeing this memory block */
             pa_free_cb_t free_cb;
+            /* If type == PA_MEMBLOCK_USER this is passed as free_cb argument */
+            void *free_cb_data;
         } user;
 
         struct {
@@ -139,6 +156,23 @@ struct pa_memexport {
     PA_LLIST_FIELDS(pa_memexport);
 };
 
+struct mempool_magazine {
+    unsigned n;
+    struct mempool_slot *slots[PA_MEMPOOL_MAGAZINE_SIZE];
+};
+
+/* The slots a thread keeps of a pool. Only the thread itself touches
+ * the magazines, except when the pool is freed or the thread exits,
+ * which happens with caches_mutex taken. */
+struct mempool_cache {
+    pa_atomic_ptr_t pool; /* NULL after the pool has been freed */
+
+    struct mempool_magazine *loaded, *previous;
+
+    PA_LLIST_FIELDS(struct mempool_cache); /* all caches of the pool */
+    struct mempool_cache *thread_next; /* all caches of the thread */
+};
+
 struct pa_mempool {
     pa_semaphore *semaphore;
     pa_mutex *mutex;
@@ -149,18 +183,36 @@ struct pa_mempool {
 
     pa_atomic_t n_init;
 
+    /* The large slots, starting right after the normal ones */
+    size_t large_block_size;
+    unsigned n_large_blocks;
+    pa_atomic_t n_large_init;
+
     PA_LLIST_HEAD(pa_memimport, imports);
     PA_LLIST_HEAD(pa_memexport, exports);
 
     /* A list of free slots that may be reused */
     pa_flist *free_slots;
+    pa_flist *free_large_slots;
+
+    /* Magazines of normal slots that are not owned by any thread */
+    pa_flist *full_magazines;
+    pa_flist *empty_magazines;
+
+    /* Protected by caches_mutex */
+    PA_LLIST_HEAD(struct mempool_cache, caches);
 
     pa_mempool_stat stat;
 };
 
 static void segment_detach(pa_memimport_segment *seg);
 
+static void caches_free(void *userdata);
+
 PA_STATIC_FLIST_DECLARE(unused_memblocks, 0, pa_xfree);
+PA_STATIC_TLS_DECLARE(mempool_caches, caches_free);
+
+static pa_static_mutex caches_mutex = PA_STATIC_MUTEX_INIT;
 
 /* No lock necessary */
 static void stat_add(pa_memblock*b) {
@@ -245,12 +297,165 @@ static pa_memblock *memblock_new_appended(pa_mempool *p, size_t length) {
     return b;
 }
 
+static inline uint8_t* mempool_large_slots(pa_mempool *p) {
+    return (uint8_t*) p->memory.ptr + p->block_size * p->n_blocks;
+}
+
+/* No lock necessary */
+static struct mempool_magazine* magazine_new(pa_mempool *p) {
+    struct mempool_magazine *m;
+
+    if (!(m = pa_flist_pop(p->empty_magazines)))
+        m = pa_xnew(struct mempool_magazine, 1);
+
+    m->n = 0;
+    return m;
+}
+
+/* No lock necessary */
+static void magazine_release(pa_mempool *p, struct mempool_magazine *m) {
+    if (pa_flist_push(p->empty_magazines, m) < 0)
+        pa_xfree(m);
+}
+
+/* No lock necessary. Hands a magazine with slots back to the pool */
+static void magazine_return(pa_mempool *p, struct mempool_magazine *m) {
+
+    if (m->n <= 0) {
+        magazine_release(p, m);
+        return;
+    }
+
+    if (pa_flist_push(p->full_magazines, m) >= 0)
+        return;
+
+    /* No room, so let's give back the slots one by one */
+    while (m->n > 0)
+        while (pa_flist_push(p->free_slots, m->slots[--m->n]) < 0)
+            ;
+
+    magazine_release(p, m);
+}
+
+/* Called at thread exit */
+static void caches_free(void *userdata) {
+    struct mempool_cache *c = userdata;
+    pa_mutex *mutex;
+
+    mutex = pa_static_mutex_get(&caches_mutex, false, false);
+    pa_mutex_lock(mutex);
+
+    while (c) {
+        struct mempool_cache *n = c->thread_next;
+        pa_mempool *p;
+
+        if ((p = pa_atomic_ptr_load(&c->pool))) {
+            magazine_return(p, c->loaded);
+            magazine_return(p, c->previous);
+            PA_LLIST_REMOVE(struct mempool_cache, p->caches, c);
+        }
+
+        pa_xfree(c);
+        c = n;
+    }
+
+    pa_mutex_unlock(mutex);
+}
+
+/* No lock necessary in the common case */
+static struct mempool_cache* mempool_get_cache(pa_mempool *p) {
+    struct mempool_cache *c, *head, **i;
+    pa_mutex *mutex;
+
+    head = PA_STATIC_TLS_GET(mempool_caches);
+
+    for (c = head; c; c = c->thread_next)
+        if (pa_atomic_ptr_load(&c->pool) == p)
+            return c;
+
+    mutex = pa_static_mutex_get(&caches_mutex, false, false);
+    pa_mutex_lock(mutex);
+
+    /* Get rid of the caches of pools that are gone, while we are at it */
+    for (i = &head; *i; ) {
+        if (!pa_atomic_ptr_load(&(*i)->pool)) {
+            c = *i;
+            *i = c->thread_next;
+            pa_xfree(c);
+        } else
+            i = &(*i)->thread_next;
+    }
+
+    c = pa_xnew0(struct mempool_cache, 1);
+    pa_atomic_ptr_store(&c->pool, p);
+    c->loaded = magazine_new(p);
+    c->previous = magazine_new(p);
+    PA_LLIST_PREPEND(struct mempool_cache, p->caches, c);
+
+    pa_mutex_unlock(mutex);
+
+    c->thread_next = head;
+    PA_STATIC_TLS_SET(mempool_caches, c);
+
+    return c;
+}
+
+/* No lock necessary */
+static struct mempool_slot* mempool_cache_pop(pa_mempool *p) {
+    struct mempool_cache *c;
+
+    c = mempool_get_cache(p);
+
+    if (c->loaded->n <= 0) {
+        struct mempool_magazine *m;
+
+        if (c->previous->n > 0) {
+            m = c->loaded;
+            c->loaded = c->previous;
+            c->previous = m;
+        } else {
+            if (!(m = pa_flist_pop(p->full_magazines)))
+                return NULL;
+
+            magazine_release(p, c->previous);
+            c->previous = c->loaded;
+            c->loaded = m;
+        }
+    }
+
+    return c->loaded->slots[--c->loaded->n];
+}
+
+/* No lock necessary */
+static void mempool_cache_push(pa_mempool *p, struct mempool_slot *slot) {
+    struct mempool_cache *c;
+
+    c = mempool_get_cache(p);
+
+    if (c->loaded->n >= PA_MEMPOOL_MAGAZINE_SIZE) {
+        struct mempool_magazine *m;
+
+        if (c->previous->n <= 0) {
+            m = c->loaded;
+            c->loaded = c->previous;
+            c->previous = m;
+        } else {
+            magazine_return(p, c->previous);
+            c->previous = c->loaded;
+            c->loaded = magazine_new(p);
+        }
+    }
+
+    c->loaded->slots[c->loaded->n++] = slot;
+}
+
 /* No lock necessary */
 static struct mempool_slot* mempool_allocate_slot(pa_mempool *p) {
     struct mempool_slot *slot;
     pa_assert(p);
 
-    if (!(slot = pa_flist_pop(p->free_slots))) {
+    if (!(slot = mempool_cache_pop(p)) &&
+        !(slot = pa_flist_pop(p->free_slots))) {
         int idx;
 
         /* The free list was empty, we have to allocate a new entry */
@@ -268,6 +473,8 @@ static struct mempool_slot* mempool_allocate_slot(pa_mempool *p) {
         }
     }
 
+    pa_atomic_inc(&p->stat.n_slots_used);
+
 /* #ifdef HAVE_VALGRIND_MEMCHECK_H */
 /*     if (PA_UNLIKELY(pa_in_valgrind())) { */
 /*         VALGRIND_MALLOCLIKE_BLOCK(slot, p->block_size, 0, 0); */
@@ -277,6 +484,32 @@ static struct mempool_slot* mempool_allocate_slot(pa_mempool *p) {
     return slot;
 }
 
+/* No lock necessary */
+static struct mempool_slot* mempool_allocate_large_slot(pa_mempool *p) {
+    struct mempool_slot *slot;
+    pa_assert(p);
+
+    if (!(slot = pa_flist_pop(p->free_large_slots))) {
+        int idx;
+
+        if ((unsigned) (idx = pa_atomic_inc(&p->n_large_init)) >= p->n_large_blocks)
+            pa_atomic_dec(&p->n_large_init);
+        else
+            slot = (struct mempool_slot*) (mempool_large_slots(p) + (p->large_block_size * (size_t) idx));
+
+        if (!slot) {
+            if (pa_log_ratelimit(PA_LOG_DEBUG))
+                pa_log_debug("No large slot left");
+            pa_atomic_inc(&p->stat.n_pool_full);
+            return NULL;
+        }
+    }
+
+    pa_atomic_inc(&p->stat.n_large_slots_used);
+
+    return slot;
+}
+
 /* No lock necessary, totally redundant anyway */
 static inline void* mempool_slot_data(struct mempool_slot *slot) {
     return slot;
@@ -292,10 +525,23 @@ static unsigned mempool_slot_idx(pa_mempool *p, void *ptr) {
     return (unsigned) ((size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr) / p->block_size);
 }
 
+/* No lock necessary */
+static inline bool mempool_slot_is_large(pa_mempool *p, void *ptr) {
+    return (uint8_t*) ptr >= mempool_large_slots(p);
+}
+
 /* No lock necessary */
 static struct mempool_slot* mempool_slot_by_ptr(pa_mempool *p, void *ptr) {
     unsigned idx;
 
+    if (mempool_slot_is_large(p, ptr)) {
+        size_t offset = (size_t) ((uint8_t*) ptr - mempool_large_slots(p));
+
+        pa_assert(offset < p->large_block_size * p->n_large_blocks);
+
+        return (struct mempool_slot*) (mempool_large_slots(p) + (offset / p->large_block_size) * p->large_block_size);
+    }
+
     if ((idx = mempool_slot_idx(p, ptr)) == (unsigned) -1)
         return NULL;
 
@@ -306,6 +552,7 @@ static struct mempool_slot* mempool_slot_by_ptr(pa_mempool *p, void *ptr) {
 pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
     pa_memblock *b = NULL;
     struct mempool_slot *slot;
+    size_t slot_size;
     static int mempool_disable = 0;
 
     pa_assert(p);
@@ -323,30 +570,34 @@ pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
     if (length == (size_t) -1)
         length = pa_mempool_block_size_max(p);
 
-    if (p->block_size >= PA_ALIGN(sizeof(pa_memblock)) + length) {
+    if (p->block_size >= length) {
+        slot_size = p->block_size;
+        slot = mempool_allocate_slot(p);
+    } else if (p->n_large_blocks > 0 && p->large_block_size >= length) {
+        slot_size = p->large_block_size;
+        slot = mempool_allocate_large_slot(p);
+    } else {
+        pa_log_debug("Memory block too large for pool: %lu > %lu", (unsigned long) length, (unsigned long) p->large_block_size);
+        pa_atomic_inc(&p->stat.n_too_large_for_pool);
+        return NULL;
+    }
+
+    if (!slot)
+        return NULL;
 
-        if (!(slot = mempool_allocate_slot(p)))
-            return NULL;
+    if (slot_size >= PA_ALIGN(sizeof(pa_memblock)) + length) {
 
         b = mempool_slot_data(slot);
         b->type = PA_MEMBLOCK_POOL;
         pa_atomic_ptr_store(&b->data, (uint8_t*) b + PA_ALIGN(sizeof(pa_memblock)));
 
-    } else if (p->block_size >= length) {
-
-        if (!(slot = mempool_allocate_slot(p)))
-            return NULL;
+    } else {
 
         if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
             b = pa_xnew(pa_memblock, 1);
 
         b->type = PA_MEMBLOCK_POOL_EXTERNAL;
         pa_atomic_ptr_store(&b->data, mempool_slot_data(slot));
-
-    } else {
-        pa_log_debug("Memory block too large for pool: %lu > %lu", (unsigned long) length, (unsigned long) p->block_size);
-        pa_atomic_inc(&p->stat.n_too_large_for_pool);
-        return NULL;
     }
 
     PA_REFCNT_INIT(b);
@@ -387,7 +638,7 @@ pa_memblock *pa_memblock_new_fixed(pa_mempool *p, void *d, size_t length, bool r
 }
 
 /* No lock necessary */
-pa_memblock *pa_memblock_new_user(pa_mempool *p, void *d, size_t length, pa_free_cb_t free_cb, bool read_only) {
+pa_memblock *pa_memblock_new_user(pa_mempool *p, void *d, size_t length, pa_free_cb_t free_cb, void *free_cb_data, bool read_only) {
     pa_memblock *b;
 
     pa_assert(p);
@@ -410,6 +661,7 @@ pa_memblock *pa_memblock_new_user(pa_mempool *p, void *d, size_t length, pa_free
     pa_atomic_store(&b->please_signal, 0);
 
     b->per_type.user.free_cb = free_cb;
+    b->per_type.user.free_cb_data = free_cb_data;
 
     stat_add(b);
     return b;
@@ -513,7 +765,7 @@ static void memblock_free(pa_memblock *b) {
     switch (b->type) {
         case PA_MEMBLOCK_USER :
             pa_assert(b->per_type.user.free_cb);
-            b->per_type.user.free_cb(pa_atomic_ptr_load(&b->data));
+            b->per_type.user.free_cb(b->per_type.user.free_cb_data);
 
             /* Fall through */
 
@@ -572,11 +824,18 @@ static void memblock_free(pa_memblock *b) {
 /*             } */
 /* #endif */
 
-            /* The free list dimensions should easily allow all slots
-             * to fit in, hence try harder if pushing this slot into
-             * the free list fails */
-            while (pa_flist_push(b->pool->free_slots, slot) < 0)
-                ;
+            if (mempool_slot_is_large(b->pool, slot)) {
+                /* The free list dimensions should easily allow all slots
+                 * to fit in, hence try harder if pushing this slot into
+                 * the free list fails */
+                while (pa_flist_push(b->pool->free_large_slots, slot) < 0)
+                    ;
+
+                pa_atomic_dec(&b->pool->stat.n_large_slots_used);
+            } else {
+                mempool_cache_push(b->pool, slot);
+                pa_atomic_dec(&b->pool->stat.n_slots_used);
+            }
 
             if (call_free)
                 if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), b) < 0)
@@ -626,10 +885,17 @@ static void memblock_make_local(pa_memblock *b) {
 
     pa_atomic_dec(&b->pool->stat.n_allocated_by_type[b->type]);
 
-    if (b->length <= b->pool->block_size) {
+    if (b->length <= b->pool->large_block_size) {
         struct mempool_slot *slot;
 
-        if ((slot = mempool_allocate_slot(b->pool))) {
+        if (b->length <= b->pool->block_size)
+            slot = mempool_allocate_slot(b->pool);
+        else if (b->pool->n_large_blocks > 0)
+            slot = mempool_allocate_large_slot(b->pool);
+        else
+            slot = NULL;
+
+        if (slot) {
             void *new_data;
             /* We can move it into a local pool, perfect! */
 
@@ -647,6 +913,7 @@ static void memblock_make_local(pa_memblock *b) {
     /* Humm, not enough space in the pool, so lets allocate the memory with malloc() */
     b->per_type.user.free_cb = pa_xfree;
     pa_atomic_ptr_store(&b->data, pa_xmemdup(pa_atomic_ptr_load(&b->data), b->length));
+    b->per_type.user.free_cb_data = pa_atomic_ptr_load(&b->data);
 
     b->type = PA_MEMBLOCK_USER;
     b->read_only = false;
@@ -713,8 +980,12 @@ static void memblock_replace_import(pa_memblock *b) {
 }
 
 pa_mempool* pa_mempool_new(bool shared, size_t size) {
+    return pa_mempool_new_full(shared, size, false, -1);
+}
+
+pa_mempool* pa_mempool_new_full(bool shared, size_t size, bool huge_pages, int numa_node) {
     pa_mempool *p;
-    char t1[PA_BYTES_SNPRINT_MAX], t2[PA_BYTES_SNPRINT_MAX];
+    char t1[PA_BYTES_SNPRINT_MAX], t2[PA_BYTES_SNPRINT_MAX], t3[PA_BYTES_SNPRINT_MAX];
 
     p = pa_xnew(pa_mempool, 1);
 
@@ -731,33 +1002,63 @@ pa_mempool* pa_mempool_new(bool shared, size_t size) {
             p->n_blocks = 2;
     }
 
-    if (pa_shm_create_rw(&p->memory, p->n_blocks * p->block_size, shared, 0700) < 0) {
+    p->large_block_size = p->block_size * PA_MEMPOOL_LARGE_SLOT_FACTOR;
+    p->n_large_blocks = p->n_blocks / PA_MEMPOOL_LARGE_SLOTS_DIVISOR;
+    p->n_blocks -= p->n_large_blocks * PA_MEMPOOL_LARGE_SLOT_FACTOR;
+
+    if (pa_shm_create_rw(&p->memory, p->n_blocks * p->block_size + p->n_large_blocks * p->large_block_size, shared, huge_pages, 0700) < 0) {
         pa_xfree(p);
         return NULL;
     }
 
-    pa_log_debug("Using %s memory pool with %u slots of size %s each, total size is %s, maximum usable slot size is %lu",
+    /* Nothing has been touched yet, so all pages will end up there */
+    if (numa_node >= 0 && pa_numa_bind_memory(p->memory.ptr, PA_PAGE_ALIGN(p->memory.size), numa_node) < 0)
+        numa_node = -1;
+
+    pa_log_debug("Using %s memory pool with %s pages of %s, NUMA node %i",
+                 p->memory.shared ? "shared" : "private",
+                 pa_shm_pages_to_string(p->memory.pages),
+                 pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->memory.page_size),
+                 numa_node);
+
+    pa_log_debug("Using %s memory pool with %u slots of size %s each and %u of size %s, total size is %s, maximum usable slot size is %lu",
                  p->memory.shared ? "shared" : "private",
                  p->n_blocks,
                  pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->block_size),
-                 pa_bytes_snprint(t2, sizeof(t2), (unsigned) (p->n_blocks * p->block_size)),
+                 p->n_large_blocks,
+                 pa_bytes_snprint(t2, sizeof(t2), (unsigned) p->large_block_size),
+                 pa_bytes_snprint(t3, sizeof(t3), (unsigned) p->memory.size),
                  (unsigned long) pa_mempool_block_size_max(p));
 
     memset(&p->stat, 0, sizeof(p->stat));
+    pa_atomic_store(&p->stat.n_slots, (int) p->n_blocks);
+    pa_atomic_store(&p->stat.n_large_slots, (int) p->n_large_blocks);
+    pa_atomic_store(&p->stat.pages, (int) p->memory.pages);
+    pa_atomic_store(&p->stat.page_size, (int) p->memory.page_size);
+    pa_atomic_store(&p->stat.n_pages, (int) (PA_ROUND_UP(p->memory.size, p->memory.page_size) / p->memory.page_size));
+    pa_atomic_store(&p->stat.numa_node, numa_node);
     pa_atomic_store(&p->n_init, 0);
+    pa_atomic_store(&p->n_large_init, 0);
 
     PA_LLIST_HEAD_INIT(pa_memimport, p->imports);
     PA_LLIST_HEAD_INIT(pa_memexport, p->exports);
+    PA_LLIST_HEAD_INIT(struct mempool_cache, p->caches);
 
     p->mutex = pa_mutex_new(true, true);
     p->semaphore = pa_semaphore_new(0);
 
     p->free_slots = pa_flist_new(p->n_blocks);
+    p->free_large_slots = pa_flist_new(PA_MAX(p->n_large_blocks, 1U));
+    p->full_magazines = pa_flist_new(p->n_blocks);
+    p->empty_magazines = pa_flist_new(p->n_blocks);
 
     return p;
 }
 
 void pa_mempool_free(pa_mempool *p) {
+    struct mempool_cache *c;
+    pa_mutex *mutex;
+
     pa_assert(p);
 
     pa_mutex_lock(p->mutex);
@@ -770,7 +1071,24 @@ void pa_mempool_free(pa_mempool *p) {
 
     pa_mutex_unlock(p->mutex);
 
+    /* The threads free the caches themselves, we just orphan them */
+    mutex = pa_static_mutex_get(&caches_mutex, false, false);
+    pa_mutex_lock(mutex);
+
+    while ((c = p->caches)) {
+        PA_LLIST_REMOVE(struct mempool_cache, p->caches, c);
+        pa_xfree(c->loaded);
+        pa_xfree(c->previous);
+        c->loaded = c->previous = NULL;
+        pa_atomic_ptr_store(&c->pool, NULL);
+    }
+
+    pa_mutex_unlock(mutex);
+
     pa_flist_free(p->free_slots, NULL);
+    pa_flist_free(p->free_large_slots, NULL);
+    pa_flist_free(p->full_magazines, pa_xfree);
+    pa_flist_free(p->empty_magazines, pa_xfree);
 
     if (pa_atomic_load(&p->stat.n_allocated) > 0) {
 
@@ -839,28 +1157,48 @@ size_t pa_mempool_block_size_max(pa_mempool *p) {
 }
 
 /* No lock necessary */
-void pa_mempool_vacuum(pa_mempool *p) {
+static void vacuum_slots(pa_mempool *p, pa_flist *free_slots, unsigned n, size_t block_size) {
     struct mempool_slot *slot;
     pa_flist *list;
 
-    pa_assert(p);
+    list = pa_flist_new(n);
 
-    list = pa_flist_new(p->n_blocks);
-
-    while ((slot = pa_flist_pop(p->free_slots)))
+    while ((slot = pa_flist_pop(free_slots)))
         while (pa_flist_push(list, slot) < 0)
             ;
 
     while ((slot = pa_flist_pop(list))) {
-        pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), p->block_size);
+        pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), block_size);
 
-        while (pa_flist_push(p->free_slots, slot))
+        while (pa_flist_push(free_slots, slot))
             ;
     }
 
     pa_flist_free(list, NULL);
 }
 
+/* No lock necessary */
+void pa_mempool_vacuum(pa_mempool *p) {
+    struct mempool_magazine *m;
+
+    pa_assert(p);
+
+    /* Slots in the magazines the pool holds go back to the free list
+     * first. Only those the threads keep for themselves stay. */
+    while ((m = pa_flist_pop(p->full_magazines))) {
+        while (m->n > 0)
+            while (pa_flist_push(p->free_slots, m->slots[--m->n]) < 0)
+                ;
+
+        magazine_release(p, m);
+    }
+
+    vacuum_slots(p, p->free_slots, p->n_blocks, p->block_size);
+
+    if (p->n_large_blocks > 0)
+        vacuum_slots(p, p->free_large_slots, p->n_large_blocks, p->large_block_size);
+}
+
 /* No lock necessary */
 int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id) {
     pa_assert(p);
@@ -29,6 +29,7 @@ typedef struct pa_memblock pa_memblock;
 #include <inttypes.h>
 
 #include <pulse/def.h>
+#include <pulse/xmalloc.h>
 #include <pulsecore/atomic.h>
 #include <pulsecore/memchunk.h>
 
@@ -74,6 +75,18 @@ struct pa_mempool_stat {
     pa_atomic_t n_too_large_for_pool;
     pa_atomic_t n_pool_full;
 
+    pa_atomic_t n_slots;
+    pa_atomic_t n_slots_used;
+    pa_atomic_t n_large_slots;
+    pa_atomic_t n_large_slots_used;
+
+    /* The pages backing the pool, pages being a pa_shm_pages_t, and
+     * the NUMA node it is bound to, or -1 */
+    pa_atomic_t pages;
+    pa_atomic_t page_size;
+    pa_atomic_t n_pages;
+    pa_atomic_t numa_node;
+
     pa_atomic_t n_allocated_by_type[PA_MEMBLOCK_TYPE_MAX];
     pa_atomic_t n_accumulated_by_type[PA_MEMBLOCK_TYPE_MAX];
 };
@@ -85,10 +98,12 @@ pa_memblock *pa_memblock_new(pa_mempool *, size_t length);
 pa_memblock *pa_memblock_new_pool(pa_mempool *, size_t length);
 
 /* Allocate a new memory block of type PA_MEMBLOCK_USER */
-pa_memblock *pa_memblock_new_user(pa_mempool *, void *data, size_t length, pa_free_cb_t free_cb, bool read_only);
+pa_memblock *pa_memblock_new_user(pa_mempool *, void *data, size_t length, pa_free_cb_t free_cb, void *free_cb_data, bool read_only);
 
 /* A special case of pa_memblock_new_user: take a memory buffer previously allocated with pa_xmalloc()  */
-#define pa_memblock_new_malloced(p,data,length) pa_memblock_new_user(p, data, length, pa_xfree, 0)
+static inline pa_memblock *pa_memblock_new_malloced(pa_mempool *p, void *data, size_t length) {
+    return pa_memblock_new_user(p, data, length, pa_xfree, data, 0);
+}
 
 /* Allocate a new memory block of type PA_MEMBLOCK_FIXED */
 pa_memblock *pa_memblock_new_fixed(pa_mempool *, void *data, size_t length, bool read_only);
@@ -120,6 +135,9 @@ pa_memblock *pa_memblock_will_need(pa_memblock *b);
 
 /* The memory block manager */
 pa_mempool* pa_mempool_new(bool shared, size_t size);
+/* Like pa_mempool_new(), but backs the pool with huge pages if
+ * possible and binds it to the NUMA node, unless it is negative */
+pa_mempool* pa_mempool_new_full(bool shared, size_t size, bool huge_pages, int numa_node);
 void pa_mempool_free(pa_mempool *p);
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
 void pa_mempool_vacuum(pa_mempool *p);
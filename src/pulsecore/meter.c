@@ -0,0 +1,367 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/sink.h>
+#include <pulsecore/source.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/sconv.h>
+#include <pulsecore/endianmacros.h>
+#include <pulsecore/macro.h>
+
+#include "meter.h"
+
+/* Samples converted to float at a time for formats without a meter
+ * function of their own */
+#define CONVERT_SAMPLES 1024
+
+static void pa_meter_s16ne_c(const int16_t *src, unsigned channels, unsigned n, float *peak, float *sum) {
+    unsigned i, c = 0;
+
+    for (i = 0; i < n; i++) {
+        float v = fabsf(src[i] * (1.0f / 0x8000));
+
+        if (v > peak[c])
+            peak[c] = v;
+        sum[c] += v * v;
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+static void pa_meter_s16re_c(const int16_t *src, unsigned channels, unsigned n, float *peak, float *sum) {
+    unsigned i, c = 0;
+
+    for (i = 0; i < n; i++) {
+        float v = fabsf((int16_t) PA_INT16_SWAP(src[i]) * (1.0f / 0x8000));
+
+        if (v > peak[c])
+            peak[c] = v;
+        sum[c] += v * v;
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+static void pa_meter_float32ne_c(const float *src, unsigned channels, unsigned n, float *peak, float *sum) {
+    unsigned i, c = 0;
+
+    for (i = 0; i < n; i++) {
+        float v = fabsf(src[i]);
+
+        if (v > peak[c])
+            peak[c] = v;
+        sum[c] += v * v;
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+static void pa_meter_s32ne_c(const int32_t *src, unsigned channels, unsigned n, float *peak, float *sum) {
+    unsigned i, c = 0;
+
+    for (i = 0; i < n; i++) {
+        float v = fabsf(src[i] * (1.0f / 0x80000000U));
+
+        if (v > peak[c])
+            peak[c] = v;
+        sum[c] += v * v;
+
+        if (++c >= channels)
+            c = 0;
+    }
+}
+
+/* Everything else is converted to float in pieces first */
+static pa_do_meter_func_t do_meter_table[PA_SAMPLE_MAX] = {
+    [PA_SAMPLE_S16NE]     = (pa_do_meter_func_t) pa_meter_s16ne_c,
+    [PA_SAMPLE_S16RE]     = (pa_do_meter_func_t) pa_meter_s16re_c,
+    [PA_SAMPLE_FLOAT32NE] = (pa_do_meter_func_t) pa_meter_float32ne_c,
+    [PA_SAMPLE_S32NE]     = (pa_do_meter_func_t) pa_meter_s32ne_c
+};
+
+pa_do_meter_func_t pa_get_meter_func(pa_sample_format_t f) {
+    pa_assert(pa_sample_format_valid(f));
+
+    return do_meter_table[f];
+}
+
+void pa_set_meter_func(pa_sample_format_t f, pa_do_meter_func_t func) {
+    pa_assert(pa_sample_format_valid(f));
+
+    do_meter_table[f] = func;
+}
+
+void pa_meter_init(pa_meter *m) {
+    unsigned c;
+
+    pa_assert(m);
+
+    pa_atomic_store(&m->enabled, 0);
+    pa_atomic_store(&m->channels, 0);
+
+    for (c = 0; c < PA_CHANNELS_MAX; c++) {
+        pa_atomic_store(&m->peak[c], 0);
+        pa_atomic_store(&m->rms[c], 0);
+        m->last_peak[c] = m->last_rms[c] = 0;
+    }
+
+    m->n_users = 0;
+    m->n_channels = 0;
+}
+
+/* No lock necessary */
+static void store_max(pa_atomic_t *a, float v) {
+    union { float f; int i; } u;
+
+    /* Also filters out NaN */
+    if (!(v > 0))
+        return;
+
+    u.f = v;
+
+    for (;;) {
+        int old = pa_atomic_load(a);
+
+        if (u.i <= old || pa_atomic_cmpxchg(a, old, u.i))
+            return;
+    }
+}
+
+static float take(pa_atomic_t *a) {
+    union { float f; int i; } u;
+
+    do
+        u.i = pa_atomic_load(a);
+    while (!pa_atomic_cmpxchg(a, u.i, 0));
+
+    return u.f;
+}
+
+static void meter_converted(const void *src, const pa_sample_spec *ss, unsigned n, float *peak, float *sum) {
+    float buf[CONVERT_SAMPLES];
+    pa_convert_func_t convert;
+    unsigned piece;
+
+    pa_assert_se(convert = pa_get_convert_to_float32ne_function(ss->format));
+
+    /* Whole frames only, so every piece starts with the first channel */
+    piece = CONVERT_SAMPLES - CONVERT_SAMPLES % ss->channels;
+
+    while (n > 0) {
+        unsigned k = PA_MIN(n, piece);
+
+        convert(k, src, buf);
+        pa_get_meter_func(PA_SAMPLE_FLOAT32NE)(buf, ss->channels, k, peak, sum);
+
+        src = (const uint8_t *) src + k * pa_sample_size(ss);
+        n -= k;
+    }
+}
+
+/* Called from IO thread context */
+void pa_meter_process(pa_meter *m, const pa_sample_spec *ss, const pa_memchunk *chunk, const pa_cvolume *volume) {
+    float peak[PA_CHANNELS_MAX], sum[PA_CHANNELS_MAX];
+    pa_do_meter_func_t func;
+    const void *src;
+    unsigned c, n, frames;
+
+    pa_assert(m);
+    pa_assert(ss);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+    pa_assert(!volume || volume->channels == ss->channels);
+
+    if (!pa_meter_is_enabled(m))
+        return;
+
+    frames = (unsigned) (chunk->length / pa_frame_size(ss));
+    n = frames * ss->channels;
+
+    if (n == 0)
+        return;
+
+    /* Nothing to add to the levels */
+    if (pa_memblock_is_silence(chunk->memblock)) {
+        pa_atomic_store(&m->channels, ss->channels);
+        return;
+    }
+
+    memset(peak, 0, sizeof(float) * ss->channels);
+    memset(sum, 0, sizeof(float) * ss->channels);
+
+    src = pa_memblock_acquire_chunk(chunk);
+
+    if ((func = pa_get_meter_func(ss->format)))
+        func(src, ss->channels, n, peak, sum);
+    else
+        meter_converted(src, ss, n, peak, sum);
+
+    pa_memblock_release(chunk->memblock);
+
+    pa_atomic_store(&m->channels, ss->channels);
+
+    for (c = 0; c < ss->channels; c++) {
+        float p = peak[c], r = sqrtf(sum[c] / frames);
+
+        /* Scaling by the volume is cheaper than applying it first */
+        if (volume && volume->values[c] != PA_VOLUME_NORM) {
+            float f = (float) pa_sw_volume_to_linear(volume->values[c]);
+
+            p *= f;
+            r *= f;
+        }
+
+        store_max(&m->peak[c], p);
+        store_max(&m->rms[c], r);
+    }
+}
+
+/* Returns false if nobody is interested in the meter */
+static bool collect(pa_meter *m) {
+    unsigned c;
+
+    if (m->n_users == 0)
+        return false;
+
+    m->n_channels = (uint8_t) pa_atomic_load(&m->channels);
+
+    for (c = 0; c < m->n_channels; c++) {
+        m->last_peak[c] = take(&m->peak[c]);
+        m->last_rms[c] = take(&m->rms[c]);
+    }
+
+    return true;
+}
+
+static void tick_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_core *c = userdata;
+    pa_sink *s;
+    pa_source *so;
+    pa_sink_input *i;
+    uint32_t idx;
+    bool active = false;
+
+    pa_assert(c);
+    pa_assert(c->meter_event == e);
+
+    PA_IDXSET_FOREACH(s, c->sinks, idx)
+        active |= collect(&s->meter);
+
+    PA_IDXSET_FOREACH(so, c->sources, idx)
+        active |= collect(&so->meter);
+
+    PA_IDXSET_FOREACH(i, c->sink_inputs, idx)
+        active |= collect(&i->meter);
+
+    if (!active) {
+        pa_log_debug("No meters in use anymore, stopping.");
+        pa_meter_stop(c);
+        return;
+    }
+
+    pa_hook_fire(&c->hooks[PA_CORE_HOOK_METERS_UPDATED], NULL);
+
+    pa_core_rttime_restart(c, e, pa_rtclock_now() + PA_METER_TICK_USEC);
+}
+
+void pa_meter_add_user(pa_core *c, pa_meter *m) {
+    unsigned ch;
+
+    pa_assert(c);
+    pa_assert(m);
+
+    if (m->n_users++ == 0) {
+        for (ch = 0; ch < PA_CHANNELS_MAX; ch++) {
+            pa_atomic_store(&m->peak[ch], 0);
+            pa_atomic_store(&m->rms[ch], 0);
+            m->last_peak[ch] = m->last_rms[ch] = 0;
+        }
+
+        pa_atomic_store(&m->enabled, 1);
+    }
+
+    if (!c->meter_event)
+        c->meter_event = pa_core_rttime_new(c, pa_rtclock_now() + PA_METER_TICK_USEC, tick_cb, c);
+}
+
+/* The tick stops by itself once no meter is in use anymore */
+void pa_meter_remove_user(pa_core *c, pa_meter *m) {
+    pa_assert(c);
+    pa_assert(m);
+    pa_assert(m->n_users > 0);
+
+    if (--m->n_users == 0)
+        pa_atomic_store(&m->enabled, 0);
+}
+
+pa_meter *pa_meter_get(pa_core *c, pa_subscription_event_type_t facility, uint32_t idx) {
+    pa_assert(c);
+
+    switch (facility & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+        case PA_SUBSCRIPTION_EVENT_SINK: {
+            pa_sink *s;
+
+            if ((s = pa_idxset_get_by_index(c->sinks, idx)) && PA_SINK_IS_LINKED(s->state))
+                return &s->meter;
+            break;
+        }
+
+        case PA_SUBSCRIPTION_EVENT_SOURCE: {
+            pa_source *s;
+
+            if ((s = pa_idxset_get_by_index(c->sources, idx)) && PA_SOURCE_IS_LINKED(s->state))
+                return &s->meter;
+            break;
+        }
+
+        case PA_SUBSCRIPTION_EVENT_SINK_INPUT: {
+            pa_sink_input *i;
+
+            if ((i = pa_idxset_get_by_index(c->sink_inputs, idx)) && PA_SINK_INPUT_IS_LINKED(i->state))
+                return &i->meter;
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return NULL;
+}
+
+void pa_meter_stop(pa_core *c) {
+    pa_assert(c);
+
+    if (c->meter_event) {
+        c->mainloop->time_free(c->meter_event);
+        c->meter_event = NULL;
+    }
+}
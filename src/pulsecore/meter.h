@@ -0,0 +1,90 @@
+#ifndef foopulsecoremeterhfoo
+#define foopulsecoremeterhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/def.h>
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/volume.h>
+#include <pulsecore/atomic.h>
+
+/* Peak and RMS levels of sinks, sources and sink inputs, computed once
+ * per IO cycle while at least one client is interested in them. This
+ * is what clients used to open PA_STREAM_PEAK_DETECT record streams
+ * for, without a source output and resampler per meter.
+ *
+ * The IO thread folds every chunk into the atomics below. The main
+ * thread collects them every PA_METER_TICK_USEC, which also resets
+ * them, and then fires PA_CORE_HOOK_METERS_UPDATED. */
+
+#define PA_METER_TICK_USEC (20*PA_USEC_PER_MSEC)
+
+typedef struct pa_meter {
+    /* Set from the main thread, checked by the IO thread */
+    pa_atomic_t enabled;
+
+    /* Written by the IO thread, collected by the main thread. Levels
+     * are positive floats stored as their bit patterns, which compare
+     * just like the values do. */
+    pa_atomic_t channels;
+    pa_atomic_t peak[PA_CHANNELS_MAX];
+    pa_atomic_t rms[PA_CHANNELS_MAX];
+
+    /* Main thread only */
+    unsigned n_users;
+    uint8_t n_channels;
+    float last_peak[PA_CHANNELS_MAX];
+    float last_rms[PA_CHANNELS_MAX];
+} pa_meter;
+
+#include <pulsecore/core.h>
+#include <pulsecore/memchunk.h>
+
+/* Adds the absolute peak and the sum of squares of n interleaved
+ * samples to the per channel values. Samples are scaled to 1.0 full
+ * scale. */
+typedef void (*pa_do_meter_func_t) (const void *src, unsigned channels, unsigned n, float *peak, float *sum);
+
+pa_do_meter_func_t pa_get_meter_func(pa_sample_format_t f);
+void pa_set_meter_func(pa_sample_format_t f, pa_do_meter_func_t func);
+
+void pa_meter_init(pa_meter *m);
+
+/* Called from the IO thread. volume is the software volume that will be
+ * applied to the chunk later on, if any. */
+void pa_meter_process(pa_meter *m, const pa_sample_spec *ss, const pa_memchunk *chunk, const pa_cvolume *volume);
+
+static inline bool pa_meter_is_enabled(pa_meter *m) {
+    return pa_atomic_load(&m->enabled) != 0;
+}
+
+/* Called from the main thread */
+void pa_meter_add_user(pa_core *c, pa_meter *m);
+void pa_meter_remove_user(pa_core *c, pa_meter *m);
+
+/* Returns the meter of the sink, source or sink input with the given
+ * index, facility being one of PA_SUBSCRIPTION_EVENT_SINK,
+ * PA_SUBSCRIPTION_EVENT_SOURCE and PA_SUBSCRIPTION_EVENT_SINK_INPUT */
+pa_meter *pa_meter_get(pa_core *c, pa_subscription_event_type_t facility, uint32_t idx);
+
+void pa_meter_stop(pa_core *c);
+
+#endif
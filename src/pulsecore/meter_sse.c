@@ -0,0 +1,162 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "cpu-x86.h"
+#include "meter.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+static pa_do_meter_func_t meter_s16ne_c, meter_float32ne_c;
+
+/* The vector loops keep one accumulator per lane. As long as the
+ * number of channels divides the number of lanes every lane always
+ * sees the same channel, which is the case for the common 1, 2 and 4
+ * (and for 16 bit samples 8) channel layouts. */
+
+static const PA_DECLARE_ALIGNED (16, uint32_t, abs_mask[4]) = { 0x7fffffff, 0x7fffffff, 0x7fffffff, 0x7fffffff };
+
+static void meter_s16ne_sse2(const int16_t *src, unsigned channels, unsigned n, float *peak, float *sum) {
+    PA_DECLARE_ALIGNED (16, int16_t, max[8]);
+    PA_DECLARE_ALIGNED (16, int16_t, min[8]);
+    PA_DECLARE_ALIGNED (16, float, s[8]);
+    pa_reg_x86 blocks = n / 8;
+    unsigned i;
+
+    if (8 % channels != 0 || blocks == 0) {
+        meter_s16ne_c(src, channels, n, peak, sum);
+        return;
+    }
+
+    __asm__ __volatile__ (
+        " pxor %%xmm4, %%xmm4           \n\t" /* minima */
+        " pxor %%xmm5, %%xmm5           \n\t" /* maxima */
+        " xorps %%xmm6, %%xmm6          \n\t" /* sums of samples 0..3 */
+        " xorps %%xmm7, %%xmm7          \n\t" /* sums of samples 4..7 */
+
+        "1:                             \n\t"
+        " movdqu (%0), %%xmm0           \n\t" /* read 8 samples */
+        " pminsw %%xmm0, %%xmm4         \n\t" /* -0x8000 has no 16 bit abs, */
+        " pmaxsw %%xmm0, %%xmm5         \n\t" /* so both ends are tracked */
+
+        " movdqa %%xmm0, %%xmm2         \n\t"
+        " punpcklwd %%xmm0, %%xmm0      \n\t" /* sign extend to 32 bit */
+        " punpckhwd %%xmm2, %%xmm2      \n\t"
+        " psrad $16, %%xmm0             \n\t"
+        " psrad $16, %%xmm2             \n\t"
+        " cvtdq2ps %%xmm0, %%xmm0       \n\t"
+        " cvtdq2ps %%xmm2, %%xmm2       \n\t"
+        " mulps %%xmm0, %%xmm0          \n\t"
+        " mulps %%xmm2, %%xmm2          \n\t"
+        " addps %%xmm0, %%xmm6          \n\t"
+        " addps %%xmm2, %%xmm7          \n\t"
+
+        " add $16, %0                   \n\t"
+        " dec %1                        \n\t"
+        " jne 1b                        \n\t"
+
+        " movdqa %%xmm4, (%2)           \n\t"
+        " movdqa %%xmm5, (%3)           \n\t"
+        " movaps %%xmm6, (%4)           \n\t"
+        " movaps %%xmm7, 16(%4)         \n\t"
+
+        : "+r" (src), "+r" (blocks)
+        : "r" (min), "r" (max), "r" (s)
+        : "cc", "memory", "xmm0", "xmm2", "xmm4", "xmm5", "xmm6", "xmm7"
+    );
+
+    for (i = 0; i < 8; i++) {
+        float v = PA_MAX(-min[i], max[i]) * (1.0f / 0x8000);
+
+        if (v > peak[i % channels])
+            peak[i % channels] = v;
+        sum[i % channels] += s[i] * (1.0f / 0x8000 / 0x8000);
+    }
+
+    /* src has been advanced to the leftover frames */
+    meter_s16ne_c(src, channels, n % 8, peak, sum);
+}
+
+static void meter_float32ne_sse(const float *src, unsigned channels, unsigned n, float *peak, float *sum) {
+    PA_DECLARE_ALIGNED (16, float, p[4]);
+    PA_DECLARE_ALIGNED (16, float, s[4]);
+    pa_reg_x86 blocks = n / 4;
+    unsigned i;
+
+    if (4 % channels != 0 || blocks == 0) {
+        meter_float32ne_c(src, channels, n, peak, sum);
+        return;
+    }
+
+    __asm__ __volatile__ (
+        " movaps %4, %%xmm7             \n\t"
+        " xorps %%xmm5, %%xmm5          \n\t" /* peaks */
+        " xorps %%xmm6, %%xmm6          \n\t" /* sums */
+
+        "1:                             \n\t"
+        " movups (%0), %%xmm0           \n\t" /* read 4 samples */
+        " andps %%xmm7, %%xmm0          \n\t" /* abs */
+        " maxps %%xmm0, %%xmm5          \n\t"
+        " mulps %%xmm0, %%xmm0          \n\t"
+        " addps %%xmm0, %%xmm6          \n\t"
+
+        " add $16, %0                   \n\t"
+        " dec %1                        \n\t"
+        " jne 1b                        \n\t"
+
+        " movaps %%xmm5, (%2)           \n\t"
+        " movaps %%xmm6, (%3)           \n\t"
+
+        : "+r" (src), "+r" (blocks)
+        : "r" (p), "r" (s), "m" (*abs_mask)
+        : "cc", "memory", "xmm0", "xmm5", "xmm6", "xmm7"
+    );
+
+    for (i = 0; i < 4; i++) {
+        if (p[i] > peak[i % channels])
+            peak[i % channels] = p[i];
+        sum[i % channels] += s[i];
+    }
+
+    meter_float32ne_c(src, channels, n % 4, peak, sum);
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_meter_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized meters.");
+
+        meter_s16ne_c = pa_get_meter_func(PA_SAMPLE_S16NE);
+        meter_float32ne_c = pa_get_meter_func(PA_SAMPLE_FLOAT32NE);
+
+        pa_set_meter_func(PA_SAMPLE_S16NE, (pa_do_meter_func_t) meter_s16ne_sse2);
+        pa_set_meter_func(PA_SAMPLE_FLOAT32NE, (pa_do_meter_func_t) meter_float32ne_sse);
+    }
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -0,0 +1,363 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/sink.h>
+#include <pulsecore/source.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/source-output.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/shm.h>
+#include <pulsecore/strbuf.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "metrics.h"
+
+#define METRICS_PREFIX "pulseaudio_"
+
+const pa_usec_t pa_metrics_histogram_bounds[PA_METRICS_HISTOGRAM_BUCKETS] = {
+    50, 100, 250, 500,
+    1 * PA_USEC_PER_MSEC,
+    2500,
+    5 * PA_USEC_PER_MSEC,
+    10 * PA_USEC_PER_MSEC,
+    25 * PA_USEC_PER_MSEC,
+    50 * PA_USEC_PER_MSEC
+};
+
+/* No lock necessary */
+void pa_metrics_histogram_add(pa_metrics_histogram *h, pa_usec_t usec) {
+    unsigned i;
+
+    pa_assert(h);
+
+    for (i = 0; i < PA_METRICS_HISTOGRAM_BUCKETS; i++)
+        if (usec <= pa_metrics_histogram_bounds[i])
+            break;
+
+    pa_atomic_inc(&h->buckets[i]);
+    pa_atomic_inc(&h->count);
+    pa_atomic_add(&h->sum_usec, (int) usec);
+}
+
+static unsigned load(const pa_atomic_t *a) {
+    return (unsigned) pa_atomic_load(a);
+}
+
+/* Label values may contain anything, the exposition format wants
+ * backslashes, double quotes and newlines escaped */
+static char *escape_label(const char *t) {
+    pa_strbuf *sb;
+
+    sb = pa_strbuf_new();
+
+    for (; *t; t++) {
+        if (*t == '\\')
+            pa_strbuf_puts(sb, "\\\\");
+        else if (*t == '"')
+            pa_strbuf_puts(sb, "\\\"");
+        else if (*t == '\n')
+            pa_strbuf_puts(sb, "\\n");
+        else
+            pa_strbuf_putsn(sb, t, 1);
+    }
+
+    return pa_strbuf_tostring_free(sb);
+}
+
+static void print_type(pa_strbuf *s, const char *name, const char *type, const char *help) {
+    pa_strbuf_printf(s, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+    pa_strbuf_printf(s, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+static void print_histogram(pa_strbuf *s, const char *name, const char *labels, const pa_metrics_histogram *h) {
+    unsigned i, cumulative = 0;
+
+    for (i = 0; i < PA_METRICS_HISTOGRAM_BUCKETS; i++) {
+        cumulative += load(&h->buckets[i]);
+        pa_strbuf_printf(s, METRICS_PREFIX "%s_bucket{%s,le=\"%0.6f\"} %u\n",
+                         name, labels, (double) pa_metrics_histogram_bounds[i] / PA_USEC_PER_SEC, cumulative);
+    }
+
+    cumulative += load(&h->buckets[PA_METRICS_HISTOGRAM_BUCKETS]);
+    pa_strbuf_printf(s, METRICS_PREFIX "%s_bucket{%s,le=\"+Inf\"} %u\n", name, labels, cumulative);
+    pa_strbuf_printf(s, METRICS_PREFIX "%s_sum{%s} %0.6f\n", name, labels, (double) load(&h->sum_usec) / PA_USEC_PER_SEC);
+    pa_strbuf_printf(s, METRICS_PREFIX "%s_count{%s} %u\n", name, labels, load(&h->count));
+}
+
+static char *device_labels(const char *kind, const char *name) {
+    char *e, *labels;
+
+    e = escape_label(name);
+    labels = pa_sprintf_malloc("%s=\"%s\"", kind, e);
+    pa_xfree(e);
+
+    return labels;
+}
+
+static void print_sinks(pa_strbuf *s, pa_core *c) {
+    pa_sink *sink;
+    uint32_t idx;
+    char *labels;
+
+    print_type(s, "sink_render_seconds", "histogram", "Time spent rendering one block of audio in the IO thread.");
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        labels = device_labels("sink", sink->name);
+        print_histogram(s, "sink_render_seconds", labels, &sink->metrics.process_time);
+        pa_xfree(labels);
+    }
+
+    print_type(s, "sink_underruns_total", "counter", "Number of device buffer underruns.");
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        labels = device_labels("sink", sink->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "sink_underruns_total{%s} %u\n", labels, load(&sink->metrics.n_xruns));
+        pa_xfree(labels);
+    }
+
+    print_type(s, "sink_rewinds_total", "counter", "Number of rewinds.");
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        labels = device_labels("sink", sink->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "sink_rewinds_total{%s} %u\n", labels, load(&sink->metrics.n_rewinds));
+        pa_xfree(labels);
+    }
+
+    print_type(s, "sink_rewind_bytes_total", "counter", "Number of bytes rewound.");
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        labels = device_labels("sink", sink->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "sink_rewind_bytes_total{%s} %u\n", labels, load(&sink->metrics.rewind_bytes));
+        pa_xfree(labels);
+    }
+
+    print_type(s, "sink_rendered_bytes_total", "counter", "Number of bytes rendered, including data rendered again after rewinds.");
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        labels = device_labels("sink", sink->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "sink_rendered_bytes_total{%s} %u\n", labels, load(&sink->metrics.rendered_bytes));
+        pa_xfree(labels);
+    }
+
+    print_type(s, "sink_rewind_replayed_bytes_total", "counter", "Number of bytes rendered again from the mix history after a rewind.");
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        labels = device_labels("sink", sink->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "sink_rewind_replayed_bytes_total{%s} %u\n", labels, load(&sink->metrics.replayed_bytes));
+        pa_xfree(labels);
+    }
+
+    print_type(s, "sink_silent_renders_total", "counter", "Render cycles that skipped mixing because all inputs were silent or muted.");
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        labels = device_labels("sink", sink->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "sink_silent_renders_total{%s} %u\n", labels, load(&sink->metrics.silent_renders));
+        pa_xfree(labels);
+    }
+}
+
+static void print_sources(pa_strbuf *s, pa_core *c) {
+    pa_source *source;
+    uint32_t idx;
+    char *labels;
+
+    print_type(s, "source_post_seconds", "histogram", "Time spent posting one block of audio in the IO thread.");
+    PA_IDXSET_FOREACH(source, c->sources, idx) {
+        labels = device_labels("source", source->name);
+        print_histogram(s, "source_post_seconds", labels, &source->metrics.process_time);
+        pa_xfree(labels);
+    }
+
+    print_type(s, "source_overruns_total", "counter", "Number of device buffer overruns.");
+    PA_IDXSET_FOREACH(source, c->sources, idx) {
+        labels = device_labels("source", source->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "source_overruns_total{%s} %u\n", labels, load(&source->metrics.n_xruns));
+        pa_xfree(labels);
+    }
+
+    print_type(s, "source_rewinds_total", "counter", "Number of rewinds.");
+    PA_IDXSET_FOREACH(source, c->sources, idx) {
+        labels = device_labels("source", source->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "source_rewinds_total{%s} %u\n", labels, load(&source->metrics.n_rewinds));
+        pa_xfree(labels);
+    }
+
+    print_type(s, "source_rewind_bytes_total", "counter", "Number of bytes rewound.");
+    PA_IDXSET_FOREACH(source, c->sources, idx) {
+        labels = device_labels("source", source->name);
+        pa_strbuf_printf(s, METRICS_PREFIX "source_rewind_bytes_total{%s} %u\n", labels, load(&source->metrics.rewind_bytes));
+        pa_xfree(labels);
+    }
+}
+
+static char *stream_labels(uint32_t idx, const char *device, pa_resample_method_t method) {
+    char *e, *labels;
+
+    e = escape_label(device);
+    labels = pa_sprintf_malloc("index=\"%u\",device=\"%s\",resample_method=\"%s\"",
+                               idx, e, pa_strna(pa_resample_method_to_string(method)));
+    pa_xfree(e);
+
+    return labels;
+}
+
+enum stream_field {
+    STREAM_FIELD_XRUNS,
+    STREAM_FIELD_RESAMPLE,
+    STREAM_FIELD_RESAMPLES,
+    STREAM_FIELD_QUEUE,
+    STREAM_FIELD_UPSTREAM_LAG,
+    STREAM_FIELD_UPSTREAM_SKIPPED,
+    STREAM_FIELD_REWIND_SAVED,
+    STREAM_FIELD_DSP_SKIPPED,
+    STREAM_FIELD_RESAMPLE_DOWNGRADE,
+    STREAM_FIELD_MIXED
+};
+
+static void print_stream_field(pa_strbuf *s, const char *name, const char *labels, const pa_stream_metrics *m, enum stream_field f) {
+    switch (f) {
+        case STREAM_FIELD_XRUNS:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->n_xruns));
+            break;
+        case STREAM_FIELD_RESAMPLE:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %0.6f\n", name, labels, (double) load(&m->resample_usec) / PA_USEC_PER_SEC);
+            break;
+        case STREAM_FIELD_RESAMPLES:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->n_resamples));
+            break;
+        case STREAM_FIELD_QUEUE:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->queue_length));
+            break;
+        case STREAM_FIELD_UPSTREAM_LAG:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->upstream_lag));
+            break;
+        case STREAM_FIELD_UPSTREAM_SKIPPED:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->upstream_skipped));
+            break;
+        case STREAM_FIELD_REWIND_SAVED:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->rewind_saved));
+            break;
+        case STREAM_FIELD_DSP_SKIPPED:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->dsp_skipped));
+            break;
+        case STREAM_FIELD_RESAMPLE_DOWNGRADE:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->resample_downgrade));
+            break;
+        case STREAM_FIELD_MIXED:
+            pa_strbuf_printf(s, METRICS_PREFIX "%s{%s} %u\n", name, labels, load(&m->mixed_bytes));
+            break;
+    }
+}
+
+static void print_streams(pa_strbuf *s, pa_core *c) {
+    static const struct {
+        const char *sink_input_name, *source_output_name, *type, *help;
+    } fields[] = {
+        [STREAM_FIELD_XRUNS] = { "sink_input_underruns_total", "source_output_overruns_total", "counter",
+                                 "Number of times the stream ran out of data resp. overflowed its delay queue." },
+        [STREAM_FIELD_RESAMPLE] = { "sink_input_resampler_seconds_total", "source_output_resampler_seconds_total", "counter",
+                                    "CPU time spent resampling." },
+        [STREAM_FIELD_RESAMPLES] = { "sink_input_resampler_runs_total", "source_output_resampler_runs_total", "counter",
+                                     "Number of blocks passed through the resampler." },
+        [STREAM_FIELD_QUEUE] = { "sink_input_queue_bytes", "source_output_queue_bytes", "gauge",
+                                 "Fill level of the render resp. delay queue." },
+        [STREAM_FIELD_UPSTREAM_LAG] = { "sink_input_upstream_lag_bytes", "source_output_upstream_lag_bytes", "gauge",
+                                        "How far the stream is behind the thread feeding it, e.g. for combined outputs." },
+        [STREAM_FIELD_UPSTREAM_SKIPPED] = { "sink_input_upstream_skipped_bytes_total", "source_output_upstream_skipped_bytes_total", "counter",
+                                            "Data the stream skipped because it fell too far behind the thread feeding it." },
+        /* Source outputs don't keep anything for rewinds */
+        [STREAM_FIELD_REWIND_SAVED] = { "sink_input_rewind_saved_bytes", NULL, "gauge",
+                                        "Rendered data not kept for rewinds because the stream renders it again on demand." },
+        /* Only the sink inputs of filter sinks skip anything so far */
+        [STREAM_FIELD_DSP_SKIPPED] = { "sink_input_dsp_skipped_total", NULL, "counter",
+                                       "Filter processing cycles skipped because the filter's input was silent." },
+        [STREAM_FIELD_RESAMPLE_DOWNGRADE] = { "sink_input_resampler_downgrade", NULL, "gauge",
+                                              "Steps the resampler CPU budget moved the stream's resampler down its quality ladder." },
+        [STREAM_FIELD_MIXED] = { "sink_input_mixed_bytes_total", NULL, "counter",
+                                 "Data the sink mixed from the stream, including data mixed again after rewinds." }
+    };
+    pa_sink_input *i;
+    pa_source_output *o;
+    uint32_t idx;
+    unsigned f;
+    char *labels;
+
+    for (f = 0; f < PA_ELEMENTSOF(fields); f++) {
+        print_type(s, fields[f].sink_input_name, fields[f].type, fields[f].help);
+
+        PA_IDXSET_FOREACH(i, c->sink_inputs, idx) {
+            labels = stream_labels(i->index, i->sink ? i->sink->name : "", pa_sink_input_get_resample_method(i));
+            print_stream_field(s, fields[f].sink_input_name, labels, &i->metrics, f);
+            pa_xfree(labels);
+        }
+    }
+
+    for (f = 0; f < PA_ELEMENTSOF(fields); f++) {
+        if (!fields[f].source_output_name)
+            continue;
+
+        print_type(s, fields[f].source_output_name, fields[f].type, fields[f].help);
+
+        PA_IDXSET_FOREACH(o, c->source_outputs, idx) {
+            labels = stream_labels(o->index, o->source ? o->source->name : "", pa_source_output_get_resample_method(o));
+            print_stream_field(s, fields[f].source_output_name, labels, &o->metrics, f);
+            pa_xfree(labels);
+        }
+    }
+}
+
+char *pa_metrics_to_string(pa_core *c) {
+    pa_strbuf *s;
+    const pa_mempool_stat *stat;
+
+    pa_core_assert_ref(c);
+
+    s = pa_strbuf_new();
+
+    print_sinks(s, c);
+    print_sources(s, c);
+    print_streams(s, c);
+
+    stat = pa_mempool_get_stat(c->mempool);
+
+    print_type(s, "mempool_slots", "gauge", "Number of slots in the memory pool.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_slots %u\n", load(&stat->n_slots));
+    print_type(s, "mempool_slots_used", "gauge", "Number of memory pool slots currently in use.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_slots_used %u\n", load(&stat->n_slots_used));
+    print_type(s, "mempool_large_slots", "gauge", "Number of large slots in the memory pool.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_large_slots %u\n", load(&stat->n_large_slots));
+    print_type(s, "mempool_large_slots_used", "gauge", "Number of large memory pool slots currently in use.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_large_slots_used %u\n", load(&stat->n_large_slots_used));
+    print_type(s, "mempool_pages", "gauge", "Number of pages backing the memory pool, by kind.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_pages{kind=\"%s\",page_size=\"%u\"} %u\n",
+                     pa_shm_pages_to_string(pa_atomic_load(&stat->pages)), load(&stat->page_size), load(&stat->n_pages));
+    print_type(s, "mempool_numa_node", "gauge", "NUMA node the memory pool is bound to, -1 if none.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_numa_node %i\n", pa_atomic_load(&stat->numa_node));
+    print_type(s, "mempool_blocks", "gauge", "Number of currently allocated memory blocks.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_blocks %u\n", load(&stat->n_allocated));
+    print_type(s, "mempool_bytes", "gauge", "Size of currently allocated memory blocks.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_bytes %u\n", load(&stat->allocated_size));
+    print_type(s, "mempool_too_large_total", "counter", "Allocations that were too large for a pool slot.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_too_large_total %u\n", load(&stat->n_too_large_for_pool));
+    print_type(s, "mempool_full_total", "counter", "Allocations that failed because the pool was full.");
+    pa_strbuf_printf(s, METRICS_PREFIX "mempool_full_total %u\n", load(&stat->n_pool_full));
+
+    return pa_strbuf_tostring_free(s);
+}
@@ -0,0 +1,111 @@
+#ifndef foopulsecoremetricshfoo
+#define foopulsecoremetricshfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/core.h>
+
+/* Counters for the audio path that are updated from the IO threads and
+ * read from the main thread. Just like pa_mempool_stat these are not
+ * locked and only meant for statistical purposes. All counters wrap
+ * around when they exceed the range of an unsigned int. */
+
+#define PA_METRICS_HISTOGRAM_BUCKETS 10
+
+/* Upper bounds of the histogram buckets, in usec. There is an implicit
+ * last bucket catching everything above the last bound. */
+extern const pa_usec_t pa_metrics_histogram_bounds[PA_METRICS_HISTOGRAM_BUCKETS];
+
+typedef struct pa_metrics_histogram {
+    pa_atomic_t buckets[PA_METRICS_HISTOGRAM_BUCKETS + 1];
+    pa_atomic_t count;
+    pa_atomic_t sum_usec;
+} pa_metrics_histogram;
+
+/* Per sink and per source */
+typedef struct pa_device_metrics {
+    /* Time spent in pa_sink_render*() resp. pa_source_post() */
+    pa_metrics_histogram process_time;
+
+    /* Sinks: bytes rendered, including data rendered again after a
+     * rewind */
+    pa_atomic_t rendered_bytes;
+
+    /* Underruns for sinks, overruns for sources, as reported by the
+     * implementor */
+    pa_atomic_t n_xruns;
+
+    pa_atomic_t n_rewinds;
+    pa_atomic_t rewind_bytes;
+
+    /* Sinks with a mix history: bytes rendered again from the history
+     * after a rewind, re-mixing only the inputs that changed */
+    pa_atomic_t replayed_bytes;
+
+    /* Sinks: render cycles in which every input was silent or muted,
+     * so nothing was mixed and no volume applied */
+    pa_atomic_t silent_renders;
+} pa_device_metrics;
+
+/* Per sink input and per source output */
+typedef struct pa_stream_metrics {
+    /* Underruns for sink inputs, overruns of the delay queue for
+     * source outputs */
+    pa_atomic_t n_xruns;
+
+    /* CPU time spent in the resampler, and how often it ran */
+    pa_atomic_t resample_usec;
+    pa_atomic_t n_resamples;
+
+    /* Sink inputs: bytes the sink mixed from the stream, counting data
+     * that is mixed again after a rewind once more */
+    pa_atomic_t mixed_bytes;
+
+    /* Sink inputs: how many steps down its quality ladder the resampler
+     * CPU budget has moved the resampler */
+    pa_atomic_t resample_downgrade;
+
+    /* Fill level of the render resp. delay queue, in bytes */
+    pa_atomic_t queue_length;
+
+    /* Sink inputs with lazy rewinds: rendered data not kept around for
+     * rewinds, in bytes */
+    pa_atomic_t rewind_saved;
+
+    /* For streams that are fed from another thread without blocking it,
+     * like the outputs of module-combine-sink: how many bytes the
+     * stream is behind its producer, and how many it had to skip
+     * because it fell too far behind */
+    pa_atomic_t upstream_lag;
+    pa_atomic_t upstream_skipped;
+
+    /* Sink inputs of filters: processing cycles the filter skipped
+     * because its input had been silent for longer than its tail */
+    pa_atomic_t dsp_skipped;
+} pa_stream_metrics;
+
+void pa_metrics_histogram_add(pa_metrics_histogram *h, pa_usec_t usec);
+
+/* Formats all metrics in the Prometheus text exposition format */
+char *pa_metrics_to_string(pa_core *c);
+
+#endif
@@ -176,6 +176,11 @@ enum {
     /* Supported since protocol v27 (3.0) */
     PA_COMMAND_SET_PORT_LATENCY_OFFSET,
 
+    /* Supported since protocol v30 (6.0) */
+    PA_COMMAND_SUBSCRIBE_METER,
+    PA_COMMAND_UNSUBSCRIBE_METER,
+    PA_COMMAND_METER_EVENT,
+
     PA_COMMAND_MAX
 };
 
@@ -192,6 +192,11 @@ static const char *command_names[PA_COMMAND_MAX] = {
 
     /* Supported since protocol v27 (3.0) */
     [PA_COMMAND_SET_PORT_LATENCY_OFFSET] = "SET_PORT_LATENCY_OFFSET",
+
+    /* Supported since protocol v30 (6.0) */
+    [PA_COMMAND_SUBSCRIBE_METER] = "SUBSCRIBE_METER",
+    [PA_COMMAND_UNSUBSCRIBE_METER] = "UNSUBSCRIBE_METER",
+    [PA_COMMAND_METER_EVENT] = "METER_EVENT",
 };
 
 #endif
@@ -42,21 +42,25 @@
 #include <pulsecore/shared.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/mime-type.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/metrics.h>
 
 #include "protocol-http.h"
 
-/* Don't allow more than this many concurrent connections */
-#define MAX_CONNECTIONS 10
+/* Don't allow more than this many concurrent connections by default */
+#define DEFAULT_MAX_CONNECTIONS 10
 
 #define URL_ROOT "/"
 #define URL_CSS "/style"
 #define URL_STATUS "/status"
+#define URL_METRICS "/metrics"
 #define URL_LISTEN "/listen"
 #define URL_LISTEN_SOURCE "/listen/source/"
 
 #define MIME_HTML "text/html; charset=utf-8"
 #define MIME_TEXT "text/plain; charset=utf-8"
 #define MIME_CSS "text/css"
+#define MIME_METRICS "text/plain; version=0.0.4; charset=utf-8"
 
 #define HTML_HEADER(t)                                                  \
     "<?xml version=\"1.0\"?>\n"                                         \
@@ -86,8 +90,11 @@ enum method {
     METHOD_HEAD
 };
 
+struct listen_group;
+
 struct connection {
     pa_http_protocol *protocol;
+    pa_http_options *options;
     pa_iochannel *io;
     pa_ioline *line;
     pa_memblockq *output_memblockq;
@@ -96,7 +103,36 @@ struct connection {
     enum state state;
     char *url;
     enum method method;
+
+    /* Only used in fan-out mode: the group we are listening to and our
+     * absolute read position in the group's ring buffer */
+    struct listen_group *group;
+    uint64_t read_index;
+    uint64_t skipped;
+
+    PA_LLIST_FIELDS(struct connection);
+};
+
+/* In fan-out mode all listeners of the same source (and module) share
+ * one source output. The converted data is written once into a ring
+ * buffer, and every listener keeps its own cursor into it. Listeners
+ * that fall behind by more than the ring size are skipped forward to
+ * the write position instead of stalling everybody else. */
+struct listen_group {
+    pa_http_protocol *protocol;
     pa_module *module;
+    pa_source *source;
+    pa_source_output *source_output;
+
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+
+    uint8_t *ring;
+    size_t ring_size;
+    uint64_t write_index;
+
+    PA_LLIST_HEAD(struct connection, listeners);
+    PA_LLIST_FIELDS(struct listen_group);
 };
 
 struct pa_http_protocol {
@@ -105,6 +141,8 @@ struct pa_http_protocol {
     pa_core *core;
     pa_idxset *connections;
 
+    PA_LLIST_HEAD(struct listen_group, listen_groups);
+
     pa_strlist *servers;
 };
 
@@ -112,10 +150,50 @@ enum {
     SOURCE_OUTPUT_MESSAGE_POST_DATA = PA_SOURCE_OUTPUT_MESSAGE_MAX
 };
 
+static void connection_unlink(struct connection *c);
+
+/* Called from main context */
+static void listen_group_free(struct listen_group *g) {
+    pa_assert(g);
+    pa_assert(!g->listeners);
+
+    pa_log_debug("Removing listen group for source %s.", g->source->name);
+
+    if (g->source_output) {
+        pa_source_output_unlink(g->source_output);
+        g->source_output->userdata = NULL;
+        pa_source_output_unref(g->source_output);
+    }
+
+    PA_LLIST_REMOVE(struct listen_group, g->protocol->listen_groups, g);
+
+    pa_xfree(g->ring);
+    pa_xfree(g);
+}
+
+/* Called from main context */
+static void listen_group_remove(struct listen_group *g, struct connection *c) {
+    pa_assert(g);
+    pa_assert(c);
+    pa_assert(c->group == g);
+
+    PA_LLIST_REMOVE(struct connection, g->listeners, c);
+    c->group = NULL;
+
+    if (c->skipped > 0)
+        pa_log_debug("Listener skipped %llu bytes in total.", (unsigned long long) c->skipped);
+
+    if (!g->listeners)
+        listen_group_free(g);
+}
+
 /* Called from main context */
 static void connection_unlink(struct connection *c) {
     pa_assert(c);
 
+    if (c->group)
+        listen_group_remove(c->group, c);
+
     if (c->source_output) {
         pa_source_output_unlink(c->source_output);
         c->source_output->userdata = NULL;
@@ -138,9 +216,58 @@ static void connection_unlink(struct connection *c) {
 
     pa_idxset_remove_by_data(c->protocol->connections, c, NULL);
 
+    if (c->options)
+        pa_http_options_unref(c->options);
+
     pa_xfree(c);
 }
 
+/* Called from main context */
+static int do_write_group(struct connection *c) {
+    struct listen_group *g;
+    uint64_t avail;
+    size_t offset, length;
+    ssize_t r;
+
+    pa_assert(c);
+    pa_assert_se(g = c->group);
+
+    avail = g->write_index - c->read_index;
+
+    if (avail > g->ring_size) {
+        size_t fs = pa_frame_size(&g->sample_spec);
+        uint64_t skip;
+
+        /* This listener is too slow and parts of the data it hasn't
+         * read yet have already been overwritten. Skip it forward to
+         * the current write position, keeping the frame alignment of
+         * what we already sent. */
+        skip = avail - (avail % fs);
+        pa_log_debug("Listener fell behind by %llu bytes, skipping ahead.", (unsigned long long) skip);
+
+        c->skipped += skip;
+        c->read_index += skip;
+        return 0;
+    }
+
+    if (avail == 0)
+        return 0;
+
+    offset = (size_t) (c->read_index % g->ring_size);
+    length = PA_MIN((size_t) avail, g->ring_size - offset);
+
+    r = pa_iochannel_write(c->io, g->ring + offset, length);
+
+    if (r < 0) {
+        pa_log("write(): %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    c->read_index += (uint64_t) r;
+
+    return 1;
+}
+
 /* Called from main context */
 static int do_write(struct connection *c) {
     pa_memchunk chunk;
@@ -149,6 +276,9 @@ static int do_write(struct connection *c) {
 
     pa_assert(c);
 
+    if (c->group)
+        return do_write_group(c);
+
     if (pa_memblockq_peek(c->output_memblockq, &chunk) < 0)
         return 0;
 
@@ -175,6 +305,10 @@ static int do_write(struct connection *c) {
 static void do_work(struct connection *c) {
     pa_assert(c);
 
+    /* We might still be waiting for the HTTP header to be drained */
+    if (!c->io)
+        return;
+
     if (pa_iochannel_is_hungup(c->io))
         goto fail;
 
@@ -249,6 +383,114 @@ static pa_usec_t source_output_get_latency_cb(pa_source_output *o) {
     return pa_bytes_to_usec(pa_memblockq_get_length(c->output_memblockq), &c->source_output->sample_spec);
 }
 
+/* Called from main context */
+static void listen_group_push(struct listen_group *g, const pa_memchunk *chunk) {
+    struct connection *c, *n;
+    const uint8_t *p;
+    size_t length, offset, l;
+
+    pa_assert(g);
+    pa_assert(chunk);
+
+    p = (const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+    length = chunk->length;
+
+    /* If a single chunk is bigger than the ring, only its tail matters */
+    if (length > g->ring_size) {
+        p += length - g->ring_size;
+        g->write_index += length - g->ring_size;
+        length = g->ring_size;
+    }
+
+    while (length > 0) {
+        offset = (size_t) (g->write_index % g->ring_size);
+        l = PA_MIN(length, g->ring_size - offset);
+
+        memcpy(g->ring + offset, p, l);
+
+        p += l;
+        length -= l;
+        g->write_index += l;
+    }
+
+    pa_memblock_release(chunk->memblock);
+
+    /* Writing to a listener may end up unlinking it, and unlinking the
+     * last one frees the group, hence the careful iteration */
+    for (c = g->listeners; c; c = n) {
+        n = c->next;
+        do_work(c);
+    }
+}
+
+/* Called from thread context, except when it is not */
+static int listen_group_process_msg(pa_msgobject *m, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
+    pa_source_output *o = PA_SOURCE_OUTPUT(m);
+    struct listen_group *g;
+
+    pa_source_output_assert_ref(o);
+
+    if (!(g = o->userdata))
+        return -1;
+
+    switch (code) {
+
+        case SOURCE_OUTPUT_MESSAGE_POST_DATA:
+            /* While this function is usually called from IO thread
+             * context, this specific command is not! */
+            listen_group_push(g, chunk);
+            break;
+
+        default:
+            return pa_source_output_process_msg(m, code, userdata, offset, chunk);
+    }
+
+    return 0;
+}
+
+/* Called from main context */
+static void listen_group_kill_cb(pa_source_output *o) {
+    struct listen_group *g;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(g = o->userdata);
+
+    /* Unlinking the last listener frees the group itself */
+    while (g->listeners->next)
+        connection_unlink(g->listeners);
+
+    connection_unlink(g->listeners);
+}
+
+/* Called from main context */
+static void listen_group_moving_cb(pa_source_output *o, pa_source *dest) {
+    struct listen_group *g;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(g = o->userdata);
+
+    /* Keep the lookup key in sync, so that new listeners of the
+     * destination join us instead of creating a second group */
+    if (dest)
+        g->source = dest;
+}
+
+/* Called from main context */
+static pa_usec_t listen_group_get_latency_cb(pa_source_output *o) {
+    struct listen_group *g;
+    struct connection *c;
+    uint64_t lag = 0;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(g = o->userdata);
+
+    /* Report the lag of the slowest listener */
+    PA_LLIST_FOREACH(c, g->listeners)
+        lag = PA_MAX(lag, g->write_index - c->read_index);
+
+    return pa_bytes_to_usec(PA_MIN(lag, (uint64_t) g->ring_size), &g->sample_spec);
+}
+
 /*** client callbacks ***/
 static void client_kill_cb(pa_client *client) {
     struct connection*c;
@@ -408,6 +650,7 @@ static void handle_root(struct connection *c) {
     pa_ioline_puts(c->line,
                    "</table>\n"
                    "<p><a href=\"" URL_STATUS "\">Show an extensive server status report</a></p>\n"
+                   "<p><a href=\"" URL_METRICS "\">Show audio path metrics</a></p>\n"
                    "<p><a href=\"" URL_LISTEN "\">Monitor sinks and sources</a></p>\n"
                    HTML_FOOTER);
 
@@ -455,6 +698,25 @@ static void handle_status(struct connection *c) {
     pa_ioline_defer_close(c->line);
 }
 
+static void handle_metrics(struct connection *c) {
+    char *r;
+
+    pa_assert(c);
+
+    http_response(c, 200, "OK", MIME_METRICS);
+
+    if (c->method == METHOD_HEAD) {
+        pa_ioline_defer_close(c->line);
+        return;
+    }
+
+    r = pa_metrics_to_string(c->protocol->core);
+    pa_ioline_puts(c->line, r);
+    pa_xfree(r);
+
+    pa_ioline_defer_close(c->line);
+}
+
 static void handle_listen(struct connection *c) {
     pa_source *source;
     pa_sink *sink;
@@ -527,12 +789,116 @@ static void line_drain_callback(pa_ioline *l, void *userdata) {
     pa_assert_se(c->io = pa_ioline_detach_iochannel(c->line));
     pa_iochannel_set_callback(c->io, io_callback, c);
 
-    pa_iochannel_socket_set_sndbuf(c->io, pa_memblockq_get_length(c->output_memblockq));
+    if (c->group)
+        pa_iochannel_socket_set_sndbuf(c->io, c->group->ring_size);
+    else
+        pa_iochannel_socket_set_sndbuf(c->io, pa_memblockq_get_length(c->output_memblockq));
 
     pa_ioline_unref(c->line);
     c->line = NULL;
 }
 
+static struct listen_group* listen_group_get(struct connection *c, pa_source *source) {
+    struct listen_group *g;
+    pa_source_output_new_data data;
+
+    pa_assert(c);
+    pa_assert(source);
+
+    PA_LLIST_FOREACH(g, c->protocol->listen_groups)
+        if (g->source == source && g->module == c->options->module)
+            return g;
+
+    g = pa_xnew0(struct listen_group, 1);
+    g->protocol = c->protocol;
+    g->module = c->options->module;
+    g->source = source;
+
+    g->sample_spec = source->sample_spec;
+    g->channel_map = source->channel_map;
+    pa_sample_spec_mimefy(&g->sample_spec, &g->channel_map);
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    data.module = g->module;
+    pa_source_output_new_data_set_source(&data, source, false);
+    pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, "HTTP listeners");
+    pa_source_output_new_data_set_sample_spec(&data, &g->sample_spec);
+    pa_source_output_new_data_set_channel_map(&data, &g->channel_map);
+
+    pa_source_output_new(&g->source_output, c->protocol->core, &data);
+    pa_source_output_new_data_done(&data);
+
+    if (!g->source_output) {
+        pa_xfree(g);
+        return NULL;
+    }
+
+    g->source_output->parent.process_msg = listen_group_process_msg;
+    g->source_output->push = source_output_push_cb;
+    g->source_output->kill = listen_group_kill_cb;
+    g->source_output->get_latency = listen_group_get_latency_cb;
+    g->source_output->moving = listen_group_moving_cb;
+    g->source_output->userdata = g;
+
+    pa_source_output_set_requested_latency(g->source_output, DEFAULT_SOURCE_LATENCY);
+
+    g->ring_size = pa_frame_align((size_t) (pa_bytes_per_second(&g->sample_spec)*RECORD_BUFFER_SECONDS), &g->sample_spec);
+    g->ring = pa_xmalloc(g->ring_size);
+
+    PA_LLIST_PREPEND(struct listen_group, c->protocol->listen_groups, g);
+
+    pa_source_output_put(g->source_output);
+
+    pa_log_debug("Created listen group for source %s.", source->name);
+
+    return g;
+}
+
+static void handle_listen_prefix_fanout(struct connection *c, pa_source *source) {
+    struct listen_group *g;
+    pa_sample_spec ss;
+    pa_channel_map cm;
+    char *t;
+
+    pa_assert(c);
+    pa_assert(source);
+
+    if (c->method == METHOD_HEAD) {
+        ss = source->sample_spec;
+        cm = source->channel_map;
+        pa_sample_spec_mimefy(&ss, &cm);
+
+        t = pa_sample_spec_to_mime_type(&ss, &cm);
+        http_response(c, 200, "OK", t);
+        pa_xfree(t);
+
+        pa_ioline_defer_close(c->line);
+        return;
+    }
+
+    if (!(g = listen_group_get(c, source))) {
+        html_response(c, 403, "Cannot create source output", NULL);
+        return;
+    }
+
+    /* New listeners start at the current write position */
+    c->group = g;
+    c->read_index = g->write_index;
+    PA_LLIST_PREPEND(struct connection, g->listeners, c);
+
+    t = pa_sample_spec_to_mime_type(&g->sample_spec, &g->channel_map);
+    http_response(c, 200, "OK", t);
+    pa_xfree(t);
+
+    pa_ioline_set_callback(c->line, NULL, NULL);
+
+    if (pa_ioline_is_drained(c->line))
+        line_drain_callback(c->line, c);
+    else
+        pa_ioline_set_drain_callback(c->line, line_drain_callback, c);
+}
+
 static void handle_listen_prefix(struct connection *c, const char *source_name) {
     pa_source *source;
     pa_source_output_new_data data;
@@ -552,6 +918,11 @@ static void handle_listen_prefix(struct connection *c, const char *source_name)
         return;
     }
 
+    if (c->options->listen_fanout) {
+        handle_listen_prefix_fanout(c, source);
+        return;
+    }
+
     ss = source->sample_spec;
     cm = source->channel_map;
 
@@ -559,7 +930,7 @@ static void handle_listen_prefix(struct connection *c, const char *source_name)
 
     pa_source_output_new_data_init(&data);
     data.driver = __FILE__;
-    data.module = c->module;
+    data.module = c->options->module;
     data.client = c->client;
     pa_source_output_new_data_set_source(&data, source, false);
     pa_proplist_update(data.proplist, PA_UPDATE_MERGE, c->client->proplist);
@@ -623,6 +994,8 @@ static void handle_url(struct connection *c) {
         handle_css(c);
     else if (pa_streq(c->url, URL_STATUS))
         handle_status(c);
+    else if (pa_streq(c->url, URL_METRICS))
+        handle_metrics(c);
     else if (pa_streq(c->url, URL_LISTEN))
         handle_listen(c);
     else if (pa_startswith(c->url, URL_LISTEN_SOURCE))
@@ -682,17 +1055,17 @@ fail:
     html_response(c, 500, "Internal Server Error", NULL);
 }
 
-void pa_http_protocol_connect(pa_http_protocol *p, pa_iochannel *io, pa_module *m) {
+void pa_http_protocol_connect(pa_http_protocol *p, pa_iochannel *io, pa_http_options *o) {
     struct connection *c;
     pa_client_new_data client_data;
     char pname[128];
 
     pa_assert(p);
     pa_assert(io);
-    pa_assert(m);
+    pa_assert(o);
 
-    if (pa_idxset_size(p->connections)+1 > MAX_CONNECTIONS) {
-        pa_log("Warning! Too many connections (%u), dropping incoming connection.", MAX_CONNECTIONS);
+    if (pa_idxset_size(p->connections)+1 > o->max_connections) {
+        pa_log("Warning! Too many connections (%u), dropping incoming connection.", o->max_connections);
         pa_iochannel_free(io);
         return;
     }
@@ -700,13 +1073,13 @@ void pa_http_protocol_connect(pa_http_protocol *p, pa_iochannel *io, pa_module *
     c = pa_xnew0(struct connection, 1);
     c->protocol = p;
     c->state = STATE_REQUEST_LINE;
-    c->module = m;
+    c->options = pa_http_options_ref(o);
 
     c->line = pa_ioline_new(io);
     pa_ioline_set_callback(c->line, line_callback, c);
 
     pa_client_new_data_init(&client_data);
-    client_data.module = c->module;
+    client_data.module = o->module;
     client_data.driver = __FILE__;
     pa_iochannel_socket_peer_to_string(io, pname, sizeof(pname));
     pa_proplist_setf(client_data.proplist, PA_PROP_APPLICATION_NAME, "HTTP client (%s)", pname);
@@ -737,7 +1110,7 @@ void pa_http_protocol_disconnect(pa_http_protocol *p, pa_module *m) {
     pa_assert(m);
 
     PA_IDXSET_FOREACH(c, p->connections, idx)
-        if (c->module == m)
+        if (c->options->module == m)
             connection_unlink(c);
 }
 
@@ -788,6 +1161,8 @@ void pa_http_protocol_unref(pa_http_protocol *p) {
 
     pa_idxset_free(p->connections, NULL);
 
+    pa_assert(!p->listen_groups);
+
     pa_strlist_free(p->servers);
 
     pa_assert_se(pa_shared_remove(p->core, "http-protocol") >= 0);
@@ -817,3 +1192,56 @@ pa_strlist *pa_http_protocol_servers(pa_http_protocol *p) {
 
     return p->servers;
 }
+
+pa_http_options* pa_http_options_new(void) {
+    pa_http_options *o;
+
+    o = pa_xnew0(pa_http_options, 1);
+    PA_REFCNT_INIT(o);
+
+    o->max_connections = DEFAULT_MAX_CONNECTIONS;
+    o->listen_fanout = false;
+
+    return o;
+}
+
+pa_http_options* pa_http_options_ref(pa_http_options *o) {
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    PA_REFCNT_INC(o);
+
+    return o;
+}
+
+void pa_http_options_unref(pa_http_options *o) {
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (PA_REFCNT_DEC(o) > 0)
+        return;
+
+    pa_xfree(o);
+}
+
+int pa_http_options_parse(pa_http_options *o, pa_core *c, pa_modargs *ma) {
+    bool enabled;
+
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+    pa_assert(ma);
+
+    if (pa_modargs_get_value_u32(ma, "max-connections", &o->max_connections) < 0 || o->max_connections < 1) {
+        pa_log("max-connections= expects a positive integer argument.");
+        return -1;
+    }
+
+    enabled = o->listen_fanout;
+    if (pa_modargs_get_value_boolean(ma, "listen-fanout", &enabled) < 0) {
+        pa_log("listen-fanout= expects a boolean argument.");
+        return -1;
+    }
+    o->listen_fanout = enabled;
+
+    return 0;
+}
@@ -30,14 +30,32 @@
 
 typedef struct pa_http_protocol pa_http_protocol;
 
+typedef struct pa_http_options {
+    PA_REFCNT_DECLARE;
+
+    pa_module *module;
+
+    /* Maximum number of concurrent connections accepted through this module */
+    uint32_t max_connections;
+
+    /* If enabled, all /listen clients of the same source share a single
+     * source output and a single ring buffer of converted data */
+    bool listen_fanout:1;
+} pa_http_options;
+
 pa_http_protocol* pa_http_protocol_get(pa_core *core);
 pa_http_protocol* pa_http_protocol_ref(pa_http_protocol *p);
 void pa_http_protocol_unref(pa_http_protocol *p);
-void pa_http_protocol_connect(pa_http_protocol *p, pa_iochannel *io, pa_module *m);
+void pa_http_protocol_connect(pa_http_protocol *p, pa_iochannel *io, pa_http_options *o);
 void pa_http_protocol_disconnect(pa_http_protocol *p, pa_module *m);
 
 void pa_http_protocol_add_server_string(pa_http_protocol *p, const char *name);
 void pa_http_protocol_remove_server_string(pa_http_protocol *p, const char *name);
 pa_strlist *pa_http_protocol_servers(pa_http_protocol *p);
 
+pa_http_options* pa_http_options_new(void);
+pa_http_options* pa_http_options_ref(pa_http_options *o);
+void pa_http_options_unref(pa_http_options *o);
+int pa_http_options_parse(pa_http_options *o, pa_core *c, pa_modargs *ma);
+
 #endif
@@ -49,6 +49,8 @@
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-scache.h>
 #include <pulsecore/core-subscribe.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/log.h>
 #include <pulsecore/strlist.h>
 #include <pulsecore/shared.h>
@@ -167,6 +169,25 @@ typedef struct upload_stream {
 #define UPLOAD_STREAM(o) (upload_stream_cast(o))
 PA_DEFINE_PRIVATE_CLASS(upload_stream, output_stream);
 
+/* Bounds for the interval at which a client gets the levels of a meter */
+#define METER_INTERVAL_MAX (10*PA_USEC_PER_SEC)
+#define METERS_MAX 256
+
+typedef struct meter_subscription meter_subscription;
+
+struct meter_subscription {
+    pa_subscription_event_type_t facility;
+    uint32_t index;
+    pa_usec_t interval, next_event;
+
+    /* Levels collected since the last event */
+    uint8_t channels;
+    float peak[PA_CHANNELS_MAX];
+    float rms[PA_CHANNELS_MAX];
+
+    PA_LLIST_FIELDS(meter_subscription);
+};
+
 struct pa_native_connection {
     pa_msgobject parent;
     pa_native_protocol *protocol;
@@ -181,6 +202,10 @@ struct pa_native_connection {
     uint32_t rrobin_index;
     pa_subscription *subscription;
     pa_time_event *auth_timeout_event;
+
+    PA_LLIST_HEAD(meter_subscription, meters);
+    unsigned n_meters;
+    pa_hook_slot *meters_updated_slot;
 };
 
 #define PA_NATIVE_CONNECTION(o) (pa_native_connection_cast(o))
@@ -294,6 +319,8 @@ static void command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag,
 static void command_set_card_profile(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_sink_or_source_port(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_subscribe_meter(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_unsubscribe_meter(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_ERROR] = NULL,
@@ -397,6 +424,9 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 
     [PA_COMMAND_SET_PORT_LATENCY_OFFSET] = command_set_port_latency_offset,
 
+    [PA_COMMAND_SUBSCRIBE_METER] = command_subscribe_meter,
+    [PA_COMMAND_UNSUBSCRIBE_METER] = command_unsubscribe_meter,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
@@ -1303,6 +1333,27 @@ static int native_connection_process_msg(pa_msgobject *o, int code, void*userdat
 }
 
 /* Called from main context */
+static void meter_subscription_free(pa_native_connection *c, meter_subscription *s) {
+    pa_meter *m;
+
+    pa_assert(c);
+    pa_assert(s);
+
+    /* The meter is gone already if its sink, source or sink input is */
+    if ((m = pa_meter_get(c->protocol->core, s->facility, s->index)))
+        pa_meter_remove_user(c->protocol->core, m);
+
+    PA_LLIST_REMOVE(meter_subscription, c->meters, s);
+    pa_assert(c->n_meters > 0);
+    c->n_meters--;
+    pa_xfree(s);
+
+    if (!c->meters && c->meters_updated_slot) {
+        pa_hook_slot_free(c->meters_updated_slot);
+        c->meters_updated_slot = NULL;
+    }
+}
+
 static void native_connection_unlink(pa_native_connection *c) {
     record_stream *r;
     output_stream *o;
@@ -1329,6 +1380,9 @@ static void native_connection_unlink(pa_native_connection *c) {
     if (c->subscription)
         pa_subscription_free(c->subscription);
 
+    while (c->meters)
+        meter_subscription_free(c, c->meters);
+
     if (c->pstream)
         pa_pstream_unlink(c->pstream);
 
@@ -2822,6 +2876,13 @@ static void command_stat(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_tagstruct_putu32(reply, (uint32_t) pa_atomic_load(&stat->n_accumulated));
     pa_tagstruct_putu32(reply, (uint32_t) pa_atomic_load(&stat->accumulated_size));
     pa_tagstruct_putu32(reply, (uint32_t) pa_scache_total_size(c->protocol->core));
+
+    if (c->version >= 30) {
+        pa_tagstruct_putu32(reply, (uint32_t) pa_scache_variants_total_size(c->protocol->core));
+        pa_tagstruct_putu64(reply, c->protocol->core->scache_hits);
+        pa_tagstruct_putu64(reply, c->protocol->core->scache_misses);
+    }
+
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
@@ -4804,6 +4865,164 @@ static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command,
     pa_pstream_send_simple_ack(c->pstream, tag);
 }
 
+static meter_subscription *meter_subscription_find(pa_native_connection *c, pa_subscription_event_type_t facility, uint32_t idx) {
+    meter_subscription *s;
+
+    PA_LLIST_FOREACH(s, c->meters)
+        if (s->facility == facility && s->index == idx)
+            return s;
+
+    return NULL;
+}
+
+static pa_hook_result_t meters_updated_cb(pa_core *core, void *data, pa_native_connection *c) {
+    meter_subscription *s, *n;
+    pa_tagstruct *t = NULL;
+    pa_usec_t now;
+
+    pa_native_connection_assert_ref(c);
+
+    now = pa_rtclock_now();
+
+    for (s = c->meters; s; s = n) {
+        pa_cvolume peak, rms;
+        pa_meter *m;
+        unsigned i;
+
+        n = s->next;
+
+        if (!(m = pa_meter_get(core, s->facility, s->index))) {
+            /* The client learns about that from the subscription
+             * events, if it cares */
+            meter_subscription_free(c, s);
+            continue;
+        }
+
+        /* Sink inputs may move to sinks with a different number of
+         * channels */
+        if (s->channels != m->n_channels) {
+            s->channels = m->n_channels;
+            memset(s->peak, 0, sizeof(s->peak));
+            memset(s->rms, 0, sizeof(s->rms));
+        }
+
+        for (i = 0; i < s->channels; i++) {
+            s->peak[i] = PA_MAX(s->peak[i], m->last_peak[i]);
+            s->rms[i] = PA_MAX(s->rms[i], m->last_rms[i]);
+        }
+
+        if (now < s->next_event)
+            continue;
+
+        s->next_event += s->interval;
+        if (s->next_event <= now)
+            s->next_event = now + s->interval;
+
+        /* Nothing rendered yet */
+        if (s->channels == 0)
+            continue;
+
+        peak.channels = rms.channels = s->channels;
+        for (i = 0; i < s->channels; i++) {
+            peak.values[i] = pa_sw_volume_from_linear(s->peak[i]);
+            rms.values[i] = pa_sw_volume_from_linear(s->rms[i]);
+            s->peak[i] = s->rms[i] = 0;
+        }
+
+        if (!t) {
+            t = pa_tagstruct_new(NULL, 0);
+            pa_tagstruct_putu32(t, PA_COMMAND_METER_EVENT);
+            pa_tagstruct_putu32(t, (uint32_t) -1);
+        }
+
+        pa_tagstruct_putu32(t, s->facility);
+        pa_tagstruct_putu32(t, s->index);
+        pa_tagstruct_put_cvolume(t, &peak);
+        pa_tagstruct_put_cvolume(t, &rms);
+    }
+
+    /* All meters of one connection go out in a single packet */
+    if (t)
+        pa_pstream_send_tagstruct(c->pstream, t);
+
+    return PA_HOOK_OK;
+}
+
+static void command_subscribe_meter(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t facility, idx;
+    pa_usec_t interval;
+    meter_subscription *s;
+    pa_meter *m;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &facility) < 0 ||
+        pa_tagstruct_getu32(t, &idx) < 0 ||
+        pa_tagstruct_get_usec(t, &interval) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream,
+                   facility == PA_SUBSCRIPTION_EVENT_SINK ||
+                   facility == PA_SUBSCRIPTION_EVENT_SOURCE ||
+                   facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT, tag, PA_ERR_INVALID);
+    CHECK_VALIDITY(c->pstream, idx != PA_INVALID_INDEX, tag, PA_ERR_INVALID);
+
+    m = pa_meter_get(c->protocol->core, facility, idx);
+    CHECK_VALIDITY(c->pstream, m, tag, PA_ERR_NOENTITY);
+
+    if (!(s = meter_subscription_find(c, facility, idx))) {
+        CHECK_VALIDITY(c->pstream, c->n_meters < METERS_MAX, tag, PA_ERR_TOOLARGE);
+
+        s = pa_xnew0(meter_subscription, 1);
+        s->facility = facility;
+        s->index = idx;
+
+        PA_LLIST_PREPEND(meter_subscription, c->meters, s);
+        c->n_meters++;
+
+        pa_meter_add_user(c->protocol->core, m);
+
+        if (!c->meters_updated_slot)
+            c->meters_updated_slot = pa_hook_connect(&c->protocol->core->hooks[PA_CORE_HOOK_METERS_UPDATED], PA_HOOK_NORMAL, (pa_hook_cb_t) meters_updated_cb, c);
+    }
+
+    s->interval = PA_CLAMP(interval, PA_METER_TICK_USEC, METER_INTERVAL_MAX);
+    s->next_event = pa_rtclock_now() + s->interval;
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
+static void command_unsubscribe_meter(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t facility, idx;
+    meter_subscription *s;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &facility) < 0 ||
+        pa_tagstruct_getu32(t, &idx) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    s = meter_subscription_find(c, facility, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+
+    meter_subscription_free(c, s);
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
 /*** pstream callbacks ***/
 
 static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
@@ -5050,6 +5269,10 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
     c->rrobin_index = PA_IDXSET_INVALID;
     c->subscription = NULL;
 
+    PA_LLIST_HEAD_INIT(meter_subscription, c->meters);
+    c->n_meters = 0;
+    c->meters_updated_slot = NULL;
+
     pa_idxset_put(p->connections, c, NULL);
 
 #ifdef HAVE_CREDS
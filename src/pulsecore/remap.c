@@ -86,73 +86,139 @@ static void remap_mono_to_stereo_c(pa_remap_t *m, void *dst, const void *src, un
     }
 }
 
-static void remap_channels_matrix_c(pa_remap_t *m, void *dst, const void *src, unsigned n) {
-    unsigned oc, ic, i;
-    unsigned n_ic, n_oc;
-
-    n_ic = m->i_ss->channels;
-    n_oc = m->o_ss->channels;
+static void remap_stereo_to_mono_c(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    unsigned i;
 
     switch (*m->format) {
         case PA_SAMPLE_FLOAT32NE:
         {
             float *d, *s;
+            float w0, w1;
+
+            d = (float *) dst;
+            s = (float *) src;
+            w0 = m->tap_f[0][0];
+            w1 = m->tap_f[0][1];
+
+            for (i = n >> 2; i; i--) {
+                d[0] = s[0] * w0 + s[1] * w1;
+                d[1] = s[2] * w0 + s[3] * w1;
+                d[2] = s[4] * w0 + s[5] * w1;
+                d[3] = s[6] * w0 + s[7] * w1;
+                s += 8;
+                d += 4;
+            }
+            for (i = n & 3; i; i--) {
+                d[0] = s[0] * w0 + s[1] * w1;
+                s += 2;
+                d++;
+            }
+            break;
+        }
+        case PA_SAMPLE_S16NE:
+        {
+            int16_t *d, *s;
+            int32_t w0, w1;
 
-            memset(dst, 0, n * sizeof(float) * n_oc);
+            d = (int16_t *) dst;
+            s = (int16_t *) src;
+            w0 = m->tap_i[0][0];
+            w1 = m->tap_i[0][1];
 
-            for (oc = 0; oc < n_oc; oc++) {
+            for (i = n; i; i--) {
+                int32_t sum = (((int32_t) s[0] * w0) >> 16) + (((int32_t) s[1] * w1) >> 16);
 
-                for (ic = 0; ic < n_ic; ic++) {
-                    float vol;
+                d[0] = (int16_t) PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+                s += 2;
+                d++;
+            }
+            break;
+        }
+        default:
+            pa_assert_not_reached();
+    }
+}
 
-                    vol = m->map_table_f[oc][ic];
+/* Every output channel is a copy of a single input channel, or silent */
+static void remap_channels_copy_c(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    unsigned oc, n_ic, n_oc;
 
-                    if (vol <= 0.0)
-                        continue;
+    n_ic = m->i_ss->channels;
+    n_oc = m->o_ss->channels;
 
-                    d = (float *)dst + oc;
-                    s = (float *)src + ic;
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+        {
+            float *d, *s;
 
-                    if (vol >= 1.0) {
-                        for (i = n; i > 0; i--, s += n_ic, d += n_oc)
-                            *d += *s;
-                    } else {
-                        for (i = n; i > 0; i--, s += n_ic, d += n_oc)
-                            *d += *s * vol;
-                    }
-                }
-            }
+            d = (float *) dst;
+            s = (float *) src;
 
+            for (; n > 0; n--, s += n_ic, d += n_oc)
+                for (oc = 0; oc < n_oc; oc++)
+                    d[oc] = m->n_taps[oc] ? s[m->tap_ic[oc][0]] : 0.0f;
             break;
         }
         case PA_SAMPLE_S16NE:
         {
             int16_t *d, *s;
 
-            memset(dst, 0, n * sizeof(int16_t) * n_oc);
+            d = (int16_t *) dst;
+            s = (int16_t *) src;
 
-            for (oc = 0; oc < n_oc; oc++) {
+            for (; n > 0; n--, s += n_ic, d += n_oc)
+                for (oc = 0; oc < n_oc; oc++)
+                    d[oc] = m->n_taps[oc] ? s[m->tap_ic[oc][0]] : 0;
+            break;
+        }
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+/* Walks the frames once and only touches the non-zero matrix entries,
+ * instead of making a pass over the whole buffer per entry */
+static void remap_channels_matrix_c(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    unsigned oc, k, n_ic, n_oc;
 
-                for (ic = 0; ic < n_ic; ic++) {
-                    int32_t vol;
+    n_ic = m->i_ss->channels;
+    n_oc = m->o_ss->channels;
 
-                    vol = m->map_table_i[oc][ic];
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+        {
+            float *d, *s;
+
+            d = (float *) dst;
+            s = (float *) src;
 
-                    if (vol <= 0)
-                        continue;
+            for (; n > 0; n--, s += n_ic, d += n_oc)
+                for (oc = 0; oc < n_oc; oc++) {
+                    float sum = 0.0f;
 
-                    d = (int16_t *)dst + oc;
-                    s = (int16_t *)src + ic;
+                    for (k = 0; k < m->n_taps[oc]; k++)
+                        sum += s[m->tap_ic[oc][k]] * m->tap_f[oc][k];
 
-                    if (vol >= 0x10000) {
-                        for (i = n; i > 0; i--, s += n_ic, d += n_oc)
-                            *d += *s;
-                    } else {
-                        for (i = n; i > 0; i--, s += n_ic, d += n_oc)
-                            *d += (int16_t) (((int32_t)*s * vol) >> 16);
-                    }
+                    d[oc] = sum;
+                }
+            break;
+        }
+        case PA_SAMPLE_S16NE:
+        {
+            int16_t *d, *s;
+
+            d = (int16_t *) dst;
+            s = (int16_t *) src;
+
+            for (; n > 0; n--, s += n_ic, d += n_oc)
+                for (oc = 0; oc < n_oc; oc++) {
+                    int32_t sum = 0;
+
+                    for (k = 0; k < m->n_taps[oc]; k++)
+                        sum += ((int32_t) s[m->tap_ic[oc][k]] * m->tap_i[oc][k]) >> 16;
+
+                    d[oc] = (int16_t) PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
                 }
-            }
             break;
         }
         default:
@@ -160,6 +226,45 @@ static void remap_channels_matrix_c(pa_remap_t *m, void *dst, const void *src, u
     }
 }
 
+/* Collect the non-zero entries of the matrices. Gains above unity are
+ * taken as unity, as the matrices are normalized anyway. */
+static void init_taps(pa_remap_t *m) {
+    unsigned oc, ic, n_oc, n_ic;
+
+    n_oc = m->o_ss->channels;
+    n_ic = m->i_ss->channels;
+
+    for (oc = 0; oc < n_oc; oc++) {
+        unsigned k = 0;
+
+        for (ic = 0; ic < n_ic; ic++) {
+            if (m->map_table_f[oc][ic] <= 0.0f && m->map_table_i[oc][ic] <= 0)
+                continue;
+
+            m->tap_ic[oc][k] = (uint8_t) ic;
+            m->tap_f[oc][k] = PA_CLAMP(m->map_table_f[oc][ic], 0.0f, 1.0f);
+            m->tap_i[oc][k] = PA_CLAMP(m->map_table_i[oc][ic], 0, 0x10000);
+            k++;
+        }
+
+        m->n_taps[oc] = k;
+    }
+}
+
+static bool taps_are_copies(pa_remap_t *m) {
+    unsigned oc;
+
+    for (oc = 0; oc < m->o_ss->channels; oc++) {
+        if (m->n_taps[oc] == 0)
+            continue;
+
+        if (m->n_taps[oc] > 1 || m->tap_f[oc][0] != 1.0f || m->tap_i[oc][0] != 0x10000)
+            return false;
+    }
+
+    return true;
+}
+
 /* set the function that will execute the remapping based on the matrices */
 static void init_remap_c(pa_remap_t *m) {
     unsigned n_oc, n_ic;
@@ -167,14 +272,22 @@ static void init_remap_c(pa_remap_t *m) {
     n_oc = m->o_ss->channels;
     n_ic = m->i_ss->channels;
 
+    init_taps(m);
+
     /* find some common channel remappings, fall back to full matrix operation. */
     if (n_ic == 1 && n_oc == 2 &&
             m->map_table_i[0][0] == PA_VOLUME_NORM && m->map_table_i[1][0] == PA_VOLUME_NORM) {
         m->do_remap = (pa_do_remap_func_t) remap_mono_to_stereo_c;
         pa_log_info("Using mono to stereo remapping");
+    } else if (n_ic == 2 && n_oc == 1 && m->n_taps[0] == 2) {
+        m->do_remap = (pa_do_remap_func_t) remap_stereo_to_mono_c;
+        pa_log_info("Using stereo to mono remapping");
+    } else if (taps_are_copies(m)) {
+        m->do_remap = (pa_do_remap_func_t) remap_channels_copy_c;
+        pa_log_info("Using channel copy remapping");
     } else {
         m->do_remap = (pa_do_remap_func_t) remap_channels_matrix_c;
-        pa_log_info("Using generic matrix remapping");
+        pa_log_info("Using sparse matrix remapping");
     }
 }
 
@@ -35,6 +35,19 @@ struct pa_remap {
     float map_table_f[PA_CHANNELS_MAX][PA_CHANNELS_MAX];
     int32_t map_table_i[PA_CHANNELS_MAX][PA_CHANNELS_MAX];
     pa_do_remap_func_t do_remap;
+
+    /* Precomputed by the init functions for the kernel they picked.
+     * The matrices are sparse for all the usual layouts, so output
+     * channel oc only sums up the n_taps[oc] input channels tap_ic[oc]
+     * with the gains tap_f[oc] resp. tap_i[oc] (16.16). */
+    unsigned n_taps[PA_CHANNELS_MAX];
+    uint8_t tap_ic[PA_CHANNELS_MAX][PA_CHANNELS_MAX];
+    float tap_f[PA_CHANNELS_MAX][PA_CHANNELS_MAX];
+    int32_t tap_i[PA_CHANNELS_MAX][PA_CHANNELS_MAX];
+
+    /* Gains rearranged for the vector kernels, s16 ones in 2.14 */
+    float simd_f[16];
+    int16_t simd_i[16];
 };
 
 void pa_init_remap (pa_remap_t *m);
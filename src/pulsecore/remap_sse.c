@@ -24,6 +24,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulse/sample.h>
 #include <pulse/volume.h>
 #include <pulsecore/log.h>
@@ -130,18 +132,414 @@ static void remap_mono_to_stereo_sse2(pa_remap_t *m, void *dst, const void *src,
     }
 }
 
+/* The vector kernels below work on the gains in m->simd_f and
+ * m->simd_i as set up by init_remap_sse2(). The s16 ones use pmaddwd
+ * on 2.14 gains, so unity stays exact and a sum of products cannot
+ * overflow as long as the gains of an output channel add up to at most
+ * unity, which the resampler makes sure of. */
+
+static void remap_stereo_to_mono_sse2(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    pa_reg_x86 blocks = n / 8;
+
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+        {
+            float *d, *s;
+
+            if (blocks > 0) {
+                __asm__ __volatile__ (
+                    " movups (%3), %%xmm6           \n\t" /* w0 w1 w0 w1 */
+
+                    "1:                             \n\t"
+                    " movups (%1), %%xmm0           \n\t" /* L0 R0 L1 R1 */
+                    " movups 16(%1), %%xmm1         \n\t" /* L2 R2 L3 R3 */
+                    " movups 32(%1), %%xmm3         \n\t"
+                    " movups 48(%1), %%xmm4         \n\t"
+                    " mulps %%xmm6, %%xmm0          \n\t"
+                    " mulps %%xmm6, %%xmm1          \n\t"
+                    " mulps %%xmm6, %%xmm3          \n\t"
+                    " mulps %%xmm6, %%xmm4          \n\t"
+                    " movaps %%xmm0, %%xmm2         \n\t"
+                    " movaps %%xmm3, %%xmm5         \n\t"
+                    " shufps $0x88, %%xmm1, %%xmm0  \n\t" /* L0 L1 L2 L3 */
+                    " shufps $0xdd, %%xmm1, %%xmm2  \n\t" /* R0 R1 R2 R3 */
+                    " shufps $0x88, %%xmm4, %%xmm3  \n\t"
+                    " shufps $0xdd, %%xmm4, %%xmm5  \n\t"
+                    " addps %%xmm2, %%xmm0          \n\t"
+                    " addps %%xmm5, %%xmm3          \n\t"
+                    " movups %%xmm0, (%0)           \n\t"
+                    " movups %%xmm3, 16(%0)         \n\t"
+                    " add $64, %1                   \n\t"
+                    " add $32, %0                   \n\t"
+                    " dec %2                        \n\t"
+                    " jne 1b                        \n\t"
+                    : "+r" (dst), "+r" (src), "+r" (blocks)
+                    : "r" (m->simd_f)
+                    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6"
+                );
+            }
+
+            d = (float *) dst;
+            s = (float *) src;
+
+            for (n &= 7; n > 0; n--, s += 2, d++)
+                d[0] = s[0] * m->simd_f[0] + s[1] * m->simd_f[1];
+            break;
+        }
+        case PA_SAMPLE_S16NE:
+        {
+            int16_t *d, *s;
+
+            if (blocks > 0) {
+                __asm__ __volatile__ (
+                    " movdqu (%3), %%xmm6           \n\t" /* w0 w1 w0 w1 ... */
+
+                    "1:                             \n\t"
+                    " movdqu (%1), %%xmm0           \n\t" /* L0 R0 .. L3 R3 */
+                    " movdqu 16(%1), %%xmm1         \n\t" /* L4 R4 .. L7 R7 */
+                    " pmaddwd %%xmm6, %%xmm0        \n\t" /* L*w0 + R*w1 */
+                    " pmaddwd %%xmm6, %%xmm1        \n\t"
+                    " psrad $14, %%xmm0             \n\t"
+                    " psrad $14, %%xmm1             \n\t"
+                    " packssdw %%xmm1, %%xmm0       \n\t"
+                    " movdqu %%xmm0, (%0)           \n\t"
+                    " add $32, %1                   \n\t"
+                    " add $16, %0                   \n\t"
+                    " dec %2                        \n\t"
+                    " jne 1b                        \n\t"
+                    : "+r" (dst), "+r" (src), "+r" (blocks)
+                    : "r" (m->simd_i)
+                    : "cc", "memory", "xmm0", "xmm1", "xmm6"
+                );
+            }
+
+            d = (int16_t *) dst;
+            s = (int16_t *) src;
+
+            for (n &= 7; n > 0; n--, s += 2, d++) {
+                int32_t sum = ((int32_t) s[0] * m->simd_i[0] + (int32_t) s[1] * m->simd_i[1]) >> 14;
+
+                d[0] = (int16_t) PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+            }
+            break;
+        }
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+/* 5.1 and 7.1 to stereo, one frame per iteration: the frame is
+ * multiplied by the left and the right row of the matrix and the two
+ * products are summed up horizontally. */
+
+#define LOAD_FRAME_6_f                                 \
+                " movups (%1), %%xmm0           \n\t"  \
+                " movq 16(%1), %%xmm1           \n\t"
+
+#define LOAD_FRAME_8_f                                 \
+                " movups (%1), %%xmm0           \n\t"  \
+                " movups 16(%1), %%xmm1         \n\t"
+
+#define LOAD_FRAME_6_i                                 \
+                " movq (%1), %%xmm0             \n\t"  \
+                " movd 8(%1), %%xmm1            \n\t"  \
+                " punpcklqdq %%xmm1, %%xmm0     \n\t"
+
+#define LOAD_FRAME_8_i                                 \
+                " movdqu (%1), %%xmm0           \n\t"
+
+#define DOWNMIX_TO_STEREO_f(ch)                        \
+                " movups (%3), %%xmm4           \n\t"  \
+                " movups 16(%3), %%xmm5         \n\t"  \
+                " movups 32(%3), %%xmm6         \n\t"  \
+                " movups 48(%3), %%xmm7         \n\t"  \
+                "1:                             \n\t"  \
+                LOAD_FRAME_##ch##_f                    \
+                " movaps %%xmm0, %%xmm2         \n\t"  \
+                " movaps %%xmm1, %%xmm3         \n\t"  \
+                " mulps %%xmm4, %%xmm0          \n\t"  \
+                " mulps %%xmm5, %%xmm1          \n\t"  \
+                " mulps %%xmm6, %%xmm2          \n\t"  \
+                " mulps %%xmm7, %%xmm3          \n\t"  \
+                " addps %%xmm1, %%xmm0          \n\t"  /* left partial sums */ \
+                " addps %%xmm3, %%xmm2          \n\t"  /* right partial sums */ \
+                " movaps %%xmm0, %%xmm1         \n\t"  \
+                " unpcklps %%xmm2, %%xmm0       \n\t"  \
+                " unpckhps %%xmm2, %%xmm1       \n\t"  \
+                " addps %%xmm1, %%xmm0          \n\t"  \
+                " movhlps %%xmm0, %%xmm1        \n\t"  \
+                " addps %%xmm1, %%xmm0          \n\t"  \
+                " movlps %%xmm0, (%0)           \n\t"  \
+                " add $"#ch"*4, %1              \n\t"  \
+                " add $8, %0                    \n\t"  \
+                " dec %2                        \n\t"  \
+                " jne 1b                        \n\t"
+
+#define DOWNMIX_TO_STEREO_i(ch)                        \
+                " movdqu (%3), %%xmm4           \n\t"  \
+                " movdqu 16(%3), %%xmm5         \n\t"  \
+                "1:                             \n\t"  \
+                LOAD_FRAME_##ch##_i                    \
+                " movdqa %%xmm0, %%xmm1         \n\t"  \
+                " pmaddwd %%xmm4, %%xmm0        \n\t"  /* left partial sums */ \
+                " pmaddwd %%xmm5, %%xmm1        \n\t"  /* right partial sums */ \
+                " movdqa %%xmm0, %%xmm2         \n\t"  \
+                " punpckldq %%xmm1, %%xmm0      \n\t"  \
+                " punpckhdq %%xmm1, %%xmm2      \n\t"  \
+                " paddd %%xmm2, %%xmm0          \n\t"  \
+                " pshufd $0xee, %%xmm0, %%xmm2  \n\t"  \
+                " paddd %%xmm2, %%xmm0          \n\t"  \
+                " psrad $14, %%xmm0             \n\t"  \
+                " packssdw %%xmm0, %%xmm0       \n\t"  \
+                " movd %%xmm0, (%0)             \n\t"  \
+                " add $"#ch"*2, %1              \n\t"  \
+                " add $4, %0                    \n\t"  \
+                " dec %2                        \n\t"  \
+                " jne 1b                        \n\t"
+
+static void remap_6_to_stereo_sse2(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    pa_reg_x86 frames = n;
+
+    if (n == 0)
+        return;
+
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+            __asm__ __volatile__ (
+                DOWNMIX_TO_STEREO_f(6)
+                : "+r" (dst), "+r" (src), "+r" (frames)
+                : "r" (m->simd_f)
+                : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+            );
+            break;
+        case PA_SAMPLE_S16NE:
+            __asm__ __volatile__ (
+                DOWNMIX_TO_STEREO_i(6)
+                : "+r" (dst), "+r" (src), "+r" (frames)
+                : "r" (m->simd_i)
+                : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm4", "xmm5"
+            );
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+static void remap_8_to_stereo_sse2(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    pa_reg_x86 frames = n;
+
+    if (n == 0)
+        return;
+
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+            __asm__ __volatile__ (
+                DOWNMIX_TO_STEREO_f(8)
+                : "+r" (dst), "+r" (src), "+r" (frames)
+                : "r" (m->simd_f)
+                : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+            );
+            break;
+        case PA_SAMPLE_S16NE:
+            __asm__ __volatile__ (
+                DOWNMIX_TO_STEREO_i(8)
+                : "+r" (dst), "+r" (src), "+r" (frames)
+                : "r" (m->simd_i)
+                : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm4", "xmm5"
+            );
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+/* Stereo to 5.1 and 7.1: both samples of a frame are broadcast and
+ * multiplied by the left and the right column of the matrix. */
+
+#define STORE_FRAME_6_f                                \
+                " movups %%xmm0, (%0)           \n\t"  \
+                " movlps %%xmm2, 16(%0)         \n\t"
+
+#define STORE_FRAME_8_f                                \
+                " movups %%xmm0, (%0)           \n\t"  \
+                " movups %%xmm2, 16(%0)         \n\t"
+
+#define STORE_FRAME_6_i                                \
+                " movq %%xmm0, (%0)             \n\t"  \
+                " psrldq $8, %%xmm0             \n\t"  \
+                " movd %%xmm0, 8(%0)            \n\t"
+
+#define STORE_FRAME_8_i                                \
+                " movdqu %%xmm0, (%0)           \n\t"
+
+#define UPMIX_FROM_STEREO_f(ch)                        \
+                " movups (%3), %%xmm4           \n\t"  \
+                " movups 16(%3), %%xmm5         \n\t"  \
+                " movups 32(%3), %%xmm6         \n\t"  \
+                " movups 48(%3), %%xmm7         \n\t"  \
+                "1:                             \n\t"  \
+                " movss (%1), %%xmm0            \n\t"  \
+                " movss 4(%1), %%xmm1           \n\t"  \
+                " shufps $0, %%xmm0, %%xmm0     \n\t"  \
+                " shufps $0, %%xmm1, %%xmm1     \n\t"  \
+                " movaps %%xmm0, %%xmm2         \n\t"  \
+                " movaps %%xmm1, %%xmm3         \n\t"  \
+                " mulps %%xmm4, %%xmm0          \n\t"  \
+                " mulps %%xmm6, %%xmm1          \n\t"  \
+                " mulps %%xmm5, %%xmm2          \n\t"  \
+                " mulps %%xmm7, %%xmm3          \n\t"  \
+                " addps %%xmm1, %%xmm0          \n\t"  /* channels 0..3 */ \
+                " addps %%xmm3, %%xmm2          \n\t"  /* channels 4..7 */ \
+                STORE_FRAME_##ch##_f                   \
+                " add $8, %1                    \n\t"  \
+                " add $"#ch"*4, %0              \n\t"  \
+                " dec %2                        \n\t"  \
+                " jne 1b                        \n\t"
+
+#define UPMIX_FROM_STEREO_i(ch)                        \
+                " movdqu (%3), %%xmm4           \n\t"  \
+                " movdqu 16(%3), %%xmm5         \n\t"  \
+                "1:                             \n\t"  \
+                " movd (%1), %%xmm0             \n\t"  \
+                " pshufd $0, %%xmm0, %%xmm0     \n\t"  /* L R L R L R L R */ \
+                " movdqa %%xmm0, %%xmm1         \n\t"  \
+                " pmaddwd %%xmm4, %%xmm0        \n\t"  /* channels 0..3 */ \
+                " pmaddwd %%xmm5, %%xmm1        \n\t"  /* channels 4..7 */ \
+                " psrad $14, %%xmm0             \n\t"  \
+                " psrad $14, %%xmm1             \n\t"  \
+                " packssdw %%xmm1, %%xmm0       \n\t"  \
+                STORE_FRAME_##ch##_i                   \
+                " add $4, %1                    \n\t"  \
+                " add $"#ch"*2, %0              \n\t"  \
+                " dec %2                        \n\t"  \
+                " jne 1b                        \n\t"
+
+static void remap_stereo_to_6_sse2(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    pa_reg_x86 frames = n;
+
+    if (n == 0)
+        return;
+
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+            __asm__ __volatile__ (
+                UPMIX_FROM_STEREO_f(6)
+                : "+r" (dst), "+r" (src), "+r" (frames)
+                : "r" (m->simd_f)
+                : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+            );
+            break;
+        case PA_SAMPLE_S16NE:
+            __asm__ __volatile__ (
+                UPMIX_FROM_STEREO_i(6)
+                : "+r" (dst), "+r" (src), "+r" (frames)
+                : "r" (m->simd_i)
+                : "cc", "memory", "xmm0", "xmm1", "xmm4", "xmm5"
+            );
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+static void remap_stereo_to_8_sse2(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    pa_reg_x86 frames = n;
+
+    if (n == 0)
+        return;
+
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+            __asm__ __volatile__ (
+                UPMIX_FROM_STEREO_f(8)
+                : "+r" (dst), "+r" (src), "+r" (frames)
+                : "r" (m->simd_f)
+                : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+            );
+            break;
+        case PA_SAMPLE_S16NE:
+            __asm__ __volatile__ (
+                UPMIX_FROM_STEREO_i(8)
+                : "+r" (dst), "+r" (src), "+r" (frames)
+                : "r" (m->simd_i)
+                : "cc", "memory", "xmm0", "xmm1", "xmm4", "xmm5"
+            );
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+/* The vector kernels rely on gains between zero and unity */
+static bool gains_in_range(pa_remap_t *m) {
+    unsigned oc, ic;
+
+    for (oc = 0; oc < m->o_ss->channels; oc++)
+        for (ic = 0; ic < m->i_ss->channels; ic++) {
+            if (m->map_table_f[oc][ic] < 0.0f || m->map_table_f[oc][ic] > 1.0f)
+                return false;
+            if (m->map_table_i[oc][ic] < 0 || m->map_table_i[oc][ic] > 0x10000)
+                return false;
+        }
+
+    return true;
+}
+
+static int16_t gain_2_14(int32_t v) {
+    /* 16.16 to 2.14, rounded */
+    return (int16_t) ((v + 2) >> 2);
+}
+
 /* set the function that will execute the remapping based on the matrices */
 static void init_remap_sse2(pa_remap_t *m) {
-    unsigned n_oc, n_ic;
+    unsigned n_oc, n_ic, c;
 
     n_oc = m->o_ss->channels;
     n_ic = m->i_ss->channels;
 
+    memset(m->simd_f, 0, sizeof(m->simd_f));
+    memset(m->simd_i, 0, sizeof(m->simd_i));
+
     /* find some common channel remappings, fall back to full matrix operation. */
     if (n_ic == 1 && n_oc == 2 &&
             m->map_table_i[0][0] == PA_VOLUME_NORM && m->map_table_i[1][0] == PA_VOLUME_NORM) {
         m->do_remap = (pa_do_remap_func_t) remap_mono_to_stereo_sse2;
         pa_log_info("Using SSE2 mono to stereo remapping");
+    } else if (!gains_in_range(m)) {
+        return;
+    } else if (n_ic == 2 && n_oc == 1) {
+        /* w0 w1 w0 w1 ... */
+        for (c = 0; c < 8; c++) {
+            if (c < 4)
+                m->simd_f[c] = m->map_table_f[0][c & 1];
+            m->simd_i[c] = gain_2_14(m->map_table_i[0][c & 1]);
+        }
+
+        m->do_remap = (pa_do_remap_func_t) remap_stereo_to_mono_sse2;
+        pa_log_info("Using SSE2 stereo to mono remapping");
+    } else if ((n_ic == 6 || n_ic == 8) && n_oc == 2) {
+        /* the left row, then the right row, each padded to 8 channels */
+        for (c = 0; c < n_ic; c++) {
+            m->simd_f[c] = m->map_table_f[0][c];
+            m->simd_f[8 + c] = m->map_table_f[1][c];
+            m->simd_i[c] = gain_2_14(m->map_table_i[0][c]);
+            m->simd_i[8 + c] = gain_2_14(m->map_table_i[1][c]);
+        }
+
+        m->do_remap = (pa_do_remap_func_t) (n_ic == 6 ? remap_6_to_stereo_sse2 : remap_8_to_stereo_sse2);
+        pa_log_info("Using SSE2 %u channel to stereo remapping", n_ic);
+    } else if (n_ic == 2 && (n_oc == 6 || n_oc == 8)) {
+        /* float: the left column, then the right column, each padded to
+         * 8 channels. s16: the columns interleaved for pmaddwd. */
+        for (c = 0; c < n_oc; c++) {
+            m->simd_f[c] = m->map_table_f[c][0];
+            m->simd_f[8 + c] = m->map_table_f[c][1];
+            m->simd_i[2 * c] = gain_2_14(m->map_table_i[c][0]);
+            m->simd_i[2 * c + 1] = gain_2_14(m->map_table_i[c][1]);
+        }
+
+        m->do_remap = (pa_do_remap_func_t) (n_oc == 6 ? remap_stereo_to_6_sse2 : remap_stereo_to_8_sse2);
+        pa_log_info("Using SSE2 stereo to %u channel remapping", n_oc);
     }
 }
 #endif /* defined (__i386__) || defined (__amd64__) */
@@ -0,0 +1,129 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+
+#include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "resample-budget.h"
+
+static void balance_sink(pa_core *c, pa_sink *s, pa_usec_t elapsed) {
+    pa_sink_input *i, *costly = NULL, *cheap = NULL;
+    unsigned costly_usec = 0, cheap_usec = 0;
+    uint64_t total = 0, budget;
+    uint32_t idx;
+
+    PA_IDXSET_FOREACH(i, s->inputs, idx) {
+        unsigned seen, used;
+
+        /* The counter wraps around, the difference doesn't care */
+        seen = (unsigned) pa_atomic_load(&i->metrics.resample_usec);
+        used = seen - i->resample_usec_seen;
+        i->resample_usec_seen = seen;
+
+        if (!PA_SINK_INPUT_IS_LINKED(i->state) || !i->thread_info.resampler)
+            continue;
+
+        total += used;
+
+        if ((!costly || used > costly_usec) &&
+            pa_resample_method_cheaper(i->actual_resample_method) != PA_RESAMPLER_INVALID) {
+            costly = i;
+            costly_usec = used;
+        }
+
+        if (i->resample_downgrade > 0 && (!cheap || used < cheap_usec)) {
+            cheap = i;
+            cheap_usec = used;
+        }
+    }
+
+    budget = elapsed * c->resample_cpu_budget / 100;
+
+    if (total > budget && costly) {
+        pa_log_debug("Resampling for sink %s took %llu usec, over its budget of %llu usec.",
+                     s->name, (unsigned long long) total, (unsigned long long) budget);
+
+        pa_sink_input_set_resample_downgrade(costly, costly->resample_downgrade + 1);
+
+    /* A step up the ladder may well double the cost of a stream, which
+     * must not take the sink over its budget right away again */
+    } else if (cheap && total + cheap_usec < budget / 2)
+        pa_sink_input_set_resample_downgrade(cheap, cheap->resample_downgrade - 1);
+}
+
+static void tick_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_core *c = userdata;
+    pa_usec_t now, elapsed;
+    pa_sink *s;
+    uint32_t idx;
+
+    pa_assert(c);
+    pa_assert(c->resample_budget_event == e);
+
+    if (pa_idxset_isempty(c->sink_inputs)) {
+        pa_log_debug("No sink inputs anymore, stopping the resampler budget.");
+        pa_resample_budget_stop(c);
+        return;
+    }
+
+    now = pa_rtclock_now();
+    elapsed = now - c->resample_budget_last;
+    c->resample_budget_last = now;
+
+    PA_IDXSET_FOREACH(s, c->sinks, idx)
+        if (PA_SINK_IS_LINKED(s->state))
+            balance_sink(c, s, elapsed);
+
+    pa_core_rttime_restart(c, e, now + PA_RESAMPLE_BUDGET_TICK_USEC);
+}
+
+void pa_resample_budget_start(pa_core *c) {
+    pa_sink_input *i;
+    uint32_t idx;
+
+    pa_assert(c);
+    pa_assert(c->resample_cpu_budget > 0);
+
+    if (c->resample_budget_event)
+        return;
+
+    /* Only count what happens from now on */
+    PA_IDXSET_FOREACH(i, c->sink_inputs, idx)
+        i->resample_usec_seen = (unsigned) pa_atomic_load(&i->metrics.resample_usec);
+
+    c->resample_budget_last = pa_rtclock_now();
+    c->resample_budget_event = pa_core_rttime_new(c, c->resample_budget_last + PA_RESAMPLE_BUDGET_TICK_USEC, tick_cb, c);
+}
+
+void pa_resample_budget_stop(pa_core *c) {
+    pa_assert(c);
+
+    if (c->resample_budget_event) {
+        c->mainloop->time_free(c->resample_budget_event);
+        c->resample_budget_event = NULL;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef foopulsecoreresamplebudgethfoo
+#define foopulsecoreresamplebudgethfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/timeval.h>
+#include <pulsecore/core.h>
+
+/* The resampler CPU budget trades resampling quality for CPU time when
+ * a sink has more streams to resample than it can afford. Every
+ * PA_RESAMPLE_BUDGET_TICK_USEC the time the resamplers of each sink's
+ * inputs took is compared with c->resample_cpu_budget percent of the
+ * time that passed, i.e. of every IO cycle of the sink. A sink over its
+ * budget moves the resampler of its most expensive input one step down
+ * the quality ladder, see pa_resample_method_cheaper(). A sink well
+ * within its budget moves its cheapest downgraded input one step back
+ * up again. */
+
+#define PA_RESAMPLE_BUDGET_TICK_USEC (PA_USEC_PER_SEC)
+
+/* Called from the main thread. The tick stops by itself once there are
+ * no sink inputs anymore. */
+void pa_resample_budget_start(pa_core *c);
+void pa_resample_budget_stop(pa_core *c);
+
+#endif
@@ -40,6 +40,7 @@
 #include <pulsecore/strbuf.h>
 #include <pulsecore/remap.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/mix.h>
 #include "ffmpeg/avcodec.h"
 
 #include "resampler.h"
@@ -83,6 +84,13 @@ struct pa_resampler {
     pa_remap_t remap;
     bool map_required;
 
+    /* Software volumes applied in the input and the output channel map,
+     * see pa_resampler_set_volume() */
+    pa_cvolume pre_volume;
+    pa_cvolume post_volume;
+    bool have_pre_volume;
+    bool have_post_volume;
+
     pa_resampler_impl impl;
 };
 
@@ -591,6 +599,70 @@ void pa_resampler_reset(pa_resampler *r) {
     *r->have_leftover = false;
 }
 
+size_t pa_resampler_crossfade(pa_mempool *pool, const pa_sample_spec *ss, const pa_memchunk *old, pa_memchunk *out, size_t done, size_t length) {
+    pa_convert_func_t to_float, from_float;
+    pa_memblock *b;
+    size_t fs, n, f;
+    float *o, *d;
+    void *p;
+    unsigned c;
+
+    pa_assert(pool);
+    pa_assert(ss);
+    pa_assert(old);
+    pa_assert(out);
+    pa_assert(length > 0);
+
+    pa_assert_se(to_float = pa_get_convert_to_float32ne_function(ss->format));
+    pa_assert_se(from_float = pa_get_convert_from_float32ne_function(ss->format));
+
+    /* Two resamplers delay the data a bit differently, so their output
+     * doesn't always line up exactly */
+    fs = pa_frame_size(ss);
+    n = PA_MIN(out->length, old->length) / fs;
+
+    if (n == 0)
+        return 0;
+
+    b = pa_memblock_new(pool, 2 * n * ss->channels * sizeof(float));
+    o = pa_memblock_acquire(b);
+    d = o + n * ss->channels;
+
+    to_float((unsigned) (n * ss->channels), pa_memblock_acquire_chunk(old), o);
+    pa_memblock_release(old->memblock);
+
+    pa_memchunk_make_writable(out, 0);
+    p = pa_memblock_acquire_chunk(out);
+    to_float((unsigned) (n * ss->channels), p, d);
+
+    for (f = 0; f < n; f++) {
+        float g = PA_MIN((float) (done + f) / length, 1.0f);
+
+        for (c = 0; c < ss->channels; c++, o++, d++)
+            *d = *o + (*d - *o) * g;
+    }
+
+    from_float((unsigned) (n * ss->channels), d - n * ss->channels, p);
+
+    pa_memblock_release(out->memblock);
+    pa_memblock_release(b);
+    pa_memblock_unref(b);
+
+    return n;
+}
+
+void pa_resampler_set_volume(pa_resampler *r, const pa_cvolume *pre, const pa_cvolume *post) {
+    pa_assert(r);
+    pa_assert(!pre || pre->channels == r->i_ss.channels);
+    pa_assert(!post || post->channels == r->o_ss.channels);
+
+    if ((r->have_pre_volume = pre && !pa_cvolume_is_norm(pre)))
+        r->pre_volume = *pre;
+
+    if ((r->have_post_volume = post && !pa_cvolume_is_norm(post)))
+        r->post_volume = *post;
+}
+
 pa_resample_method_t pa_resampler_get_method(pa_resampler *r) {
     pa_assert(r);
 
@@ -684,6 +756,40 @@ int pa_resample_method_supported(pa_resample_method_t m) {
     return 1;
 }
 
+pa_resample_method_t pa_resample_method_cheaper(pa_resample_method_t m) {
+
+    do {
+        if ((m > PA_RESAMPLER_SPEEX_FLOAT_BASE && m <= PA_RESAMPLER_SPEEX_FLOAT_MAX) ||
+            (m > PA_RESAMPLER_SPEEX_FIXED_BASE && m <= PA_RESAMPLER_SPEEX_FIXED_MAX))
+            m--;
+        else
+            switch (m) {
+                case PA_RESAMPLER_SRC_SINC_BEST_QUALITY:
+                    m = PA_RESAMPLER_SRC_SINC_MEDIUM_QUALITY;
+                    break;
+                case PA_RESAMPLER_SRC_SINC_MEDIUM_QUALITY:
+                    m = PA_RESAMPLER_SRC_SINC_FASTEST;
+                    break;
+                case PA_RESAMPLER_SRC_SINC_FASTEST:
+                    m = PA_RESAMPLER_SRC_LINEAR;
+                    break;
+                case PA_RESAMPLER_SRC_LINEAR:
+                case PA_RESAMPLER_SRC_ZERO_ORDER_HOLD:
+                case PA_RESAMPLER_SPEEX_FLOAT_BASE:
+                case PA_RESAMPLER_SPEEX_FIXED_BASE:
+                case PA_RESAMPLER_FFMPEG:
+                    m = PA_RESAMPLER_TRIVIAL;
+                    break;
+                default:
+                    return PA_RESAMPLER_INVALID;
+            }
+
+    /* Ends with 'trivial' at the latest, which is always there */
+    } while (!pa_resample_method_supported(m));
+
+    return m;
+}
+
 pa_resample_method_t pa_parse_resample_method(const char *string) {
     pa_resample_method_t m;
 
@@ -1181,6 +1287,31 @@ static void fit_buf(pa_resampler *r, pa_memchunk *buf, size_t len, size_t *size,
     buf->length = len;
 }
 
+static void apply_volume(pa_resampler *r, pa_memchunk *buf, size_t offset, size_t length,
+                         pa_sample_format_t format, uint8_t channels, const pa_cvolume *volume) {
+    pa_sample_spec ss;
+    pa_memchunk chunk;
+
+    pa_assert(r);
+    pa_assert(buf);
+    pa_assert(buf->memblock);
+    pa_assert(offset + length <= buf->length);
+    pa_assert(volume->channels == channels);
+
+    if (length <= 0)
+        return;
+
+    ss.format = format;
+    ss.channels = channels;
+    ss.rate = r->i_ss.rate;
+
+    chunk.memblock = buf->memblock;
+    chunk.index = buf->index + offset;
+    chunk.length = length;
+
+    pa_volume_memchunk(&chunk, &ss, volume);
+}
+
 static pa_memchunk* convert_to_work_format(pa_resampler *r, pa_memchunk *input) {
     unsigned in_n_samples, out_n_samples;
     void *src, *dst;
@@ -1198,7 +1329,7 @@ static pa_memchunk* convert_to_work_format(pa_resampler *r, pa_memchunk *input)
     have_leftover = r->leftover_in_to_work;
     r->leftover_in_to_work = false;
 
-    if (!have_leftover && (!r->to_work_format_func || !input->length))
+    if (!have_leftover && ((!r->to_work_format_func && !r->have_pre_volume) || !input->length))
         return input;
     else if (input->length <= 0)
         return &r->to_work_format_buf;
@@ -1223,6 +1354,13 @@ static pa_memchunk* convert_to_work_format(pa_resampler *r, pa_memchunk *input)
     pa_memblock_release(input->memblock);
     pa_memblock_release(r->to_work_format_buf.memblock);
 
+    /* The converted data is still hot in the cache and the buffer is ours,
+     * so the input volume costs neither a copy nor a pass of its own. The
+     * leftover data had the volume applied already. */
+    if (r->have_pre_volume)
+        apply_volume(r, &r->to_work_format_buf, leftover_length, r->w_sz * in_n_samples,
+                     r->work_format, r->i_ss.channels, &r->pre_volume);
+
     return &r->to_work_format_buf;
 }
 
@@ -1332,19 +1470,40 @@ static pa_memchunk *convert_from_work_format(pa_resampler *r, pa_memchunk *input
     /* Convert the data into the correct sample type and place the result in
      * from_work_format_buf. */
 
-    if (!r->from_work_format_func || !input->length)
+    if (!input->length)
         return input;
 
+    if (!r->from_work_format_func) {
+        if (!r->have_post_volume)
+            return input;
+
+        /* The buffers of the earlier stages are ours and can take the
+         * output volume in place. Only the caller's data needs a copy. */
+        if (input == &r->to_work_format_buf || input == &r->remap_buf || input == &r->resample_buf) {
+            apply_volume(r, input, 0, input->length, r->o_ss.format, r->o_ss.channels, &r->post_volume);
+            return input;
+        }
+    }
+
     n_samples = (unsigned) (input->length / r->w_sz);
     n_frames = n_samples / r->o_ss.channels;
     fit_buf(r, &r->from_work_format_buf, r->o_fz * n_frames, &r->from_work_format_buf_size, 0);
 
     src = pa_memblock_acquire_chunk(input);
     dst = pa_memblock_acquire(r->from_work_format_buf.memblock);
-    r->from_work_format_func(n_samples, src, dst);
+
+    if (r->from_work_format_func)
+        r->from_work_format_func(n_samples, src, dst);
+    else
+        memcpy(dst, src, input->length);
+
     pa_memblock_release(input->memblock);
     pa_memblock_release(r->from_work_format_buf.memblock);
 
+    if (r->have_post_volume)
+        apply_volume(r, &r->from_work_format_buf, 0, r->from_work_format_buf.length,
+                     r->o_ss.format, r->o_ss.channels, &r->post_volume);
+
     return &r->from_work_format_buf;
 }
 
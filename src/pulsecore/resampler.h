@@ -24,6 +24,7 @@
 
 #include <pulse/sample.h>
 #include <pulse/channelmap.h>
+#include <pulse/volume.h>
 #include <pulsecore/memblock.h>
 #include <pulsecore/memchunk.h>
 
@@ -96,12 +97,29 @@ void pa_resampler_set_input_rate(pa_resampler *r, uint32_t rate);
 /* Change the output rate of the resampler object */
 void pa_resampler_set_output_rate(pa_resampler *r, uint32_t rate);
 
+/* Set the software volume to apply to the input data (in the input
+ * channel map) and to the output data (in the output channel map) while
+ * converting from and to the work format. NULL means no volume. */
+void pa_resampler_set_volume(pa_resampler *r, const pa_cvolume *pre, const pa_cvolume *post);
+
+/* Crossfade from old, the output of a resampler that is being replaced,
+ * to out, the output of its replacement for the same input. Both are in
+ * the sample spec ss. done of the length frames of the fade have been
+ * faded before. Returns the number of frames faded now, which may be
+ * fewer than out has. */
+size_t pa_resampler_crossfade(pa_mempool *pool, const pa_sample_spec *ss, const pa_memchunk *old, pa_memchunk *out, size_t done, size_t length);
+
 /* Reinitialize state of the resampler, possibly due to seeking or other discontinuities */
 void pa_resampler_reset(pa_resampler *r);
 
 /* Return the resampling method of the resampler object */
 pa_resample_method_t pa_resampler_get_method(pa_resampler *r);
 
+/* Return the next cheaper method of the quality ladder the specified
+ * method is on, or PA_RESAMPLER_INVALID if there is none. Every ladder
+ * ends with 'trivial'. */
+pa_resample_method_t pa_resample_method_cheaper(pa_resample_method_t m);
+
 /* Try to parse the resampler method */
 pa_resample_method_t pa_parse_resample_method(const char *string);
 
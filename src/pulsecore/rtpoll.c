@@ -28,6 +28,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
@@ -46,6 +53,9 @@
 
 /* #define DEBUG_TIMING */
 
+/* Messages an asyncmsgq item handles at most before the loop returns */
+#define ASYNCMSGQ_WORK_MAX 32
+
 struct pa_rtpoll {
     struct pollfd *pollfd, *pollfd2;
     unsigned n_pollfd_alloc, n_pollfd_used;
@@ -64,6 +74,22 @@ struct pa_rtpoll {
     pa_usec_t slept, awake;
 #endif
 
+    pa_usec_t timer_slack;
+
+#ifdef USE_EPOLL
+    /* With epoll the fds stay registered between iterations. registered
+     * mirrors pollfd and holds what the kernel knows about each slot, so
+     * that only slots that changed cost a system call. */
+    int epoll_fd, timer_fd;
+    struct pollfd *registered, *registered2;
+    int *fd_slot;
+    unsigned n_fd_slot;
+    struct epoll_event *events;
+    unsigned n_events;
+
+    pa_usec_t timer_armed;
+#endif
+
     PA_LLIST_HEAD(pa_rtpoll_item, items);
 };
 
@@ -86,7 +112,67 @@ struct pa_rtpoll_item {
 
 PA_STATIC_FLIST_DECLARE(items, 0, pa_xfree);
 
-pa_rtpoll *pa_rtpoll_new(void) {
+#ifdef USE_EPOLL
+static bool epoll_init(pa_rtpoll *p) {
+    struct epoll_event ev;
+
+    if ((p->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        pa_log_debug("epoll_create1() failed: %s", pa_cstrerror(errno));
+        return false;
+    }
+
+    if ((p->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK)) < 0) {
+        pa_log_debug("timerfd_create() failed: %s", pa_cstrerror(errno));
+        pa_close(p->epoll_fd);
+        p->epoll_fd = -1;
+        return false;
+    }
+
+    pa_zero(ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = p->timer_fd;
+
+    if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->timer_fd, &ev) < 0) {
+        pa_log_debug("Failed to add timerfd to epoll: %s", pa_cstrerror(errno));
+        pa_close(p->timer_fd);
+        pa_close(p->epoll_fd);
+        p->epoll_fd = p->timer_fd = -1;
+        return false;
+    }
+
+    p->registered = pa_xnew(struct pollfd, p->n_pollfd_alloc);
+    p->registered2 = pa_xnew(struct pollfd, p->n_pollfd_alloc);
+    p->n_events = p->n_pollfd_alloc + 1;
+    p->events = pa_xnew(struct epoll_event, p->n_events);
+    p->fd_slot = NULL;
+    p->n_fd_slot = 0;
+    p->timer_armed = 0;
+
+    return true;
+}
+
+/* Switches to poll() for good, used when epoll cannot do what the items
+ * need, like watching the same fd twice or a regular file */
+static void epoll_done(pa_rtpoll *p) {
+    if (p->epoll_fd < 0)
+        return;
+
+    pa_close(p->timer_fd);
+    pa_close(p->epoll_fd);
+    p->epoll_fd = p->timer_fd = -1;
+
+    pa_xfree(p->registered);
+    pa_xfree(p->registered2);
+    pa_xfree(p->events);
+    pa_xfree(p->fd_slot);
+    p->registered = p->registered2 = NULL;
+    p->events = NULL;
+    p->fd_slot = NULL;
+    p->n_fd_slot = 0;
+}
+#endif
+
+pa_rtpoll *pa_rtpoll_new_with_backend(pa_rtpoll_backend_t backend) {
     pa_rtpoll *p;
 
     p = pa_xnew0(pa_rtpoll, 1);
@@ -95,6 +181,20 @@ pa_rtpoll *pa_rtpoll_new(void) {
     p->pollfd = pa_xnew(struct pollfd, p->n_pollfd_alloc);
     p->pollfd2 = pa_xnew(struct pollfd, p->n_pollfd_alloc);
 
+#ifdef USE_EPOLL
+    p->epoll_fd = p->timer_fd = -1;
+
+    if (backend != PA_RTPOLL_BACKEND_POLL && !epoll_init(p) && backend == PA_RTPOLL_BACKEND_EPOLL) {
+        pa_rtpoll_free(p);
+        return NULL;
+    }
+#else
+    if (backend == PA_RTPOLL_BACKEND_EPOLL) {
+        pa_rtpoll_free(p);
+        return NULL;
+    }
+#endif
+
 #ifdef DEBUG_TIMING
     p->timestamp = pa_rtclock_now();
 #endif
@@ -102,6 +202,21 @@ pa_rtpoll *pa_rtpoll_new(void) {
     return p;
 }
 
+pa_rtpoll *pa_rtpoll_new(void) {
+    return pa_rtpoll_new_with_backend(PA_RTPOLL_BACKEND_AUTO);
+}
+
+pa_rtpoll_backend_t pa_rtpoll_get_backend(pa_rtpoll *p) {
+    pa_assert(p);
+
+#ifdef USE_EPOLL
+    if (p->epoll_fd >= 0)
+        return PA_RTPOLL_BACKEND_EPOLL;
+#endif
+
+    return PA_RTPOLL_BACKEND_POLL;
+}
+
 static void rtpoll_rebuild(pa_rtpoll *p) {
 
     struct pollfd *e, *t;
@@ -116,6 +231,13 @@ static void rtpoll_rebuild(pa_rtpoll *p) {
         /* Hmm, we have to allocate some more space */
         p->n_pollfd_alloc = p->n_pollfd_used * 2;
         p->pollfd2 = pa_xrealloc(p->pollfd2, p->n_pollfd_alloc * sizeof(struct pollfd));
+#ifdef USE_EPOLL
+        if (p->epoll_fd >= 0) {
+            p->registered2 = pa_xrealloc(p->registered2, p->n_pollfd_alloc * sizeof(struct pollfd));
+            p->n_events = p->n_pollfd_alloc + 1;
+            p->events = pa_xrealloc(p->events, p->n_events * sizeof(struct epoll_event));
+        }
+#endif
         ra = 1;
     }
 
@@ -126,6 +248,20 @@ static void rtpoll_rebuild(pa_rtpoll *p) {
         if (i->n_pollfd > 0) {
             size_t l = i->n_pollfd * sizeof(struct pollfd);
 
+#ifdef USE_EPOLL
+            /* The registrations move along with the slots */
+            if (p->epoll_fd >= 0) {
+                struct pollfd *r = p->registered2 + (e - p->pollfd2);
+                unsigned k;
+
+                if (i->pollfd)
+                    memcpy(r, p->registered + (i->pollfd - p->pollfd), l);
+                else
+                    for (k = 0; k < i->n_pollfd; k++)
+                        r[k].fd = -1;
+            }
+#endif
+
             if (i->pollfd)
                 memcpy(e, i->pollfd, l);
             else
@@ -145,6 +281,23 @@ static void rtpoll_rebuild(pa_rtpoll *p) {
 
     if (ra)
         p->pollfd2 = pa_xrealloc(p->pollfd2, p->n_pollfd_alloc * sizeof(struct pollfd));
+
+#ifdef USE_EPOLL
+    if (p->epoll_fd >= 0) {
+        unsigned k;
+
+        t = p->registered;
+        p->registered = p->registered2;
+        p->registered2 = t;
+
+        if (ra)
+            p->registered2 = pa_xrealloc(p->registered2, p->n_pollfd_alloc * sizeof(struct pollfd));
+
+        for (k = 0; k < p->n_pollfd_used; k++)
+            if (p->registered[k].fd >= 0)
+                p->fd_slot[p->registered[k].fd] = (int) k;
+    }
+#endif
 }
 
 static void rtpoll_item_destroy(pa_rtpoll_item *i) {
@@ -154,6 +307,21 @@ static void rtpoll_item_destroy(pa_rtpoll_item *i) {
 
     p = i->rtpoll;
 
+#ifdef USE_EPOLL
+    if (p->epoll_fd >= 0 && i->pollfd) {
+        struct pollfd *r = p->registered + (i->pollfd - p->pollfd);
+        unsigned k;
+
+        /* The fd might be closed already, which removed it anyway */
+        for (k = 0; k < i->n_pollfd; k++)
+            if (r[k].fd >= 0) {
+                epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, r[k].fd, NULL);
+                p->fd_slot[r[k].fd] = -1;
+                r[k].fd = -1;
+            }
+    }
+#endif
+
     PA_LLIST_REMOVE(pa_rtpoll_item, p->items, i);
 
     p->n_pollfd_used -= i->n_pollfd;
@@ -170,6 +338,10 @@ void pa_rtpoll_free(pa_rtpoll *p) {
     while (p->items)
         rtpoll_item_destroy(p->items);
 
+#ifdef USE_EPOLL
+    epoll_done(p);
+#endif
+
     pa_xfree(p->pollfd);
     pa_xfree(p->pollfd2);
 
@@ -203,6 +375,131 @@ static void reset_all_revents(pa_rtpoll *p) {
     }
 }
 
+/* The time the timer should fire at, pushed back by up to the slack so
+ * that timers set close to each other fire together */
+static pa_usec_t timer_target(pa_rtpoll *p) {
+    pa_usec_t t = pa_timeval_load(&p->next_elapse);
+
+    if (p->timer_slack > 0)
+        t = PA_ROUND_UP(t, p->timer_slack);
+
+    return t;
+}
+
+#ifdef USE_EPOLL
+/* Brings the epoll set in line with the pollfd array. Slots that did not
+ * change since the last iteration cost nothing but a comparison. */
+static int epoll_update(pa_rtpoll *p) {
+    unsigned k;
+
+    for (k = 0; k < p->n_pollfd_used; k++) {
+        struct pollfd *want = p->pollfd + k, *have = p->registered + k;
+        struct epoll_event ev;
+        int op;
+
+        if (want->fd == have->fd && (want->fd < 0 || want->events == have->events))
+            continue;
+
+        if (have->fd >= 0 && have->fd != want->fd) {
+            epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, have->fd, NULL);
+            p->fd_slot[have->fd] = -1;
+            have->fd = -1;
+        }
+
+        if (want->fd < 0)
+            continue;
+
+        if ((unsigned) want->fd >= p->n_fd_slot) {
+            unsigned n = PA_MAX((unsigned) want->fd + 1, p->n_fd_slot * 2);
+
+            p->fd_slot = pa_xrealloc(p->fd_slot, n * sizeof(int));
+            for (; p->n_fd_slot < n; p->n_fd_slot++)
+                p->fd_slot[p->n_fd_slot] = -1;
+        }
+
+        if (have->fd == want->fd)
+            op = EPOLL_CTL_MOD;
+        else if (p->fd_slot[want->fd] >= 0) {
+            pa_log_debug("fd %i is watched twice, falling back to poll().", want->fd);
+            return -1;
+        } else
+            op = EPOLL_CTL_ADD;
+
+        pa_zero(ev);
+        ev.events = (uint32_t) want->events;
+        ev.data.fd = want->fd;
+
+        if (epoll_ctl(p->epoll_fd, op, want->fd, &ev) < 0) {
+            pa_log_debug("Cannot watch fd %i with epoll, falling back to poll(): %s", want->fd, pa_cstrerror(errno));
+            return -1;
+        }
+
+        *have = *want;
+        p->fd_slot[want->fd] = (int) k;
+    }
+
+    return 0;
+}
+
+static int epoll_sleep(pa_rtpoll *p, bool wait_op) {
+    bool timer_fired = false;
+    int n, k, r = 0;
+
+    if (wait_op && !p->quit) {
+        pa_usec_t target = p->timer_enabled ? PA_MAX(timer_target(p), 1U) : 0;
+
+        /* Only touch the timer when the deadline really changes */
+        if (target != p->timer_armed) {
+            struct itimerspec its;
+
+            pa_zero(its);
+            pa_timespec_store(&its.it_value, target);
+
+            if (timerfd_settime(p->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+                pa_log_error("timerfd_settime(): %s", pa_cstrerror(errno));
+
+            p->timer_armed = target;
+        }
+    }
+
+    n = epoll_wait(p->epoll_fd, p->events, (int) p->n_events, wait_op && !p->quit ? -1 : 0);
+
+    if (n < 0) {
+        p->timer_elapsed = false;
+        return n;
+    }
+
+    for (k = 0; k < (int) p->n_pollfd_used; k++)
+        p->pollfd[k].revents = 0;
+
+    for (k = 0; k < n; k++) {
+        int fd = p->events[k].data.fd;
+
+        if (fd == p->timer_fd) {
+            uint64_t expirations;
+
+            if (read(p->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                /* A one-shot timerfd is disarmed once it expired, so the
+                 * same deadline has to be programmed again next time */
+                timer_fired = true;
+                p->timer_armed = 0;
+            }
+
+            continue;
+        }
+
+        if ((unsigned) fd < p->n_fd_slot && p->fd_slot[fd] >= 0) {
+            p->pollfd[p->fd_slot[fd]].revents = (short) p->events[k].events;
+            r++;
+        }
+    }
+
+    p->timer_elapsed = timer_fired || r == 0;
+
+    return r;
+}
+#endif
+
 int pa_rtpoll_run(pa_rtpoll *p, bool wait_op) {
     pa_rtpoll_item *i;
     int r = 0;
@@ -282,42 +579,59 @@ int pa_rtpoll_run(pa_rtpoll *p, bool wait_op) {
     if (p->rebuild_needed)
         rtpoll_rebuild(p);
 
-    pa_zero(timeout);
-
-    /* Calculate timeout */
-    if (wait_op && !p->quit && p->timer_enabled) {
-        struct timeval now;
-        pa_rtclock_get(&now);
-
-        if (pa_timeval_cmp(&p->next_elapse, &now) > 0)
-            pa_timeval_add(&timeout, pa_timeval_diff(&p->next_elapse, &now));
-    }
+#ifdef USE_EPOLL
+    if (p->epoll_fd >= 0 && epoll_update(p) < 0)
+        epoll_done(p);
 
+    if (p->epoll_fd >= 0) {
 #ifdef DEBUG_TIMING
-    {
         pa_usec_t now = pa_rtclock_now();
         p->awake = now - p->timestamp;
         p->timestamp = now;
-        if (!wait_op || p->quit || p->timer_enabled)
-            pa_log("poll timeout: %d ms ",(int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)));
-        else
-            pa_log("poll timeout is ZERO");
-    }
 #endif
 
-    /* OK, now let's sleep */
-#ifdef HAVE_PPOLL
+        r = epoll_sleep(p, wait_op);
+    } else
+#endif
     {
-        struct timespec ts;
-        ts.tv_sec = timeout.tv_sec;
-        ts.tv_nsec = timeout.tv_usec * 1000;
-        r = ppoll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? &ts : NULL, NULL);
-    }
+        pa_zero(timeout);
+
+        /* Calculate timeout */
+        if (wait_op && !p->quit && p->timer_enabled) {
+            struct timeval now, elapse;
+            pa_rtclock_get(&now);
+            pa_timeval_store(&elapse, timer_target(p));
+
+            if (pa_timeval_cmp(&elapse, &now) > 0)
+                pa_timeval_add(&timeout, pa_timeval_diff(&elapse, &now));
+        }
+
+#ifdef DEBUG_TIMING
+        {
+            pa_usec_t now = pa_rtclock_now();
+            p->awake = now - p->timestamp;
+            p->timestamp = now;
+            if (!wait_op || p->quit || p->timer_enabled)
+                pa_log("poll timeout: %d ms ",(int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)));
+            else
+                pa_log("poll timeout is ZERO");
+        }
+#endif
+
+        /* OK, now let's sleep */
+#ifdef HAVE_PPOLL
+        {
+            struct timespec ts;
+            ts.tv_sec = timeout.tv_sec;
+            ts.tv_nsec = timeout.tv_usec * 1000;
+            r = ppoll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? &ts : NULL, NULL);
+        }
 #else
-    r = pa_poll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? (int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)) : -1);
+        r = pa_poll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? (int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)) : -1);
 #endif
 
-    p->timer_elapsed = r == 0;
+        p->timer_elapsed = r == 0;
+    }
 
 #ifdef DEBUG_TIMING
     {
@@ -397,6 +711,12 @@ void pa_rtpoll_set_timer_disabled(pa_rtpoll *p) {
     p->timer_enabled = false;
 }
 
+void pa_rtpoll_set_timer_slack(pa_rtpoll *p, pa_usec_t usec) {
+    pa_assert(p);
+
+    p->timer_slack = usec;
+}
+
 pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsigned n_fds) {
     pa_rtpoll_item *i, *j, *l = NULL;
 
@@ -543,18 +863,24 @@ static void asyncmsgq_read_after(pa_rtpoll_item *i) {
     pa_asyncmsgq_read_after_poll(i->userdata);
 }
 
+/* Handle a few messages per run, instead of going through the whole
+ * loop of the IO thread for every single one of them */
 static int asyncmsgq_read_work(pa_rtpoll_item *i) {
     pa_msgobject *object;
     int code;
     void *data;
     pa_memchunk chunk;
     int64_t offset;
+    unsigned n;
 
     pa_assert(i);
 
-    if (pa_asyncmsgq_get(i->userdata, &object, &code, &data, &offset, &chunk, 0) == 0) {
+    for (n = 0; n < ASYNCMSGQ_WORK_MAX; n++) {
         int ret;
 
+        if (pa_asyncmsgq_get(i->userdata, &object, &code, &data, &offset, &chunk, 0) < 0)
+            break;
+
         if (!object && code == PA_MESSAGE_SHUTDOWN) {
             pa_asyncmsgq_done(i->userdata, 0);
             pa_rtpoll_quit(i->rtpoll);
@@ -563,10 +889,13 @@ static int asyncmsgq_read_work(pa_rtpoll_item *i) {
 
         ret = pa_asyncmsgq_dispatch(object, code, data, offset, &chunk);
         pa_asyncmsgq_done(i->userdata, ret);
-        return 1;
+
+        /* The message might have removed us or stopped the loop */
+        if (i->dead || i->rtpoll->quit)
+            return 1;
     }
 
-    return 0;
+    return n > 0;
 }
 
 pa_rtpoll_item *pa_rtpoll_item_new_asyncmsgq_read(pa_rtpoll *p, pa_rtpoll_priority_t prio, pa_asyncmsgq *q) {
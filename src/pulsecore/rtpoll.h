@@ -41,7 +41,11 @@
  * 3) It allows arbitrary functions to be run before entering the
  * actual poll() and after it.
  *
- * Only a single interval timer is supported..*/
+ * Only a single interval timer is supported..
+ *
+ * On Linux the fds are kept registered in an epoll set between
+ * iterations and the timer is a timerfd, so an iteration only costs
+ * system calls for the fds that changed. */
 
 typedef struct pa_rtpoll pa_rtpoll;
 typedef struct pa_rtpoll_item pa_rtpoll_item;
@@ -53,9 +57,22 @@ typedef enum pa_rtpoll_priority {
     PA_RTPOLL_NEVER  = INT_MAX,       /* For stuff that doesn't register any callbacks, but only fds to listen on */
 } pa_rtpoll_priority_t;
 
+typedef enum pa_rtpoll_backend {
+    PA_RTPOLL_BACKEND_AUTO,           /* epoll where available, poll() otherwise */
+    PA_RTPOLL_BACKEND_POLL,
+    PA_RTPOLL_BACKEND_EPOLL,
+} pa_rtpoll_backend_t;
+
 pa_rtpoll *pa_rtpoll_new(void);
+/* Returns NULL if the backend is not available */
+pa_rtpoll *pa_rtpoll_new_with_backend(pa_rtpoll_backend_t backend);
 void pa_rtpoll_free(pa_rtpoll *p);
 
+/* The backend in use. An epoll rtpoll falls back to poll() for good when
+ * an item needs something epoll can't do, like watching a regular file
+ * or the same fd twice. */
+pa_rtpoll_backend_t pa_rtpoll_get_backend(pa_rtpoll *p);
+
 /* Sleep on the rtpoll until the time event, or any of the fd events
  * is triggered. If "wait" is 0 we don't sleep but only update the
  * struct pollfd. Returns negative on error, positive if the loop
@@ -67,6 +84,10 @@ void pa_rtpoll_set_timer_absolute(pa_rtpoll *p, pa_usec_t usec);
 void pa_rtpoll_set_timer_relative(pa_rtpoll *p, pa_usec_t usec);
 void pa_rtpoll_set_timer_disabled(pa_rtpoll *p);
 
+/* Allow the timer to fire up to usec late, so that timers set close to
+ * each other end up in a single wakeup. Defaults to 0. */
+void pa_rtpoll_set_timer_slack(pa_rtpoll *p, pa_usec_t usec);
+
 /* Return true when the elapsed timer was the reason for
  * the last pa_rtpoll_run() invocation to finish */
 bool pa_rtpoll_timer_elapsed(pa_rtpoll *p);
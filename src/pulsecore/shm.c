@@ -95,6 +95,55 @@ struct shm_marker {
 
 #define SHM_MARKER_SIZE PA_ALIGN(sizeof(struct shm_marker))
 
+/* Used if the kernel doesn't tell us */
+#define DEFAULT_HUGE_PAGE_SIZE (2*1024*1024)
+
+static size_t huge_page_size(void) {
+    static size_t size = 0;
+#ifdef __linux__
+    FILE *f;
+    char ln[128];
+    unsigned long kb;
+#endif
+
+    if (size > 0)
+        return size;
+
+    size = DEFAULT_HUGE_PAGE_SIZE;
+
+#ifdef __linux__
+    if (!(f = pa_fopen_cloexec("/proc/meminfo", "r")))
+        return size;
+
+    while (fgets(ln, sizeof(ln), f))
+        if (sscanf(ln, "Hugepagesize: %lu kB", &kb) == 1 && kb > 0) {
+            size = (size_t) kb * 1024;
+            break;
+        }
+
+    fclose(f);
+#endif
+
+    return size;
+}
+
+/* Asks for transparent huge pages, the kernel decides whether it
+ * actually uses them */
+static void advise_huge_pages(pa_shm *m, size_t size) {
+    m->pages = PA_SHM_PAGES_NORMAL;
+    m->page_size = PA_PAGE_SIZE;
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(m->ptr, size, MADV_HUGEPAGE) < 0) {
+        pa_log_debug("madvise(MADV_HUGEPAGE) failed: %s", pa_cstrerror(errno));
+        return;
+    }
+
+    m->pages = PA_SHM_PAGES_TRANSPARENT_HUGE;
+    m->page_size = huge_page_size();
+#endif
+}
+
 #ifdef HAVE_SHM_OPEN
 static char *segment_name(char *fn, size_t l, unsigned id) {
     pa_snprintf(fn, l, "/pulse-shm-%u", id);
@@ -102,7 +151,7 @@ static char *segment_name(char *fn, size_t l, unsigned id) {
 }
 #endif
 
-int pa_shm_create_rw(pa_shm *m, size_t size, bool shared, mode_t mode) {
+int pa_shm_create_rw(pa_shm *m, size_t size, bool shared, bool huge_pages, mode_t mode) {
 #ifdef HAVE_SHM_OPEN
     char fn[32];
     int fd = -1;
@@ -121,14 +170,38 @@ int pa_shm_create_rw(pa_shm *m, size_t size, bool shared, mode_t mode) {
     /* Round up to make it page aligned */
     size = PA_PAGE_ALIGN(size);
 
+    m->pages = PA_SHM_PAGES_NORMAL;
+    m->page_size = PA_PAGE_SIZE;
+
     if (!shared) {
         m->id = 0;
         m->size = size;
 
 #ifdef MAP_ANONYMOUS
-        if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
-            pa_log("mmap() failed: %s", pa_cstrerror(errno));
-            goto fail;
+        m->ptr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        if (huge_pages) {
+            size_t hsize = huge_page_size();
+
+            /* This only works if the admin reserved enough huge pages */
+            if ((m->ptr = mmap(NULL, PA_ROUND_UP(size, hsize), PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE|MAP_HUGETLB, -1, (off_t) 0)) != MAP_FAILED) {
+                m->size = PA_ROUND_UP(size, hsize);
+                m->pages = PA_SHM_PAGES_HUGE;
+                m->page_size = hsize;
+            } else
+                pa_log_debug("No reserved huge pages available, trying transparent huge pages: %s", pa_cstrerror(errno));
+        }
+#endif
+
+        if (m->ptr == MAP_FAILED) {
+            if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
+                pa_log("mmap() failed: %s", pa_cstrerror(errno));
+                goto fail;
+            }
+
+            if (huge_pages)
+                advise_huge_pages(m, m->size);
         }
 #elif defined(HAVE_POSIX_MEMALIGN)
         {
@@ -173,6 +246,11 @@ int pa_shm_create_rw(pa_shm *m, size_t size, bool shared, mode_t mode) {
             goto fail;
         }
 
+        /* Huge pages for tmpfs only work if the admin enabled them
+         * for shmem in "advise" mode or better */
+        if (huge_pages)
+            advise_huge_pages(m, PA_PAGE_ALIGN(m->size));
+
         /* We store our PID at the end of the shm block, so that we
          * can check for dead shm segments later */
         marker = (struct shm_marker*) ((uint8_t*) m->ptr + m->size - SHM_MARKER_SIZE);
@@ -242,6 +320,19 @@ void pa_shm_free(pa_shm *m) {
     pa_zero(*m);
 }
 
+const char *pa_shm_pages_to_string(pa_shm_pages_t pages) {
+    switch (pages) {
+        case PA_SHM_PAGES_NORMAL:
+            return "normal";
+        case PA_SHM_PAGES_TRANSPARENT_HUGE:
+            return "transparent huge";
+        case PA_SHM_PAGES_HUGE:
+            return "huge";
+    }
+
+    pa_assert_not_reached();
+}
+
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
     void *ptr;
     size_t o;
@@ -258,6 +349,12 @@ void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
     /* You're welcome to implement this as NOOP on systems that don't
      * support it */
 
+    /* Huge pages can't be given back partially. With transparent
+     * ones the kernel would split them, and we asked for them to
+     * avoid that. */
+    if (m->pages != PA_SHM_PAGES_NORMAL)
+        return;
+
     /* Align the pointer up to multiples of the page size */
     ptr = (uint8_t*) m->ptr + offset;
     o = (size_t) ((uint8_t*) ptr - (uint8_t*) PA_PAGE_ALIGN_PTR(ptr));
@@ -324,6 +421,8 @@ int pa_shm_attach_ro(pa_shm *m, unsigned id) {
         goto fail;
     }
 
+    m->pages = PA_SHM_PAGES_NORMAL;
+    m->page_size = PA_PAGE_SIZE;
     m->do_unlink = false;
     m->shared = true;
 
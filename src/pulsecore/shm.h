@@ -26,21 +26,36 @@
 
 #include <pulsecore/macro.h>
 
+/* What kind of pages back a segment */
+typedef enum pa_shm_pages {
+    PA_SHM_PAGES_NORMAL,
+    PA_SHM_PAGES_TRANSPARENT_HUGE, /* madvise()d, the kernel may still use normal pages for parts of it */
+    PA_SHM_PAGES_HUGE              /* hugetlbfs pages, reserved by the admin */
+} pa_shm_pages_t;
+
 typedef struct pa_shm {
     unsigned id;
     void *ptr;
     size_t size;
+    pa_shm_pages_t pages;
+    size_t page_size;
     bool do_unlink:1;
     bool shared:1;
 } pa_shm;
 
-int pa_shm_create_rw(pa_shm *m, size_t size, bool shared, mode_t mode);
+/* If huge_pages is true we try to back the segment with huge pages,
+ * which saves the IO threads a lot of TLB misses. Private segments
+ * use reserved huge pages if there are any and transparent huge pages
+ * otherwise, shared ones can only use the latter. */
+int pa_shm_create_rw(pa_shm *m, size_t size, bool shared, bool huge_pages, mode_t mode);
 int pa_shm_attach_ro(pa_shm *m, unsigned id);
 
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size);
 
 void pa_shm_free(pa_shm *m);
 
+const char *pa_shm_pages_to_string(pa_shm_pages_t pages);
+
 int pa_shm_cleanup(void);
 
 #endif
@@ -31,6 +31,7 @@
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 #include <pulse/internal.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/core-format.h>
 #include <pulsecore/mix.h>
@@ -40,6 +41,7 @@
 #include <pulsecore/play-memblockq.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/resample-budget.h>
 
 #include "sink-input.h"
 
@@ -48,6 +50,10 @@
 #define MEMBLOCKQ_MAXLENGTH (32*1024*1024)
 #define CONVERT_BUFFER_LENGTH (PA_PAGE_SIZE)
 
+/* How long the output of a replaced resampler is faded over to the
+ * output of the new one */
+#define RESAMPLER_FADE_USEC (10*PA_USEC_PER_MSEC)
+
 PA_DEFINE_PUBLIC_CLASS(pa_sink_input, pa_msgobject);
 
 struct volume_factor_entry {
@@ -479,6 +485,9 @@ int pa_sink_input_new(
 
     i->requested_resample_method = data->resample_method;
     i->actual_resample_method = resampler ? pa_resampler_get_method(resampler) : PA_RESAMPLER_INVALID;
+    i->full_resample_method = i->actual_resample_method;
+    i->resample_downgrade = 0;
+    i->resample_usec_seen = 0;
     i->sample_spec = data->sample_spec;
     i->channel_map = data->channel_map;
     i->format = pa_format_info_copy(data->format);
@@ -527,20 +536,32 @@ int pa_sink_input_new(
     reset_callbacks(i);
     i->userdata = NULL;
 
+    pa_meter_init(&i->meter);
+
     i->thread_info.state = i->state;
     i->thread_info.attached = false;
     pa_atomic_store(&i->thread_info.drained, 1);
     i->thread_info.sample_spec = i->sample_spec;
     i->thread_info.resampler = resampler;
+    i->thread_info.fading_resampler = NULL;
+    i->thread_info.fade_done = i->thread_info.fade_length = 0;
     i->thread_info.soft_volume = i->soft_volume;
     i->thread_info.muted = i->muted;
     i->thread_info.requested_sink_latency = (pa_usec_t) -1;
     i->thread_info.rewrite_nbytes = 0;
     i->thread_info.rewrite_flush = false;
     i->thread_info.dont_rewind_render = false;
+    i->thread_info.history_replay = false;
+    pa_cvolume_init(&i->thread_info.history_volume);
+    i->thread_info.history_volume_since = INT64_MIN;
+    i->thread_info.lazy_rewind = false;
+    i->thread_info.checkpoints = NULL;
+    i->thread_info.n_checkpoints = i->thread_info.first_checkpoint = 0;
+    i->thread_info.popped = 0;
     i->thread_info.underrun_for = (uint64_t) -1;
     i->thread_info.underrun_for_sink = 0;
     i->thread_info.playing_for = 0;
+    i->thread_info.silent_for = 0;
     i->thread_info.direct_outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
     pa_assert_se(pa_idxset_put(core->sink_inputs, i, &i->index) == 0);
@@ -737,9 +758,14 @@ static void sink_input_free(pa_object *o) {
     if (i->thread_info.render_memblockq)
         pa_memblockq_free(i->thread_info.render_memblockq);
 
+    pa_xfree(i->thread_info.checkpoints);
+
     if (i->thread_info.resampler)
         pa_resampler_free(i->thread_info.resampler);
 
+    if (i->thread_info.fading_resampler)
+        pa_resampler_free(i->thread_info.fading_resampler);
+
     if (i->format)
         pa_format_info_free(i->format);
 
@@ -799,12 +825,22 @@ void pa_sink_input_put(pa_sink_input *i) {
     i->thread_info.soft_volume = i->soft_volume;
     i->thread_info.muted = i->muted;
 
+    /* Only implementors that keep their data around for rewinds can
+     * hand it out again */
+    if (i->core->lazy_rewind && i->update_max_rewind) {
+        i->thread_info.lazy_rewind = true;
+        i->thread_info.checkpoints = pa_xnew(pa_sink_input_checkpoint, PA_SINK_INPUT_CHECKPOINTS);
+    }
+
     pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_ADD_INPUT, i, 0, NULL) == 0);
 
     pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_NEW, i->index);
     pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_PUT], i);
 
     pa_sink_update_status(i->sink);
+
+    if (i->core->resample_cpu_budget > 0)
+        pa_resample_budget_start(i->core);
 }
 
 /* Called from main context */
@@ -835,6 +871,160 @@ pa_usec_t pa_sink_input_get_latency(pa_sink_input *i, pa_usec_t *sink_latency) {
     return r[0];
 }
 
+/* Called from thread context */
+static bool lazy_rewind_active(pa_sink_input *i) {
+
+    /* A mix history needs the render memblockq to take our data out
+     * of it again */
+    if (!i->thread_info.lazy_rewind || i->sink->thread_info.history)
+        return false;
+
+    /* A resampler that changes the rate carries filter state and
+     * leftover samples from one block to the next. Resetting it for
+     * rendering again would not reproduce what has been played, so
+     * only conversions without state are done lazily. */
+    return !i->thread_info.resampler ||
+        pa_resampler_get_method(i->thread_info.resampler) == PA_RESAMPLER_COPY;
+}
+
+/* Called from thread context. Rewinds may go back to the oldest
+ * checkpoint, so they are spread over twice max_rewind. */
+static size_t checkpoint_distance(pa_sink_input *i) {
+    return pa_frame_align(i->sink->thread_info.max_rewind / (PA_SINK_INPUT_CHECKPOINTS / 2), &i->sink->sample_spec);
+}
+
+/* Called from thread context */
+static pa_sink_input_checkpoint *checkpoint_get(pa_sink_input *i, unsigned n) {
+    return i->thread_info.checkpoints + (i->thread_info.first_checkpoint + n) % PA_SINK_INPUT_CHECKPOINTS;
+}
+
+/* Called from thread context. Remembers the current write index of the
+ * render memblockq, unless the last checkpoint is still close enough. */
+static void checkpoint_add(pa_sink_input *i) {
+    pa_sink_input_checkpoint *c;
+    int64_t idx;
+
+    idx = pa_memblockq_get_write_index(i->thread_info.render_memblockq);
+
+    if (i->thread_info.n_checkpoints > 0) {
+        c = checkpoint_get(i, i->thread_info.n_checkpoints - 1);
+
+        if (idx < c->render_index + (int64_t) PA_MAX(checkpoint_distance(i), 1U))
+            return;
+    }
+
+    if (i->thread_info.n_checkpoints >= PA_SINK_INPUT_CHECKPOINTS) {
+        i->thread_info.first_checkpoint = (i->thread_info.first_checkpoint + 1) % PA_SINK_INPUT_CHECKPOINTS;
+        i->thread_info.n_checkpoints--;
+    }
+
+    c = checkpoint_get(i, i->thread_info.n_checkpoints++);
+    c->render_index = idx;
+    c->popped = i->thread_info.popped;
+}
+
+/* Called from thread context. Forgets all checkpoints, when what has
+ * been rendered can't be rendered again from the implementor. */
+static void checkpoints_reset(pa_sink_input *i) {
+    i->thread_info.n_checkpoints = 0;
+    i->thread_info.first_checkpoint = 0;
+}
+
+/* Called from thread context */
+static void resampler_fade_stop(pa_sink_input *i) {
+
+    if (i->thread_info.fading_resampler) {
+        pa_resampler_free(i->thread_info.fading_resampler);
+        i->thread_info.fading_resampler = NULL;
+    }
+}
+
+/* Called from thread context. After a rewind both resamplers start over
+ * from the same input, so the fade has to start over as well. */
+static void resampler_fade_restart(pa_sink_input *i) {
+
+    if (i->thread_info.fading_resampler) {
+        pa_resampler_reset(i->thread_info.fading_resampler);
+        i->thread_info.fade_done = 0;
+    }
+}
+
+/* Called from thread context. Runs the replaced resampler on the same
+ * input as the new one and fades its output over to the output of the
+ * new one, so that switching methods doesn't click. */
+static void resampler_fade(pa_sink_input *i, const pa_memchunk *in, pa_memchunk *out) {
+    pa_memchunk old;
+
+    pa_resampler_run(i->thread_info.fading_resampler, in, &old);
+
+    if (out->memblock && old.memblock)
+        i->thread_info.fade_done += pa_resampler_crossfade(i->core->mempool, &i->sink->sample_spec, &old, out,
+                                                           i->thread_info.fade_done, i->thread_info.fade_length);
+
+    if (old.memblock)
+        pa_memblock_unref(old.memblock);
+
+    if (i->thread_info.fade_done >= i->thread_info.fade_length)
+        resampler_fade_stop(i);
+}
+
+/* Called from thread context. Rewinds the render memblockq by nbytes
+ * without any history in it: the implementor is rewound to the last
+ * checkpoint before the new read index, and everything after that
+ * point is dropped and rendered again on the next peek. If there is no
+ * checkpoint that old, the oldest one is used and only the data before
+ * it is lost. Returns false if there is no checkpoint that has already
+ * been played. */
+static bool lazy_rewind(pa_sink_input *i, size_t nbytes) {
+    pa_sink_input_checkpoint *c = NULL;
+    int64_t read_index, target;
+    unsigned n;
+
+    read_index = pa_memblockq_get_read_index(i->thread_info.render_memblockq);
+    target = read_index - (int64_t) nbytes;
+
+    for (n = i->thread_info.n_checkpoints; n > 0; n--) {
+        c = checkpoint_get(i, n - 1);
+
+        if (c->render_index <= target)
+            break;
+    }
+
+    if (n == 0) {
+        if (i->thread_info.n_checkpoints == 0)
+            return false;
+
+        /* Flushing from the target on would drop data that hasn't been
+         * played yet */
+        c = checkpoint_get(i, 0);
+        if (c->render_index > read_index)
+            return false;
+
+        pa_log_debug("No checkpoint to render %lu bytes again from, rewinding into silence up to the oldest one.",
+                     (unsigned long) nbytes);
+        n = 1;
+    }
+
+    pa_log_debug("Rendering %lu bytes again from the implementor.", (unsigned long) (pa_memblockq_get_write_index(i->thread_info.render_memblockq) - c->render_index));
+
+    i->process_rewind(i, (size_t) (i->thread_info.popped - c->popped));
+    i->thread_info.popped = c->popped;
+    i->thread_info.n_checkpoints = n;
+
+    /* Whatever is pushed before the read index is dropped right away, a
+     * checkpoint after it leaves a hole that is played as silence */
+    pa_memblockq_rewind(i->thread_info.render_memblockq, nbytes);
+    pa_memblockq_flush_write(i->thread_info.render_memblockq, true);
+    pa_memblockq_seek(i->thread_info.render_memblockq, c->render_index - target, PA_SEEK_RELATIVE, true);
+
+    if (i->thread_info.resampler)
+        pa_resampler_reset(i->thread_info.resampler);
+
+    resampler_fade_restart(i);
+
+    return true;
+}
+
 /* Called from thread context */
 void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa_memchunk *chunk, pa_cvolume *volume) {
     bool do_volume_adj_here, need_volume_factor_sink;
@@ -905,6 +1095,14 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
 
             pa_memblockq_seek(i->thread_info.render_memblockq, (int64_t) slength, PA_SEEK_RELATIVE, true);
             i->thread_info.playing_for = 0;
+
+            /* The silence can't be rendered again */
+            checkpoints_reset(i);
+
+            /* Only count the transition from playing to underrun */
+            if (i->thread_info.underrun_for == 0 && i->thread_info.state != PA_SINK_INPUT_CORKED)
+                pa_atomic_inc(&i->metrics.n_xruns);
+
             if (i->thread_info.underrun_for != (uint64_t) -1) {
                 i->thread_info.underrun_for += ilength_full;
                 i->thread_info.underrun_for_sink += slength;
@@ -921,25 +1119,54 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
         i->thread_info.underrun_for_sink = 0;
         i->thread_info.playing_for += tchunk.length;
 
+        if (i->thread_info.lazy_rewind)
+            checkpoint_add(i);
+
+        i->thread_info.popped += tchunk.length;
+
         while (tchunk.length > 0) {
             pa_memchunk wchunk;
             bool nvfs = need_volume_factor_sink;
+            bool silence;
 
             wchunk = tchunk;
             pa_memblock_ref(wchunk.memblock);
 
+            /* Volumes don't change silence, and leaving the block alone
+             * keeps it flagged so the sink can skip it when mixing */
+            silence = pa_memblock_is_silence(wchunk.memblock);
+
             if (wchunk.length > block_size_max_sink_input)
                 wchunk.length = block_size_max_sink_input;
 
-            /* It might be necessary to adjust the volume here */
-            if (do_volume_adj_here && !volume_is_norm) {
+            /* It might be necessary to adjust the volume here. The
+             * resampler applies the volumes while converting to and from
+             * its work format, which saves the copies and passes. */
+            if (i->thread_info.resampler) {
+                const pa_cvolume *pre = NULL;
+                pa_cvolume mute;
+
+                if (do_volume_adj_here && !volume_is_norm) {
+                    if (i->thread_info.muted) {
+                        pre = pa_cvolume_mute(&mute, i->thread_info.sample_spec.channels);
+                        nvfs = false;
+                    } else
+                        pre = &i->thread_info.soft_volume;
+                }
+
+                pa_resampler_set_volume(i->thread_info.resampler, pre, nvfs ? &i->volume_factor_sink : NULL);
+
+                if (i->thread_info.fading_resampler)
+                    pa_resampler_set_volume(i->thread_info.fading_resampler, pre, nvfs ? &i->volume_factor_sink : NULL);
+
+            } else if (do_volume_adj_here && !volume_is_norm && !silence) {
                 pa_memchunk_make_writable(&wchunk, 0);
 
                 if (i->thread_info.muted) {
                     pa_silence_memchunk(&wchunk, &i->thread_info.sample_spec);
                     nvfs = false;
 
-                } else if (!i->thread_info.resampler && nvfs) {
+                } else if (nvfs) {
                     pa_cvolume v;
 
                     /* If we don't need a resampler we can merge the
@@ -955,7 +1182,7 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
 
             if (!i->thread_info.resampler) {
 
-                if (nvfs) {
+                if (nvfs && !silence) {
                     pa_memchunk_make_writable(&wchunk, 0);
                     pa_volume_memchunk(&wchunk, &i->sink->sample_spec, &i->volume_factor_sink);
                 }
@@ -963,19 +1190,22 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
                 pa_memblockq_push_align(i->thread_info.render_memblockq, &wchunk);
             } else {
                 pa_memchunk rchunk;
+                pa_usec_t start;
+
+                start = pa_rtclock_now();
                 pa_resampler_run(i->thread_info.resampler, &wchunk, &rchunk);
 
+                if (i->thread_info.fading_resampler)
+                    resampler_fade(i, &wchunk, &rchunk);
+
+                pa_atomic_add(&i->metrics.resample_usec, (int) (pa_rtclock_now() - start));
+                pa_atomic_inc(&i->metrics.n_resamples);
+
 #ifdef SINK_INPUT_DEBUG
                 pa_log_debug("pushing %lu", (unsigned long) rchunk.length);
 #endif
 
                 if (rchunk.memblock) {
-
-                    if (nvfs) {
-                        pa_memchunk_make_writable(&rchunk, 0);
-                        pa_volume_memchunk(&rchunk, &i->sink->sample_spec, &i->volume_factor_sink);
-                    }
-
                     pa_memblockq_push_align(i->thread_info.render_memblockq, &rchunk);
                     pa_memblock_unref(rchunk.memblock);
                 }
@@ -992,6 +1222,17 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
 
     pa_assert_se(pa_memblockq_peek(i->thread_info.render_memblockq, chunk) >= 0);
 
+    pa_atomic_store(&i->metrics.queue_length, (int) pa_memblockq_get_length(i->thread_info.render_memblockq));
+
+    /* Without a resampler the render memblockq mostly references the
+     * implementor's blocks, so not keeping them doesn't save much */
+    if (lazy_rewind_active(i) && i->thread_info.resampler && i->thread_info.n_checkpoints > 0) {
+        int64_t kept = pa_memblockq_get_write_index(i->thread_info.render_memblockq) - checkpoint_get(i, 0)->render_index;
+
+        pa_atomic_store(&i->metrics.rewind_saved, (int) PA_MIN((int64_t) i->sink->thread_info.max_rewind, kept));
+    } else
+        pa_atomic_store(&i->metrics.rewind_saved, 0);
+
     pa_assert(chunk->length > 0);
     pa_assert(chunk->memblock);
 
@@ -1029,6 +1270,8 @@ void pa_sink_input_drop(pa_sink_input *i, size_t nbytes /* in sink sample spec *
 #endif
 
     pa_memblockq_drop(i->thread_info.render_memblockq, nbytes);
+
+    pa_atomic_add(&i->metrics.mixed_bytes, (int) nbytes);
 }
 
 /* Called from thread context */
@@ -1063,6 +1306,26 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
 
     lbq = pa_memblockq_get_length(i->thread_info.render_memblockq);
 
+    /* Whatever is rendered again may not be silent */
+    i->thread_info.silent_for = 0;
+
+    /* Without a history in the render memblockq everything from the new
+     * read index on is rendered again, which includes whatever was asked
+     * to be rewritten */
+    if (nbytes > 0 && !i->thread_info.dont_rewind_render &&
+        i->thread_info.rewrite_nbytes != (size_t) -1 &&
+        lazy_rewind_active(i)) {
+
+        if (lazy_rewind(i, nbytes)) {
+            i->thread_info.rewrite_nbytes = 0;
+            i->thread_info.rewrite_flush = false;
+            i->thread_info.dont_rewind_render = false;
+            return;
+        }
+
+        pa_log_debug("No checkpoint to render %lu bytes again from, rewinding into silence.", (unsigned long) nbytes);
+    }
+
     if (nbytes > 0 && !i->thread_info.dont_rewind_render) {
         pa_log_debug("Have to rewind %lu bytes on render memblockq.", (unsigned long) nbytes);
         pa_memblockq_rewind(i->thread_info.render_memblockq, nbytes);
@@ -1074,6 +1337,7 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
          * data from implementor the next time peek() is called */
 
         pa_memblockq_flush_write(i->thread_info.render_memblockq, true);
+        checkpoints_reset(i);
 
     } else if (i->thread_info.rewrite_nbytes > 0) {
         size_t max_rewrite, amount;
@@ -1110,6 +1374,10 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
             /* And reset the resampler */
             if (i->thread_info.resampler)
                 pa_resampler_reset(i->thread_info.resampler);
+
+            resampler_fade_restart(i);
+
+            checkpoints_reset(i);
         }
     }
 
@@ -1148,7 +1416,13 @@ void pa_sink_input_update_max_rewind(pa_sink_input *i, size_t nbytes  /* in the
     pa_assert(PA_SINK_INPUT_IS_LINKED(i->thread_info.state));
     pa_assert(pa_frame_aligned(nbytes, &i->sink->sample_spec));
 
-    pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, nbytes);
+    if (lazy_rewind_active(i)) {
+        /* The implementor has to keep enough for going back to the
+         * oldest checkpoint we might need */
+        pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, 0);
+        nbytes += 2 * checkpoint_distance(i);
+    } else
+        pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, nbytes);
 
     if (i->update_max_rewind)
         i->update_max_rewind(i, i->thread_info.resampler ? pa_resampler_request(i->thread_info.resampler, nbytes) : nbytes);
@@ -1989,6 +2263,25 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
             i->thread_info.sample_spec.rate = PA_PTR_TO_UINT(userdata);
             pa_resampler_set_input_rate(i->thread_info.resampler, PA_PTR_TO_UINT(userdata));
 
+            if (i->thread_info.fading_resampler)
+                pa_resampler_set_input_rate(i->thread_info.fading_resampler, PA_PTR_TO_UINT(userdata));
+
+            return 0;
+
+        case PA_SINK_INPUT_MESSAGE_SET_RESAMPLER:
+
+            /* A fade that is still going on ends right here */
+            resampler_fade_stop(i);
+
+            i->thread_info.fading_resampler = i->thread_info.resampler;
+            i->thread_info.resampler = userdata;
+            i->thread_info.fade_done = 0;
+            i->thread_info.fade_length = pa_usec_to_bytes(RESAMPLER_FADE_USEC, &i->sink->sample_spec) / pa_frame_size(&i->sink->sample_spec);
+
+            /* The new resampler can't render again what the old one
+             * rendered */
+            checkpoints_reset(i);
+
             return 0;
 
         case PA_SINK_INPUT_MESSAGE_SET_STATE: {
@@ -2154,6 +2447,27 @@ pa_memchunk* pa_sink_input_get_silence(pa_sink_input *i, pa_memchunk *ret) {
     return ret;
 }
 
+/* Called from IO thread context, by filters for every chunk they render
+ * from their own sink. Returns true if the data has been silent for at
+ * least tail bytes before this chunk, i.e. long enough for the filter's
+ * state to have decayed, so that the chunk needs no processing and can
+ * be passed on as silence. */
+bool pa_sink_input_silence_decayed(pa_sink_input *i, const pa_memchunk *chunk, size_t tail) {
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+
+    if (!pa_memblock_is_silence(chunk->memblock)) {
+        i->thread_info.silent_for = 0;
+        return false;
+    }
+
+    i->thread_info.silent_for += chunk->length;
+
+    return i->thread_info.silent_for - chunk->length >= tail;
+}
+
 /* Called from main context */
 void pa_sink_input_send_event(pa_sink_input *i, const char *event, pa_proplist *data) {
     pa_proplist *pl = NULL;
@@ -2183,6 +2497,14 @@ finish:
         pa_proplist_free(pl);
 }
 
+/* Called from main context */
+static pa_resample_flags_t resampler_flags(pa_sink_input *i) {
+    return ((i->flags & PA_SINK_INPUT_VARIABLE_RATE) ? PA_RESAMPLER_VARIABLE_RATE : 0) |
+           ((i->flags & PA_SINK_INPUT_NO_REMAP) ? PA_RESAMPLER_NO_REMAP : 0) |
+           (i->core->disable_remixing || (i->flags & PA_SINK_INPUT_NO_REMIX) ? PA_RESAMPLER_NO_REMIX : 0) |
+           (i->core->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0);
+}
+
 /* Called from main context */
 /* Updates the sink input's resampler with whatever the current sink requires
  * -- useful when the underlying sink's rate might have changed */
@@ -2208,10 +2530,7 @@ int pa_sink_input_update_rate(pa_sink_input *i) {
                                      &i->sample_spec, &i->channel_map,
                                      &i->sink->sample_spec, &i->sink->channel_map,
                                      i->requested_resample_method,
-                                     ((i->flags & PA_SINK_INPUT_VARIABLE_RATE) ? PA_RESAMPLER_VARIABLE_RATE : 0) |
-                                     ((i->flags & PA_SINK_INPUT_NO_REMAP) ? PA_RESAMPLER_NO_REMAP : 0) |
-                                     (i->core->disable_remixing || (i->flags & PA_SINK_INPUT_NO_REMIX) ? PA_RESAMPLER_NO_REMIX : 0) |
-                                     (i->core->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0));
+                                     resampler_flags(i));
 
         if (!new_resampler) {
             pa_log_warn("Unsupported resampling operation.");
@@ -2226,6 +2545,11 @@ int pa_sink_input_update_rate(pa_sink_input *i) {
     if (i->thread_info.resampler)
         pa_resampler_free(i->thread_info.resampler);
 
+    if (i->thread_info.fading_resampler) {
+        pa_resampler_free(i->thread_info.fading_resampler);
+        i->thread_info.fading_resampler = NULL;
+    }
+
     i->thread_info.resampler = new_resampler;
 
     pa_memblockq_free(i->thread_info.render_memblockq);
@@ -2243,9 +2567,60 @@ int pa_sink_input_update_rate(pa_sink_input *i) {
             &i->sink->silence);
     pa_xfree(memblockq_name);
 
+    checkpoints_reset(i);
+
     i->actual_resample_method = new_resampler ? pa_resampler_get_method(new_resampler) : PA_RESAMPLER_INVALID;
 
+    /* The budget starts over with the new resampler */
+    i->full_resample_method = i->actual_resample_method;
+    i->resample_downgrade = 0;
+    pa_atomic_store(&i->metrics.resample_downgrade, 0);
+
     pa_log_debug("Updated resampler for sink input %d", i->index);
 
     return 0;
 }
+
+/* Called from main context */
+int pa_sink_input_set_resample_downgrade(pa_sink_input *i, unsigned downgrade) {
+    pa_resample_method_t method;
+    pa_resampler *resampler;
+    unsigned k;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
+    pa_return_val_if_fail(i->sink && i->thread_info.resampler, -PA_ERR_BADSTATE);
+
+    if (downgrade == i->resample_downgrade)
+        return 0;
+
+    method = i->full_resample_method;
+
+    for (k = 0; k < downgrade; k++)
+        if ((method = pa_resample_method_cheaper(method)) == PA_RESAMPLER_INVALID)
+            return -PA_ERR_NOTSUPPORTED;
+
+    if (method != i->actual_resample_method) {
+        if (!(resampler = pa_resampler_new(i->core->mempool,
+                                           &i->sample_spec, &i->channel_map,
+                                           &i->sink->sample_spec, &i->sink->channel_map,
+                                           method,
+                                           resampler_flags(i))))
+            return -PA_ERR_NOTSUPPORTED;
+
+        pa_log_info("Switching resampler of sink input %u from %s to %s.", i->index,
+                    pa_resample_method_to_string(i->actual_resample_method),
+                    pa_resample_method_to_string(pa_resampler_get_method(resampler)));
+
+        pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_SET_RESAMPLER, resampler, 0, NULL) == 0);
+
+        i->actual_resample_method = pa_resampler_get_method(resampler);
+        pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+    }
+
+    i->resample_downgrade = downgrade;
+    pa_atomic_store(&i->metrics.resample_downgrade, (int) downgrade);
+
+    return 0;
+}
@@ -35,6 +35,8 @@ typedef struct pa_sink_input pa_sink_input;
 #include <pulsecore/client.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/core.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/metrics.h>
 
 typedef enum pa_sink_input_state {
     PA_SINK_INPUT_INIT,         /*< The stream is not active yet, because pa_sink_input_put() has not been called yet */
@@ -49,6 +51,17 @@ static inline bool PA_SINK_INPUT_IS_LINKED(pa_sink_input_state_t x) {
     return x == PA_SINK_INPUT_DRAINED || x == PA_SINK_INPUT_RUNNING || x == PA_SINK_INPUT_CORKED;
 }
 
+/* Number of positions remembered for lazy rewinds, spread over twice
+ * the sink's max_rewind */
+#define PA_SINK_INPUT_CHECKPOINTS 64
+
+/* A position in the render memblockq and how many bytes had been
+ * taken from the implementor when it was rendered */
+typedef struct pa_sink_input_checkpoint {
+    int64_t render_index;
+    uint64_t popped;
+} pa_sink_input_checkpoint;
+
 typedef enum pa_sink_input_flags {
     PA_SINK_INPUT_VARIABLE_RATE = 1,
     PA_SINK_INPUT_DONT_MOVE = 2,
@@ -126,6 +139,13 @@ struct pa_sink_input {
 
     pa_resample_method_t requested_resample_method, actual_resample_method;
 
+    /* For the resampler CPU budget: the method the resampler got before
+     * it was moved resample_downgrade steps down the quality ladder,
+     * and the resampler time the last look at the stream saw */
+    pa_resample_method_t full_resample_method;
+    unsigned resample_downgrade;
+    unsigned resample_usec_seen;
+
     /* Returns the chunk of audio data and drops it from the
      * queue. Returns -1 on failure. Called from IO thread context. If
      * data needs to be generated from scratch then please in the
@@ -224,6 +244,12 @@ struct pa_sink_input {
      * mute status changes. Called from main context */
     void (*mute_changed)(pa_sink_input *i); /* may be NULL */
 
+    /* Updated from the IO thread, may be read from anywhere */
+    pa_stream_metrics metrics;
+
+    /* Levels for clients that subscribed to them */
+    pa_meter meter;
+
     struct {
         pa_sink_input_state_t state;
         pa_atomic_t drained;
@@ -239,13 +265,41 @@ struct pa_sink_input {
         uint64_t underrun_for, playing_for;
         uint64_t underrun_for_sink; /* Like underrun_for, but in sink sample spec */
 
+        /* For filters: how long the data they rendered from their own
+         * sink has been silent, see pa_sink_input_silence_decayed() */
+        uint64_t silent_for;
+
         pa_sample_spec sample_spec;
 
         pa_resampler *resampler;                     /* may be NULL */
 
+        /* The resampler that was replaced by a cheaper or a better
+         * one, still run until its output has been faded over to the
+         * output of the new one. fade_done and fade_length are in
+         * sink frames. */
+        pa_resampler *fading_resampler;              /* may be NULL */
+        size_t fade_done, fade_length;
+
         /* We maintain a history of resampled audio data here. */
         pa_memblockq *render_memblockq;
 
+        /* With lazy rewinds the render memblockq keeps no history.
+         * Rewinds rewind the implementor to the last checkpoint before
+         * the new read index instead and render everything again from
+         * there. Streams whose rate is converted keep the history
+         * anyway. popped counts the bytes taken from the implementor. */
+        bool lazy_rewind:1;
+        pa_sink_input_checkpoint *checkpoints;
+        unsigned n_checkpoints, first_checkpoint;
+        uint64_t popped;
+
+        /* For sinks with a mix history: whether the sink is replaying
+         * its history and re-adding our data to it, and the volume our
+         * data was mixed with since the given history position */
+        bool history_replay:1;
+        pa_cvolume history_volume;
+        int64_t history_volume_since;
+
         pa_sink_input *sync_prev, *sync_next;
 
         /* The requested latency for the sink */
@@ -268,6 +322,7 @@ enum {
     PA_SINK_INPUT_MESSAGE_SET_STATE,
     PA_SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY,
     PA_SINK_INPUT_MESSAGE_GET_REQUESTED_LATENCY,
+    PA_SINK_INPUT_MESSAGE_SET_RESAMPLER,
     PA_SINK_INPUT_MESSAGE_MAX
 };
 
@@ -356,6 +411,11 @@ void pa_sink_input_cork(pa_sink_input *i, bool b);
 int pa_sink_input_set_rate(pa_sink_input *i, uint32_t rate);
 int pa_sink_input_update_rate(pa_sink_input *i);
 
+/* Moves the resampler the given number of steps down the quality ladder
+ * of the method it was created with, see pa_resample_method_cheaper().
+ * The switch is faded over in the IO thread. */
+int pa_sink_input_set_resample_downgrade(pa_sink_input *i, unsigned downgrade);
+
 /* This returns the sink's fields converted into out sample type */
 size_t pa_sink_input_get_max_rewind(pa_sink_input *i);
 size_t pa_sink_input_get_max_request(pa_sink_input *i);
@@ -417,6 +477,8 @@ bool pa_sink_input_process_underrun(pa_sink_input *i);
 
 pa_memchunk* pa_sink_input_get_silence(pa_sink_input *i, pa_memchunk *ret);
 
+bool pa_sink_input_silence_decayed(pa_sink_input *i, const pa_memchunk *chunk, size_t tail);
+
 #define pa_sink_input_assert_io_context(s) \
     pa_assert(pa_thread_mq_get() || !PA_SINK_INPUT_IS_LINKED((s)->state))
 
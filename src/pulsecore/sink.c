@@ -48,6 +48,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/play-memblockq.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/sconv.h>
 
 #include "sink.h"
 
@@ -57,6 +58,10 @@
 #define ABSOLUTE_MAX_LATENCY (10*PA_USEC_PER_SEC)
 #define DEFAULT_FIXED_LATENCY (250*PA_USEC_PER_MSEC)
 
+#define HISTORY_MAXLENGTH (32*1024*1024)
+/* Samples converted to float at a time when adding to the mix history */
+#define HISTORY_CONVERT_SAMPLES 1024
+
 PA_DEFINE_PUBLIC_CLASS(pa_sink, pa_msgobject);
 
 struct pa_sink_volume_change {
@@ -115,6 +120,13 @@ void pa_sink_new_data_set_alternate_sample_rate(pa_sink_new_data *data, const ui
     data->alternate_sample_rate = alternate_sample_rate;
 }
 
+void pa_sink_new_data_set_numa_node(pa_sink_new_data *data, int numa_node) {
+    pa_assert(data);
+
+    data->numa_node_is_set = true;
+    data->numa_node = numa_node;
+}
+
 void pa_sink_new_data_set_volume(pa_sink_new_data *data, const pa_cvolume *volume) {
     pa_assert(data);
 
@@ -278,6 +290,11 @@ pa_sink* pa_sink_new(
         s->alternate_sample_rate = 0;
     }
 
+    if (data->numa_node_is_set)
+        s->numa_node = data->numa_node;
+    else
+        s->numa_node = s->core->numa_node;
+
     s->inputs = pa_idxset_new(NULL, NULL);
     s->n_corked = 0;
     s->input_to_master = NULL;
@@ -292,6 +309,8 @@ pa_sink* pa_sink_new(
     reset_callbacks(s);
     s->userdata = NULL;
 
+    pa_meter_init(&s->meter);
+
     s->asyncmsgq = NULL;
 
     /* As a minor optimization we just steal the list instead of
@@ -334,6 +353,12 @@ pa_sink* pa_sink_new(
     s->thread_info.state = s->state;
     s->thread_info.rewind_nbytes = 0;
     s->thread_info.rewind_requested = false;
+    s->thread_info.history = NULL;
+    s->thread_info.history_write = 0;
+    s->thread_info.history_valid_from = 0;
+    s->thread_info.history_replay = 0;
+    s->thread_info.history_info = NULL;
+    s->thread_info.history_info_size = 0;
     s->thread_info.max_rewind = 0;
     s->thread_info.max_request = 0;
     s->thread_info.requested_latency_valid = false;
@@ -735,6 +760,10 @@ static void sink_free(pa_object *o) {
     pa_idxset_free(s->inputs, NULL);
     pa_hashmap_free(s->thread_info.inputs);
 
+    if (s->thread_info.history)
+        pa_memblockq_free(s->thread_info.history);
+    pa_xfree(s->thread_info.history_info);
+
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
 
@@ -963,6 +992,327 @@ size_t pa_sink_process_input_underruns(pa_sink *s, size_t left_to_play) {
     return left_to_play - result;
 }
 
+/* Called from IO thread context */
+static size_t history_bytes(pa_sink *s, size_t nbytes) {
+    return nbytes / pa_frame_size(&s->sample_spec) * s->sample_spec.channels * sizeof(float);
+}
+
+/* Called from IO thread context */
+static size_t history_to_sink_bytes(pa_sink *s, size_t nbytes) {
+    return nbytes / (s->sample_spec.channels * sizeof(float)) * pa_frame_size(&s->sample_spec);
+}
+
+/* Called from IO thread context. Adds sign * volume * chunk to n_frames
+ * frames of mix history. */
+static void history_add(pa_sink *s, float *d, const pa_memchunk *chunk, unsigned n_frames, const pa_cvolume *volume, float sign) {
+    float buf[HISTORY_CONVERT_SAMPLES];
+    float linear[PA_CHANNELS_MAX];
+    pa_convert_func_t convert;
+    const uint8_t *src;
+    unsigned c, n, piece;
+
+    pa_assert(volume->channels == s->sample_spec.channels);
+    pa_assert(chunk->length >= n_frames * pa_frame_size(&s->sample_spec));
+
+    if (pa_cvolume_is_muted(volume))
+        return;
+
+    for (c = 0; c < volume->channels; c++)
+        linear[c] = sign * (float) pa_sw_volume_to_linear(volume->values[c]);
+
+    pa_assert_se(convert = pa_get_convert_to_float32ne_function(s->sample_spec.format));
+
+    /* Whole frames only, so every piece starts with the first channel */
+    piece = HISTORY_CONVERT_SAMPLES - HISTORY_CONVERT_SAMPLES % s->sample_spec.channels;
+    n = n_frames * s->sample_spec.channels;
+
+    src = pa_memblock_acquire_chunk(chunk);
+
+    while (n > 0) {
+        unsigned k = PA_MIN(n, piece), j;
+
+        convert(k, src, buf);
+
+        for (j = 0, c = 0; j < k; j++) {
+            d[j] += linear[c] * buf[j];
+
+            if (PA_UNLIKELY(++c >= s->sample_spec.channels))
+                c = 0;
+        }
+
+        src += k * pa_sample_size(&s->sample_spec);
+        d += k;
+        n -= k;
+    }
+
+    pa_memblock_release(chunk->memblock);
+}
+
+/* Called from IO thread context. Applies the sink volume to n_frames
+ * frames of mix history and converts them to the sink format. */
+static void history_output(pa_sink *s, const float *src, void *dst, unsigned n_frames) {
+    float buf[HISTORY_CONVERT_SAMPLES];
+    float linear[PA_CHANNELS_MAX];
+    pa_convert_func_t convert;
+    unsigned c, n, piece;
+
+    if (s->thread_info.soft_muted || pa_cvolume_is_muted(&s->thread_info.soft_volume)) {
+        pa_silence_memory(dst, n_frames * pa_frame_size(&s->sample_spec), &s->sample_spec);
+        return;
+    }
+
+    pa_assert_se(convert = pa_get_convert_from_float32ne_function(s->sample_spec.format));
+    n = n_frames * s->sample_spec.channels;
+
+    if (pa_cvolume_is_norm(&s->thread_info.soft_volume)) {
+        convert(n, src, dst);
+        return;
+    }
+
+    for (c = 0; c < s->sample_spec.channels; c++)
+        linear[c] = (float) pa_sw_volume_to_linear(s->thread_info.soft_volume.values[c]);
+
+    piece = HISTORY_CONVERT_SAMPLES - HISTORY_CONVERT_SAMPLES % s->sample_spec.channels;
+
+    while (n > 0) {
+        unsigned k = PA_MIN(n, piece), j;
+
+        for (j = 0, c = 0; j < k; j++) {
+            buf[j] = src[j] * linear[c];
+
+            if (PA_UNLIKELY(++c >= s->sample_spec.channels))
+                c = 0;
+        }
+
+        convert(k, buf, dst);
+
+        src += k;
+        dst = (uint8_t*) dst + k * pa_sample_size(&s->sample_spec);
+        n -= k;
+    }
+}
+
+/* Called from IO thread context. Remembers the volume the data of the
+ * input at history position pos has been mixed with. */
+static void history_note_volume(pa_sink_input *i, const pa_cvolume *volume, int64_t pos) {
+
+    /* If nothing has been mixed since the input was attached or last
+     * taken out of the history there is nothing the new volume could
+     * be inconsistent with */
+    if (pa_cvolume_valid(&i->thread_info.history_volume) &&
+        !pa_cvolume_equal(&i->thread_info.history_volume, volume))
+        i->thread_info.history_volume_since = pos;
+
+    i->thread_info.history_volume = *volume;
+}
+
+/* Called from IO thread context. Renders without anything to mix leave
+ * a hole in the mix history. Fills the beginning of the hole h that was
+ * peeked at the read index with zeros, so that it can be mixed into. */
+static void history_fill_hole(pa_sink *s, pa_memchunk *h) {
+    int64_t write_index;
+
+    pa_assert(!h->memblock);
+
+    h->length = PA_MIN(h->length, history_bytes(s, history_to_sink_bytes(s, pa_mempool_block_size_max(s->core->mempool))));
+    h->index = 0;
+    h->memblock = pa_memblock_new(s->core->mempool, h->length);
+
+    memset(pa_memblock_acquire(h->memblock), 0, h->length);
+    pa_memblock_release(h->memblock);
+
+    write_index = pa_memblockq_get_write_index(s->thread_info.history);
+    pa_memblockq_seek(s->thread_info.history, pa_memblockq_get_read_index(s->thread_info.history), PA_SEEK_ABSOLUTE, true);
+    pa_assert_se(pa_memblockq_push(s->thread_info.history, h) >= 0);
+    pa_memblockq_seek(s->thread_info.history, write_index, PA_SEEK_ABSOLUTE, true);
+}
+
+/* Called from IO thread context. Takes the data the input contributed
+ * between the history positions start and end out of the history
+ * again. The input has to be positioned at end, and stays there. */
+static void history_subtract(pa_sink *s, pa_sink_input *i, int64_t start, int64_t end) {
+    int64_t read_pos;
+    size_t left;
+
+    pa_assert(start <= end);
+
+    read_pos = s->thread_info.history_write - (int64_t) s->thread_info.history_replay;
+    pa_assert(end >= read_pos);
+
+    if (start == end || !pa_cvolume_valid(&i->thread_info.history_volume))
+        return;
+
+    if (start < read_pos)
+        pa_memblockq_rewind(s->thread_info.history, history_bytes(s, (size_t) (read_pos - start)));
+    else
+        pa_memblockq_drop(s->thread_info.history, history_bytes(s, (size_t) (start - read_pos)));
+
+    pa_memblockq_rewind(i->thread_info.render_memblockq, (size_t) (end - start));
+
+    left = (size_t) (end - start);
+
+    while (left > 0) {
+        pa_memchunk h, c;
+        size_t l;
+
+        pa_assert_se(pa_memblockq_peek(s->thread_info.history, &h) >= 0);
+        pa_assert_se(pa_memblockq_peek(i->thread_info.render_memblockq, &c) >= 0);
+        pa_assert(c.memblock);
+
+        if (!h.memblock && !pa_memblock_is_silence(c.memblock))
+            history_fill_hole(s, &h);
+
+        l = PA_MIN(left, history_to_sink_bytes(s, h.length));
+        l = PA_MIN(l, c.length);
+        pa_assert(l > 0);
+
+        /* The history blocks are not shared with anyone, so they can be
+         * modified in place */
+        if (!pa_memblock_is_silence(c.memblock)) {
+            float *d = (float*) ((uint8_t*) pa_memblock_acquire(h.memblock) + h.index);
+
+            history_add(s, d, &c, (unsigned) (l / pa_frame_size(&s->sample_spec)), &i->thread_info.history_volume, -1.0f);
+            pa_memblock_release(h.memblock);
+        }
+
+        if (h.memblock)
+            pa_memblock_unref(h.memblock);
+        pa_memblock_unref(c.memblock);
+
+        pa_memblockq_drop(s->thread_info.history, history_bytes(s, l));
+        pa_memblockq_drop(i->thread_info.render_memblockq, l);
+        left -= l;
+    }
+
+    pa_memblockq_rewind(s->thread_info.history, history_bytes(s, (size_t) (end - read_pos)));
+}
+
+/* Called from IO thread context */
+static bool history_input_dirty(pa_sink_input *i) {
+    return i->thread_info.history_replay || i->thread_info.rewrite_nbytes != 0 || i->thread_info.dont_rewind_render;
+}
+
+/* Called from IO thread context. Rewinds the mix history by nbytes and
+ * takes the inputs that want to render something else now out of it.
+ * The others are left where they are and only join in again once the
+ * history has been replayed. Returns false if that isn't possible and
+ * everything needs to be mixed again. */
+static bool history_rewind(pa_sink *s, size_t nbytes) {
+    int64_t read_pos, start;
+    pa_sink_input *i;
+    void *state;
+
+    read_pos = s->thread_info.history_write - (int64_t) s->thread_info.history_replay;
+    start = read_pos - (int64_t) nbytes;
+
+    if (start < s->thread_info.history_valid_from ||
+        s->thread_info.history_replay + nbytes > s->thread_info.max_rewind)
+        return false;
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        int64_t end;
+
+        /* The data of these has to be handed out input by input */
+        if (pa_hashmap_size(i->thread_info.direct_outputs) > 0)
+            return false;
+
+        if (!history_input_dirty(i))
+            continue;
+
+        end = i->thread_info.history_replay ? read_pos : s->thread_info.history_write;
+
+        if ((size_t) (end - start) > s->thread_info.max_rewind ||
+            start < i->thread_info.history_volume_since)
+            return false;
+    }
+
+    pa_memblockq_rewind(s->thread_info.history, history_bytes(s, nbytes));
+    s->thread_info.history_replay += nbytes;
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        int64_t end;
+
+        pa_sink_input_assert_ref(i);
+
+        if (!history_input_dirty(i)) {
+            pa_sink_input_process_rewind(i, 0);
+            continue;
+        }
+
+        end = i->thread_info.history_replay ? read_pos : s->thread_info.history_write;
+
+        history_subtract(s, i, start, end);
+        pa_cvolume_init(&i->thread_info.history_volume);
+        i->thread_info.history_volume_since = start;
+        i->thread_info.history_replay = true;
+
+        pa_sink_input_process_rewind(i, (size_t) (end - start));
+    }
+
+    return true;
+}
+
+/* Called from IO thread context. Rewinds all inputs to the same position
+ * and drops the mix history after it, so that everything is mixed
+ * again. */
+static void history_flush(pa_sink *s, size_t nbytes) {
+    int64_t read_pos, start;
+    pa_sink_input *i;
+    void *state;
+
+    read_pos = s->thread_info.history_write - (int64_t) s->thread_info.history_replay;
+    start = read_pos - (int64_t) nbytes;
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        int64_t end;
+
+        pa_sink_input_assert_ref(i);
+
+        end = i->thread_info.history_replay ? read_pos : s->thread_info.history_write;
+        i->thread_info.history_replay = false;
+
+        pa_sink_input_process_rewind(i, (size_t) (end - start));
+    }
+
+    pa_memblockq_rewind(s->thread_info.history, history_bytes(s, nbytes));
+    pa_memblockq_flush_write(s->thread_info.history, true);
+
+    s->thread_info.history_write = start;
+    s->thread_info.history_replay = 0;
+}
+
+/* Called from IO thread context. Takes the data of an input that goes
+ * away out of the mix history, as far as it is still needed. */
+static void history_remove_input(pa_sink *s, pa_sink_input *i) {
+    int64_t read_pos, start, end;
+
+    if (!s->thread_info.history)
+        return;
+
+    read_pos = s->thread_info.history_write - (int64_t) s->thread_info.history_replay;
+    end = i->thread_info.history_replay ? read_pos : s->thread_info.history_write;
+
+    start = PA_MAX(s->thread_info.history_valid_from, i->thread_info.history_volume_since);
+    start = PA_MAX(start, read_pos - (int64_t) s->thread_info.max_rewind);
+    start = PA_MAX(start, end - (int64_t) s->thread_info.max_rewind);
+
+    if (start < end)
+        history_subtract(s, i, start, end);
+
+    /* Whatever the input contributed before that is still in there */
+    if (pa_cvolume_valid(&i->thread_info.history_volume) || i->thread_info.history_volume_since != INT64_MIN)
+        s->thread_info.history_valid_from = PA_MAX(s->thread_info.history_valid_from, PA_MIN(start, end));
+
+    i->thread_info.history_replay = false;
+}
+
+/* Called from IO thread context */
+static void history_add_input(pa_sink *s, pa_sink_input *i) {
+    i->thread_info.history_replay = false;
+    pa_cvolume_init(&i->thread_info.history_volume);
+    i->thread_info.history_volume_since = INT64_MIN;
+}
+
 /* Called from IO thread context */
 void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     pa_sink_input *i;
@@ -986,11 +1336,23 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
         pa_log_debug("Processing rewind...");
         if (s->flags & PA_SINK_DEFERRED_VOLUME)
             pa_sink_volume_change_rewind(s, nbytes);
+
+        pa_atomic_inc(&s->metrics.n_rewinds);
+        pa_atomic_add(&s->metrics.rewind_bytes, (int) nbytes);
     }
 
-    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
-        pa_sink_input_assert_ref(i);
-        pa_sink_input_process_rewind(i, nbytes);
+    if (s->thread_info.history && nbytes > 0) {
+
+        if (!history_rewind(s, nbytes)) {
+            pa_log_debug("Mix history cannot be used for this rewind, mixing everything again.");
+            history_flush(s, nbytes);
+        }
+
+    } else {
+        PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+            pa_sink_input_assert_ref(i);
+            pa_sink_input_process_rewind(i, nbytes);
+        }
     }
 
     if (nbytes > 0) {
@@ -1040,7 +1402,7 @@ static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, uns
 }
 
 /* Called from IO thread context */
-static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *result) {
+static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *result, bool silent) {
     pa_sink_input *i;
     void *state;
     unsigned p = 0;
@@ -1076,6 +1438,14 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         /* Drop read data */
         pa_sink_input_drop(i, result->length);
 
+        if (m && m->chunk.memblock && pa_meter_is_enabled(&i->meter)) {
+            pa_memchunk c = m->chunk;
+
+            pa_assert(result->length <= c.length);
+            c.length = result->length;
+            pa_meter_process(&i->meter, &s->sample_spec, &c, &m->volume);
+        }
+
         if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state)) {
 
             if (pa_hashmap_size(i->thread_info.direct_outputs) > 0) {
@@ -1133,8 +1503,216 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         }
     }
 
+    if (silent && !pa_memblock_is_silence(result->memblock)) {
+        size_t left = result->length;
+
+        /* The result has been silenced in the caller's buffer, which
+         * doesn't carry the silence flag. Hand the shared silence block
+         * on instead, so that the monitor and its outputs skip their
+         * volume and conversion work as well. */
+        while (left > 0) {
+            pa_memchunk c;
+
+            pa_silence_memchunk_get(&s->core->silence_cache, s->core->mempool, &c, &s->sample_spec, left);
+
+            if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state))
+                pa_source_post(s->monitor_source, &c);
+
+            pa_meter_process(&s->meter, &s->sample_spec, &c, NULL);
+
+            left -= c.length;
+            pa_memblock_unref(c.memblock);
+        }
+
+        return;
+    }
+
     if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state))
         pa_source_post(s->monitor_source, result);
+
+    pa_meter_process(&s->meter, &s->sample_spec, result, NULL);
+}
+
+/* Called from IO thread context */
+static void history_ensure_info(pa_sink *s) {
+    unsigned n = pa_hashmap_size(s->thread_info.inputs);
+
+    if (n <= s->thread_info.history_info_size)
+        return;
+
+    s->thread_info.history_info_size = PA_MAX(n, 2 * s->thread_info.history_info_size);
+    s->thread_info.history_info = pa_xrenew(pa_mix_info, s->thread_info.history_info, s->thread_info.history_info_size);
+}
+
+/* Called from IO thread context. Renders the next part of the history
+ * that is replayed after a rewind. Only the inputs that have been taken
+ * out of it are read and added in again. */
+static void history_render_replay(pa_sink *s, pa_memchunk *result) {
+    pa_mix_info *info = s->thread_info.history_info;
+    pa_sink_input *i;
+    void *state;
+    pa_memchunk h;
+    size_t length;
+    unsigned n = 0, k, n_frames;
+    int64_t read_pos;
+    float *d;
+
+    read_pos = s->thread_info.history_write - (int64_t) s->thread_info.history_replay;
+    length = PA_MIN(result->length, s->thread_info.history_replay);
+
+    pa_assert_se(pa_memblockq_peek(s->thread_info.history, &h) >= 0);
+
+    if (!h.memblock)
+        history_fill_hole(s, &h);
+
+    length = PA_MIN(length, history_to_sink_bytes(s, h.length));
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        pa_sink_input_assert_ref(i);
+
+        if (!i->thread_info.history_replay)
+            continue;
+
+        pa_sink_input_peek(i, length, &info[n].chunk, &info[n].volume);
+
+        if (info[n].chunk.length < length)
+            length = info[n].chunk.length;
+
+        if (pa_memblock_is_silence(info[n].chunk.memblock)) {
+            pa_memblock_unref(info[n].chunk.memblock);
+            continue;
+        }
+
+        info[n].userdata = i;
+        n++;
+    }
+
+    pa_assert(length > 0);
+    n_frames = (unsigned) (length / pa_frame_size(&s->sample_spec));
+
+    d = (float*) ((uint8_t*) pa_memblock_acquire(h.memblock) + h.index);
+
+    for (k = 0; k < n; k++) {
+        history_add(s, d, &info[k].chunk, n_frames, &info[k].volume, 1.0f);
+        history_note_volume(info[k].userdata, &info[k].volume, read_pos);
+        pa_memblock_unref(info[k].chunk.memblock);
+    }
+
+    history_output(s, d, (uint8_t*) pa_memblock_acquire(result->memblock) + result->index, n_frames);
+
+    pa_memblock_release(result->memblock);
+    pa_memblock_release(h.memblock);
+    pa_memblock_unref(h.memblock);
+
+    result->length = length;
+
+    pa_memblockq_drop(s->thread_info.history, history_bytes(s, length));
+    s->thread_info.history_replay -= length;
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        if (!i->thread_info.history_replay)
+            continue;
+
+        pa_sink_input_drop(i, length);
+
+        /* Everybody is in the same place again */
+        if (s->thread_info.history_replay == 0)
+            i->thread_info.history_replay = false;
+    }
+
+    pa_atomic_add(&s->metrics.replayed_bytes, (int) length);
+
+    if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state))
+        pa_source_post(s->monitor_source, result);
+
+    pa_meter_process(&s->meter, &s->sample_spec, result, NULL);
+}
+
+/* Called from IO thread context. Like mixing the inputs with pa_mix(),
+ * but the unclipped sum is kept in the mix history before the sink
+ * volume is applied. Renders into result, which is shortened to the
+ * length actually rendered. */
+static void history_render(pa_sink *s, pa_memchunk *result) {
+    size_t length, block_size_max;
+    pa_memchunk h;
+    unsigned n, k, n_frames;
+    float *d;
+
+    block_size_max = pa_mempool_block_size_max(s->core->mempool);
+    if (history_bytes(s, result->length) > block_size_max)
+        result->length = history_to_sink_bytes(s, block_size_max);
+
+    history_ensure_info(s);
+
+    if (s->thread_info.history_replay > 0) {
+        if (!result->memblock)
+            result->memblock = pa_memblock_new(s->core->mempool, result->length);
+
+        history_render_replay(s, result);
+        return;
+    }
+
+    length = result->length;
+    n = fill_mix_info(s, &length, s->thread_info.history_info, s->thread_info.history_info_size);
+    n_frames = (unsigned) (length / pa_frame_size(&s->sample_spec));
+
+    if (n == 0) {
+        /* Nothing to mix, the history just gets a hole that is filled
+         * if anything is mixed into it again */
+        pa_memblockq_seek(s->thread_info.history, (int64_t) history_bytes(s, length), PA_SEEK_RELATIVE, true);
+        pa_memblockq_drop(s->thread_info.history, history_bytes(s, length));
+
+    } else {
+        h.memblock = pa_memblock_new(s->core->mempool, history_bytes(s, length));
+        h.index = 0;
+        h.length = history_bytes(s, length);
+
+        d = pa_memblock_acquire(h.memblock);
+        memset(d, 0, h.length);
+
+        for (k = 0; k < n; k++) {
+            pa_mix_info *m = s->thread_info.history_info + k;
+
+            history_add(s, d, &m->chunk, n_frames, &m->volume, 1.0f);
+            history_note_volume(m->userdata, &m->volume, s->thread_info.history_write);
+        }
+
+        /* When muted the history is still needed for rewinds that
+         * follow unmuting, but nothing has to be converted */
+        if (!s->thread_info.soft_muted) {
+            if (!result->memblock)
+                result->memblock = pa_memblock_new(s->core->mempool, result->length);
+
+            history_output(s, d, (uint8_t*) pa_memblock_acquire(result->memblock) + result->index, n_frames);
+            pa_memblock_release(result->memblock);
+        }
+
+        pa_memblock_release(h.memblock);
+
+        pa_assert_se(pa_memblockq_push_align(s->thread_info.history, &h) >= 0);
+        pa_memblockq_drop(s->thread_info.history, h.length);
+        pa_memblock_unref(h.memblock);
+    }
+
+    s->thread_info.history_write += (int64_t) length;
+    result->length = length;
+
+    if (n == 0 || s->thread_info.soft_muted) {
+        if (!result->memblock) {
+            *result = s->silence;
+            pa_memblock_ref(result->memblock);
+
+            if (result->length > length)
+                result->length = length;
+        } else
+            pa_silence_memchunk(result, &s->sample_spec);
+
+        pa_atomic_inc(&s->metrics.silent_renders);
+        inputs_drop(s, s->thread_info.history_info, n, result, true);
+        return;
+    }
+
+    inputs_drop(s, s->thread_info.history_info, n, result, false);
 }
 
 /* Called from IO thread context */
@@ -1142,6 +1720,7 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     pa_mix_info info[MAX_MIX_CHANNELS];
     unsigned n;
     size_t block_size_max;
+    pa_usec_t start;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1160,6 +1739,7 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     }
 
     pa_sink_ref(s);
+    start = pa_rtclock_now();
 
     if (length <= 0)
         length = pa_frame_align(MIX_BUFFER_LENGTH, &s->sample_spec);
@@ -1170,9 +1750,19 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     pa_assert(length > 0);
 
+    if (s->thread_info.history) {
+        result->memblock = NULL;
+        result->index = 0;
+        result->length = length;
+
+        history_render(s, result);
+        goto finish;
+    }
+
     n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
 
-    if (n == 0) {
+    /* Nothing to mix, or everything would be muted anyway */
+    if (n == 0 || s->thread_info.soft_muted) {
 
         *result = s->silence;
         pa_memblock_ref(result->memblock);
@@ -1180,6 +1770,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
         if (result->length > length)
             result->length = length;
 
+        pa_atomic_inc(&s->metrics.silent_renders);
+
     } else if (n == 1) {
         pa_cvolume volume;
 
@@ -1191,13 +1783,15 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
         pa_sw_cvolume_multiply(&volume, &s->thread_info.soft_volume, &info[0].volume);
 
-        if (s->thread_info.soft_muted || pa_cvolume_is_muted(&volume)) {
+        if (pa_cvolume_is_muted(&volume)) {
             pa_memblock_unref(result->memblock);
             pa_silence_memchunk_get(&s->core->silence_cache,
                                     s->core->mempool,
                                     result,
                                     &s->sample_spec,
                                     result->length);
+
+            pa_atomic_inc(&s->metrics.silent_renders);
         } else if (!pa_cvolume_is_norm(&volume)) {
             pa_memchunk_make_writable(result, 0);
             pa_volume_memchunk(result, &s->sample_spec, &volume);
@@ -1211,13 +1805,17 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
                                 ptr, length,
                                 &s->sample_spec,
                                 &s->thread_info.soft_volume,
-                                s->thread_info.soft_muted);
+                                false);
         pa_memblock_release(result->memblock);
 
         result->index = 0;
     }
 
-    inputs_drop(s, info, n, result);
+    inputs_drop(s, info, n, result, false);
+
+finish:
+    pa_metrics_histogram_add(&s->metrics.process_time, pa_rtclock_now() - start);
+    pa_atomic_add(&s->metrics.rendered_bytes, (int) result->length);
 
     pa_sink_unref(s);
 }
@@ -1227,6 +1825,8 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
     pa_mix_info info[MAX_MIX_CHANNELS];
     unsigned n;
     size_t length, block_size_max;
+    pa_usec_t start;
+    bool silent = false;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1245,6 +1845,7 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
     }
 
     pa_sink_ref(s);
+    start = pa_rtclock_now();
 
     length = target->length;
     block_size_max = pa_mempool_block_size_max(s->core->mempool);
@@ -1253,13 +1854,22 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     pa_assert(length > 0);
 
+    if (s->thread_info.history) {
+        if (target->length > length)
+            target->length = length;
+
+        history_render(s, target);
+        goto finish;
+    }
+
     n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
 
-    if (n == 0) {
+    if (n == 0 || s->thread_info.soft_muted) {
         if (target->length > length)
             target->length = length;
 
         pa_silence_memchunk(target, &s->sample_spec);
+        silent = true;
     } else if (n == 1) {
         pa_cvolume volume;
 
@@ -1268,9 +1878,10 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
         pa_sw_cvolume_multiply(&volume, &s->thread_info.soft_volume, &info[0].volume);
 
-        if (s->thread_info.soft_muted || pa_cvolume_is_muted(&volume))
+        if (pa_cvolume_is_muted(&volume)) {
             pa_silence_memchunk(target, &s->sample_spec);
-        else {
+            silent = true;
+        } else {
             pa_memchunk vchunk;
 
             vchunk = info[0].chunk;
@@ -1297,12 +1908,19 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
                                 (uint8_t*) ptr + target->index, length,
                                 &s->sample_spec,
                                 &s->thread_info.soft_volume,
-                                s->thread_info.soft_muted);
+                                false);
 
         pa_memblock_release(target->memblock);
     }
 
-    inputs_drop(s, info, n, target);
+    if (silent)
+        pa_atomic_inc(&s->metrics.silent_renders);
+
+    inputs_drop(s, info, n, target, silent);
+
+finish:
+    pa_metrics_histogram_add(&s->metrics.process_time, pa_rtclock_now() - start);
+    pa_atomic_add(&s->metrics.rendered_bytes, (int) target->length);
 
     pa_sink_unref(s);
 }
@@ -2459,6 +3077,7 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
              * PA_SINK_MESSAGE_FINISH_MOVE, too. */
 
             pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
+            history_add_input(s, i);
 
             /* Since the caller sleeps in pa_sink_input_put(), we can
              * safely access data outside of thread_info even though
@@ -2522,6 +3141,8 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
              * sink input handling a few lines down at
              * PA_SINK_MESSAGE_START_MOVE, too. */
 
+            history_remove_input(s, i);
+
             if (i->detach)
                 i->detach(i);
 
@@ -2567,6 +3188,8 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             pa_assert(!i->thread_info.sync_next);
             pa_assert(!i->thread_info.sync_prev);
 
+            history_remove_input(s, i);
+
             if (i->thread_info.state != PA_SINK_INPUT_CORKED) {
                 pa_usec_t usec = 0;
                 size_t sink_nbytes, total_nbytes;
@@ -2654,6 +3277,11 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
 
             pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
 
+            /* The render queue still has the data from the old sink, so
+             * the next rewind needs to mix everything again */
+            history_add_input(s, i);
+            s->thread_info.history_valid_from = s->thread_info.history_write;
+
             pa_assert(!i->thread_info.attached);
             i->thread_info.attached = true;
 
@@ -2778,6 +3406,15 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
                 (s->thread_info.state == PA_SINK_SUSPENDED && PA_SINK_IS_OPENED(PA_PTR_TO_UINT(userdata))) ||
                 (PA_SINK_IS_OPENED(s->thread_info.state) && PA_PTR_TO_UINT(userdata) == PA_SINK_SUSPENDED);
 
+            /* This is the first message the IO thread gets from
+             * pa_sink_put(), so bind it to the node's CPUs now. Only
+             * what the thread allocates from the heap from here on is
+             * local to the node by first touch. The memory pool, and
+             * with it the slots cached for this thread, is shared by all
+             * threads and stays on the node of the core. */
+            if (s->thread_info.state == PA_SINK_INIT && s->numa_node >= 0 && !s->input_to_master)
+                pa_numa_bind_thread(s->numa_node);
+
             s->thread_info.state = PA_PTR_TO_UINT(userdata);
 
             if (s->thread_info.state == PA_SINK_SUSPENDED) {
@@ -2792,6 +3429,9 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
                 while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL)))
                     if (i->suspend_within_thread)
                         i->suspend_within_thread(i, s->thread_info.state == PA_SINK_SUSPENDED);
+
+                /* Nothing from before the suspend can be rewound to */
+                s->thread_info.history_valid_from = s->thread_info.history_write;
             }
 
             return 0;
@@ -3035,6 +3675,11 @@ void pa_sink_set_max_rewind_within_thread(pa_sink *s, size_t max_rewind) {
 
     s->thread_info.max_rewind = max_rewind;
 
+    if (s->thread_info.history) {
+        pa_memblockq_set_maxrewind(s->thread_info.history, 2 * history_bytes(s, max_rewind));
+        s->thread_info.history_valid_from = s->thread_info.history_write;
+    }
+
     if (PA_SINK_IS_LINKED(s->thread_info.state))
         PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
             pa_sink_input_update_max_rewind(i, s->thread_info.max_rewind);
@@ -3054,6 +3699,50 @@ void pa_sink_set_max_rewind(pa_sink *s, size_t max_rewind) {
         pa_sink_set_max_rewind_within_thread(s, max_rewind);
 }
 
+/* Called from main thread, before the sink is put. Makes the sink keep
+ * the unclipped mix of its inputs for as long as it can be rewound, in
+ * float. When only some inputs change, a rewind then takes just those
+ * out of the history and mixes them in again while the others stay
+ * where they are. This always mixes all inputs, not just the first
+ * MAX_MIX_CHANNELS. */
+void pa_sink_set_incremental_rewind(pa_sink *s, bool enable) {
+    pa_sample_spec ss;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(!PA_SINK_IS_LINKED(s->state));
+
+    if (!enable) {
+        if (s->thread_info.history) {
+            pa_memblockq_free(s->thread_info.history);
+            s->thread_info.history = NULL;
+        }
+
+        return;
+    }
+
+    if (s->thread_info.history)
+        return;
+
+    ss = s->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32NE;
+
+    s->thread_info.history = pa_memblockq_new(
+            "sink mix history",
+            0,
+            HISTORY_MAXLENGTH,
+            0,
+            &ss,
+            0,
+            1,
+            2 * history_bytes(s, s->thread_info.max_rewind),
+            NULL);
+
+    s->thread_info.history_write = 0;
+    s->thread_info.history_valid_from = 0;
+    s->thread_info.history_replay = 0;
+}
+
 /* Called from IO as well as the main thread -- the latter only before the IO thread started up */
 void pa_sink_set_max_request_within_thread(pa_sink *s, size_t max_request) {
     void *state = NULL;
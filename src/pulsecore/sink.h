@@ -37,6 +37,8 @@ typedef struct pa_sink_volume_change pa_sink_volume_change;
 #include <pulsecore/core.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/memchunk.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/mix.h>
 #include <pulsecore/source.h>
 #include <pulsecore/module.h>
 #include <pulsecore/asyncmsgq.h>
@@ -46,6 +48,8 @@ typedef struct pa_sink_volume_change pa_sink_volume_change;
 #include <pulsecore/card.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/thread-mq.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/metrics.h>
 #include <pulsecore/sink-input.h>
 
 #define PA_MAX_INPUTS_PER_SINK 256
@@ -80,6 +84,12 @@ struct pa_sink {
     uint32_t default_sample_rate;
     uint32_t alternate_sample_rate;
 
+    /* The IO thread is bound to this node's CPUs when the sink is
+     * put, -1 if it is not. This doesn't move the memory pool, which
+     * stays on the core's node. Filter sinks run in their master's
+     * thread and leave it alone. */
+    int numa_node;
+
     pa_idxset *inputs;
     unsigned n_corked;
     pa_source *monitor_source;
@@ -232,6 +242,12 @@ struct pa_sink {
      * main thread. */
     int (*update_rate)(pa_sink *s, uint32_t rate);
 
+    /* Updated from the IO thread, may be read from anywhere */
+    pa_device_metrics metrics;
+
+    /* Levels for clients that subscribed to them */
+    pa_meter meter;
+
     /* Contains copies of the above data so that the real-time worker
      * thread can work without access locking */
     struct {
@@ -261,6 +277,22 @@ struct pa_sink {
         size_t rewind_nbytes;
         bool rewind_requested;
 
+        /* Mix history for incremental rewinds, see
+         * pa_sink_set_incremental_rewind(). This is the unclipped sum
+         * of all inputs before the sink volume as float32ne, so a
+         * single input can be taken out of it again and put back in
+         * without mixing the others again. history_write is the
+         * position of its end in bytes of the sink sample spec, the
+         * last history_replay bytes of it are rendered again before
+         * mixing resumes. Rewinds to positions before
+         * history_valid_from always mix everything again. */
+        pa_memblockq *history;
+        int64_t history_write;
+        int64_t history_valid_from;
+        size_t history_replay;
+        pa_mix_info *history_info;
+        unsigned history_info_size;
+
         /* Both dynamic and fixed latencies will be clamped to this
          * range. */
         pa_usec_t min_latency; /* we won't go below this latency */
@@ -341,12 +373,14 @@ typedef struct pa_sink_new_data {
     pa_sample_spec sample_spec;
     pa_channel_map channel_map;
     uint32_t alternate_sample_rate;
+    int numa_node;
     pa_cvolume volume;
     bool muted :1;
 
     bool sample_spec_is_set:1;
     bool channel_map_is_set:1;
     bool alternate_sample_rate_is_set:1;
+    bool numa_node_is_set:1;
     bool volume_is_set:1;
     bool muted_is_set:1;
 
@@ -362,6 +396,7 @@ void pa_sink_new_data_set_name(pa_sink_new_data *data, const char *name);
 void pa_sink_new_data_set_sample_spec(pa_sink_new_data *data, const pa_sample_spec *spec);
 void pa_sink_new_data_set_channel_map(pa_sink_new_data *data, const pa_channel_map *map);
 void pa_sink_new_data_set_alternate_sample_rate(pa_sink_new_data *data, const uint32_t alternate_sample_rate);
+void pa_sink_new_data_set_numa_node(pa_sink_new_data *data, int numa_node);
 void pa_sink_new_data_set_volume(pa_sink_new_data *data, const pa_cvolume *volume);
 void pa_sink_new_data_set_muted(pa_sink_new_data *data, bool mute);
 void pa_sink_new_data_set_port(pa_sink_new_data *data, const char *port);
@@ -389,6 +424,7 @@ void pa_sink_set_asyncmsgq(pa_sink *s, pa_asyncmsgq *q);
 void pa_sink_set_rtpoll(pa_sink *s, pa_rtpoll *p);
 
 void pa_sink_set_max_rewind(pa_sink *s, size_t max_rewind);
+void pa_sink_set_incremental_rewind(pa_sink *s, bool enable);
 void pa_sink_set_max_request(pa_sink *s, size_t max_request);
 void pa_sink_set_latency_range(pa_sink *s, pa_usec_t min_latency, pa_usec_t max_latency);
 void pa_sink_set_fixed_latency(pa_sink *s, pa_usec_t latency);
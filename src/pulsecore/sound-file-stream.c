@@ -25,18 +25,28 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include <sndfile.h>
 
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 
+#include <pulsecore/asyncq.h>
+#include <pulsecore/atomic.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/sink-input.h>
 #include <pulsecore/log.h>
+#include <pulsecore/memtrap.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/mix.h>
@@ -46,13 +56,33 @@
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* Mapped data is paged in ahead of playback in windows of this size */
+#define PREFETCH_WINDOW (256*1024)
+
+/* Blocks decoded ahead of playback for all other files */
+#define DECODE_QUEUE_LENGTH 8
+
 typedef struct file_stream {
     pa_msgobject parent;
     pa_core *core;
     pa_sink_input *sink_input;
 
+    /* Uncompressed WAV files are memory mapped and played straight from
+     * the mapping. data_offset is the offset of the samples in the
+     * block. */
+    pa_memblock *mapping;
+    size_t data_offset, data_length;
+    size_t read_index;
+
+    size_t frame_size;
+
+    /* Everything else is decoded in a background thread */
     SNDFILE *sndfile;
     sf_count_t (*readf_function)(SNDFILE *sndfile, void *ptr, sf_count_t frames);
+    size_t decode_size;
+    pa_thread *decoder;
+    pa_asyncq *decoded;
+    pa_atomic_t decoder_done, decoder_quit;
 
     /* We need this memblockq here to easily fulfill rewind requests
      * (even beyond the file start!) */
@@ -60,12 +90,198 @@ typedef struct file_stream {
 } file_stream;
 
 enum {
-    FILE_STREAM_MESSAGE_UNLINK
+    FILE_STREAM_MESSAGE_UNLINK,
+    FILE_STREAM_MESSAGE_PREFETCH
 };
 
 PA_DEFINE_PRIVATE_CLASS(file_stream, pa_msgobject);
 #define FILE_STREAM(o) (file_stream_cast(o))
 
+#ifdef HAVE_SYS_MMAN_H
+struct file_mapping {
+    void *data;
+    size_t length;
+
+    /* Survives the file being truncated while we play it */
+    pa_memtrap *trap;
+};
+
+static void file_mapping_free(void *userdata) {
+    struct file_mapping *m = userdata;
+
+    pa_assert(m);
+
+    pa_memtrap_remove(m->trap);
+    munmap(m->data, m->length);
+    pa_xfree(m);
+}
+
+/* Looks for the samples in a RIFF WAVE file */
+static int find_wav_data(const uint8_t *p, size_t size, size_t *offset, size_t *length) {
+    size_t i = 12;
+
+    if (size < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4))
+        return -1;
+
+    while (i + 8 <= size) {
+        size_t l = (size_t) p[i+4] | ((size_t) p[i+5] << 8) | ((size_t) p[i+6] << 16) | ((size_t) p[i+7] << 24);
+
+        if (!memcmp(p + i, "data", 4)) {
+            *offset = i + 8;
+            *length = PA_MIN(l, size - *offset);
+            return 0;
+        }
+
+        /* Chunks are padded to an even size */
+        i += 8 + l + (l & 1);
+    }
+
+    return -1;
+}
+
+/* Maps the file if its samples can be played as they are stored. Returns
+ * the mapping as a read-only memblock. */
+static pa_memblock* map_file(pa_mempool *pool, int fd, const SF_INFO *sfi, pa_sample_spec *ss, size_t *offset, size_t *length) {
+    struct file_mapping *m;
+    struct stat st;
+    void *data;
+    size_t l;
+
+    switch (sfi->format & SF_FORMAT_TYPEMASK) {
+        case SF_FORMAT_WAV:
+        case SF_FORMAT_WAVEX:
+            break;
+        default:
+            return NULL;
+    }
+
+    switch (sfi->format & SF_FORMAT_SUBMASK) {
+        case SF_FORMAT_PCM_U8:
+            ss->format = PA_SAMPLE_U8;
+            break;
+        case SF_FORMAT_PCM_16:
+            ss->format = PA_SAMPLE_S16LE;
+            break;
+        case SF_FORMAT_PCM_24:
+            ss->format = PA_SAMPLE_S24LE;
+            break;
+        case SF_FORMAT_PCM_32:
+            ss->format = PA_SAMPLE_S32LE;
+            break;
+        case SF_FORMAT_FLOAT:
+            ss->format = PA_SAMPLE_FLOAT32LE;
+            break;
+        case SF_FORMAT_ULAW:
+            ss->format = PA_SAMPLE_ULAW;
+            break;
+        case SF_FORMAT_ALAW:
+            ss->format = PA_SAMPLE_ALAW;
+            break;
+        default:
+            return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size <= 0)
+        return NULL;
+
+    l = (size_t) st.st_size;
+
+    if ((data = mmap(NULL, l, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        pa_log_debug("mmap() failed, decoding instead: %s", pa_cstrerror(errno));
+        return NULL;
+    }
+
+    /* Trust libsndfile about the number of frames, as long as they are
+     * really there */
+    if (find_wav_data(data, l, offset, length) < 0 ||
+        (uint64_t) sfi->frames * pa_frame_size(ss) > *length) {
+        munmap(data, l);
+        return NULL;
+    }
+
+    *length = (size_t) sfi->frames * pa_frame_size(ss);
+
+#ifdef HAVE_POSIX_MADVISE
+    posix_madvise(data, l, POSIX_MADV_SEQUENTIAL);
+#endif
+
+    m = pa_xnew(struct file_mapping, 1);
+    m->data = data;
+    m->length = l;
+    m->trap = pa_memtrap_add(data, l);
+
+    return pa_memblock_new_user(pool, data, l, file_mapping_free, m, true);
+}
+#endif
+
+/* Called from decoder thread context */
+static void decoder_thread(void *userdata) {
+    file_stream *u = userdata;
+
+    pa_log_debug("Decoder thread starting up");
+
+    while (!pa_atomic_load(&u->decoder_quit)) {
+        pa_memblock *b;
+        size_t fs = u->frame_size;
+        void *p;
+        sf_count_t n;
+
+        b = pa_memblock_new(u->core->mempool, u->decode_size);
+        p = pa_memblock_acquire(b);
+
+        if (u->readf_function)
+            n = u->readf_function(u->sndfile, p, (sf_count_t) (u->decode_size / fs));
+        else {
+            n = sf_read_raw(u->sndfile, p, (sf_count_t) u->decode_size);
+            n = n / (sf_count_t) fs;
+        }
+
+        if (n > 0 && (size_t) n * fs < u->decode_size) {
+            /* The last block has to have the right size, since that is
+             * all the queue carries */
+            pa_memblock *t = pa_memblock_new(u->core->mempool, (size_t) n * fs);
+
+            memcpy(pa_memblock_acquire(t), p, (size_t) n * fs);
+            pa_memblock_release(t);
+            pa_memblock_release(b);
+            pa_memblock_unref(b);
+            b = t;
+        } else
+            pa_memblock_release(b);
+
+        if (n <= 0) {
+            pa_memblock_unref(b);
+            break;
+        }
+
+        /* Blocks while the queue is full */
+        pa_asyncq_push(u->decoded, b, true);
+    }
+
+    pa_atomic_store(&u->decoder_done, 1);
+
+    pa_log_debug("Decoder thread shutting down");
+}
+
+/* Called from main context */
+static void decoder_stop(file_stream *u) {
+    pa_memblock *b;
+
+    pa_assert(u);
+
+    if (!u->decoder)
+        return;
+
+    pa_atomic_store(&u->decoder_quit, 1);
+
+    /* Make room in case the thread waits for it */
+    while ((b = pa_asyncq_pop(u->decoded, false)))
+        pa_memblock_unref(b);
+
+    pa_thread_free(u->decoder);
+    u->decoder = NULL;
+}
+
 /* Called from main context */
 static void file_stream_unlink(file_stream *u) {
     pa_assert(u);
@@ -86,9 +302,17 @@ static void file_stream_free(pa_object *o) {
     file_stream *u = FILE_STREAM(o);
     pa_assert(u);
 
+    decoder_stop(u);
+
+    if (u->decoded)
+        pa_asyncq_free(u->decoded, (pa_free_cb_t) pa_memblock_unref);
+
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
+    if (u->mapping)
+        pa_memblock_unref(u->mapping);
+
     if (u->sndfile)
         sf_close(u->sndfile);
 
@@ -104,6 +328,20 @@ static int file_stream_process_msg(pa_msgobject *o, int code, void*userdata, int
         case FILE_STREAM_MESSAGE_UNLINK:
             file_stream_unlink(u);
             break;
+
+        case FILE_STREAM_MESSAGE_PREFETCH: {
+            size_t l;
+
+            /* Page in the window after the one being played, so that the
+             * IO thread does not have to wait for the disk */
+            if (!u->mapping || (size_t) offset >= u->data_length)
+                break;
+
+            l = PA_MIN((size_t) PREFETCH_WINDOW, u->data_length - (size_t) offset);
+            pa_will_need((const uint8_t *) pa_memblock_acquire(u->mapping) + u->data_offset + offset, l);
+            pa_memblock_release(u->mapping);
+            break;
+        }
     }
 
     return 0;
@@ -135,6 +373,54 @@ static void sink_input_state_change_cb(pa_sink_input *i, pa_sink_input_state_t s
         pa_sink_input_request_rewind(i, 0, false, true, true);
 }
 
+/* Called from IO thread context. Pushes the next piece of the file into
+ * the queue. Returns 1 if there was one, 0 if the decoder has not caught
+ * up yet and -1 at the end of the file. */
+static int file_stream_fill(file_stream *u, size_t length) {
+    pa_memchunk chunk;
+
+    if (u->mapping) {
+        size_t next;
+
+        if (u->read_index >= u->data_length)
+            return -1;
+
+        chunk.memblock = u->mapping;
+        chunk.index = u->data_offset + u->read_index;
+        chunk.length = PA_MIN(PA_MAX(length / u->frame_size * u->frame_size, u->frame_size),
+                              u->data_length - u->read_index);
+        pa_memblockq_push(u->memblockq, &chunk);
+
+        next = u->read_index + chunk.length;
+        if (next / PREFETCH_WINDOW != u->read_index / PREFETCH_WINDOW)
+            pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u), FILE_STREAM_MESSAGE_PREFETCH, NULL,
+                              (int64_t) (next / PREFETCH_WINDOW + 1) * PREFETCH_WINDOW, NULL, NULL);
+
+        u->read_index = next;
+        return 1;
+    }
+
+    if (u->decoded) {
+        /* Check the queue again after seeing the decoder finished, it
+         * might have pushed the last block in between */
+        if (!(chunk.memblock = pa_asyncq_pop(u->decoded, false))) {
+            if (!pa_atomic_load(&u->decoder_done))
+                return 0;
+
+            if (!(chunk.memblock = pa_asyncq_pop(u->decoded, false)))
+                return -1;
+        }
+
+        chunk.index = 0;
+        chunk.length = pa_memblock_get_length(chunk.memblock);
+        pa_memblockq_push(u->memblockq, &chunk);
+        pa_memblock_unref(chunk.memblock);
+        return 1;
+    }
+
+    return -1;
+}
+
 /* Called from IO thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
     file_stream *u;
@@ -148,10 +434,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
         return -1;
 
     for (;;) {
-        pa_memchunk tchunk;
-        size_t fs;
-        void *p;
-        sf_count_t n;
+        int r;
 
         if (pa_memblockq_peek(u->memblockq, chunk) >= 0) {
             chunk->length = PA_MIN(chunk->length, length);
@@ -159,36 +442,11 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
             return 0;
         }
 
-        if (!u->sndfile)
-            break;
-
-        tchunk.memblock = pa_memblock_new(i->sink->core->mempool, length);
-        tchunk.index = 0;
-
-        p = pa_memblock_acquire(tchunk.memblock);
-
-        if (u->readf_function) {
-            fs = pa_frame_size(&i->sample_spec);
-            n = u->readf_function(u->sndfile, p, (sf_count_t) (length/fs));
-        } else {
-            fs = 1;
-            n = sf_read_raw(u->sndfile, p, (sf_count_t) length);
-        }
+        if ((r = file_stream_fill(u, length)) == 0)
+            return -1;
 
-        pa_memblock_release(tchunk.memblock);
-
-        if (n <= 0) {
-            pa_memblock_unref(tchunk.memblock);
-
-            sf_close(u->sndfile);
-            u->sndfile = NULL;
+        if (r < 0)
             break;
-        }
-
-        tchunk.length = (size_t) n * fs;
-
-        pa_memblockq_push(u->memblockq, &tchunk);
-        pa_memblock_unref(tchunk.memblock);
     }
 
     if (pa_sink_input_safe_to_remove(i)) {
@@ -230,13 +488,17 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
 int pa_play_file(
         pa_sink *sink,
         const char *fname,
-        const pa_cvolume *volume) {
+        const pa_cvolume *volume,
+        const pa_channel_map *volume_map,
+        pa_proplist *p,
+        pa_sink_input_flags_t flags,
+        uint32_t *sink_input_index) {
 
     file_stream *u = NULL;
     pa_sample_spec ss;
     pa_channel_map cm;
     pa_sink_input_new_data data;
-    int fd;
+    int fd, sf_fd;
     SF_INFO sfi;
     pa_memchunk silence;
 
@@ -248,8 +510,14 @@ int pa_play_file(
     u->parent.process_msg = file_stream_process_msg;
     u->core = sink->core;
     u->sink_input = NULL;
+    u->mapping = NULL;
+    u->data_offset = u->data_length = u->read_index = 0;
     u->sndfile = NULL;
     u->readf_function = NULL;
+    u->decoder = NULL;
+    u->decoded = NULL;
+    pa_atomic_store(&u->decoder_done, 0);
+    pa_atomic_store(&u->decoder_quit, 0);
     u->memblockq = NULL;
 
     if ((fd = pa_open_cloexec(fname, O_RDONLY, 0)) < 0) {
@@ -257,23 +525,9 @@ int pa_play_file(
         goto fail;
     }
 
-    /* FIXME: For now we just use posix_fadvise to avoid page faults
-     * when accessing the file data. Eventually we should move the
-     * file reader into the main event loop and pass the data over the
-     * asyncmsgq. */
-
 #ifdef HAVE_POSIX_FADVISE
-    if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL) < 0) {
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL) < 0)
         pa_log_warn("POSIX_FADV_SEQUENTIAL failed: %s", pa_cstrerror(errno));
-        goto fail;
-    } else
-        pa_log_debug("POSIX_FADV_SEQUENTIAL succeeded.");
-
-    if (posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) < 0) {
-        pa_log_warn("POSIX_FADV_WILLNEED failed: %s", pa_cstrerror(errno));
-        goto fail;
-    } else
-        pa_log_debug("POSIX_FADV_WILLNEED succeeded.");
 #endif
 
     pa_zero(sfi);
@@ -282,6 +536,7 @@ int pa_play_file(
         goto fail;
     }
 
+    sf_fd = fd;
     fd = -1;
 
     if (pa_sndfile_read_sample_spec(u->sndfile, &ss) < 0) {
@@ -295,18 +550,51 @@ int pa_play_file(
         pa_channel_map_init_extend(&cm, ss.channels, PA_CHANNEL_MAP_DEFAULT);
     }
 
-    u->readf_function = pa_sndfile_readf_function(&ss);
+#ifdef HAVE_SYS_MMAN_H
+    if ((u->mapping = map_file(sink->core->mempool, sf_fd, &sfi, &ss, &u->data_offset, &u->data_length))) {
+        pa_log_debug("Playing %s from a memory mapping.", fname);
+
+        /* The first two windows, later ones are paged in one window ahead */
+        if (u->data_length > 0) {
+            pa_will_need((const uint8_t *) pa_memblock_acquire(u->mapping) + u->data_offset,
+                         PA_MIN((size_t) PREFETCH_WINDOW * 2, u->data_length));
+            pa_memblock_release(u->mapping);
+        }
+    }
+#else
+    (void) sf_fd;
+#endif
+
+    u->frame_size = pa_frame_size(&ss);
+
+    if (!u->mapping)
+        u->readf_function = pa_sndfile_readf_function(&ss);
 
     pa_sink_input_new_data_init(&data);
     pa_sink_input_new_data_set_sink(&data, sink, false);
     data.driver = __FILE__;
+    data.flags = flags;
     pa_sink_input_new_data_set_sample_spec(&data, &ss);
     pa_sink_input_new_data_set_channel_map(&data, &cm);
-    pa_sink_input_new_data_set_volume(&data, volume);
+
+    if (volume) {
+        pa_cvolume cv = *volume;
+
+        if (volume_map && volume_map->channels == cv.channels)
+            pa_cvolume_remap(&cv, volume_map, &cm);
+        else if (cv.channels != ss.channels)
+            pa_cvolume_set(&cv, ss.channels, pa_cvolume_max(volume));
+
+        pa_sink_input_new_data_set_volume(&data, &cv);
+    }
+
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, pa_path_get_filename(fname));
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_FILENAME, fname);
     pa_sndfile_init_proplist(u->sndfile, data.proplist);
 
+    if (p)
+        pa_proplist_update(data.proplist, PA_UPDATE_REPLACE, p);
+
     pa_sink_input_new(&u->sink_input, sink->core, &data);
     pa_sink_input_new_data_done(&data);
 
@@ -324,14 +612,37 @@ int pa_play_file(
     u->memblockq = pa_memblockq_new("sound-file-stream memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, &silence);
     pa_memblock_unref(silence.memblock);
 
+    if (u->mapping) {
+        /* Everything comes from the mapping now */
+        sf_close(u->sndfile);
+        u->sndfile = NULL;
+    } else {
+        u->decode_size = pa_frame_align(pa_mempool_block_size_max(sink->core->mempool), &ss);
+        u->decoded = pa_asyncq_new(DECODE_QUEUE_LENGTH);
+
+        if (!(u->decoder = pa_thread_new("sound-file", decoder_thread, u))) {
+            pa_log("Failed to create decoder thread.");
+            goto fail;
+        }
+    }
+
     pa_sink_input_put(u->sink_input);
 
+    if (sink_input_index)
+        *sink_input_index = u->sink_input->index;
+
     /* The reference to u is dangling here, because we want to keep
      * this stream around until it is fully played. */
 
     return 0;
 
 fail:
+    if (u->sink_input) {
+        pa_sink_input_unlink(u->sink_input);
+        pa_sink_input_unref(u->sink_input);
+        u->sink_input = NULL;
+    }
+
     file_stream_unref(u);
 
     if (fd >= 0)
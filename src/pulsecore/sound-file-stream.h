@@ -23,7 +23,16 @@
 ***/
 
 #include <pulsecore/sink.h>
-
-int pa_play_file(pa_sink *sink, const char *fname, const pa_cvolume *volume);
+#include <pulsecore/sink-input.h>
+
+/* Plays the file without loading it into memory first: uncompressed WAV
+ * files are played from a memory mapping, all others are decoded in a
+ * background thread a few blocks ahead of playback.
+ *
+ * volume may be NULL. It is remapped from volume_map to the channel map
+ * of the file if given, otherwise its loudest channel is applied to all
+ * channels if the channel counts differ. */
+int pa_play_file(pa_sink *sink, const char *fname, const pa_cvolume *volume, const pa_channel_map *volume_map,
+                 pa_proplist *p, pa_sink_input_flags_t flags, uint32_t *sink_input_index);
 
 #endif
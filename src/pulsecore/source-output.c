@@ -31,6 +31,7 @@
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 #include <pulse/internal.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/core-format.h>
 #include <pulsecore/mix.h>
@@ -730,6 +731,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
 
     if (pa_memblockq_push(o->thread_info.delay_memblockq, chunk) < 0) {
         pa_log_debug("Delay queue overflow!");
+        pa_atomic_inc(&o->metrics.n_xruns);
         pa_memblockq_seek(o->thread_info.delay_memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, true);
     }
 
@@ -802,6 +804,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
             o->push(o, &qchunk);
         } else {
             pa_memchunk rchunk;
+            pa_usec_t start;
 
             if (mbs == 0)
                 mbs = pa_resampler_max_block_size(o->thread_info.resampler);
@@ -809,7 +812,10 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
             if (qchunk.length > mbs)
                 qchunk.length = mbs;
 
+            start = pa_rtclock_now();
             pa_resampler_run(o->thread_info.resampler, &qchunk, &rchunk);
+            pa_atomic_add(&o->metrics.resample_usec, (int) (pa_rtclock_now() - start));
+            pa_atomic_inc(&o->metrics.n_resamples);
 
             if (rchunk.length > 0) {
                 if (nvfs) {
@@ -827,6 +833,8 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
         pa_memblock_unref(qchunk.memblock);
         pa_memblockq_drop(o->thread_info.delay_memblockq, qchunk.length);
     }
+
+    pa_atomic_store(&o->metrics.queue_length, (int) pa_memblockq_get_length(o->thread_info.delay_memblockq));
 }
 
 /* Called from thread context */
@@ -34,6 +34,7 @@ typedef struct pa_source_output pa_source_output;
 #include <pulsecore/client.h>
 #include <pulsecore/source.h>
 #include <pulsecore/core.h>
+#include <pulsecore/metrics.h>
 #include <pulsecore/sink-input.h>
 
 typedef enum pa_source_output_state {
@@ -190,6 +191,9 @@ struct pa_source_output {
      * mute status changes. Called from main context */
     void (*mute_changed)(pa_source_output *o); /* may be NULL */
 
+    /* Updated from the IO thread, may be read from anywhere */
+    pa_stream_metrics metrics;
+
     struct {
         pa_source_output_state_t state;
 
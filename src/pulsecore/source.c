@@ -280,6 +280,8 @@ pa_source* pa_source_new(
     reset_callbacks(s);
     s->userdata = NULL;
 
+    pa_meter_init(&s->meter);
+
     s->asyncmsgq = NULL;
 
     /* As a minor optimization we just steal the list instead of
@@ -890,6 +892,9 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
 
     pa_log_debug("Processing rewind...");
 
+    pa_atomic_inc(&s->metrics.n_rewinds);
+    pa_atomic_add(&s->metrics.rewind_bytes, (int) nbytes);
+
     PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
         pa_source_output_assert_ref(o);
         pa_source_output_process_rewind(o, nbytes);
@@ -900,6 +905,7 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
 void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
     pa_source_output *o;
     void *state = NULL;
+    pa_usec_t start;
 
     pa_source_assert_ref(s);
     pa_source_assert_io_context(s);
@@ -909,7 +915,11 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
     if (s->thread_info.state == PA_SOURCE_SUSPENDED)
         return;
 
-    if (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume)) {
+    start = pa_rtclock_now();
+
+    /* Silence stays silence, so a flagged block is passed on as it is */
+    if (!pa_memblock_is_silence(chunk->memblock) &&
+        (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume))) {
         pa_memchunk vchunk = *chunk;
 
         pa_memblock_ref(vchunk.memblock);
@@ -927,6 +937,8 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
                 pa_source_output_push(o, &vchunk);
         }
 
+        pa_meter_process(&s->meter, &s->sample_spec, &vchunk, NULL);
+
         pa_memblock_unref(vchunk.memblock);
     } else {
 
@@ -936,7 +948,11 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
             if (!o->thread_info.direct_on_input)
                 pa_source_output_push(o, chunk);
         }
+
+        pa_meter_process(&s->meter, &s->sample_spec, chunk, NULL);
     }
+
+    pa_metrics_histogram_add(&s->metrics.process_time, pa_rtclock_now() - start);
 }
 
 /* Called from IO thread context */
@@ -951,7 +967,8 @@ void pa_source_post_direct(pa_source*s, pa_source_output *o, const pa_memchunk *
     if (s->thread_info.state == PA_SOURCE_SUSPENDED)
         return;
 
-    if (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume)) {
+    if (!pa_memblock_is_silence(chunk->memblock) &&
+        (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume))) {
         pa_memchunk vchunk = *chunk;
 
         pa_memblock_ref(vchunk.memblock);
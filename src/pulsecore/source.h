@@ -46,6 +46,8 @@ typedef struct pa_source_volume_change pa_source_volume_change;
 #include <pulsecore/device-port.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/thread-mq.h>
+#include <pulsecore/meter.h>
+#include <pulsecore/metrics.h>
 #include <pulsecore/source-output.h>
 
 #define PA_MAX_OUTPUTS_PER_SOURCE 256
@@ -189,6 +191,12 @@ struct pa_source {
      * main thread. */
     int (*update_rate)(pa_source *s, uint32_t rate);
 
+    /* Updated from the IO thread, may be read from anywhere */
+    pa_device_metrics metrics;
+
+    /* Levels for clients that subscribed to them */
+    pa_meter meter;
+
     /* Contains copies of the above data so that the real-time worker
      * thread can work without access locking */
     struct {
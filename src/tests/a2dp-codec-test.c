@@ -0,0 +1,210 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/core-util.h>
+
+#include <modules/bluetooth/a2dp-codec-util.h>
+
+/* Runs every A2DP codec's encoder and decoder over some PCM and reports
+ * how much processing time one second of audio costs and how well the
+ * packets fill the link MTU. The input is either generated or read from
+ * a raw S16LE stereo 44.1 kHz file given on the command line. */
+
+#define INPUT_SECONDS 10
+
+static const pa_sample_spec input_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 44100,
+    .channels = 2
+};
+
+/* Typical L2CAP MTUs seen with A2DP headsets */
+static const size_t link_mtus[] = { 672, 895, 1021 };
+
+static const char *input_file = NULL;
+static uint8_t *input;
+static size_t input_size;
+
+static void load_input(void) {
+    if (input_file) {
+        FILE *f;
+        long l;
+
+        pa_assert_se(f = fopen(input_file, "rb"));
+        pa_assert_se(fseek(f, 0, SEEK_END) == 0);
+        pa_assert_se((l = ftell(f)) > 0);
+        rewind(f);
+
+        input_size = (size_t) l - ((size_t) l % pa_frame_size(&input_spec));
+        input = pa_xmalloc(input_size);
+        pa_assert_se(fread(input, 1, input_size, f) == input_size);
+        fclose(f);
+    } else {
+        int16_t *d;
+        unsigned i, n;
+
+        /* Two tones and some noise, so the encoder has something to chew on */
+        n = INPUT_SECONDS * input_spec.rate;
+        input_size = n * pa_frame_size(&input_spec);
+        d = (int16_t *) (input = pa_xmalloc(input_size));
+
+        for (i = 0; i < n; i++) {
+            double t = (double) i / input_spec.rate;
+            double v = 0.4 * sin(2 * M_PI * 440 * t) + 0.2 * sin(2 * M_PI * 3150 * t);
+
+            d[2*i] = (int16_t) (v * 0x7fff) + (int16_t) (rand() % 256 - 128);
+            d[2*i+1] = (int16_t) (v * 0x6fff) + (int16_t) (rand() % 256 - 128);
+        }
+    }
+}
+
+static void run_codec(const pa_a2dp_codec *codec, size_t link_mtu) {
+    uint8_t capabilities[254], config[254];
+    size_t capabilities_size, config_size;
+    pa_sample_spec ss;
+    void *encoder, *decoder;
+    size_t write_block_size, read_block_size;
+    uint8_t *packet, *decoded;
+    size_t offset, n_packets = 0, packet_bytes = 0, decoded_bytes = 0;
+    pa_usec_t encode_time = 0, decode_time = 0, audio_time;
+    double fill;
+
+    pa_assert_se((capabilities_size = codec->fill_capabilities(capabilities, sizeof(capabilities))) > 0);
+    pa_assert_se((config_size = codec->fill_preferred_configuration(&input_spec, capabilities, capabilities_size,
+                                                                    config, sizeof(config))) > 0);
+    fail_unless(codec->is_configuration_valid(config, config_size));
+
+    pa_assert_se(encoder = codec->init(true, config, config_size, &ss));
+    pa_assert_se(decoder = codec->init(false, config, config_size, &ss));
+    fail_unless(pa_sample_spec_equal(&ss, &input_spec));
+
+    fail_unless(codec->reset(encoder) >= 0);
+    fail_unless(codec->reset(decoder) >= 0);
+
+    write_block_size = codec->get_write_block_size(encoder, link_mtu);
+    read_block_size = codec->get_read_block_size(decoder, link_mtu);
+    fail_unless(write_block_size > 0);
+    fail_unless(read_block_size >= write_block_size);
+
+    packet = pa_xmalloc(link_mtu);
+    decoded = pa_xmalloc(read_block_size);
+
+    for (offset = 0; offset + write_block_size <= input_size; offset += write_block_size) {
+        size_t size, processed, n;
+        pa_usec_t start;
+
+        start = pa_rtclock_now();
+        size = codec->encode_buffer(encoder, offset / pa_frame_size(&ss),
+                                    input + offset, write_block_size,
+                                    packet, link_mtu, &processed);
+        encode_time += pa_rtclock_now() - start;
+
+        fail_unless(size > 0);
+        fail_unless(size <= link_mtu);
+        fail_unless(processed == write_block_size);
+
+        start = pa_rtclock_now();
+        n = codec->decode_buffer(decoder, packet, size, decoded, read_block_size, &processed);
+        decode_time += pa_rtclock_now() - start;
+
+        fail_unless(processed == size);
+        fail_unless(n == write_block_size);
+
+        n_packets++;
+        packet_bytes += size;
+        decoded_bytes += n;
+    }
+
+    fail_unless(n_packets > 0);
+
+    audio_time = pa_bytes_to_usec(decoded_bytes, &ss);
+    fill = (double) packet_bytes / (double) (n_packets * link_mtu);
+
+    pa_log_info("%s, MTU %4u: %u packets of %u bytes PCM, fill %.1f%%, "
+                "encode %llu usec/s (%.2f%% CPU), decode %llu usec/s (%.2f%% CPU)",
+                codec->name, (unsigned) link_mtu, (unsigned) n_packets, (unsigned) write_block_size, fill * 100,
+                (unsigned long long) (encode_time * PA_USEC_PER_SEC / audio_time),
+                (double) encode_time * 100 / audio_time,
+                (unsigned long long) (decode_time * PA_USEC_PER_SEC / audio_time),
+                (double) decode_time * 100 / audio_time);
+
+    /* A codec that leaves a quarter of every packet empty wastes air time */
+    fail_unless(fill >= 0.75);
+
+    pa_xfree(packet);
+    pa_xfree(decoded);
+
+    codec->deinit(encoder);
+    codec->deinit(decoder);
+}
+
+START_TEST (a2dp_codec_test) {
+    unsigned i, j;
+
+    load_input();
+
+    for (i = 0; i < pa_bluetooth_a2dp_codec_count(); i++)
+        for (j = 0; j < PA_ELEMENTSOF(link_mtus); j++)
+            run_codec(pa_bluetooth_a2dp_codec_iter(i), link_mtus[j]);
+
+    pa_xfree(input);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    if (argc > 1)
+        input_file = argv[1];
+
+    s = suite_create("A2DP Codec");
+    tc = tcase_create("a2dpcodec");
+    tcase_add_test(tc, a2dp_codec_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
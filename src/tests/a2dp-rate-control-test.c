@@ -0,0 +1,187 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/bluetooth/a2dp-rate-control.h>
+
+/* Feeds the A2DP bitrate controller with packets written to a local
+ * socketpair whose other end is read at a limited rate, simulating a
+ * Bluetooth link whose bandwidth drops and recovers. Time is simulated,
+ * so this runs as fast as the socket allows. */
+
+#define PACKET_USEC (20 * PA_USEC_PER_MSEC)
+#define SNDBUF 16384
+
+/* Packet sizes for each bitrate step, roughly what SBC at 44.1 kHz
+ * produces for bitpool 53 down to 32 */
+static const size_t packet_sizes[] = { 820, 730, 640, 550, 460 };
+
+struct phase {
+    unsigned seconds;
+    size_t bytes_per_second;
+};
+
+/* 400 kbit/s, 250 kbit/s, 400 kbit/s */
+static const struct phase phases[] = {
+    { 10, 50000 },
+    { 30, 31250 },
+    { 60, 50000 },
+};
+
+static int fds[2];
+static size_t budget;
+
+/* Drains the socket like a link with the given bandwidth would */
+static void link_read(size_t bytes_per_second) {
+    size_t quantum = bytes_per_second * PACKET_USEC / PA_USEC_PER_SEC;
+    uint8_t buf[1024];
+
+    budget += quantum;
+
+    for (;;) {
+        ssize_t l;
+
+        /* Find out how large the next packet is before consuming it */
+        if ((l = recv(fds[1], buf, sizeof(buf), MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT)) < 0) {
+            fail_unless(errno == EAGAIN);
+
+            /* An idle link can't save up bandwidth for later */
+            budget = PA_MIN(budget, quantum);
+            return;
+        }
+
+        if ((size_t) l > budget)
+            return;
+
+        fail_unless(recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT) == l);
+        budget -= (size_t) l;
+    }
+}
+
+START_TEST (a2dp_rate_control_test) {
+    pa_a2dp_rate_control *rc;
+    uint8_t packet[1024];
+    unsigned level = 0, p;
+    pa_usec_t now = 0;
+    int sndbuf = SNDBUF;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+    fail_unless(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+    pa_make_fd_nonblock(fds[0]);
+
+    memset(packet, 0x55, sizeof(packet));
+
+    rc = pa_a2dp_rate_control_new(fds[0], false);
+
+    for (p = 0; p < PA_ELEMENTSOF(phases); p++) {
+        unsigned i, n = phases[p].seconds * PA_USEC_PER_SEC / PACKET_USEC;
+        unsigned n_blocked = 0, lowest = level;
+        size_t sent_second_half = 0;
+
+        for (i = 0; i < n; i++) {
+            bool written;
+
+            now += PACKET_USEC;
+            link_read(phases[p].bytes_per_second);
+
+            pa_a2dp_rate_control_before_write(rc);
+
+            written = send(fds[0], packet, packet_sizes[level], MSG_DONTWAIT) == (ssize_t) packet_sizes[level];
+            if (!written) {
+                fail_unless(errno == EAGAIN);
+                n_blocked++;
+            } else if (i >= n / 2)
+                sent_second_half += packet_sizes[level];
+
+            switch (pa_a2dp_rate_control_after_write(rc, now, PACKET_USEC, written)) {
+                case PA_A2DP_RATE_DECREASE:
+                    if (level < PA_ELEMENTSOF(packet_sizes) - 1)
+                        level++;
+                    break;
+                case PA_A2DP_RATE_INCREASE:
+                    if (level > 0)
+                        level--;
+                    break;
+                case PA_A2DP_RATE_KEEP:
+                    break;
+            }
+
+            lowest = PA_MAX(lowest, level);
+        }
+
+        pa_log_debug("Phase %u: link %lu bytes/s, sent %lu bytes/s in the second half, "
+                     "ended at step %u, lowest step %u, %u blocked writes",
+                     p, (unsigned long) phases[p].bytes_per_second,
+                     (unsigned long) (sent_second_half * 2 / phases[p].seconds), level, lowest, n_blocked);
+
+        /* The controller has to act before the socket overflows */
+        fail_unless(n_blocked == 0);
+
+        /* Once settled we must not send more than the link can carry */
+        fail_unless(sent_second_half * 2 / phases[p].seconds <= phases[p].bytes_per_second);
+
+        /* A link that can carry the highest bitrate gets it, at the
+         * latest at the end of the phase */
+        if (phases[p].bytes_per_second * PACKET_USEC / PA_USEC_PER_SEC >= packet_sizes[0])
+            fail_unless(level == 0);
+    }
+
+    pa_a2dp_rate_control_free(rc);
+    pa_close(fds[0]);
+    pa_close(fds[1]);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("A2DP Rate Control");
+    tc = tcase_create("a2dpratecontrol");
+    tcase_add_test(tc, a2dp_rate_control_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
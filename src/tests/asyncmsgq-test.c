@@ -22,11 +22,16 @@
 #endif
 
 #include <assert.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <check.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
 #include <pulsecore/asyncmsgq.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/log.h>
@@ -39,6 +44,16 @@ enum {
     QUIT
 };
 
+#define N_MESSAGES 100000
+#define BATCH 32
+
+struct reader {
+    pa_asyncmsgq *q;
+    unsigned n_messages;
+    unsigned n_wakeups;
+    bool in_order;
+};
+
 static void the_thread(void *_q) {
     pa_asyncmsgq *q = _q;
     int quit = 0;
@@ -107,6 +122,134 @@ START_TEST (asyncmsgq_test) {
 }
 END_TEST
 
+/* Waits for messages on the read fd like an IO thread's rtpoll does,
+ * counts how often that poll() was woken up through the fd, and checks
+ * that the messages arrive in order */
+static void reader_thread(void *_r) {
+    struct reader *r = _r;
+    int64_t expected = 0;
+
+    for (;;) {
+        int code = 0;
+        int64_t offset = 0;
+
+        if (pa_asyncmsgq_get(r->q, NULL, &code, NULL, &offset, NULL, false) < 0) {
+            struct pollfd pfd;
+
+            /* Something arrived in the meantime */
+            if (pa_asyncmsgq_read_before_poll(r->q) < 0)
+                continue;
+
+            pfd.fd = pa_asyncmsgq_read_fd(r->q);
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+
+            pa_assert_se(poll(&pfd, 1, -1) == 1);
+            pa_asyncmsgq_read_after_poll(r->q);
+
+            r->n_wakeups++;
+            continue;
+        }
+
+        if (code == QUIT) {
+            pa_asyncmsgq_done(r->q, 0);
+            break;
+        }
+
+        if (offset != expected++)
+            r->in_order = false;
+        r->n_messages++;
+
+        /* Senders get the offset back */
+        pa_asyncmsgq_done(r->q, (int) offset);
+    }
+}
+
+enum mode {
+    MODE_POST,
+    MODE_POST_MANY,
+    MODE_SEND,
+    MODE_SEND_MANY
+};
+
+/* size is the size of the queue, 0 for the default */
+static void run_throughput(enum mode mode, unsigned size, const char *name) {
+    pa_asyncmsgq_msg msgs[BATCH];
+    struct reader r;
+    pa_thread *t;
+    pa_usec_t start, usec;
+    unsigned i, k;
+
+    r.q = pa_asyncmsgq_new(size);
+    fail_unless(r.q != NULL);
+    r.n_messages = r.n_wakeups = 0;
+    r.in_order = true;
+
+    t = pa_thread_new("reader", reader_thread, &r);
+    fail_unless(t != NULL);
+
+    memset(msgs, 0, sizeof(msgs));
+
+    start = pa_rtclock_now();
+
+    for (i = 0; i < N_MESSAGES; i += BATCH) {
+        switch (mode) {
+            case MODE_POST:
+                for (k = 0; k < BATCH; k++)
+                    pa_asyncmsgq_post(r.q, NULL, OPERATION_A, NULL, i + k, NULL, NULL);
+                break;
+
+            case MODE_SEND:
+                for (k = 0; k < BATCH; k++)
+                    fail_unless(pa_asyncmsgq_send(r.q, NULL, OPERATION_A, NULL, i + k, NULL) == (int) (i + k));
+                break;
+
+            case MODE_POST_MANY:
+            case MODE_SEND_MANY:
+                for (k = 0; k < BATCH; k++) {
+                    msgs[k].code = OPERATION_A;
+                    msgs[k].offset = i + k;
+                }
+
+                if (mode == MODE_POST_MANY)
+                    pa_asyncmsgq_post_many(r.q, msgs, BATCH);
+                else {
+                    fail_unless(pa_asyncmsgq_send_many(r.q, msgs, BATCH) == (int) (i + BATCH - 1));
+
+                    for (k = 0; k < BATCH; k++)
+                        fail_unless(msgs[k].ret == (int) (i + k));
+                }
+                break;
+        }
+    }
+
+    pa_asyncmsgq_send(r.q, NULL, QUIT, NULL, 0, NULL);
+    usec = pa_rtclock_now() - start;
+
+    pa_thread_free(t);
+    pa_asyncmsgq_unref(r.q);
+
+    fail_unless(r.in_order);
+    fail_unless(r.n_messages == i);
+
+    pa_log_info("%s: %u messages in %llu usec, %.0f messages/s, %.3f wakeups/message",
+                name, r.n_messages, (unsigned long long) usec,
+                r.n_messages * (double) PA_USEC_PER_SEC / PA_MAX(usec, (pa_usec_t) 1),
+                r.n_wakeups / (double) r.n_messages);
+}
+
+START_TEST (asyncmsgq_batch_test) {
+    run_throughput(MODE_POST, 0, "post");
+    run_throughput(MODE_POST_MANY, 0, "post_many");
+    run_throughput(MODE_SEND, 0, "send");
+    run_throughput(MODE_SEND_MANY, 0, "send_many");
+
+    /* A batch doesn't fit, so the sender has to wake up the reader
+     * before it waits for room */
+    run_throughput(MODE_SEND_MANY, BATCH / 4, "send_many, small queue");
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -116,6 +259,8 @@ int main(int argc, char *argv[]) {
     s = suite_create("Async Message Queue");
     tc = tcase_create("asyncmsgq");
     tcase_add_test(tc, asyncmsgq_test);
+    tcase_add_test(tc, asyncmsgq_batch_test);
+    tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
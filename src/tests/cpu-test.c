@@ -35,6 +35,7 @@
 #include <pulsecore/remap.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/mix.h>
+#include <pulsecore/meter.h>
 
 #include "runtime-test-util.h"
 
@@ -623,6 +624,176 @@ static void remap_test_mono_stereo_s16(
     run_remap_test_mono_stereo_s16(&remap, func, orig_func, 3, true, true);
 }
 
+static void run_remap_test_channels_float(
+        pa_remap_t *remap,
+        pa_do_remap_func_t func,
+        pa_do_remap_func_t orig_func,
+        int align,
+        bool correct,
+        bool perf) {
+
+    PA_DECLARE_ALIGNED(8, float, s_ref[SAMPLES*8]) = { 0 };
+    PA_DECLARE_ALIGNED(8, float, s[SAMPLES*8]) = { 0 };
+    PA_DECLARE_ALIGNED(8, float, in[SAMPLES*8]);
+    float *out, *out_ref, *input;
+    unsigned n_ic, n_oc;
+    int i, nframes;
+
+    n_ic = remap->i_ss->channels;
+    n_oc = remap->o_ss->channels;
+
+    /* Force sample alignment as requested */
+    out = s + (8 - align);
+    out_ref = s_ref + (8 - align);
+    input = in + (8 - align);
+    nframes = SAMPLES - (8 - align);
+
+    for (i = 0; i < nframes * (int) n_ic; i++)
+        input[i] = 2.1f * (rand()/(float) RAND_MAX - 0.5f);
+
+    if (correct) {
+        orig_func(remap, out_ref, input, nframes);
+        func(remap, out, input, nframes);
+
+        for (i = 0; i < nframes * (int) n_oc; i++) {
+            if (fabsf(out[i] - out_ref[i]) > 0.0001) {
+                pa_log_debug("Correctness test failed: align=%d, %u->%u channels", align, n_ic, n_oc);
+                pa_log_debug("%d: %.24f != %.24f\n", i, out[i], out_ref[i]);
+                fail();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing remap performance with %d sample alignment, %u->%u channels", align, n_ic, n_oc);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(remap, out, input, nframes);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            orig_func(remap, out_ref, input, nframes);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+}
+
+static void run_remap_test_channels_s16(
+        pa_remap_t *remap,
+        pa_do_remap_func_t func,
+        pa_do_remap_func_t orig_func,
+        int align,
+        bool correct,
+        bool perf) {
+
+    PA_DECLARE_ALIGNED(8, int16_t, s_ref[SAMPLES*8]) = { 0 };
+    PA_DECLARE_ALIGNED(8, int16_t, s[SAMPLES*8]) = { 0 };
+    PA_DECLARE_ALIGNED(8, int16_t, in[SAMPLES*8]);
+    int16_t *out, *out_ref, *input;
+    unsigned n_ic, n_oc;
+    int i, nframes;
+
+    n_ic = remap->i_ss->channels;
+    n_oc = remap->o_ss->channels;
+
+    /* Force sample alignment as requested */
+    out = s + (8 - align);
+    out_ref = s_ref + (8 - align);
+    input = in + (8 - align);
+    nframes = SAMPLES - (8 - align);
+
+    pa_random(input, nframes * n_ic * sizeof(int16_t));
+
+    if (correct) {
+        orig_func(remap, out_ref, input, nframes);
+        func(remap, out, input, nframes);
+
+        /* Both round every gain and truncate, the C version per input
+         * channel, the vector versions per output channel */
+        for (i = 0; i < nframes * (int) n_oc; i++) {
+            if (abs(out[i] - out_ref[i]) > (int) (2 * n_ic + 1)) {
+                pa_log_debug("Correctness test failed: align=%d, %u->%u channels", align, n_ic, n_oc);
+                pa_log_debug("%d: %d != %d\n", i, out[i], out_ref[i]);
+                fail();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing remap performance with %d sample alignment, %u->%u channels", align, n_ic, n_oc);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(remap, out, input, nframes);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            orig_func(remap, out_ref, input, nframes);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+}
+
+/* A sparse random matrix, normalized like the resampler does it */
+static void remap_test_channels(
+        pa_init_remap_func_t init_func,
+        pa_init_remap_func_t orig_init_func,
+        pa_sample_format_t sf,
+        unsigned n_ic,
+        unsigned n_oc) {
+
+    pa_remap_t remap;
+    pa_sample_spec iss, oss;
+    pa_do_remap_func_t orig_func, func;
+    unsigned oc, ic;
+
+    memset(&remap, 0, sizeof(remap));
+    iss.format = oss.format = sf;
+    iss.channels = n_ic;
+    oss.channels = n_oc;
+    remap.format = &sf;
+    remap.i_ss = &iss;
+    remap.o_ss = &oss;
+
+    for (oc = 0; oc < n_oc; oc++) {
+        float sum = 0;
+
+        for (ic = 0; ic < n_ic; ic++) {
+            if (rand() & 1)
+                sum += remap.map_table_f[oc][ic] = 0.1f + rand()/(float) RAND_MAX;
+        }
+
+        for (ic = 0; ic < n_ic; ic++) {
+            if (sum > 1.0f)
+                remap.map_table_f[oc][ic] /= sum;
+            remap.map_table_i[oc][ic] = (int32_t) (remap.map_table_f[oc][ic] * 0x10000);
+        }
+    }
+
+    orig_init_func(&remap);
+    orig_func = remap.do_remap;
+    if (!orig_func) {
+        pa_log_warn("No reference remapping function, abort test");
+        return;
+    }
+
+    init_func(&remap);
+    func = remap.do_remap;
+    if (!func || func == orig_func) {
+        pa_log_warn("No remapping function, abort test");
+        return;
+    }
+
+    if (sf == PA_SAMPLE_FLOAT32NE) {
+        run_remap_test_channels_float(&remap, func, orig_func, 0, true, false);
+        run_remap_test_channels_float(&remap, func, orig_func, 1, true, false);
+        run_remap_test_channels_float(&remap, func, orig_func, 2, true, false);
+        run_remap_test_channels_float(&remap, func, orig_func, 3, true, true);
+    } else {
+        run_remap_test_channels_s16(&remap, func, orig_func, 0, true, false);
+        run_remap_test_channels_s16(&remap, func, orig_func, 1, true, false);
+        run_remap_test_channels_s16(&remap, func, orig_func, 2, true, false);
+        run_remap_test_channels_s16(&remap, func, orig_func, 3, true, true);
+    }
+}
+
 #if defined (__i386__) || defined (__amd64__)
 START_TEST (remap_mmx_test) {
     pa_cpu_x86_flag_t flags = 0;
@@ -646,8 +817,10 @@ START_TEST (remap_mmx_test) {
 END_TEST
 
 START_TEST (remap_sse2_test) {
+    static const unsigned layouts[][2] = { { 2, 1 }, { 6, 2 }, { 8, 2 }, { 2, 6 }, { 2, 8 } };
     pa_cpu_x86_flag_t flags = 0;
     pa_init_remap_func_t init_func, orig_init_func;
+    unsigned i;
 
     pa_cpu_get_x86_flags(&flags);
     if (!(flags & PA_CPU_X86_SSE2)) {
@@ -663,6 +836,14 @@ START_TEST (remap_sse2_test) {
 
     pa_log_debug("Checking SSE2 remap (s16, mono->stereo)");
     remap_test_mono_stereo_s16(init_func, orig_init_func);
+
+    for (i = 0; i < PA_ELEMENTSOF(layouts); i++) {
+        pa_log_debug("Checking SSE2 remap (float, %u->%u channels)", layouts[i][0], layouts[i][1]);
+        remap_test_channels(init_func, orig_init_func, PA_SAMPLE_FLOAT32NE, layouts[i][0], layouts[i][1]);
+
+        pa_log_debug("Checking SSE2 remap (s16, %u->%u channels)", layouts[i][0], layouts[i][1]);
+        remap_test_channels(init_func, orig_init_func, PA_SAMPLE_S16NE, layouts[i][0], layouts[i][1]);
+    }
 }
 END_TEST
 #endif /* defined (__i386__) || defined (__amd64__) */
@@ -822,6 +1003,108 @@ END_TEST
 #endif /* defined (__arm__) && defined (__linux__) */
 /* End mix tests */
 
+/* Start meter tests */
+#undef SAMPLES
+#undef TIMES
+#undef TIMES2
+#define SAMPLES 1028
+#define TIMES 1000
+#define TIMES2 100
+
+static void run_meter_test(
+        pa_do_meter_func_t func,
+        pa_do_meter_func_t orig_func,
+        pa_sample_format_t format,
+        int align,
+        unsigned channels,
+        bool correct,
+        bool perf) {
+
+    PA_DECLARE_ALIGNED(8, float, f[SAMPLES]);
+    PA_DECLARE_ALIGNED(8, int16_t, s[SAMPLES]);
+    float peak[PA_CHANNELS_MAX] = { 0 }, sum[PA_CHANNELS_MAX] = { 0 };
+    float peak_ref[PA_CHANNELS_MAX] = { 0 }, sum_ref[PA_CHANNELS_MAX] = { 0 };
+    void *samples;
+    unsigned c, i, nsamples;
+
+    /* Force sample alignment as requested */
+    nsamples = SAMPLES - (8 - align);
+    nsamples -= nsamples % channels;
+
+    if (format == PA_SAMPLE_FLOAT32NE) {
+        for (i = 0; i < nsamples; i++)
+            f[8 - align + i] = 2.0f * (rand()/(float) RAND_MAX - 0.5f);
+        samples = f + (8 - align);
+    } else {
+        pa_random(s, sizeof(s));
+        /* Make sure the asymmetric end of the range is covered */
+        s[8 - align] = -0x8000;
+        samples = s + (8 - align);
+    }
+
+    if (correct) {
+        orig_func(samples, channels, nsamples, peak_ref, sum_ref);
+        func(samples, channels, nsamples, peak, sum);
+
+        for (c = 0; c < channels; c++) {
+            if (peak[c] != peak_ref[c] || fabsf(sum[c] - sum_ref[c]) > 0.0001f * sum_ref[c]) {
+                pa_log_debug("Correctness test failed: align=%d, channels=%u", align, channels);
+                pa_log_debug("%u: peak %f != %f, sum %f != %f", c, peak[c], peak_ref[c], sum[c], sum_ref[c]);
+                fail();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing meter performance with %d sample alignment, %u channels", align, channels);
+
+        PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(samples, channels, nsamples, peak, sum);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+            orig_func(samples, channels, nsamples, peak_ref, sum_ref);
+        } PA_RUNTIME_TEST_RUN_STOP
+    }
+}
+
+#if defined (__i386__) || defined (__amd64__)
+START_TEST (meter_sse2_test) {
+    pa_do_meter_func_t orig_s16_func, sse2_s16_func, orig_float_func, sse2_float_func;
+    pa_cpu_x86_flag_t flags = 0;
+    unsigned channels;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    orig_s16_func = pa_get_meter_func(PA_SAMPLE_S16NE);
+    orig_float_func = pa_get_meter_func(PA_SAMPLE_FLOAT32NE);
+    pa_meter_func_init_sse(PA_CPU_X86_SSE2);
+    sse2_s16_func = pa_get_meter_func(PA_SAMPLE_S16NE);
+    sse2_float_func = pa_get_meter_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking SSE2 meter (s16)");
+    for (channels = 1; channels <= 8; channels++) {
+        run_meter_test(sse2_s16_func, orig_s16_func, PA_SAMPLE_S16NE, 7, channels, true, false);
+        run_meter_test(sse2_s16_func, orig_s16_func, PA_SAMPLE_S16NE, 8, channels, true, false);
+    }
+    run_meter_test(sse2_s16_func, orig_s16_func, PA_SAMPLE_S16NE, 8, 2, false, true);
+
+    pa_log_debug("Checking SSE2 meter (float)");
+    for (channels = 1; channels <= 8; channels++) {
+        run_meter_test(sse2_float_func, orig_float_func, PA_SAMPLE_FLOAT32NE, 7, channels, true, false);
+        run_meter_test(sse2_float_func, orig_float_func, PA_SAMPLE_FLOAT32NE, 8, channels, true, false);
+    }
+    run_meter_test(sse2_float_func, orig_float_func, PA_SAMPLE_FLOAT32NE, 8, 2, false, true);
+}
+END_TEST
+#endif /* defined (__i386__) || defined (__amd64__) */
+/* End meter tests */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -878,6 +1161,14 @@ int main(int argc, char *argv[]) {
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
+    /* Meter tests */
+    tc = tcase_create("meter");
+#if defined (__i386__) || defined (__amd64__)
+    tcase_add_test(tc, meter_sse2_test);
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
     sr = srunner_create(s);
     srunner_run_all(sr, CK_NORMAL);
     failed = srunner_ntests_failed(sr);
@@ -0,0 +1,168 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/echo-cancel/fdaf-aec.h>
+
+#define FFT_SIZE 64
+
+#define RATE 16000
+#define BLOCK_SIZE 256
+#define N_PARTITIONS 4
+#define ECHO_LENGTH 800
+#define N_SAMPLES (BLOCK_SIZE * 320)
+
+static float noise(void) {
+    return (float) rand() / RAND_MAX - 0.5f;
+}
+
+START_TEST (fft_test) {
+    pa_fdaf_fft *t;
+    float in[FFT_SIZE], spectrum[FFT_SIZE + 2], out[FFT_SIZE];
+    unsigned i, k;
+
+    srand(0);
+    for (i = 0; i < FFT_SIZE; i++)
+        in[i] = noise();
+
+    t = pa_fdaf_fft_new(FFT_SIZE);
+    pa_fdaf_fft_forward(t, in, spectrum);
+
+    /* Compare with a plain DFT */
+    for (k = 0; k <= FFT_SIZE / 2; k++) {
+        double re = 0, im = 0;
+
+        for (i = 0; i < FFT_SIZE; i++) {
+            re += in[i] * cos(2 * M_PI * k * i / FFT_SIZE);
+            im -= in[i] * sin(2 * M_PI * k * i / FFT_SIZE);
+        }
+
+        fail_unless(fabs(spectrum[2*k] - re) < 1e-4, "bin %u real part %f, expected %f", k, spectrum[2*k], re);
+        fail_unless(fabs(spectrum[2*k+1] - im) < 1e-4, "bin %u imaginary part %f, expected %f", k, spectrum[2*k+1], im);
+    }
+
+    pa_fdaf_fft_inverse(t, spectrum, out);
+
+    for (i = 0; i < FFT_SIZE; i++)
+        fail_unless(fabsf(out[i] - in[i]) < 1e-5);
+
+    pa_fdaf_fft_free(t);
+}
+END_TEST
+
+/* Energy ratio of mic and out over the last second, in dB */
+static double erle(const float *mic, const float *out) {
+    double m = 0, o = 0;
+    unsigned i;
+
+    for (i = N_SAMPLES - RATE; i < N_SAMPLES; i++) {
+        m += mic[i] * mic[i];
+        o += out[i] * out[i];
+    }
+
+    return 10 * log10(m / o);
+}
+
+START_TEST (converge_test) {
+    float h[ECHO_LENGTH];
+    float *far, *mic, *out;
+    pa_fdaf *f;
+    unsigned i, j;
+
+    far = pa_xnew(float, N_SAMPLES);
+    mic = pa_xnew(float, N_SAMPLES);
+    out = pa_xnew(float, N_SAMPLES);
+
+    srand(0);
+    for (i = 0; i < ECHO_LENGTH; i++)
+        h[i] = 0.1f * expf(-(float) i / 150) * noise();
+
+    for (i = 0; i < N_SAMPLES; i++)
+        far[i] = 0.5f * noise();
+
+    /* Echo longer than one partition, plus some noise at -80 dB */
+    for (i = 0; i < N_SAMPLES; i++) {
+        float s = 1e-4f * noise();
+
+        for (j = 0; j < ECHO_LENGTH && j <= i; j++)
+            s += h[j] * far[i - j];
+
+        mic[i] = s;
+    }
+
+    f = pa_fdaf_new(BLOCK_SIZE, N_PARTITIONS, 0.5f);
+
+    for (i = 0; i < N_SAMPLES; i += BLOCK_SIZE)
+        pa_fdaf_process(f, mic + i, far + i, out + i, 1.0f);
+
+    pa_log_debug("ERLE after convergence: %0.1f dB", erle(mic, out));
+    fail_unless(erle(mic, out) > 40);
+
+    /* A frozen filter keeps cancelling, a reset one doesn't */
+    for (i = 0; i < N_SAMPLES; i += BLOCK_SIZE)
+        pa_fdaf_process(f, mic + i, far + i, out + i, 0.0f);
+    fail_unless(erle(mic, out) > 40);
+
+    pa_fdaf_reset(f);
+    for (i = 0; i < N_SAMPLES; i += BLOCK_SIZE)
+        pa_fdaf_process(f, mic + i, far + i, out + i, 0.0f);
+    fail_unless(erle(mic, out) < 1);
+
+    pa_fdaf_free(f);
+    pa_xfree(far);
+    pa_xfree(mic);
+    pa_xfree(out);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("FDAF");
+    tc = tcase_create("fdaf");
+    tcase_add_test(tc, fft_test);
+    tcase_add_test(tc, converge_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
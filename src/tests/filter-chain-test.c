@@ -0,0 +1,192 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <check.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/filter-chain/filter-chain.h>
+
+#define RATE 48000
+#define CHANNELS 2
+#define N_FRAMES 4800
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_FLOAT32NE,
+    .rate = RATE,
+    .channels = CHANNELS
+};
+
+static float buf[N_FRAMES * CHANNELS];
+
+static void fill_sine(double freq, float amplitude) {
+    unsigned i, c;
+
+    for (i = 0; i < N_FRAMES; i++)
+        for (c = 0; c < CHANNELS; c++)
+            buf[i * CHANNELS + c] = amplitude * (float) sin(2 * M_PI * freq * i / RATE);
+}
+
+/* Peak level of the second half of the buffer, after the filters have
+ * settled */
+static float settled_peak(void) {
+    unsigned i;
+    float peak = 0;
+
+    for (i = N_FRAMES / 2 * CHANNELS; i < N_FRAMES * CHANNELS; i++)
+        peak = PA_MAX(peak, fabsf(buf[i]));
+
+    return peak;
+}
+
+START_TEST (parse_test) {
+    static const char * const good[] = {
+        "gain",
+        "gain(db=-6)",
+        "biquad(type=lowpass freq=1000 q=0.7) gain(db=3)",
+        "biquad(type=peaking freq=1000 q=1 gain=6),delay(ms=10), limiter(ceiling=-1 release=20)",
+    };
+    static const char * const bad[] = {
+        "",
+        "foo",
+        "gain(db=-6",
+        "gain(foo=1)",
+        "biquad(type=whatever)",
+        "biquad(freq=30000)",
+        "limiter(ceiling=3)",
+    };
+    unsigned i;
+
+    for (i = 0; i < PA_ELEMENTSOF(good); i++) {
+        pa_filter_chain *c;
+
+        fail_unless((c = pa_filter_chain_new(good[i], &ss)) != NULL, "'%s' was rejected", good[i]);
+        pa_filter_chain_free(c);
+    }
+
+    for (i = 0; i < PA_ELEMENTSOF(bad); i++)
+        fail_unless(pa_filter_chain_new(bad[i], &ss) == NULL, "'%s' was accepted", bad[i]);
+}
+END_TEST
+
+START_TEST (gain_test) {
+    pa_filter_chain *c;
+
+    fail_unless((c = pa_filter_chain_new("gain(db=-6) gain(db=-6)", &ss)) != NULL);
+
+    fill_sine(1000, 1.0f);
+    pa_filter_chain_process(c, buf, N_FRAMES);
+    fail_unless(fabsf(settled_peak() - 0.251f) < 0.001f);
+
+    pa_filter_chain_free(c);
+}
+END_TEST
+
+START_TEST (biquad_test) {
+    pa_filter_chain *c;
+
+    fail_unless((c = pa_filter_chain_new("biquad(type=lowpass freq=1000)", &ss)) != NULL);
+
+    /* Well inside the pass band */
+    fill_sine(50, 1.0f);
+    pa_filter_chain_process(c, buf, N_FRAMES);
+    fail_unless(fabsf(settled_peak() - 1.0f) < 0.01f);
+
+    /* Two octaves above the corner, 24 dB down */
+    pa_filter_chain_reset(c);
+    fill_sine(4000, 1.0f);
+    pa_filter_chain_process(c, buf, N_FRAMES);
+    fail_unless(settled_peak() < 0.07f);
+
+    pa_filter_chain_free(c);
+
+    fail_unless((c = pa_filter_chain_new("biquad(type=peaking freq=1000 q=1 gain=6)", &ss)) != NULL);
+
+    fill_sine(1000, 0.25f);
+    pa_filter_chain_process(c, buf, N_FRAMES);
+    fail_unless(fabsf(settled_peak() - 0.5f) < 0.01f);
+
+    pa_filter_chain_free(c);
+}
+END_TEST
+
+START_TEST (delay_test) {
+    pa_filter_chain *c;
+    unsigned i;
+
+    fail_unless((c = pa_filter_chain_new("delay(ms=10) gain delay(ms=5)", &ss)) != NULL);
+    fail_unless(pa_filter_chain_get_latency(c) == RATE * 15 / 1000);
+
+    memset(buf, 0, sizeof(buf));
+    buf[0] = buf[1] = 1.0f;
+    pa_filter_chain_process(c, buf, N_FRAMES);
+
+    for (i = 0; i < N_FRAMES * CHANNELS; i++)
+        fail_unless(buf[i] == (i / CHANNELS == RATE * 15 / 1000 ? 1.0f : 0.0f));
+
+    pa_filter_chain_free(c);
+}
+END_TEST
+
+START_TEST (limiter_test) {
+    pa_filter_chain *c;
+
+    fail_unless((c = pa_filter_chain_new("gain(db=12) limiter(ceiling=-6)", &ss)) != NULL);
+
+    fill_sine(1000, 0.5f);
+    pa_filter_chain_process(c, buf, N_FRAMES);
+    fail_unless(settled_peak() <= 0.502f);
+    fail_unless(settled_peak() > 0.45f);
+
+    pa_filter_chain_free(c);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Filter Chain");
+    tc = tcase_create("filterchain");
+    tcase_add_test(tc, parse_test);
+    tcase_add_test(tc, gain_test);
+    tcase_add_test(tc, biquad_test);
+    tcase_add_test(tc, delay_test);
+    tcase_add_test(tc, limiter_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
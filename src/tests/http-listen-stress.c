@@ -0,0 +1,210 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+/* Opens a lot of concurrent /listen connections to the HTTP protocol
+ * module on the loopback interface and checks that all of them receive
+ * data, even though one of them never reads anything. This expects the
+ * daemon to run module-http-protocol-tcp with listen-fanout=1 and a
+ * high enough max-connections. */
+
+#define HTTP_PORT 4714
+#define N_CLIENTS 64
+#define RUN_SECONDS 5
+#define SOURCE_NAME "null.monitor"
+
+struct client {
+    int fd;
+    bool header_done;
+    bool ok;
+    size_t header_length;
+    char header[1024];
+    uint64_t bytes;
+};
+
+static struct client clients[N_CLIENTS];
+static const char *source_name = SOURCE_NAME;
+
+static int client_connect(void) {
+    struct sockaddr_in sa;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    fail_unless(fd >= 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(HTTP_PORT);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) < 0) {
+        fprintf(stderr, "connect(): %s\n", strerror(errno));
+        fail();
+    }
+
+    return fd;
+}
+
+static void client_handle_data(struct client *c, const char *buf, size_t n) {
+    size_t l;
+    char *e;
+
+    if (c->header_done) {
+        c->bytes += n;
+        return;
+    }
+
+    l = PA_MIN(n, sizeof(c->header) - 1 - c->header_length);
+    memcpy(c->header + c->header_length, buf, l);
+    c->header_length += l;
+    c->header[c->header_length] = 0;
+
+    if (!(e = strstr(c->header, "\n\n")))
+        return;
+
+    c->header_done = true;
+    c->ok = strncmp(c->header, "HTTP/1.0 200 OK", 15) == 0;
+
+    /* Whatever follows the empty line is already audio data */
+    c->bytes += c->header_length - (size_t) (e + 2 - c->header);
+    if (n > l)
+        c->bytes += n - l;
+}
+
+START_TEST (http_listen_stress_test) {
+    struct pollfd pollfd[N_CLIENTS];
+    pa_usec_t start, now;
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < N_CLIENTS; i++) {
+        char *request;
+
+        memset(&clients[i], 0, sizeof(clients[i]));
+        clients[i].fd = client_connect();
+
+        request = pa_sprintf_malloc("GET /listen/source/%s HTTP/1.0\n\n", source_name);
+        fail_unless(write(clients[i].fd, request, strlen(request)) == (ssize_t) strlen(request));
+        pa_xfree(request);
+
+        fail_unless(fcntl(clients[i].fd, F_SETFL, O_NONBLOCK) >= 0);
+    }
+
+    start = pa_rtclock_now();
+
+    do {
+        int n;
+
+        /* Client 0 stops reading right after the header to simulate a
+         * listener on a stalled network link */
+        for (i = 0; i < N_CLIENTS; i++) {
+            pollfd[i].fd = clients[i].fd;
+            pollfd[i].events = (i == 0 && clients[i].header_done) ? 0 : POLLIN;
+            pollfd[i].revents = 0;
+        }
+
+        n = poll(pollfd, N_CLIENTS, 100);
+        fail_unless(n >= 0);
+
+        for (i = 0; i < N_CLIENTS; i++) {
+            char buf[4096];
+            ssize_t r;
+
+            if (!(pollfd[i].revents & (POLLIN|POLLHUP)))
+                continue;
+
+            if ((r = read(clients[i].fd, buf, sizeof(buf))) <= 0) {
+                if (r < 0 && errno == EAGAIN)
+                    continue;
+
+                fprintf(stderr, "Client %i lost its connection.\n", i);
+                fail();
+            }
+
+            client_handle_data(&clients[i], buf, (size_t) r);
+        }
+
+        now = pa_rtclock_now();
+    } while (now - start < RUN_SECONDS * PA_USEC_PER_SEC);
+
+    for (i = 0; i < N_CLIENTS; i++) {
+        fail_unless(clients[i].header_done);
+        fail_unless(clients[i].ok);
+
+        /* Everybody but the stalled client has to get its data */
+        if (i > 0) {
+            fail_unless(clients[i].bytes > 0);
+            total += clients[i].bytes;
+        }
+
+        pa_close(clients[i].fd);
+    }
+
+    fprintf(stderr, "%i listeners received %llu bytes in %i s (%llu bytes/s per listener).\n",
+            N_CLIENTS - 1, (unsigned long long) total, RUN_SECONDS,
+            (unsigned long long) (total / (N_CLIENTS - 1) / RUN_SECONDS));
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (argc > 1)
+        source_name = argv[1];
+
+    s = suite_create("HTTP Listen Stress");
+    tc = tcase_create("httplistenstress");
+    tcase_add_test(tc, http_listen_stress_test);
+    tcase_set_timeout(tc, 2 * RUN_SECONDS);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,382 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* Renders a stream across sink rewinds and compares what the sink
+ * played with a run that had no rewinds, with and without lazy
+ * rewinds. */
+
+#define BLOCK 4096
+#define MAX_REWIND (8 * BLOCK)
+
+enum {
+    SINK_MESSAGE_RUN = PA_SINK_MESSAGE_MAX
+};
+
+typedef struct step {
+    bool rewind;
+    size_t nbytes;
+} step;
+
+typedef struct script {
+    const step *steps;
+    unsigned n_steps;
+    uint8_t *out;
+    size_t length;
+} script;
+
+typedef struct stream {
+    pa_sample_spec ss;
+    uint64_t pos;
+    bool underrun;
+} stream;
+
+static const pa_sample_spec sink_ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static pa_mainloop *mainloop;
+static pa_core *core;
+static pa_rtpoll *rtpoll;
+static pa_thread_mq thread_mq;
+static pa_thread *thread;
+static pa_sink *sink;
+
+/* Called from IO thread context */
+static void run_script(script *sc) {
+    unsigned n;
+
+    for (n = 0; n < sc->n_steps; n++) {
+        const step *st = sc->steps + n;
+
+        if (sink->thread_info.rewind_requested)
+            pa_sink_process_rewind(sink, 0);
+
+        if (st->rewind) {
+            fail_unless(st->nbytes <= sc->length);
+            pa_sink_process_rewind(sink, st->nbytes);
+            sc->length -= st->nbytes;
+        } else {
+            size_t left;
+
+            for (left = st->nbytes; left > 0; left -= BLOCK) {
+                pa_memchunk chunk;
+                void *p;
+
+                pa_sink_render_full(sink, BLOCK, &chunk);
+                fail_unless(chunk.length == BLOCK);
+
+                sc->out = pa_xrealloc(sc->out, sc->length + BLOCK);
+                p = pa_memblock_acquire(chunk.memblock);
+                memcpy(sc->out + sc->length, (uint8_t *) p + chunk.index, BLOCK);
+                pa_memblock_release(chunk.memblock);
+                pa_memblock_unref(chunk.memblock);
+
+                sc->length += BLOCK;
+            }
+        }
+    }
+}
+
+/* Called from IO thread context */
+static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    switch (code) {
+        case SINK_MESSAGE_RUN:
+            run_script(data);
+            return 0;
+
+        case PA_SINK_MESSAGE_GET_LATENCY:
+            *((int64_t*) data) = 0;
+            return 0;
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+static void thread_func(void *userdata) {
+    pa_thread_mq_install(&thread_mq);
+
+    /* Everything is driven by the messages we get */
+    while (pa_rtpoll_run(rtpoll, true) > 0)
+        ;
+}
+
+static void drain_mainloop(void) {
+    while (pa_mainloop_iterate(mainloop, 0, NULL) > 0)
+        ;
+}
+
+static void sink_setup(bool lazy) {
+    pa_sink_new_data data;
+
+    mainloop = pa_mainloop_new();
+    fail_unless(mainloop != NULL);
+
+    core = pa_core_new(pa_mainloop_get_api(mainloop), false, false, -1, 0);
+    fail_unless(core != NULL);
+    core->lazy_rewind = lazy;
+
+    rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&thread_mq, core->mainloop, rtpoll);
+
+    pa_sink_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_new_data_set_name(&data, "lazy-rewind-test");
+    pa_sink_new_data_set_sample_spec(&data, &sink_ss);
+    sink = pa_sink_new(core, &data, 0);
+    pa_sink_new_data_done(&data);
+    fail_unless(sink != NULL);
+
+    sink->parent.process_msg = sink_process_msg;
+    pa_sink_set_asyncmsgq(sink, thread_mq.inq);
+    pa_sink_set_rtpoll(sink, rtpoll);
+    pa_sink_set_max_rewind(sink, MAX_REWIND);
+    pa_sink_set_max_request(sink, BLOCK);
+    pa_sink_set_fixed_latency(sink, pa_bytes_to_usec(MAX_REWIND, &sink_ss));
+
+    thread = pa_thread_new("lazy-rewind-test", thread_func, NULL);
+    fail_unless(thread != NULL);
+
+    pa_sink_put(sink);
+    drain_mainloop();
+}
+
+static void sink_teardown(void) {
+    pa_sink_unlink(sink);
+    drain_mainloop();
+
+    pa_asyncmsgq_send(thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(thread);
+    pa_thread_mq_done(&thread_mq);
+
+    pa_sink_unref(sink);
+    pa_rtpoll_free(rtpoll);
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+}
+
+/* Called from IO thread context. Hands out a sine that only depends on
+ * the position in the stream, so whatever is rendered again is the
+ * same as before. */
+static int stream_pop(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    stream *st = i->userdata;
+    size_t fs = pa_frame_size(&st->ss), n, c;
+    void *p;
+
+    if (st->underrun) {
+        st->underrun = false;
+        return -1;
+    }
+
+    nbytes = PA_MIN(pa_frame_align(nbytes, &st->ss), (size_t) BLOCK);
+    fail_unless(nbytes > 0);
+
+    chunk->memblock = pa_memblock_new(i->core->mempool, nbytes);
+    chunk->index = 0;
+    chunk->length = nbytes;
+
+    p = pa_memblock_acquire(chunk->memblock);
+
+    for (n = 0; n < nbytes / fs; n++) {
+        double v = 0.5 * sin(2.0 * M_PI * 441.0 * (double) (st->pos + n) / st->ss.rate);
+
+        for (c = 0; c < st->ss.channels; c++) {
+            if (st->ss.format == PA_SAMPLE_FLOAT32NE)
+                ((float *) p)[n * st->ss.channels + c] = (float) v;
+            else
+                ((int16_t *) p)[n * st->ss.channels + c] = (int16_t) lrint(v * 0x7fff);
+        }
+    }
+
+    pa_memblock_release(chunk->memblock);
+
+    st->pos += nbytes / fs;
+
+    return 0;
+}
+
+/* Called from IO thread context */
+static void stream_process_rewind(pa_sink_input *i, size_t nbytes) {
+    stream *st = i->userdata;
+    uint64_t frames = nbytes / pa_frame_size(&st->ss);
+
+    st->pos = frames > st->pos ? 0 : st->pos - frames;
+}
+
+/* Called from IO thread context. The stream can always be rendered
+ * again, so there is nothing to keep. */
+static void stream_update_max_rewind(pa_sink_input *i, size_t nbytes) {
+}
+
+static void stream_kill(pa_sink_input *i) {
+}
+
+/* Plays the stream on a fresh sink through the given script and
+ * returns what the sink rendered */
+static uint8_t *play(bool lazy, const pa_sample_spec *ss, bool underrun, const step *steps, unsigned n_steps, size_t *length) {
+    pa_sink_input_new_data data;
+    pa_sink_input *i = NULL;
+    stream st;
+    script sc;
+
+    sink_setup(lazy);
+
+    st.ss = *ss;
+    st.pos = 0;
+    st.underrun = underrun;
+
+    pa_sink_input_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_input_new_data_set_sink(&data, sink, false);
+    pa_sink_input_new_data_set_sample_spec(&data, ss);
+    fail_unless(pa_sink_input_new(&i, core, &data) >= 0);
+    pa_sink_input_new_data_done(&data);
+
+    i->pop = stream_pop;
+    i->process_rewind = stream_process_rewind;
+    i->update_max_rewind = stream_update_max_rewind;
+    i->kill = stream_kill;
+    i->userdata = &st;
+
+    pa_sink_input_put(i);
+    drain_mainloop();
+
+    sc.steps = steps;
+    sc.n_steps = n_steps;
+    sc.out = NULL;
+    sc.length = 0;
+
+    pa_assert_se(pa_asyncmsgq_send(sink->asyncmsgq, PA_MSGOBJECT(sink), SINK_MESSAGE_RUN, &sc, 0, NULL) == 0);
+    drain_mainloop();
+
+    pa_sink_input_unlink(i);
+    pa_sink_input_unref(i);
+    drain_mainloop();
+
+    sink_teardown();
+
+    *length = sc.length;
+    return sc.out;
+}
+
+static void compare(bool lazy, const pa_sample_spec *ss, bool underrun, const step *steps, unsigned n_steps, const step *ref_steps, unsigned n_ref_steps) {
+    uint8_t *out, *ref;
+    size_t length, ref_length;
+
+    out = play(lazy, ss, underrun, steps, n_steps, &length);
+    ref = play(lazy, ss, underrun, ref_steps, n_ref_steps, &ref_length);
+
+    pa_log_debug("%s %s %u Hz%s: %lu bytes", lazy ? "lazy" : "history", pa_sample_format_to_string(ss->format),
+                 ss->rate, underrun ? " after an underrun" : "", (unsigned long) length);
+
+    fail_unless(length <= ref_length);
+    fail_unless(memcmp(out, ref, length) == 0);
+
+    pa_xfree(out);
+    pa_xfree(ref);
+}
+
+static const pa_sample_spec stream_specs[] = {
+    /* No resampler */
+    { .format = PA_SAMPLE_S16NE, .rate = 44100, .channels = 2 },
+    /* A format conversion only */
+    { .format = PA_SAMPLE_FLOAT32NE, .rate = 44100, .channels = 2 },
+    /* A resampler with state */
+    { .format = PA_SAMPLE_S16NE, .rate = 48000, .channels = 2 }
+};
+
+START_TEST (rewind_test) {
+    static const step steps[] = {
+        { false, 16 * BLOCK },
+        { true, 6 * BLOCK },
+        { false, 16 * BLOCK }
+    };
+    static const step ref_steps[] = {
+        { false, 26 * BLOCK }
+    };
+    unsigned n;
+
+    for (n = 0; n < PA_ELEMENTSOF(stream_specs); n++) {
+        compare(false, &stream_specs[n], false, steps, PA_ELEMENTSOF(steps), ref_steps, PA_ELEMENTSOF(ref_steps));
+        compare(true, &stream_specs[n], false, steps, PA_ELEMENTSOF(steps), ref_steps, PA_ELEMENTSOF(ref_steps));
+    }
+}
+END_TEST
+
+/* The first block is silence from an underrun, so the rewind goes back
+ * further than the oldest checkpoint */
+START_TEST (oldest_checkpoint_test) {
+    static const step steps[] = {
+        { false, 4 * BLOCK },
+        { true, 3 * BLOCK + BLOCK / 2 },
+        { false, 6 * BLOCK }
+    };
+    static const step ref_steps[] = {
+        { false, 7 * BLOCK }
+    };
+
+    compare(false, &stream_specs[0], true, steps, PA_ELEMENTSOF(steps), ref_steps, PA_ELEMENTSOF(ref_steps));
+    compare(true, &stream_specs[0], true, steps, PA_ELEMENTSOF(steps), ref_steps, PA_ELEMENTSOF(ref_steps));
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Lazy Rewind");
+    tc = tcase_create("lazy-rewind");
+    tcase_add_test(tc, rewind_test);
+    tcase_add_test(tc, oldest_checkpoint_test);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -22,15 +22,25 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <check.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/log.h>
 #include <pulsecore/memblock.h>
+#include <pulsecore/shm.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/atomic.h>
+
+#define N_THREADS 4
+#define N_SHARED 64
+#define N_ITERATIONS 200000
 
 static void release_cb(pa_memimport *i, uint32_t block_id, void *userdata) {
     pa_log("%s: Imported block %u is released.", (char*) userdata, block_id);
@@ -54,6 +64,8 @@ static void print_stats(pa_mempool *p, const char *text) {
                  "\texported_size = %u\n"
                  "\tn_too_large_for_pool = %u\n"
                  "\tn_pool_full = %u\n"
+                 "\tn_slots_used = %u\n"
+                 "\tn_large_slots_used = %u\n"
                  "}",
            text,
            (unsigned) pa_atomic_load(&s->n_allocated),
@@ -65,7 +77,9 @@ static void print_stats(pa_mempool *p, const char *text) {
            (unsigned) pa_atomic_load(&s->imported_size),
            (unsigned) pa_atomic_load(&s->exported_size),
            (unsigned) pa_atomic_load(&s->n_too_large_for_pool),
-           (unsigned) pa_atomic_load(&s->n_pool_full));
+           (unsigned) pa_atomic_load(&s->n_pool_full),
+           (unsigned) pa_atomic_load(&s->n_slots_used),
+           (unsigned) pa_atomic_load(&s->n_large_slots_used));
 }
 
 START_TEST (memblock_test) {
@@ -75,7 +89,7 @@ START_TEST (memblock_test) {
     pa_memimport *import_b, *import_c;
     pa_memblock *mb_a, *mb_b, *mb_c;
     int r, i;
-    pa_memblock* blocks[5];
+    pa_memblock* blocks[6];
     uint32_t id, shm_id;
     size_t offset, size;
     char *x;
@@ -105,8 +119,15 @@ START_TEST (memblock_test) {
     snprintf(x, pa_memblock_get_length(blocks[2]), "%s", txt);
     pa_memblock_release(blocks[2]);
 
-    blocks[3] = pa_memblock_new_malloced(pool_a, pa_xstrdup(txt), sizeof(txt));
-    blocks[4] = NULL;
+    /* Too large for a normal slot, but not for a large one */
+    blocks[3] = pa_memblock_new_pool(pool_a, 2 * pa_mempool_block_size_max(pool_a));
+    fail_unless(blocks[3] != NULL);
+    x = pa_memblock_acquire(blocks[3]);
+    snprintf(x, pa_memblock_get_length(blocks[3]), "%s", txt);
+    pa_memblock_release(blocks[3]);
+
+    blocks[4] = pa_memblock_new_malloced(pool_a, pa_xstrdup(txt), sizeof(txt));
+    blocks[5] = NULL;
 
     for (i = 0; blocks[i]; i++) {
         pa_log("Memory block %u", i);
@@ -177,6 +198,121 @@ START_TEST (memblock_test) {
 }
 END_TEST
 
+/* Huge pages are optional, but whatever the pool got must add up */
+START_TEST (memblock_huge_pages_test) {
+    pa_mempool *pool;
+    const pa_mempool_stat *stat;
+    pa_memblock *b;
+    unsigned i;
+
+    for (i = 0; i < 2; i++) {
+        pool = pa_mempool_new_full(i > 0, 0, true, -1);
+        fail_unless(pool != NULL);
+
+        stat = pa_mempool_get_stat(pool);
+        pa_log("%s pool: %u %s pages of %u bytes", i > 0 ? "Shared" : "Private",
+               (unsigned) pa_atomic_load(&stat->n_pages),
+               pa_shm_pages_to_string(pa_atomic_load(&stat->pages)),
+               (unsigned) pa_atomic_load(&stat->page_size));
+
+        fail_unless(pa_atomic_load(&stat->page_size) > 0);
+        fail_unless(pa_atomic_load(&stat->n_pages) > 0);
+        fail_unless(pa_atomic_load(&stat->numa_node) == -1);
+
+        b = pa_memblock_new_pool(pool, 1024);
+        fail_unless(b != NULL);
+        memset(pa_memblock_acquire(b), 0x55, 1024);
+        pa_memblock_release(b);
+        pa_memblock_unref(b);
+
+        pa_mempool_vacuum(pool);
+        pa_mempool_free(pool);
+    }
+}
+END_TEST
+
+struct stress {
+    pa_mempool *pool;
+    pa_atomic_ptr_t shared[N_SHARED];
+};
+
+/* Allocates blocks and swaps them with the ones other threads left
+ * behind, so that about every block is freed in another thread than
+ * the one which allocated it */
+static void stress_thread(void *userdata) {
+    struct stress *s = userdata;
+    size_t max = pa_mempool_block_size_max(s->pool);
+    uint32_t r = (uint32_t) (uintptr_t) pa_thread_self();
+    unsigned n;
+
+    for (n = 0; n < N_ITERATIONS; n++) {
+        pa_memblock *b, *old;
+        size_t length;
+
+        r = r * 1103515245 + 12345;
+
+        /* Every 16th block needs a large slot */
+        length = (r >> 8) % 16 == 0 ? 2 * max : 1 + (r >> 12) % max;
+
+        b = pa_memblock_new(s->pool, length);
+
+        if ((old = pa_atomic_ptr_load(&s->shared[(r >> 16) % N_SHARED]))) {
+            if (pa_atomic_ptr_cmpxchg(&s->shared[(r >> 16) % N_SHARED], old, b)) {
+                pa_memblock_unref(old);
+                continue;
+            }
+        } else if (pa_atomic_ptr_cmpxchg(&s->shared[(r >> 16) % N_SHARED], NULL, b))
+            continue;
+
+        pa_memblock_unref(b);
+    }
+}
+
+START_TEST (memblock_stress_test) {
+    struct stress s;
+    pa_thread *threads[N_THREADS];
+    const pa_mempool_stat *stat;
+    pa_usec_t t;
+    unsigned i;
+
+    s.pool = pa_mempool_new(false, 0);
+    fail_unless(s.pool != NULL);
+
+    for (i = 0; i < N_SHARED; i++)
+        pa_atomic_ptr_store(&s.shared[i], NULL);
+
+    t = pa_rtclock_now();
+
+    for (i = 0; i < N_THREADS; i++)
+        fail_unless((threads[i] = pa_thread_new("stress", stress_thread, &s)) != NULL);
+
+    for (i = 0; i < N_THREADS; i++)
+        pa_thread_free(threads[i]);
+
+    t = pa_rtclock_now() - t;
+
+    pa_log("%u threads did %u allocations in %0.2f ms, that is %0.0f allocations per second.",
+           N_THREADS, N_THREADS * N_ITERATIONS, (double) t / PA_USEC_PER_MSEC,
+           (double) N_THREADS * N_ITERATIONS * PA_USEC_PER_SEC / (double) PA_MAX(t, 1U));
+
+    for (i = 0; i < N_SHARED; i++) {
+        pa_memblock *b;
+
+        if ((b = pa_atomic_ptr_load(&s.shared[i])))
+            pa_memblock_unref(b);
+    }
+
+    print_stats(s.pool, "Stress");
+
+    stat = pa_mempool_get_stat(s.pool);
+    fail_unless(pa_atomic_load(&stat->n_allocated) == 0);
+    fail_unless(pa_atomic_load(&stat->n_slots_used) == 0);
+    fail_unless(pa_atomic_load(&stat->n_large_slots_used) == 0);
+
+    pa_mempool_free(s.pool);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -189,6 +325,10 @@ int main(int argc, char *argv[]) {
     s = suite_create("Memblock");
     tc = tcase_create("memblock");
     tcase_add_test(tc, memblock_test);
+    tcase_add_test(tc, memblock_huge_pages_test);
+    tcase_add_test(tc, memblock_stress_test);
+    /* The stress test takes a while under valgrind */
+    tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -22,13 +22,109 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 #include <pulse/sample.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/resampler.h>
+#include <pulsecore/cpu-x86.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/memblock.h>
 
+#define FRAMES 1024
+#define TIMES 1000
+
+/* Remixes the same random frames as s16 and as float and checks that
+ * both agree, which compares the fixed point matrix with the float one,
+ * then times the remixing. Returns the number of mismatching samples. */
+static unsigned remix(pa_mempool *pool, const pa_sample_spec *ss1, const pa_channel_map *map1,
+                      const pa_sample_spec *ss2, const pa_channel_map *map2) {
+    pa_sample_spec s16_ss1 = *ss1, s16_ss2 = *ss2, f_ss1 = *ss1, f_ss2 = *ss2;
+    pa_resampler *r_s16, *r_f;
+    pa_memchunk in_s16, in_f, out_s16, out_f;
+    const int16_t *o_s16;
+    const float *o_f;
+    int16_t *i_s16;
+    float *i_f;
+    unsigned i, k, bad = 0;
+    pa_usec_t t_s16, t_f;
+
+    s16_ss1.format = s16_ss2.format = PA_SAMPLE_S16NE;
+    f_ss1.format = f_ss2.format = PA_SAMPLE_FLOAT32NE;
+
+    r_s16 = pa_resampler_new(pool, &s16_ss1, map1, &s16_ss2, map2, PA_RESAMPLER_AUTO, 0);
+    r_f = pa_resampler_new(pool, &f_ss1, map1, &f_ss2, map2, PA_RESAMPLER_AUTO, 0);
+
+    in_s16.index = in_f.index = 0;
+    in_s16.length = FRAMES * pa_frame_size(&s16_ss1);
+    in_f.length = FRAMES * pa_frame_size(&f_ss1);
+    in_s16.memblock = pa_memblock_new(pool, in_s16.length);
+    in_f.memblock = pa_memblock_new(pool, in_f.length);
+
+    i_s16 = pa_memblock_acquire(in_s16.memblock);
+    i_f = pa_memblock_acquire(in_f.memblock);
+
+    for (i = 0; i < FRAMES * ss1->channels; i++) {
+        i_s16[i] = (int16_t) (rand() - RAND_MAX / 2);
+        i_f[i] = i_s16[i] / (float) 0x8000;
+    }
+
+    pa_memblock_release(in_s16.memblock);
+    pa_memblock_release(in_f.memblock);
+
+    pa_resampler_run(r_s16, &in_s16, &out_s16);
+    pa_resampler_run(r_f, &in_f, &out_f);
+
+    pa_assert_se(out_s16.length / pa_frame_size(&s16_ss2) == FRAMES);
+    pa_assert_se(out_f.length / pa_frame_size(&f_ss2) == FRAMES);
+
+    o_s16 = pa_memblock_acquire_chunk(&out_s16);
+    o_f = pa_memblock_acquire_chunk(&out_f);
+
+    /* The s16 gains are rounded and the products truncated, which may
+     * cost about one LSB per input channel */
+    for (i = 0; i < FRAMES * ss2->channels; i++) {
+        float expected = o_f[i] * 0x8000;
+
+        if (fabsf(expected - o_s16[i]) > ss1->channels + 1) {
+            if (bad++ < 4)
+                pa_log_error("Sample %u mismatch: %d vs. %f", i, o_s16[i], expected);
+        }
+    }
+
+    pa_memblock_release(out_s16.memblock);
+    pa_memblock_release(out_f.memblock);
+    pa_memblock_unref(out_s16.memblock);
+    pa_memblock_unref(out_f.memblock);
+
+    t_s16 = pa_rtclock_now();
+    for (k = 0; k < TIMES; k++) {
+        pa_resampler_run(r_s16, &in_s16, &out_s16);
+        pa_memblock_unref(out_s16.memblock);
+    }
+    t_s16 = pa_rtclock_now() - t_s16;
+
+    t_f = pa_rtclock_now();
+    for (k = 0; k < TIMES; k++) {
+        pa_resampler_run(r_f, &in_f, &out_f);
+        pa_memblock_unref(out_f.memblock);
+    }
+    t_f = pa_rtclock_now() - t_f;
+
+    pa_log_info("%u frames %u times: s16 %llu usec, float %llu usec.", FRAMES, TIMES,
+                (unsigned long long) t_s16, (unsigned long long) t_f);
+
+    pa_memblock_unref(in_s16.memblock);
+    pa_memblock_unref(in_f.memblock);
+
+    pa_resampler_free(r_s16);
+    pa_resampler_free(r_f);
+
+    return bad;
+}
+
 int main(int argc, char *argv[]) {
 
     static const pa_channel_map maps[] = {
@@ -47,11 +143,19 @@ int main(int argc, char *argv[]) {
         { 0, { 0 } }
     };
 
-    unsigned i, j;
+    unsigned i, j, bad = 0;
     pa_mempool *pool;
+#if defined (__i386__) || defined (__amd64__)
+    pa_cpu_x86_flag_t flags = 0;
+#endif
 
     pa_log_set_level(PA_LOG_DEBUG);
 
+    /* Check the remappers that would be used for real */
+#if defined (__i386__) || defined (__amd64__)
+    pa_cpu_init_x86(&flags);
+#endif
+
     pa_assert_se(pool = pa_mempool_new(false, 0));
 
     for (i = 0; maps[i].channels > 0; i++)
@@ -59,6 +163,7 @@ int main(int argc, char *argv[]) {
             char a[PA_CHANNEL_MAP_SNPRINT_MAX], b[PA_CHANNEL_MAP_SNPRINT_MAX];
             pa_resampler *r;
             pa_sample_spec ss1, ss2;
+            unsigned n;
 
             pa_log_info("Converting from '%s' to '%s'.\n", pa_channel_map_snprint(a, sizeof(a), &maps[i]), pa_channel_map_snprint(b, sizeof(b), &maps[j]));
 
@@ -74,9 +179,14 @@ int main(int argc, char *argv[]) {
              * see the remixing debug output. */
 
             pa_resampler_free(r);
+
+            if ((n = remix(pool, &ss1, &maps[i], &ss2, &maps[j])) > 0) {
+                pa_log_error("%u samples differ between s16 and float.", n);
+                bad += n;
+            }
         }
 
     pa_mempool_free(pool);
 
-    return 0;
+    return bad > 0 ? 1 : 0;
 }
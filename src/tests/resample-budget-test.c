@@ -0,0 +1,363 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/resample-budget.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* Plays a resampled stream on a sink with a resampler CPU budget, has
+ * the budget switch its resampler down and up the quality ladder, and
+ * checks that the switches fade over without a click. */
+
+#define BLOCK 1024
+#define POP_FRAMES 128
+
+enum {
+    SINK_MESSAGE_RENDER = PA_SINK_MESSAGE_MAX,
+    SINK_MESSAGE_REWRITE
+};
+
+static const pa_sample_spec sink_ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static const pa_sample_spec stream_ss = {
+    .format = PA_SAMPLE_S16NE,
+    .rate = 48000,
+    .channels = 2
+};
+
+static pa_mainloop *mainloop;
+static pa_core *core;
+static pa_rtpoll *rtpoll;
+static pa_thread_mq thread_mq;
+static pa_thread *thread;
+static pa_sink *sink;
+static pa_sink_input *input;
+
+static uint64_t stream_pos;
+static int16_t *out;
+static size_t out_frames;
+
+/* Called from IO thread context */
+static void render(size_t nbytes) {
+    size_t fs = pa_frame_size(&sink_ss);
+
+    for (; nbytes > 0; nbytes -= BLOCK) {
+        pa_memchunk chunk;
+        void *p;
+
+        if (sink->thread_info.rewind_requested)
+            pa_sink_process_rewind(sink, 0);
+
+        pa_sink_render_full(sink, BLOCK, &chunk);
+        fail_unless(chunk.length == BLOCK);
+
+        out = pa_xrealloc(out, out_frames * fs + BLOCK);
+        p = pa_memblock_acquire(chunk.memblock);
+        memcpy((uint8_t *) out + out_frames * fs, (uint8_t *) p + chunk.index, BLOCK);
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+
+        out_frames += BLOCK / fs;
+    }
+}
+
+/* Called from IO thread context. Has the input render the last nbytes
+ * again, like a client that writes over what it has sent before. */
+static void rewrite(size_t nbytes) {
+    size_t n;
+
+    pa_sink_input_request_rewind(input, nbytes, true, false, false);
+    fail_unless(sink->thread_info.rewind_requested);
+
+    n = PA_MIN(sink->thread_info.rewind_nbytes, out_frames * pa_frame_size(&sink_ss));
+    pa_sink_process_rewind(sink, n);
+    out_frames -= n / pa_frame_size(&sink_ss);
+}
+
+/* Called from IO thread context */
+static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    switch (code) {
+        case SINK_MESSAGE_RENDER:
+            render((size_t) offset);
+            return 0;
+
+        case SINK_MESSAGE_REWRITE:
+            rewrite((size_t) offset);
+            return 0;
+
+        case PA_SINK_MESSAGE_GET_LATENCY:
+            *((int64_t*) data) = 0;
+            return 0;
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+static void thread_func(void *userdata) {
+    pa_thread_mq_install(&thread_mq);
+
+    /* Everything is driven by the messages we get */
+    while (pa_rtpoll_run(rtpoll, true) > 0)
+        ;
+}
+
+static void drain_mainloop(void) {
+    while (pa_mainloop_iterate(mainloop, 0, NULL) > 0)
+        ;
+}
+
+static void run(int code, size_t nbytes) {
+    pa_assert_se(pa_asyncmsgq_send(sink->asyncmsgq, PA_MSGOBJECT(sink), code, NULL, (int64_t) nbytes, NULL) == 0);
+    drain_mainloop();
+}
+
+/* Called from IO thread context. A sine that only depends on the
+ * position in the stream. */
+static int stream_pop(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    size_t fs = pa_frame_size(&stream_ss), n, c;
+    int16_t *d;
+
+    /* Small pieces, so that a fade takes several of them */
+    nbytes = PA_MIN(pa_frame_align(nbytes, &stream_ss), POP_FRAMES * fs);
+    fail_unless(nbytes > 0);
+
+    chunk->memblock = pa_memblock_new(i->core->mempool, nbytes);
+    chunk->index = 0;
+    chunk->length = nbytes;
+
+    d = pa_memblock_acquire(chunk->memblock);
+
+    for (n = 0; n < nbytes / fs; n++)
+        for (c = 0; c < stream_ss.channels; c++)
+            *(d++) = (int16_t) lrint(0x4000 * sin(2.0 * M_PI * 441.0 * (double) (stream_pos + n) / stream_ss.rate));
+
+    pa_memblock_release(chunk->memblock);
+
+    stream_pos += nbytes / fs;
+
+    return 0;
+}
+
+/* Called from IO thread context */
+static void stream_process_rewind(pa_sink_input *i, size_t nbytes) {
+    uint64_t frames = nbytes / pa_frame_size(&stream_ss);
+
+    stream_pos = frames > stream_pos ? 0 : stream_pos - frames;
+}
+
+static void stream_kill(pa_sink_input *i) {
+}
+
+static void setup(void) {
+    pa_sink_new_data data;
+    pa_sink_input_new_data idata;
+    size_t max_rewind;
+
+    mainloop = pa_mainloop_new();
+    fail_unless(mainloop != NULL);
+
+    core = pa_core_new(pa_mainloop_get_api(mainloop), false, false, -1, 0);
+    fail_unless(core != NULL);
+    core->resample_cpu_budget = 50;
+
+    rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&thread_mq, core->mainloop, rtpoll);
+
+    pa_sink_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_new_data_set_name(&data, "resample-budget-test");
+    pa_sink_new_data_set_sample_spec(&data, &sink_ss);
+    sink = pa_sink_new(core, &data, 0);
+    pa_sink_new_data_done(&data);
+    fail_unless(sink != NULL);
+
+    max_rewind = 8 * BLOCK;
+
+    sink->parent.process_msg = sink_process_msg;
+    pa_sink_set_asyncmsgq(sink, thread_mq.inq);
+    pa_sink_set_rtpoll(sink, rtpoll);
+    pa_sink_set_max_rewind(sink, max_rewind);
+    pa_sink_set_max_request(sink, BLOCK);
+    pa_sink_set_fixed_latency(sink, pa_bytes_to_usec(max_rewind, &sink_ss));
+
+    thread = pa_thread_new("resample-budget-test", thread_func, NULL);
+    fail_unless(thread != NULL);
+
+    pa_sink_put(sink);
+    drain_mainloop();
+
+    pa_sink_input_new_data_init(&idata);
+    idata.driver = __FILE__;
+    idata.resample_method = PA_RESAMPLER_FFMPEG;
+    pa_sink_input_new_data_set_sink(&idata, sink, false);
+    pa_sink_input_new_data_set_sample_spec(&idata, &stream_ss);
+    fail_unless(pa_sink_input_new(&input, core, &idata) >= 0);
+    pa_sink_input_new_data_done(&idata);
+
+    input->pop = stream_pop;
+    input->process_rewind = stream_process_rewind;
+    input->kill = stream_kill;
+
+    stream_pos = 0;
+    out = NULL;
+    out_frames = 0;
+
+    pa_sink_input_put(input);
+    drain_mainloop();
+
+    fail_unless(input->actual_resample_method == PA_RESAMPLER_FFMPEG);
+}
+
+static void teardown(void) {
+    pa_sink_input_unlink(input);
+    pa_sink_input_unref(input);
+    drain_mainloop();
+
+    pa_sink_unlink(sink);
+    drain_mainloop();
+
+    pa_asyncmsgq_send(thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(thread);
+    pa_thread_mq_done(&thread_mq);
+
+    pa_sink_unref(sink);
+    pa_rtpoll_free(rtpoll);
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+
+    pa_xfree(out);
+}
+
+/* Runs the main loop until the budget has moved the input to the given
+ * step of the ladder */
+static void wait_for_downgrade(unsigned downgrade) {
+    pa_usec_t until = pa_rtclock_now() + 5 * PA_RESAMPLE_BUDGET_TICK_USEC;
+
+    while (input->resample_downgrade != downgrade) {
+        fail_unless(pa_rtclock_now() < until);
+        fail_unless(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+    }
+}
+
+/* Called while the IO thread is idle */
+static bool input_fading(void) {
+    return input->thread_info.fading_resampler != NULL;
+}
+
+/* The largest change from one frame to the next, in the first channel */
+static unsigned max_step(size_t from) {
+    unsigned m = 0;
+    size_t k;
+
+    for (k = from + 1; k < out_frames; k++)
+        m = PA_MAX(m, (unsigned) abs(out[k * sink_ss.channels] - out[(k - 1) * sink_ss.channels]));
+
+    return m;
+}
+
+START_TEST (downgrade_test) {
+    unsigned allowed;
+
+    /* The sine moves 2 pi 441 / 44100 per frame. Picking the nearest
+     * input frame may take two steps of the stream at once. */
+    allowed = (unsigned) (2.5 * 0x4000 * 2.0 * M_PI * 441.0 / sink_ss.rate);
+
+    setup();
+
+    run(SINK_MESSAGE_RENDER, 8 * BLOCK);
+
+    /* Pretend that resampling took ten seconds */
+    pa_atomic_add(&input->metrics.resample_usec, (int) (10 * PA_USEC_PER_SEC));
+    wait_for_downgrade(1);
+    fail_unless(input->actual_resample_method == pa_resample_method_cheaper(PA_RESAMPLER_FFMPEG));
+
+    run(SINK_MESSAGE_RENDER, BLOCK);
+    fail_unless(input_fading());
+
+    run(SINK_MESSAGE_RENDER, 7 * BLOCK);
+    fail_unless(!input_fading());
+
+    /* Leave out how the filter starts up */
+    pa_log_debug("Largest step %u, allowed %u", max_step(64), allowed);
+    fail_unless(max_step(64) <= allowed);
+
+    /* Resampling takes next to nothing now, so it moves back up */
+    wait_for_downgrade(0);
+    fail_unless(input->actual_resample_method == PA_RESAMPLER_FFMPEG);
+
+    /* A rewrite in the middle of the fade starts it over */
+    run(SINK_MESSAGE_RENDER, BLOCK);
+    fail_unless(input_fading());
+
+    run(SINK_MESSAGE_REWRITE, 2 * BLOCK);
+    fail_unless(input_fading());
+    fail_unless(input->thread_info.fade_done == 0);
+
+    run(SINK_MESSAGE_RENDER, 8 * BLOCK);
+    fail_unless(!input_fading());
+
+    teardown();
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Resample Budget");
+    tc = tcase_create("resample-budget");
+    tcase_add_test(tc, downgrade_test);
+    tcase_set_timeout(tc, 30);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
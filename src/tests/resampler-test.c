@@ -22,6 +22,7 @@
 #endif
 
 #include <stdio.h>
+#include <math.h>
 #include <getopt.h>
 #include <locale.h>
 
@@ -37,7 +38,9 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/endianmacros.h>
 #include <pulsecore/memblock.h>
+#include <pulsecore/mix.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/sconv.h>
 #include <pulsecore/core-util.h>
 
 static void dump_block(const char *label, const pa_sample_spec *ss, const pa_memchunk *chunk) {
@@ -253,6 +256,282 @@ static pa_memblock* generate_block(pa_mempool *pool, const pa_sample_spec *ss) {
     return r;
 }
 
+/* Largest error a sample of this format adds to a signal in [-1, 1] */
+static float format_step(pa_sample_format_t f) {
+    switch (f) {
+        case PA_SAMPLE_U8:
+            return 1.0f / 0x80;
+        case PA_SAMPLE_ULAW:
+        case PA_SAMPLE_ALAW:
+            return 1.0f / 0x20;
+        default:
+            return 1.0f / 0x8000;
+    }
+}
+
+static pa_memblock* generate_sine(pa_mempool *pool, const pa_sample_spec *ss, unsigned n_frames) {
+    pa_memblock *r;
+    float *f;
+    unsigned i, n = n_frames * ss->channels;
+
+    f = pa_xnew(float, n);
+
+    for (i = 0; i < n; i++)
+        f[i] = 0.8f * sinf((float) (i / ss->channels) * 0.05f + (float) (i % ss->channels));
+
+    pa_assert_se(r = pa_memblock_new(pool, pa_frame_size(ss) * n_frames));
+    pa_get_convert_from_float32ne_function(ss->format)(n, f, pa_memblock_acquire(r));
+    pa_memblock_release(r);
+
+    pa_xfree(f);
+
+    return r;
+}
+
+/* Checks that having the resampler apply the volumes gives the same result
+ * as applying them in separate passes before and after resampling */
+static bool volume_test(pa_mempool *pool, const pa_sample_spec *a, const pa_sample_spec *b, pa_resample_method_t method) {
+    pa_resampler *folded, *separate;
+    pa_memchunk i, w, j, k;
+    pa_cvolume pre, post;
+    float *fj, *fk, tolerance;
+    unsigned c, n;
+    bool ok = true;
+
+    pa_assert_se(folded = pa_resampler_new(pool, a, NULL, b, NULL, method, 0));
+    pa_assert_se(separate = pa_resampler_new(pool, a, NULL, b, NULL, method, 0));
+
+    pre.channels = a->channels;
+    for (c = 0; c < a->channels; c++)
+        pre.values[c] = pa_sw_volume_from_linear(0.3 + 0.2 * c);
+
+    post.channels = b->channels;
+    for (c = 0; c < b->channels; c++)
+        post.values[c] = pa_sw_volume_from_linear(0.9 - 0.1 * c);
+
+    i.memblock = generate_sine(pool, a, 1024);
+    i.length = pa_memblock_get_length(i.memblock);
+    i.index = 0;
+
+    pa_resampler_set_volume(folded, &pre, &post);
+    pa_resampler_run(folded, &i, &j);
+
+    w = i;
+    pa_memblock_ref(w.memblock);
+    pa_memchunk_make_writable(&w, 0);
+    pa_volume_memchunk(&w, a, &pre);
+    pa_resampler_run(separate, &w, &k);
+    pa_memchunk_make_writable(&k, 0);
+    pa_volume_memchunk(&k, b, &post);
+
+    pa_assert_se(j.length == k.length);
+    n = (unsigned) (j.length / pa_sample_size(b));
+
+    fj = pa_xnew(float, n);
+    fk = pa_xnew(float, n);
+    pa_get_convert_to_float32ne_function(b->format)(n, pa_memblock_acquire_chunk(&j), fj);
+    pa_get_convert_to_float32ne_function(b->format)(n, pa_memblock_acquire_chunk(&k), fk);
+    pa_memblock_release(j.memblock);
+    pa_memblock_release(k.memblock);
+
+    /* The volumes may be applied in the work format instead, which can
+     * round differently by a step of the input and the output format */
+    tolerance = 2 * (format_step(a->format) + format_step(b->format));
+
+    for (c = 0; c < n; c++)
+        if (fabsf(fj[c] - fk[c]) > tolerance) {
+            pa_log_error("Volume mismatch %s -> %s at %u: %f != %f",
+                         pa_sample_format_to_string(a->format), pa_sample_format_to_string(b->format),
+                         c, fj[c], fk[c]);
+            ok = false;
+            break;
+        }
+
+    pa_xfree(fj);
+    pa_xfree(fk);
+
+    pa_memblock_unref(i.memblock);
+    pa_memblock_unref(w.memblock);
+    pa_memblock_unref(j.memblock);
+    pa_memblock_unref(k.memblock);
+
+    pa_resampler_free(folded);
+    pa_resampler_free(separate);
+
+    return ok;
+}
+
+/* Checks one step down a quality ladder, skipping the methods that
+ * aren't compiled in just like pa_resample_method_cheaper() does */
+static bool ladder_test(const pa_resample_method_t *ladder, unsigned n) {
+    unsigned k, j;
+
+    for (k = 0; k < n; k++) {
+        pa_resample_method_t expected = PA_RESAMPLER_INVALID, got;
+
+        for (j = k + 1; j < n; j++)
+            if (pa_resample_method_supported(ladder[j])) {
+                expected = ladder[j];
+                break;
+            }
+
+        if ((got = pa_resample_method_cheaper(ladder[k])) != expected) {
+            pa_log_error("Cheaper than %s should be %s, is %s.",
+                         pa_strnull(pa_resample_method_to_string(ladder[k])),
+                         pa_strnull(pa_resample_method_to_string(expected)),
+                         pa_strnull(pa_resample_method_to_string(got)));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* The ladders the resampler CPU budget moves streams down on */
+static bool cheaper_test(void) {
+    static const pa_resample_method_t src[] = {
+        PA_RESAMPLER_SRC_SINC_BEST_QUALITY,
+        PA_RESAMPLER_SRC_SINC_MEDIUM_QUALITY,
+        PA_RESAMPLER_SRC_SINC_FASTEST,
+        PA_RESAMPLER_SRC_LINEAR,
+        PA_RESAMPLER_TRIVIAL
+    };
+    static const pa_resample_method_t zoh[] = { PA_RESAMPLER_SRC_ZERO_ORDER_HOLD, PA_RESAMPLER_TRIVIAL };
+    static const pa_resample_method_t ffmpeg[] = { PA_RESAMPLER_FFMPEG, PA_RESAMPLER_TRIVIAL };
+    /* Nothing is cheaper than these */
+    static const pa_resample_method_t bottom[] = { PA_RESAMPLER_TRIVIAL, PA_RESAMPLER_COPY, PA_RESAMPLER_PEAKS };
+    pa_resample_method_t speex_float[PA_RESAMPLER_SPEEX_FLOAT_MAX - PA_RESAMPLER_SPEEX_FLOAT_BASE + 2];
+    pa_resample_method_t speex_fixed[PA_RESAMPLER_SPEEX_FIXED_MAX - PA_RESAMPLER_SPEEX_FIXED_BASE + 2];
+    unsigned k;
+    bool ok = true;
+
+    /* speex-float-10, speex-float-9, ... speex-float-0, trivial */
+    for (k = 0; k < PA_ELEMENTSOF(speex_float) - 1; k++)
+        speex_float[k] = PA_RESAMPLER_SPEEX_FLOAT_MAX - k;
+    speex_float[k] = PA_RESAMPLER_TRIVIAL;
+
+    for (k = 0; k < PA_ELEMENTSOF(speex_fixed) - 1; k++)
+        speex_fixed[k] = PA_RESAMPLER_SPEEX_FIXED_MAX - k;
+    speex_fixed[k] = PA_RESAMPLER_TRIVIAL;
+
+    ok &= ladder_test(speex_float, PA_ELEMENTSOF(speex_float));
+    ok &= ladder_test(speex_fixed, PA_ELEMENTSOF(speex_fixed));
+    ok &= ladder_test(src, PA_ELEMENTSOF(src));
+    ok &= ladder_test(zoh, PA_ELEMENTSOF(zoh));
+    ok &= ladder_test(ffmpeg, PA_ELEMENTSOF(ffmpeg));
+
+    for (k = 0; k < PA_ELEMENTSOF(bottom); k++)
+        ok &= ladder_test(bottom + k, 1);
+
+    return ok;
+}
+
+/* Switches from one method to another in the middle of a sine with a
+ * crossfade, like sink inputs do when their resampler is downgraded,
+ * and checks that the output doesn't jump anywhere */
+static bool switch_test(pa_mempool *pool, pa_resample_method_t from, pa_resample_method_t to) {
+    static const pa_sample_spec a = { .format = PA_SAMPLE_FLOAT32NE, .rate = 44100, .channels = 1 };
+    static const pa_sample_spec b = { .format = PA_SAMPLE_FLOAT32NE, .rate = 48000, .channels = 1 };
+    const unsigned n_blocks = 20, block = 441, fade_length = 480;
+    pa_resampler *r, *fading = NULL;
+    pa_memchunk in;
+    size_t fade_done = 0;
+    float *out = NULL, max_step = 0, allowed;
+    unsigned k, n_out = 0, n;
+
+    pa_assert_se(r = pa_resampler_new(pool, &a, NULL, &b, NULL, from, 0));
+
+    in.memblock = generate_sine(pool, &a, n_blocks * block);
+
+    for (k = 0; k < n_blocks; k++) {
+        pa_memchunk o, old;
+        const float *f;
+
+        if (k == n_blocks / 2) {
+            fading = r;
+            pa_assert_se(r = pa_resampler_new(pool, &a, NULL, &b, NULL, to, 0));
+        }
+
+        in.index = k * block * pa_frame_size(&a);
+        in.length = block * pa_frame_size(&a);
+
+        pa_resampler_run(r, &in, &o);
+
+        if (fading) {
+            pa_resampler_run(fading, &in, &old);
+
+            if (o.memblock && old.memblock)
+                fade_done += pa_resampler_crossfade(pool, &b, &old, &o, fade_done, fade_length);
+
+            if (old.memblock)
+                pa_memblock_unref(old.memblock);
+
+            if (fade_done >= fade_length) {
+                pa_resampler_free(fading);
+                fading = NULL;
+            }
+        }
+
+        if (!o.memblock)
+            continue;
+
+        n = (unsigned) (o.length / pa_frame_size(&b));
+        out = pa_xrenew(float, out, n_out + n);
+
+        f = pa_memblock_acquire_chunk(&o);
+        memcpy(out + n_out, f, n * sizeof(float));
+        pa_memblock_release(o.memblock);
+        pa_memblock_unref(o.memblock);
+
+        n_out += n;
+    }
+
+    /* Leave out how the filters start up */
+    for (k = 64; k < n_out; k++) {
+        max_step = PA_MAX(max_step, fabsf(out[k] - out[k - 1]));
+    }
+
+    /* The sine moves 0.05 rad per input frame, so it doesn't change by
+     * more than about 0.04 from one output frame to the next */
+    allowed = 2.0f * 0.8f * 0.05f * a.rate / b.rate;
+
+    pa_log_debug("Switching from %s to %s: largest step %f",
+                 pa_resample_method_to_string(from), pa_resample_method_to_string(to), max_step);
+
+    pa_xfree(out);
+    pa_memblock_unref(in.memblock);
+
+    if (fading)
+        pa_resampler_free(fading);
+    pa_resampler_free(r);
+
+    if (max_step > allowed) {
+        pa_log_error("Switching from %s to %s jumps by %f, more than %f.",
+                     pa_resample_method_to_string(from), pa_resample_method_to_string(to), max_step, allowed);
+        return false;
+    }
+
+    return true;
+}
+
+/* Every method that the resampler CPU budget may switch away from */
+static bool switch_methods_test(pa_mempool *pool) {
+    pa_resample_method_t m;
+    bool ok = true;
+
+    for (m = 0; m < PA_RESAMPLER_MAX; m++) {
+        pa_resample_method_t cheaper;
+
+        if (!pa_resample_method_supported(m) ||
+            (cheaper = pa_resample_method_cheaper(m)) == PA_RESAMPLER_INVALID)
+            continue;
+
+        ok &= switch_test(pool, m, cheaper);
+    }
+
+    return ok;
+}
+
 static void help(const char *argv0) {
     printf(_("%s [options]\n\n"
              "-h, --help                            Show this help\n"
@@ -474,6 +753,28 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    for (a.format = 0; a.format < PA_SAMPLE_MAX; a.format ++) {
+        for (b.format = 0; b.format < PA_SAMPLE_MAX; b.format ++) {
+            pa_sample_spec sa = a, sb = b;
+
+            /* Same layout, then remapping and resampling */
+            sa.channels = sb.channels = 2;
+            if (!volume_test(pool, &sa, &sb, method))
+                ret = 1;
+
+            sa.channels = 1;
+            sb.rate = 48000;
+            if (!volume_test(pool, &sa, &sb, method))
+                ret = 1;
+        }
+    }
+
+    if (!cheaper_test())
+        ret = 1;
+
+    if (!switch_methods_test(pool))
+        ret = 1;
+
  quit:
     if (pool)
         pa_mempool_free(pool);
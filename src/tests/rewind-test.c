@@ -0,0 +1,412 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+/* Plays a few resampled streams on a null sink with incremental_rewind
+ * enabled, changes one of them and checks on the /metrics page that the
+ * sink replays its mix history instead of asking the other streams for
+ * their data again: only the changed streams are mixed again after the
+ * rewind, the others are mixed exactly once for every byte the sink
+ * plays. The metrics are served by a module-http-protocol-unix the test
+ * loads on a socket of its own. */
+
+#define SINK_NAME "rewind_test"
+#define SINK_RATE "44100"
+#define STREAM_RATE 48000
+#define N_STREAMS 4
+#define SETTLE_USEC (1500*PA_USEC_PER_MSEC)
+#define MEASURE_USEC (500*PA_USEC_PER_MSEC)
+
+struct metrics {
+    unsigned mixed_bytes[N_STREAMS];
+    unsigned rendered_bytes;
+    unsigned rewind_bytes;
+    unsigned replayed_bytes;
+};
+
+static pa_threaded_mainloop *mainloop = NULL;
+static pa_context *context = NULL;
+static pa_stream *streams[N_STREAMS];
+static uint32_t sink_module = PA_INVALID_INDEX, http_module = PA_INVALID_INDEX;
+static char *http_socket = NULL;
+static unsigned phase[N_STREAMS];
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void index_cb(pa_context *c, uint32_t idx, void *userdata) {
+    *(uint32_t*) userdata = idx;
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void success_cb(pa_context *c, int success, void *userdata) {
+    fail_unless(success);
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void stream_write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    unsigned n = PA_PTR_TO_UINT(userdata);
+    int16_t *d;
+    size_t i;
+
+    fail_unless(pa_stream_begin_write(s, (void**) &d, &nbytes) == 0);
+
+    /* A different tone per stream, 2 channels */
+    for (i = 0; i < nbytes / 4; i++, phase[n]++) {
+        int16_t v = (int16_t) (0x1000 * sin(2 * M_PI * (220 * (n + 1)) * phase[n] / STREAM_RATE));
+
+        d[2*i] = d[2*i+1] = v;
+    }
+
+    fail_unless(pa_stream_write(s, d, nbytes / 4 * 4, NULL, 0, PA_SEEK_RELATIVE) == 0);
+}
+
+/* Called with the mainloop locked */
+static void wait_for_operation(pa_operation *o) {
+    fail_unless(o != NULL);
+
+    while (pa_operation_get_state(o) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(mainloop);
+
+    pa_operation_unref(o);
+}
+
+/* Called with the mainloop locked */
+static pa_stream *stream_new(unsigned n) {
+    static const pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16LE,
+        .rate = STREAM_RATE,
+        .channels = 2
+    };
+    pa_buffer_attr attr;
+    pa_stream *s;
+    char name[32];
+
+    /* A long buffer so that there is a lot to rewind */
+    memset(&attr, 0xff, sizeof(attr));
+    attr.tlength = (uint32_t) pa_usec_to_bytes(PA_USEC_PER_SEC, &ss);
+
+    pa_snprintf(name, sizeof(name), "rewind test %u", n);
+    fail_unless((s = pa_stream_new(context, name, &ss, NULL)) != NULL);
+
+    phase[n] = 0;
+    pa_stream_set_state_callback(s, stream_state_cb, NULL);
+    pa_stream_set_write_callback(s, stream_write_cb, PA_UINT_TO_PTR(n));
+
+    fail_unless(pa_stream_connect_playback(s, SINK_NAME, &attr, PA_STREAM_NOFLAGS, NULL, NULL) == 0);
+
+    while (pa_stream_get_state(s) != PA_STREAM_READY) {
+        fail_unless(PA_STREAM_IS_GOOD(pa_stream_get_state(s)));
+        pa_threaded_mainloop_wait(mainloop);
+    }
+
+    return s;
+}
+
+/* Called with the mainloop locked */
+static void stream_free(pa_stream *s) {
+    fail_unless(pa_stream_disconnect(s) == 0);
+    pa_stream_unref(s);
+}
+
+static char *http_get(const char *path) {
+    struct sockaddr_un sa;
+    char *request, *buf;
+    size_t length = 0, allocated = 4096;
+    ssize_t r;
+    int fd;
+
+    fail_unless((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    fail_unless(strlen(http_socket) < sizeof(sa.sun_path));
+    strcpy(sa.sun_path, http_socket);
+
+    if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) < 0) {
+        fprintf(stderr, "connect(): %s\n", strerror(errno));
+        fail();
+    }
+
+    request = pa_sprintf_malloc("GET %s HTTP/1.0\n\n", path);
+    fail_unless(write(fd, request, strlen(request)) == (ssize_t) strlen(request));
+    pa_xfree(request);
+
+    buf = pa_xmalloc(allocated);
+
+    while ((r = read(fd, buf + length, allocated - length - 1)) > 0) {
+        length += (size_t) r;
+
+        if (allocated - length < 1024) {
+            allocated *= 2;
+            buf = pa_xrealloc(buf, allocated);
+        }
+    }
+
+    fail_unless(r == 0);
+    buf[length] = 0;
+
+    pa_close(fd);
+
+    return buf;
+}
+
+/* Returns the value of the first sample of the metric whose labels
+ * contain the given text */
+static unsigned metric_value(const char *page, const char *name, const char *label) {
+    const char *p = page;
+    size_t l = strlen(name);
+
+    while ((p = strstr(p, name))) {
+        const char *e = strchr(p, '\n');
+
+        if (p[l] == '{' && (p == page || p[-1] == '_')) {
+            const char *close = strchr(p, '}');
+
+            if (close && (!e || close < e) && strstr(p, label) && strstr(p, label) < close)
+                return (unsigned) strtoul(close + 2, NULL, 10);
+        }
+
+        if (!e)
+            break;
+
+        p = e;
+    }
+
+    return 0;
+}
+
+/* Called with the mainloop unlocked */
+static void metrics_get(struct metrics *m) {
+    char *page, label[32];
+    unsigned n;
+
+    page = http_get("/metrics");
+
+    pa_threaded_mainloop_lock(mainloop);
+
+    for (n = 0; n < N_STREAMS; n++) {
+        m->mixed_bytes[n] = 0;
+
+        if (!streams[n])
+            continue;
+
+        pa_snprintf(label, sizeof(label), "index=\"%u\"", pa_stream_get_index(streams[n]));
+        m->mixed_bytes[n] = metric_value(page, "sink_input_mixed_bytes_total", label);
+    }
+
+    pa_threaded_mainloop_unlock(mainloop);
+
+    m->rendered_bytes = metric_value(page, "sink_rendered_bytes_total", "sink=\"" SINK_NAME "\"");
+    m->rewind_bytes = metric_value(page, "sink_rewind_bytes_total", "sink=\"" SINK_NAME "\"");
+    m->replayed_bytes = metric_value(page, "sink_rewind_replayed_bytes_total", "sink=\"" SINK_NAME "\"");
+
+    pa_xfree(page);
+}
+
+/* Checks what the sink did between before and after. Every stream in
+ * touched has been taken out of the mix history, so it is mixed again
+ * for the rewound data and thus for everything the sink rendered. The
+ * ones in untouched are left in the history, so they miss the part the
+ * sink replayed from it. Without a mix history they would be mixed again
+ * just like the touched ones. Only streams that exist during the whole
+ * event may be passed. */
+static void check_mixed(const struct metrics *before, const struct metrics *after, unsigned touched, unsigned untouched) {
+    unsigned n, rendered, rewound, replayed;
+
+    rendered = after->rendered_bytes - before->rendered_bytes;
+    rewound = after->rewind_bytes - before->rewind_bytes;
+    replayed = after->replayed_bytes - before->replayed_bytes;
+
+    fprintf(stderr, "%u bytes rendered, %u rewound, %u replayed.\n", rendered, rewound, replayed);
+
+    fail_unless(rewound > 0);
+    fail_unless(replayed > 0);
+
+    for (n = 0; n < N_STREAMS; n++) {
+        unsigned mixed = after->mixed_bytes[n] - before->mixed_bytes[n];
+
+        if (touched & (1U << n)) {
+            fprintf(stderr, "Stream %u (changed): %u bytes mixed.\n", n, mixed);
+            fail_unless(mixed + rewound / 2 >= rendered);
+        }
+
+        if (untouched & (1U << n)) {
+            fprintf(stderr, "Stream %u (untouched): %u bytes mixed.\n", n, mixed);
+            fail_unless(mixed + rewound / 2 <= rendered);
+        }
+    }
+}
+
+static void event_volume(void) {
+    pa_cvolume v;
+
+    pa_threaded_mainloop_lock(mainloop);
+    pa_cvolume_set(&v, 2, PA_VOLUME_NORM / 2);
+    wait_for_operation(pa_context_set_sink_input_volume(context, pa_stream_get_index(streams[0]), &v, success_cb, NULL));
+    pa_threaded_mainloop_unlock(mainloop);
+}
+
+static void event_add(void) {
+    pa_threaded_mainloop_lock(mainloop);
+    streams[N_STREAMS - 1] = stream_new(N_STREAMS - 1);
+    pa_threaded_mainloop_unlock(mainloop);
+}
+
+static void event_remove(void) {
+    pa_threaded_mainloop_lock(mainloop);
+    stream_free(streams[1]);
+    streams[1] = NULL;
+    pa_threaded_mainloop_unlock(mainloop);
+}
+
+START_TEST (rewind_test) {
+    struct metrics before, after;
+    char *socket_name, *args;
+    unsigned n;
+
+    fail_unless((mainloop = pa_threaded_mainloop_new()) != NULL);
+    fail_unless((context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "rewind-test")) != NULL);
+    pa_context_set_state_callback(context, context_state_cb, NULL);
+
+    pa_threaded_mainloop_lock(mainloop);
+    fail_unless(pa_threaded_mainloop_start(mainloop) >= 0);
+    fail_unless(pa_context_connect(context, NULL, 0, NULL) >= 0);
+
+    while (pa_context_get_state(context) != PA_CONTEXT_READY) {
+        fail_unless(PA_CONTEXT_IS_GOOD(pa_context_get_state(context)));
+        pa_threaded_mainloop_wait(mainloop);
+    }
+
+    wait_for_operation(pa_context_load_module(context, "module-null-sink",
+                                              "sink_name=" SINK_NAME " rate=" SINK_RATE " incremental_rewind=yes",
+                                              index_cb, &sink_module));
+    fail_unless(sink_module != PA_INVALID_INDEX);
+
+    /* Relative socket names end up in the runtime directory, which is
+     * the same for the server and for us */
+    socket_name = pa_sprintf_malloc("rewind-test-%lu", (unsigned long) getpid());
+    fail_unless((http_socket = pa_runtime_path(socket_name)) != NULL);
+    args = pa_sprintf_malloc("socket=%s", socket_name);
+    wait_for_operation(pa_context_load_module(context, "module-http-protocol-unix", args, index_cb, &http_module));
+    fail_unless(http_module != PA_INVALID_INDEX);
+    pa_xfree(args);
+    pa_xfree(socket_name);
+
+    /* The last one is added later on */
+    for (n = 0; n < N_STREAMS - 1; n++)
+        streams[n] = stream_new(n);
+    streams[N_STREAMS - 1] = NULL;
+
+    pa_threaded_mainloop_unlock(mainloop);
+
+    pa_msleep(SETTLE_USEC / PA_USEC_PER_MSEC);
+
+    /* Changing the volume of stream 0 takes only its data out of the
+     * history, the others are left alone */
+    metrics_get(&before);
+    event_volume();
+    pa_msleep(MEASURE_USEC / PA_USEC_PER_MSEC);
+    metrics_get(&after);
+
+    fprintf(stderr, "Volume change:\n");
+    check_mixed(&before, &after, 0x1, 0x6);
+
+    /* A new stream is mixed into the history */
+    metrics_get(&before);
+    event_add();
+    pa_msleep(MEASURE_USEC / PA_USEC_PER_MSEC);
+    metrics_get(&after);
+
+    fprintf(stderr, "New stream:\n");
+    check_mixed(&before, &after, 0, 0x7);
+
+    /* A stream that goes away is subtracted from it */
+    metrics_get(&before);
+    event_remove();
+    pa_msleep(MEASURE_USEC / PA_USEC_PER_MSEC);
+    metrics_get(&after);
+
+    fprintf(stderr, "Removed stream:\n");
+    check_mixed(&before, &after, 0, 0xd);
+
+    pa_threaded_mainloop_lock(mainloop);
+
+    for (n = 0; n < N_STREAMS; n++)
+        if (streams[n])
+            stream_free(streams[n]);
+
+    wait_for_operation(pa_context_unload_module(context, http_module, success_cb, NULL));
+    wait_for_operation(pa_context_unload_module(context, sink_module, success_cb, NULL));
+    pa_xfree(http_socket);
+
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    pa_threaded_mainloop_unlock(mainloop);
+
+    pa_threaded_mainloop_stop(mainloop);
+    pa_threaded_mainloop_free(mainloop);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Rewind");
+    tc = tcase_create("rewind");
+    tcase_add_test(tc, rewind_test);
+    tcase_set_timeout(tc, 30);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
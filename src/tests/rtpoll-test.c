@@ -23,11 +23,30 @@
 
 #include <check.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/poll.h>
 #include <pulsecore/log.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/rtpoll.h>
 
+#define LATENCY_ROUNDS 2000
+
+static const pa_rtpoll_backend_t backends[] = {
+    PA_RTPOLL_BACKEND_POLL,
+    PA_RTPOLL_BACKEND_EPOLL
+};
+
+static const char *backend_name(pa_rtpoll_backend_t b) {
+    return b == PA_RTPOLL_BACKEND_EPOLL ? "epoll" : "poll";
+}
+
 static int before(pa_rtpoll_item *i) {
     pa_log("before");
     return 0;
@@ -84,15 +103,237 @@ START_TEST (rtpoll_test) {
 }
 END_TEST
 
+START_TEST (timer_test) {
+    unsigned i;
+
+    for (i = 0; i < PA_ELEMENTSOF(backends); i++) {
+        pa_rtpoll *p;
+        pa_usec_t start, elapsed;
+
+        if (!(p = pa_rtpoll_new_with_backend(backends[i]))) {
+            pa_log_info("%s backend not available, skipping", backend_name(backends[i]));
+            continue;
+        }
+
+        start = pa_rtclock_now();
+        pa_rtpoll_set_timer_relative(p, 20000);
+        fail_unless(pa_rtpoll_run(p, true) == 1);
+        elapsed = pa_rtclock_now() - start;
+
+        fail_unless(pa_rtpoll_timer_elapsed(p));
+        fail_unless(elapsed >= 20000, "%s: woke up after %llu usec", backend_name(backends[i]), (unsigned long long) elapsed);
+
+        /* With slack the deadline may only move later, never earlier */
+        pa_rtpoll_set_timer_slack(p, 5000);
+        start = pa_rtclock_now();
+        pa_rtpoll_set_timer_relative(p, 10000);
+        fail_unless(pa_rtpoll_run(p, true) == 1);
+        elapsed = pa_rtclock_now() - start;
+
+        fail_unless(pa_rtpoll_timer_elapsed(p));
+        fail_unless(elapsed >= 10000);
+
+        pa_rtpoll_free(p);
+    }
+}
+END_TEST
+
+START_TEST (fd_change_test) {
+    unsigned i;
+
+    for (i = 0; i < PA_ELEMENTSOF(backends); i++) {
+        pa_rtpoll *p;
+        pa_rtpoll_item *item;
+        struct pollfd *pollfd;
+        int a[2], b[2];
+        char c = 'x';
+
+        if (!(p = pa_rtpoll_new_with_backend(backends[i])))
+            continue;
+
+        pa_pipe_cloexec(a);
+        pa_pipe_cloexec(b);
+
+        item = pa_rtpoll_item_new(p, PA_RTPOLL_NORMAL, 1);
+        pollfd = pa_rtpoll_item_get_pollfd(item, NULL);
+        pollfd->fd = a[0];
+        pollfd->events = POLLIN;
+
+        fail_unless(write(a[1], &c, 1) == 1);
+        fail_unless(pa_rtpoll_run(p, true) == 1);
+        fail_unless(pollfd->revents & POLLIN);
+
+        /* Switching to another fd must drop the old registration,
+         * otherwise the still readable pipe would wake us up */
+        pollfd->fd = b[0];
+        pollfd->revents = 0;
+        pa_rtpoll_set_timer_relative(p, 1000);
+        fail_unless(pa_rtpoll_run(p, true) == 1);
+        fail_unless(pollfd->revents == 0);
+        fail_unless(pa_rtpoll_timer_elapsed(p));
+
+        /* Neither may masking out the events */
+        fail_unless(write(b[1], &c, 1) == 1);
+        pollfd->events = 0;
+        pa_rtpoll_set_timer_relative(p, 1000);
+        fail_unless(pa_rtpoll_run(p, true) == 1);
+        fail_unless(pollfd->revents == 0);
+
+        pollfd->events = POLLIN;
+        pa_rtpoll_set_timer_disabled(p);
+        fail_unless(pa_rtpoll_run(p, true) == 1);
+        fail_unless(pollfd->revents & POLLIN);
+        fail_unless(!pa_rtpoll_timer_elapsed(p));
+
+        /* Pipes never need the poll() fallback */
+        fail_unless(pa_rtpoll_get_backend(p) == backends[i]);
+
+        pa_rtpoll_item_free(item);
+        pa_rtpoll_free(p);
+
+        pa_close_pipe(a);
+        pa_close_pipe(b);
+    }
+}
+END_TEST
+
+struct latency_data {
+    int fd;
+    pa_semaphore *ready;
+};
+
+static void latency_writer(void *userdata) {
+    struct latency_data *d = userdata;
+    unsigned i;
+
+    for (i = 0; i < LATENCY_ROUNDS; i++) {
+        pa_usec_t now;
+
+        pa_semaphore_wait(d->ready);
+
+        now = pa_rtclock_now();
+        pa_assert_se(pa_write(d->fd, &now, sizeof(now), NULL) == sizeof(now));
+    }
+}
+
+static int compare_usec(const void *a, const void *b) {
+    const pa_usec_t *x = a, *y = b;
+
+    return *x < *y ? -1 : (*x > *y ? 1 : 0);
+}
+
+static int idle_before(pa_rtpoll_item *i) {
+    return 0;
+}
+
+static void idle_after(pa_rtpoll_item *i) {
+}
+
+/* Measures the time from a write on one fd to the rtpoll loop having
+ * dispatched it, with n_items - 1 idle items sitting next to it */
+static void run_latency(pa_rtpoll_backend_t backend, unsigned n_items) {
+    pa_rtpoll *p;
+    pa_rtpoll_item **items;
+    int *pipes;
+    struct pollfd *signal_pollfd = NULL;
+    struct latency_data d;
+    pa_thread *t;
+    pa_usec_t *lat;
+    double sum = 0;
+    unsigned i;
+
+    if (!(p = pa_rtpoll_new_with_backend(backend))) {
+        pa_log_info("%s backend not available, skipping", backend_name(backend));
+        return;
+    }
+
+    items = pa_xnew(pa_rtpoll_item*, n_items);
+    pipes = pa_xnew(int, 2 * n_items);
+    lat = pa_xnew(pa_usec_t, LATENCY_ROUNDS);
+
+    for (i = 0; i < n_items; i++) {
+        struct pollfd *pollfd;
+
+        pa_pipe_cloexec(pipes + 2 * i);
+
+        items[i] = pa_rtpoll_item_new(p, PA_RTPOLL_NORMAL, 1);
+        pa_rtpoll_item_set_before_callback(items[i], idle_before);
+        pa_rtpoll_item_set_after_callback(items[i], idle_after);
+
+        pollfd = pa_rtpoll_item_get_pollfd(items[i], NULL);
+        pollfd->fd = pipes[2 * i];
+        pollfd->events = POLLIN;
+    }
+
+    /* The pollfd array is only stable once all items are in */
+    signal_pollfd = pa_rtpoll_item_get_pollfd(items[n_items - 1], NULL);
+
+    d.fd = pipes[2 * n_items - 1];
+    d.ready = pa_semaphore_new(0);
+    t = pa_thread_new("rtpoll-writer", latency_writer, &d);
+
+    for (i = 0; i < LATENCY_ROUNDS; i++) {
+        pa_usec_t sent;
+
+        pa_semaphore_post(d.ready);
+
+        do {
+            fail_unless(pa_rtpoll_run(p, true) == 1);
+        } while (!(signal_pollfd->revents & POLLIN));
+
+        lat[i] = pa_rtclock_now();
+        fail_unless(pa_read(signal_pollfd->fd, &sent, sizeof(sent), NULL) == sizeof(sent));
+        lat[i] -= sent;
+        sum += lat[i];
+    }
+
+    pa_thread_free(t);
+    pa_semaphore_free(d.ready);
+
+    qsort(lat, LATENCY_ROUNDS, sizeof(pa_usec_t), compare_usec);
+
+    pa_log_info("%-5s %3u items: wakeup to dispatch avg = %0.1f usec, median = %llu usec, p99 = %llu usec",
+                backend_name(backend), n_items, sum / LATENCY_ROUNDS,
+                (unsigned long long) lat[LATENCY_ROUNDS / 2],
+                (unsigned long long) lat[LATENCY_ROUNDS * 99 / 100]);
+
+    for (i = 0; i < n_items; i++) {
+        pa_rtpoll_item_free(items[i]);
+        pa_close_pipe(pipes + 2 * i);
+    }
+
+    pa_rtpoll_free(p);
+
+    pa_xfree(items);
+    pa_xfree(pipes);
+    pa_xfree(lat);
+}
+
+START_TEST (latency_test) {
+    unsigned i;
+
+    for (i = 0; i < PA_ELEMENTSOF(backends); i++) {
+        run_latency(backends[i], 1);
+        run_latency(backends[i], 100);
+    }
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
     TCase *tc;
     SRunner *sr;
 
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_INFO);
+
     s = suite_create("RT Poll");
     tc = tcase_create("rtpoll");
     tcase_add_test(tc, rtpoll_test);
+    tcase_add_test(tc, timer_test);
+    tcase_add_test(tc, fd_change_test);
+    tcase_add_test(tc, latency_test);
     /* the default timeout is too small,
      * set it to a reasonable large one.
      */
@@ -44,6 +44,7 @@ pulseaudio -n \
         --load="module-suspend-on-idle" \
         --load="module-native-protocol-unix" \
         --load="module-cli-protocol-unix" \
+        --load="module-http-protocol-tcp listen-fanout=1 max-connections=128" \
         --dl-search-path="$(dirname $SCRIPTNAME)/.libs/" \
         &
 
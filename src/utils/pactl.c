@@ -177,6 +177,15 @@ static void stat_callback(pa_context *c, const pa_stat_info *i, void *userdata)
     pa_bytes_snprint(s, sizeof(s), i->scache_size);
     printf(_("Sample cache size: %s\n"), s);
 
+    if (pa_context_get_server_protocol_version(c) >= 30) {
+        pa_bytes_snprint(s, sizeof(s), i->scache_converted_size);
+        printf(_("Converted sample cache size: %s\n"), s);
+
+        printf(_("Sample cache hits: %llu, misses: %llu\n"),
+               (unsigned long long) i->scache_hits,
+               (unsigned long long) i->scache_misses);
+    }
+
     complete_action();
 }
 